@@ -0,0 +1,549 @@
+/* cab-writer.c -- write a Microsoft cabinet file with MSZIP compressed
+   folders.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* A cabinet is a header, a list of folders, a list of files, and then
+   the data blocks of every folder.  A folder is one compressed stream
+   holding the concatenated contents of a run of files.  MSZIP resets
+   the compressor for every 32 KiB data block and only carries over the
+   previous block as a preset dictionary, so splitting the files into
+   several folders costs almost nothing in compression ratio.  We
+   exploit that by cutting the file list into folders of roughly equal
+   size and compressing all folders at the same time on the shared
+   thread pool.  Each folder is compressed into its own temporary file,
+   and the temporary files are concatenated once the header offsets are
+   known.
+
+   The deflate implementation comes from zlib.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "thread-pool.h"
+#include "cab-writer.h"
+
+#define CAB_BLOCK_SIZE 32768
+/* Worst-case size of a compressed MSZIP block, including the "CK"
+   signature.  */
+#define CAB_MAX_COMP_BLOCK (CAB_BLOCK_SIZE + 6144)
+#define CAB_MAX_FILES 65535
+#define CAB_MAX_FOLDER_SIZE 0x7fff8000
+#define FOLDER_MIN_SIZE (1024 * 1024)
+#define FOLDER_MAX_TARGET (64 * 1024 * 1024)
+
+typedef struct CabFolder_t CabFolder;
+typedef struct CabJob_t CabJob;
+
+struct CabFolder_t
+{
+	unsigned firstFile;
+	unsigned numFiles;
+	uint32_t uncompSize;
+	FILE* data; /* Temporary file with the CFDATA blocks */
+	unsigned numBlocks;
+	uint32_t compSize;
+	bool failed;
+};
+
+EA_TYPE(CabFolder);
+
+/* State shared by all workers of one `WriteCabinets()' call.  The
+   files of all cabinets are concatenated, and the folders of each
+   cabinet follow those of the previous one.  */
+struct CabJob_t
+{
+	CabFile* files;
+	uint32_t* sizes;
+	uint16_t* dates;
+	uint16_t* times;
+	bool statFailed;
+	CabFolder_array folders;
+	/* Index of the first folder of each cabinet, plus one past the
+	   last folder.  */
+	unsigned* cabFolders;
+};
+
+/* Private Declarations */
+static bool AssembleCabinet(CabJob* job, const char* cabPath,
+							unsigned firstFolder, unsigned endFolder);
+static void StatCabFile(void* data, unsigned index);
+static void CompressFolder(void* data, unsigned index);
+static bool EmitBlock(z_stream* zs, CabFolder* folder,
+					  const unsigned char* block, unsigned len,
+					  const unsigned char* prev, unsigned prevLen,
+					  unsigned char* out);
+static void Put16(unsigned char* p, unsigned v);
+static void Put32(unsigned char* p, uint32_t v);
+
+/* Compute the cabinet checksum of `len' bytes, which is the XOR of
+   all 32-bit little-endian words with the trailing bytes folded in.
+   The checksum of a CFDATA block is
+   `CabChecksum(&cbData, 4, CabChecksum(data, cbData, 0))'.  */
+uint32_t CabChecksum(const void* data, size_t len, uint32_t seed)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	uint32_t csum = seed;
+	uint32_t tail = 0;
+	size_t numWords = len / 4;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* XOR is associative, so the words can be combined eight bytes at
+	   a time in independent accumulators and folded at the end.  */
+	{
+		uint64_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+		while (numWords >= 8)
+		{
+			uint64_t w[4];
+			memcpy(w, p, sizeof(w));
+			acc0 ^= w[0]; acc1 ^= w[1]; acc2 ^= w[2]; acc3 ^= w[3];
+			p += 32;
+			numWords -= 8;
+		}
+		acc0 ^= acc1 ^ acc2 ^ acc3;
+		csum ^= (uint32_t)acc0 ^ (uint32_t)(acc0 >> 32);
+	}
+#endif
+	while (numWords-- > 0)
+	{
+		csum ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+			((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		p += 4;
+	}
+	/* The leftover bytes are taken most significant first.  */
+	switch (len & 3)
+	{
+	case 3:
+		tail |= (uint32_t)*p++ << 16;
+		/* Fall through */
+	case 2:
+		tail |= (uint32_t)*p++ << 8;
+		/* Fall through */
+	case 1:
+		tail |= (uint32_t)*p;
+	}
+	return csum ^ tail;
+}
+
+/* Write the `count' files in `files' to the cabinet `cabPath', in the
+   given order.  Returns nonzero on success, zero on failure.  */
+int WriteCabinet(const char* cabPath, CabFile* files, unsigned count)
+{
+	CabOutput cab;
+	cab.path = cabPath;
+	cab.files = files;
+	cab.count = count;
+	return WriteCabinets(&cab, 1);
+}
+
+/* Write several cabinets at once.  The folders of all cabinets are
+   compressed together on the thread pool, so many small cabinets keep
+   all threads as busy as one large cabinet would.  Returns nonzero on
+   success, zero on failure.  */
+int WriteCabinets(CabOutput* cabs, unsigned numCabs)
+{
+	CabJob job;
+	unsigned totalCount = 0;
+	uint64_t totalSize;
+	uint64_t target;
+	int retval = 0;
+	unsigned i, j;
+
+	for (i = 0; i < numCabs; i++)
+	{
+		if (cabs[i].count > CAB_MAX_FILES)
+		{
+			fprintf(stderr, "ERROR: Too many files for one cabinet: %u.\n",
+					cabs[i].count);
+			return 0;
+		}
+		totalCount += cabs[i].count;
+	}
+	job.files = (CabFile*)xmalloc(sizeof(CabFile) * (totalCount + 1));
+	job.sizes = (uint32_t*)xmalloc(sizeof(uint32_t) * (totalCount + 1));
+	job.dates = (uint16_t*)xmalloc(sizeof(uint16_t) * (totalCount + 1));
+	job.times = (uint16_t*)xmalloc(sizeof(uint16_t) * (totalCount + 1));
+	job.statFailed = false;
+	EA_INIT(CabFolder, job.folders, 16);
+	job.cabFolders = (unsigned*)xmalloc(sizeof(unsigned) * (numCabs + 1));
+	totalCount = 0;
+	for (i = 0; i < numCabs; i++)
+	{
+		memcpy(job.files + totalCount, cabs[i].files,
+			   sizeof(CabFile) * cabs[i].count);
+		totalCount += cabs[i].count;
+	}
+
+	ParallelFor(totalCount, StatCabFile, &job);
+	if (job.statFailed == true)
+		goto cleanup;
+
+	/* Cut the files into folders of roughly equal size, with enough
+	   folders to keep every thread busy.  A folder never spans two
+	   cabinets.  */
+	totalSize = 0;
+	for (i = 0; i < totalCount; i++)
+		totalSize += job.sizes[i];
+	target = totalSize / (ThreadPoolSize() * 4);
+	if (target < FOLDER_MIN_SIZE)
+		target = FOLDER_MIN_SIZE;
+	if (target > FOLDER_MAX_TARGET)
+		target = FOLDER_MAX_TARGET;
+	totalCount = 0;
+	for (i = 0; i < numCabs; i++)
+	{
+		job.cabFolders[i] = job.folders.len;
+		for (j = totalCount; j < totalCount + cabs[i].count; j++)
+		{
+			CabFolder* last = (job.folders.len > job.cabFolders[i]) ?
+				&EA_BACK(job.folders) : NULL;
+			if (last == NULL || (last->uncompSize > 0 &&
+				 ((uint64_t)last->uncompSize + job.sizes[j] > target ||
+				  (uint64_t)last->uncompSize + job.sizes[j] >
+				  CAB_MAX_FOLDER_SIZE)))
+			{
+				CabFolder* folder;
+				EA_SET_SIZE(job.folders, job.folders.len + 1);
+				folder = &EA_BACK(job.folders);
+				folder->firstFile = j;
+				folder->numFiles = 0;
+				folder->uncompSize = 0;
+				folder->data = NULL;
+				folder->numBlocks = 0;
+				folder->compSize = 0;
+				folder->failed = false;
+				last = folder;
+			}
+			last->numFiles++;
+			last->uncompSize += job.sizes[j];
+		}
+		totalCount += cabs[i].count;
+	}
+	job.cabFolders[numCabs] = job.folders.len;
+
+	ParallelFor(job.folders.len, CompressFolder, &job);
+	for (i = 0; i < job.folders.len; i++)
+	{
+		if (job.folders.d[i].failed == true)
+			goto cleanup;
+	}
+
+	for (i = 0; i < numCabs; i++)
+	{
+		if (!AssembleCabinet(&job, cabs[i].path, job.cabFolders[i],
+							 job.cabFolders[i+1]))
+			goto cleanup;
+	}
+	retval = 1;
+
+cleanup:
+	for (i = 0; i < job.folders.len; i++)
+	{
+		if (job.folders.d[i].data != NULL)
+			fclose(job.folders.d[i].data);
+	}
+	EA_DESTROY(job.folders);
+	xfree(job.files);
+	xfree(job.sizes);
+	xfree(job.dates);
+	xfree(job.times);
+	xfree(job.cabFolders);
+	return retval;
+}
+
+/* Write one cabinet from its compressed folders.  */
+static bool AssembleCabinet(CabJob* job, const char* cabPath,
+							unsigned firstFolder, unsigned endFolder)
+{
+	unsigned numFolders = endFolder - firstFolder;
+	unsigned firstFile = 0;
+	unsigned count = 0;
+	uint64_t offset;
+	unsigned char hdr[36];
+	FILE* fp;
+	bool retval = false;
+	unsigned i;
+
+	if (numFolders > 0)
+	{
+		firstFile = job->folders.d[firstFolder].firstFile;
+		count = job->folders.d[endFolder-1].firstFile +
+			job->folders.d[endFolder-1].numFiles - firstFile;
+	}
+
+	/* Lay out the cabinet.  */
+	offset = 36 + 8 * numFolders;
+	for (i = firstFile; i < firstFile + count; i++)
+		offset += 16 + strlen(job->files[i].name) + 1;
+	{
+		uint64_t dataStart = offset;
+		for (i = firstFolder; i < endFolder; i++)
+			offset += job->folders.d[i].compSize;
+		if (offset > 0x7fffffff)
+		{
+			fprintf(stderr, "ERROR: Cabinet would be too large: %s\n",
+					cabPath);
+			return false;
+		}
+
+		fp = fopen(cabPath, "wb");
+		if (fp == NULL)
+		{
+			fprintf(stderr, "ERROR: Could not open file: %s\n", cabPath);
+			return false;
+		}
+		memset(hdr, 0, sizeof(hdr));
+		memcpy(hdr, "MSCF", 4);
+		Put32(hdr + 8, (uint32_t)offset); /* cbCabinet */
+		Put32(hdr + 16, 36 + 8 * numFolders); /* coffFiles */
+		hdr[24] = 3; /* versionMinor */
+		hdr[25] = 1; /* versionMajor */
+		Put16(hdr + 26, numFolders);
+		Put16(hdr + 28, count);
+		fwrite(hdr, 1, 36, fp);
+
+		/* CFFOLDER entries */
+		for (i = firstFolder; i < endFolder; i++)
+		{
+			unsigned char folderHdr[8];
+			Put32(folderHdr, (uint32_t)dataStart);
+			Put16(folderHdr + 4, job->folders.d[i].numBlocks);
+			Put16(folderHdr + 6, 1); /* MSZIP */
+			fwrite(folderHdr, 1, 8, fp);
+			dataStart += job->folders.d[i].compSize;
+		}
+	}
+
+	/* CFFILE entries */
+	for (i = firstFolder; i < endFolder; i++)
+	{
+		CabFolder* folder = &job->folders.d[i];
+		uint32_t folderOffset = 0;
+		unsigned j;
+		for (j = folder->firstFile; j < folder->firstFile + folder->numFiles;
+			 j++)
+		{
+			unsigned char fileHdr[16];
+			Put32(fileHdr, job->sizes[j]);
+			Put32(fileHdr + 4, folderOffset);
+			Put16(fileHdr + 8, i - firstFolder);
+			Put16(fileHdr + 10, job->dates[j]);
+			Put16(fileHdr + 12, job->times[j]);
+			Put16(fileHdr + 14, 0x20); /* _A_ARCH */
+			fwrite(fileHdr, 1, 16, fp);
+			fwrite(job->files[j].name, 1, strlen(job->files[j].name) + 1, fp);
+			folderOffset += job->sizes[j];
+		}
+	}
+
+	/* CFDATA blocks */
+	for (i = firstFolder; i < endFolder; i++)
+	{
+		unsigned char buf[8192];
+		size_t numRead;
+		rewind(job->folders.d[i].data);
+		while ((numRead = fread(buf, 1, sizeof(buf),
+								job->folders.d[i].data)) > 0)
+			fwrite(buf, 1, numRead, fp);
+	}
+
+	if (ferror(fp))
+		fprintf(stderr, "ERROR: Could not write file: %s\n", cabPath);
+	else
+		retval = true;
+	if (fclose(fp) != 0)
+		retval = false;
+	return retval;
+}
+
+/* Get the size and DOS time stamp of a file.  */
+static void StatCabFile(void* data, unsigned index)
+{
+	CabJob* job = (CabJob*)data;
+	struct stat st;
+	struct tm tmBuf;
+	if (stat(job->files[index].path, &st) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not open file: %s\n",
+				job->files[index].path);
+		job->statFailed = true;
+		return;
+	}
+	if ((uint64_t)st.st_size > CAB_MAX_FOLDER_SIZE)
+	{
+		fprintf(stderr, "ERROR: File too large for a cabinet: %s\n",
+				job->files[index].path);
+		job->statFailed = true;
+		return;
+	}
+	job->sizes[index] = (uint32_t)st.st_size;
+	localtime_r(&st.st_mtime, &tmBuf);
+	if (tmBuf.tm_year < 80)
+	{
+		tmBuf.tm_year = 80;
+		tmBuf.tm_mon = 0;
+		tmBuf.tm_mday = 1;
+	}
+	job->dates[index] = (uint16_t)(((tmBuf.tm_year - 80) << 9) |
+								   ((tmBuf.tm_mon + 1) << 5) | tmBuf.tm_mday);
+	job->times[index] = (uint16_t)((tmBuf.tm_hour << 11) |
+								   (tmBuf.tm_min << 5) | (tmBuf.tm_sec / 2));
+}
+
+/* Compress the files of one folder into its temporary file.  */
+static void CompressFolder(void* data, unsigned index)
+{
+	CabJob* job = (CabJob*)data;
+	CabFolder* folder = &job->folders.d[index];
+	z_stream zs;
+	unsigned char* block[2];
+	unsigned char* out;
+	unsigned cur = 0;
+	unsigned fill = 0;
+	unsigned prevLen = 0;
+	unsigned i;
+
+	folder->failed = true;
+	folder->data = tmpfile();
+	if (folder->data == NULL)
+	{
+		fputs("ERROR: Could not create a temporary file.\n", stderr);
+		return;
+	}
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+					 Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+	block[0] = (unsigned char*)xmalloc(CAB_BLOCK_SIZE);
+	block[1] = (unsigned char*)xmalloc(CAB_BLOCK_SIZE);
+	out = (unsigned char*)xmalloc(CAB_MAX_COMP_BLOCK);
+
+	for (i = folder->firstFile; i < folder->firstFile + folder->numFiles; i++)
+	{
+		FILE* fp;
+		uint32_t left = job->sizes[i];
+		fp = fopen(job->files[i].path, "rb");
+		if (fp == NULL)
+		{
+			fprintf(stderr, "ERROR: Could not open file: %s\n",
+					job->files[i].path);
+			goto cleanup;
+		}
+		while (left > 0)
+		{
+			size_t want = CAB_BLOCK_SIZE - fill;
+			size_t numRead;
+			if (want > left)
+				want = left;
+			numRead = fread(block[cur] + fill, 1, want, fp);
+			if (numRead != want)
+			{
+				fprintf(stderr, "ERROR: Could not read file: %s\n",
+						job->files[i].path);
+				fclose(fp);
+				goto cleanup;
+			}
+			fill += numRead;
+			left -= numRead;
+			if (fill == CAB_BLOCK_SIZE)
+			{
+				if (!EmitBlock(&zs, folder, block[cur], fill,
+							   block[cur^1], prevLen, out))
+				{
+					fclose(fp);
+					goto cleanup;
+				}
+				prevLen = fill;
+				cur ^= 1;
+				fill = 0;
+			}
+		}
+		fclose(fp);
+	}
+	if (fill > 0)
+	{
+		if (!EmitBlock(&zs, folder, block[cur], fill,
+					   block[cur^1], prevLen, out))
+			goto cleanup;
+	}
+	if (ferror(folder->data))
+		fputs("ERROR: Could not write a temporary file.\n", stderr);
+	else
+		folder->failed = false;
+
+cleanup:
+	deflateEnd(&zs);
+	xfree(block[0]);
+	xfree(block[1]);
+	xfree(out);
+}
+
+/* Compress one block and append it to the folder as a CFDATA
+   structure.  `prev' holds the previous block of the same folder,
+   which serves as the dictionary.  */
+static bool EmitBlock(z_stream* zs, CabFolder* folder,
+					  const unsigned char* block, unsigned len,
+					  const unsigned char* prev, unsigned prevLen,
+					  unsigned char* out)
+{
+	unsigned char hdr[8];
+	unsigned compLen;
+
+	if (folder->numBlocks == 0xffff)
+	{
+		fputs("ERROR: Too many data blocks in a cabinet folder.\n", stderr);
+		return false;
+	}
+	deflateReset(zs);
+	if (prevLen > 0)
+		deflateSetDictionary(zs, prev, prevLen);
+	out[0] = 'C';
+	out[1] = 'K';
+	zs->next_in = (Bytef*)block;
+	zs->avail_in = len;
+	zs->next_out = out + 2;
+	zs->avail_out = CAB_MAX_COMP_BLOCK - 2;
+	if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+	{
+		fputs("ERROR: MSZIP compression failed.\n", stderr);
+		return false;
+	}
+	compLen = CAB_MAX_COMP_BLOCK - zs->avail_out;
+
+	Put16(hdr + 4, compLen);
+	Put16(hdr + 6, len);
+	Put32(hdr, CabChecksum(hdr + 4, 4, CabChecksum(out, compLen, 0)));
+	fwrite(hdr, 1, 8, folder->data);
+	fwrite(out, 1, compLen, folder->data);
+	folder->numBlocks++;
+	folder->compSize += 8 + compLen;
+	return true;
+}
+
+static void Put16(unsigned char* p, unsigned v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void Put32(unsigned char* p, uint32_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
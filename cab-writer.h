@@ -0,0 +1,40 @@
+/* cab-writer.h -- write a Microsoft cabinet file with MSZIP compressed
+   folders.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef CAB_WRITER_H
+#define CAB_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct CabFile_t CabFile;
+
+/* One file to store in a cabinet.  Files are stored in the order they
+   are given.  */
+struct CabFile_t
+{
+	const char* path; /* Where to read the file data from */
+	const char* name; /* Name of the file within the cabinet */
+};
+
+typedef struct CabOutput_t CabOutput;
+
+/* One cabinet and the files to store in it.  */
+struct CabOutput_t
+{
+	const char* path;
+	CabFile* files;
+	unsigned count;
+};
+
+uint32_t CabChecksum(const void* data, size_t len, uint32_t seed);
+int WriteCabinet(const char* cabPath, CabFile* files, unsigned count);
+int WriteCabinets(CabOutput* cabs, unsigned numCabs);
+
+#endif /* not CAB_WRITER_H */
@@ -0,0 +1,842 @@
+/* cfb.c -- read and write OLE compound files (structured storage).
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* A compound file is a small file system inside a file: a header, a
+   file allocation table (FAT) of sector chains, a directory of
+   storages and streams arranged as one binary tree per storage, and a
+   second "mini" FAT for streams smaller than 4096 bytes, which are
+   packed in 64 byte units into a stream owned by the root entry.
+
+   `CfbRead()' loads every stream of an existing file into memory, so
+   it is only meant for files of moderate size such as database
+   templates.  `CfbWrite()' always writes a fresh version 3 file with
+   512 byte sectors and lays every chain out contiguously.  Streams
+   whose contents come from `srcPath' are copied straight from disk
+   while writing, so large payloads never have to be held in
+   memory.  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "cfb.h"
+
+#define FREESECT   0xffffffff
+#define ENDOFCHAIN 0xfffffffe
+#define FATSECT    0xfffffffd
+#define DIFSECT    0xfffffffc
+#define NOSTREAM   0xffffffff
+
+#define SECTOR_SIZE 512
+#define MINI_SECTOR_SIZE 64
+#define MINI_CUTOFF 4096
+#define HEADER_DIFAT 109
+
+static const unsigned char cfbSignature[8] =
+	{ 0xd0, 0xcf, 0x11, 0xe0, 0xa1, 0xb1, 0x1a, 0xe1 };
+
+EA_TYPE(uint32_t);
+
+/* Private Declarations */
+static uint32_t Get32(const unsigned char* p);
+static unsigned Get16(const unsigned char* p);
+static void Put16(unsigned char* p, unsigned v);
+static void Put32(unsigned char* p, uint32_t v);
+static bool ReadChain(uint32_t start, const uint32_t* fat, uint32_t fatLen,
+					  uint32_t maxLen, uint32_t_array* chain);
+static int CfbNameCmp(const CfbEntry* e1, const CfbEntry* e2);
+static uint32_t BuildSiblingTree(unsigned* kids, unsigned lo, unsigned hi,
+								 uint32_t* left, uint32_t* right,
+								 const uint32_t* dirIds);
+static bool CopyFileData(FILE* out, const char* srcPath, uint64_t size);
+static void WritePadding(FILE* fp, uint64_t len, unsigned unit);
+
+/* Initialize an empty compound file that only has a root entry.  */
+void CfbInit(CfbFile* cfb)
+{
+	static const char rootName[] = "Root Entry";
+	CfbEntry* root;
+	unsigned i;
+	EA_INIT(CfbEntry, cfb->entries, 16);
+	EA_SET_SIZE(cfb->entries, 1);
+	root = &cfb->entries.d[0];
+	memset(root, 0, sizeof(CfbEntry));
+	for (i = 0; rootName[i] != '\0'; i++)
+		root->name[i] = (uint16_t)rootName[i];
+	root->nameLen = i;
+	root->type = CFB_ROOT;
+}
+
+/* Read the compound file `path' into `cfb', which must not be
+   initialized yet.  Returns nonzero on success, zero on failure.  */
+int CfbRead(CfbFile* cfb, const char* path)
+{
+	FILE* fp;
+	unsigned char* file = NULL;
+	size_t fileSize;
+	unsigned sectSize;
+	uint32_t numSectors;
+	uint32_t cutoff;
+	uint32_t_array fat;
+	uint32_t_array chain;
+	uint32_t_array miniFat;
+	unsigned char* miniStream = NULL;
+	uint64_t miniSize = 0;
+	unsigned char* dir = NULL;
+	uint32_t numDir;
+	uint32_t_array stack;
+	unsigned char* visited = NULL;
+	int retval = 0;
+	uint32_t i;
+
+	CfbInit(cfb);
+	EA_INIT(uint32_t, fat, 16);
+	EA_INIT(uint32_t, chain, 16);
+	EA_INIT(uint32_t, miniFat, 16);
+	EA_INIT(uint32_t, stack, 16);
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open file: %s\n", path);
+		goto cleanup;
+	}
+	fseek(fp, 0, SEEK_END);
+	fileSize = (size_t)ftell(fp);
+	rewind(fp);
+	file = (unsigned char*)xmalloc(fileSize);
+	if (fread(file, 1, fileSize, fp) != fileSize)
+	{
+		fclose(fp);
+		fprintf(stderr, "ERROR: Could not read file: %s\n", path);
+		goto cleanup;
+	}
+	fclose(fp);
+
+	if (fileSize < SECTOR_SIZE || memcmp(file, cfbSignature, 8) != 0)
+		goto corrupt;
+	if (Get16(file + 30) == 9)
+		sectSize = 512;
+	else if (Get16(file + 30) == 12)
+		sectSize = 4096;
+	else
+		goto corrupt;
+	if (Get16(file + 32) != 6)
+		goto corrupt;
+	numSectors = (uint32_t)((fileSize - sectSize) / sectSize);
+	if (fileSize % sectSize != 0)
+		numSectors++; /* Tolerate a short last sector.  */
+	cutoff = Get32(file + 56);
+
+	/* Collect the FAT sector numbers from the header and the DIFAT
+	   chain, then load the FAT itself.  */
+	{
+		uint32_t numFat = Get32(file + 44);
+		uint32_t difatSect = Get32(file + 68);
+		uint32_t perSect = sectSize / 4;
+		uint32_t_array fatSects;
+		EA_INIT(uint32_t, fatSects, 16);
+		for (i = 0; i < HEADER_DIFAT && fatSects.len < numFat; i++)
+			EA_APPEND(fatSects, Get32(file + 76 + i * 4));
+		while (fatSects.len < numFat && difatSect < numSectors)
+		{
+			const unsigned char* sect = file + (size_t)(difatSect + 1) * sectSize;
+			if ((size_t)(difatSect + 2) * sectSize > fileSize)
+				break;
+			for (i = 0; i < perSect - 1 && fatSects.len < numFat; i++)
+				EA_APPEND(fatSects, Get32(sect + i * 4));
+			difatSect = Get32(sect + (perSect - 1) * 4);
+		}
+		if (fatSects.len < numFat)
+		{
+			EA_DESTROY(fatSects);
+			goto corrupt;
+		}
+		for (i = 0; i < fatSects.len; i++)
+		{
+			uint32_t j;
+			const unsigned char* sect;
+			if (fatSects.d[i] >= numSectors ||
+				(size_t)(fatSects.d[i] + 2) * sectSize > fileSize)
+			{
+				EA_DESTROY(fatSects);
+				goto corrupt;
+			}
+			sect = file + (size_t)(fatSects.d[i] + 1) * sectSize;
+			for (j = 0; j < perSect; j++)
+				EA_APPEND(fat, Get32(sect + j * 4));
+		}
+		EA_DESTROY(fatSects);
+	}
+
+/* Address of a regular sector, checked against the file size.  */
+#define SECTOR_PTR(n) (((size_t)(n) + 2) * sectSize <= fileSize ?		\
+					   file + ((size_t)(n) + 1) * sectSize : NULL)
+
+	/* Directory */
+	if (!ReadChain(Get32(file + 48), fat.d, fat.len, numSectors, &chain))
+		goto corrupt;
+	numDir = chain.len * (sectSize / 128);
+	dir = (unsigned char*)xmalloc((size_t)chain.len * sectSize + 1);
+	for (i = 0; i < chain.len; i++)
+	{
+		const unsigned char* src = SECTOR_PTR(chain.d[i]);
+		if (src == NULL)
+			goto corrupt;
+		memcpy(dir + (size_t)i * sectSize, src, sectSize);
+	}
+	if (numDir == 0 || dir[66] != CFB_ROOT)
+		goto corrupt;
+
+	/* Mini FAT and mini stream */
+	if (!ReadChain(Get32(file + 60), fat.d, fat.len, numSectors, &chain))
+		goto corrupt;
+	for (i = 0; i < chain.len; i++)
+	{
+		uint32_t j;
+		if (SECTOR_PTR(chain.d[i]) == NULL)
+			goto corrupt;
+		for (j = 0; j < sectSize / 4; j++)
+			EA_APPEND(miniFat, Get32(SECTOR_PTR(chain.d[i]) + j * 4));
+	}
+	if (!ReadChain(Get32(dir + 116), fat.d, fat.len, numSectors, &chain))
+		goto corrupt;
+	miniSize = (uint64_t)chain.len * sectSize;
+	miniStream = (unsigned char*)xmalloc((size_t)miniSize + 1);
+	for (i = 0; i < chain.len; i++)
+	{
+		const unsigned char* src = SECTOR_PTR(chain.d[i]);
+		if (src == NULL)
+			goto corrupt;
+		memcpy(miniStream + (size_t)i * sectSize, src, sectSize);
+	}
+	memcpy(cfb->entries.d[0].clsid, dir + 80, 16);
+	cfb->entries.d[0].stateBits = Get32(dir + 96);
+	memcpy(cfb->entries.d[0].times, dir + 100, 16);
+
+	/* Walk the sibling trees.  The stack holds pairs of directory IDs
+	   and the index of the entry of their parent storage.  */
+	visited = (unsigned char*)xmalloc(numDir);
+	memset(visited, 0, numDir);
+	visited[0] = 1;
+	EA_APPEND(stack, Get32(dir + 76));
+	EA_APPEND(stack, 0);
+	while (stack.len > 0)
+	{
+		uint32_t dirId, parent;
+		const unsigned char* ent;
+		CfbEntry* entry;
+		unsigned index;
+		uint64_t size;
+
+		parent = EA_BACK(stack); EA_POP_BACK(stack);
+		dirId = EA_BACK(stack); EA_POP_BACK(stack);
+		if (dirId == NOSTREAM)
+			continue;
+		if (dirId >= numDir || visited[dirId])
+			goto corrupt;
+		visited[dirId] = 1;
+		ent = dir + (size_t)dirId * 128;
+		if (ent[66] != CFB_STORAGE && ent[66] != CFB_STREAM)
+			goto corrupt;
+
+		index = cfb->entries.len;
+		EA_SET_SIZE(cfb->entries, cfb->entries.len + 1);
+		entry = &cfb->entries.d[index];
+		memset(entry, 0, sizeof(CfbEntry));
+		entry->nameLen = Get16(ent + 64) / 2;
+		if (entry->nameLen > 0)
+			entry->nameLen--;
+		if (entry->nameLen > CFB_MAX_NAME)
+			goto corrupt;
+		for (i = 0; i < entry->nameLen; i++)
+			entry->name[i] = (uint16_t)Get16(ent + i * 2);
+		entry->type = ent[66];
+		entry->parent = parent;
+		memcpy(entry->clsid, ent + 80, 16);
+		entry->stateBits = Get32(ent + 96);
+		memcpy(entry->times, ent + 100, 16);
+
+		if (entry->type == CFB_STREAM)
+		{
+			uint32_t start = Get32(ent + 116);
+			size = Get32(ent + 120);
+			if (sectSize == 4096)
+				size |= (uint64_t)Get32(ent + 124) << 32;
+			entry->size = size;
+			entry->data = (unsigned char*)xmalloc((size_t)size + 1);
+			if (size < cutoff)
+			{
+				if (!ReadChain(start, miniFat.d, miniFat.len,
+							   (uint32_t)(miniSize / MINI_SECTOR_SIZE), &chain) ||
+					(uint64_t)chain.len * MINI_SECTOR_SIZE < size)
+					goto corrupt;
+				for (i = 0; (uint64_t)i * MINI_SECTOR_SIZE < size; i++)
+				{
+					uint64_t left = size - (uint64_t)i * MINI_SECTOR_SIZE;
+					memcpy(entry->data + (size_t)i * MINI_SECTOR_SIZE,
+						   miniStream + (size_t)chain.d[i] * MINI_SECTOR_SIZE,
+						   (left < MINI_SECTOR_SIZE) ? (size_t)left :
+						   MINI_SECTOR_SIZE);
+				}
+			}
+			else
+			{
+				if (!ReadChain(start, fat.d, fat.len, numSectors, &chain) ||
+					(uint64_t)chain.len * sectSize < size)
+					goto corrupt;
+				for (i = 0; (uint64_t)i * sectSize < size; i++)
+				{
+					uint64_t left = size - (uint64_t)i * sectSize;
+					const unsigned char* src = SECTOR_PTR(chain.d[i]);
+					if (src == NULL)
+						goto corrupt;
+					memcpy(entry->data + (size_t)i * sectSize, src,
+						   (left < sectSize) ? (size_t)left : sectSize);
+				}
+			}
+		}
+
+		EA_APPEND(stack, Get32(ent + 68)); /* Left sibling */
+		EA_APPEND(stack, parent);
+		EA_APPEND(stack, Get32(ent + 72)); /* Right sibling */
+		EA_APPEND(stack, parent);
+		if (entry->type == CFB_STORAGE)
+		{
+			EA_APPEND(stack, Get32(ent + 76)); /* Child */
+			EA_APPEND(stack, index);
+		}
+	}
+#undef SECTOR_PTR
+
+	retval = 1;
+	goto cleanup;
+
+corrupt:
+	fprintf(stderr, "ERROR: Not a valid compound file: %s\n", path);
+cleanup:
+	xfree(file);
+	xfree(dir);
+	xfree(miniStream);
+	xfree(visited);
+	EA_DESTROY(fat);
+	EA_DESTROY(chain);
+	EA_DESTROY(miniFat);
+	EA_DESTROY(stack);
+	return retval;
+}
+
+/* Write `cfb' to the file `path'.  Returns nonzero on success, zero on
+   failure.  */
+int CfbWrite(CfbFile* cfb, const char* path)
+{
+	unsigned numEntries = cfb->entries.len;
+	uint32_t* dirIds;
+	uint32_t* starts;
+	uint32_t* left;
+	uint32_t* right;
+	uint32_t* child;
+	unsigned* kids;
+	uint32_t numDir = 0;
+	uint32_t numMini = 0;
+	uint32_t cursor = 0;
+	uint32_t miniStreamStart, miniStreamSects;
+	uint32_t dirStart, dirSects;
+	uint32_t miniFatStart, miniFatSects;
+	uint32_t fatStart, numFat, difatStart, numDifat;
+	uint32_t* fat;
+	unsigned char sector[SECTOR_SIZE];
+	FILE* fp;
+	int retval = 0;
+	unsigned i;
+
+	dirIds = (uint32_t*)xmalloc(sizeof(uint32_t) * numEntries);
+	starts = (uint32_t*)xmalloc(sizeof(uint32_t) * numEntries);
+	left = (uint32_t*)xmalloc(sizeof(uint32_t) * numEntries);
+	right = (uint32_t*)xmalloc(sizeof(uint32_t) * numEntries);
+	child = (uint32_t*)xmalloc(sizeof(uint32_t) * numEntries);
+	kids = (unsigned*)xmalloc(sizeof(unsigned) * numEntries);
+
+	/* Assign directory IDs and lay out the stream data.  Big streams
+	   come first, followed by the mini stream.  */
+	for (i = 0; i < numEntries; i++)
+	{
+		CfbEntry* entry = &cfb->entries.d[i];
+		/* An entry is also dropped if its storage is dropped; parents
+		   always come before their children.  */
+		if (i > 0 && cfb->entries.d[entry->parent].deleted)
+			entry->deleted = true;
+		dirIds[i] = (entry->deleted) ? NOSTREAM : numDir++;
+		left[i] = right[i] = child[i] = NOSTREAM;
+		starts[i] = ENDOFCHAIN;
+		if (entry->deleted || entry->type != CFB_STREAM || entry->size == 0)
+			continue;
+		if (entry->size < MINI_CUTOFF)
+		{
+			starts[i] = numMini;
+			numMini += (uint32_t)((entry->size + MINI_SECTOR_SIZE - 1) /
+								  MINI_SECTOR_SIZE);
+		}
+		else
+		{
+			if (entry->size > 0xffffffffU)
+			{
+				fputs("ERROR: Stream too large for a compound file.\n",
+					  stderr);
+				goto cleanup;
+			}
+			starts[i] = cursor;
+			cursor += (uint32_t)((entry->size + SECTOR_SIZE - 1) /
+								 SECTOR_SIZE);
+		}
+	}
+	miniStreamSects = (numMini * MINI_SECTOR_SIZE + SECTOR_SIZE - 1) /
+		SECTOR_SIZE;
+	miniStreamStart = (miniStreamSects > 0) ? cursor : ENDOFCHAIN;
+	cursor += miniStreamSects;
+	dirSects = (numDir * 128 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	dirStart = cursor;
+	cursor += dirSects;
+	miniFatSects = (numMini * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	miniFatStart = (miniFatSects > 0) ? cursor : ENDOFCHAIN;
+	cursor += miniFatSects;
+
+	/* The FAT has to cover its own sectors and the DIFAT sectors.  */
+	numFat = 0;
+	while (true)
+	{
+		uint32_t need;
+		numDifat = (numFat > HEADER_DIFAT) ?
+			(numFat - HEADER_DIFAT + 126) / 127 : 0;
+		need = (cursor + numFat + numDifat + 127) / 128;
+		if (need <= numFat)
+			break;
+		numFat = need;
+	}
+	fatStart = cursor;
+	difatStart = fatStart + numFat;
+
+	fat = (uint32_t*)xmalloc(sizeof(uint32_t) * numFat * 128);
+	for (i = 0; i < numFat * 128; i++)
+		fat[i] = FREESECT;
+#define CHAIN(start, count)										\
+	{															\
+		uint32_t n;												\
+		for (n = 0; n < (count); n++)							\
+			fat[(start) + n] = (n + 1 < (count)) ? (start) + n + 1 : \
+				ENDOFCHAIN;										\
+	}
+	for (i = 0; i < numEntries; i++)
+	{
+		CfbEntry* entry = &cfb->entries.d[i];
+		if (dirIds[i] == NOSTREAM || entry->type != CFB_STREAM ||
+			entry->size < MINI_CUTOFF)
+			continue;
+		CHAIN(starts[i], (uint32_t)((entry->size + SECTOR_SIZE - 1) /
+									SECTOR_SIZE));
+	}
+	if (miniStreamSects > 0)
+		CHAIN(miniStreamStart, miniStreamSects);
+	CHAIN(dirStart, dirSects);
+	if (miniFatSects > 0)
+		CHAIN(miniFatStart, miniFatSects);
+#undef CHAIN
+	for (i = 0; i < numFat; i++)
+		fat[fatStart + i] = FATSECT;
+	for (i = 0; i < numDifat; i++)
+		fat[difatStart + i] = DIFSECT;
+
+	/* Arrange the children of every storage into a balanced binary
+	   tree, ordered by name.  */
+	for (i = 0; i < numEntries; i++)
+	{
+		unsigned numKids = 0;
+		unsigned j;
+		if (dirIds[i] == NOSTREAM || cfb->entries.d[i].type == CFB_STREAM)
+			continue;
+		for (j = 1; j < numEntries; j++)
+		{
+			if (dirIds[j] != NOSTREAM && cfb->entries.d[j].parent == i)
+				kids[numKids++] = j;
+		}
+		/* Insertion sort keeps this simple; storages in installer
+		   databases have at most a few hundred streams.  */
+		for (j = 1; j < numKids; j++)
+		{
+			unsigned k = j;
+			unsigned kid = kids[j];
+			while (k > 0 && CfbNameCmp(&cfb->entries.d[kids[k-1]],
+									   &cfb->entries.d[kid]) > 0)
+			{
+				kids[k] = kids[k-1];
+				k--;
+			}
+			kids[k] = kid;
+		}
+		child[i] = BuildSiblingTree(kids, 0, numKids, left, right, dirIds);
+	}
+
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open file: %s\n", path);
+		xfree(fat);
+		goto cleanup;
+	}
+
+	/* Header */
+	memset(sector, 0, SECTOR_SIZE);
+	memcpy(sector, cfbSignature, 8);
+	Put16(sector + 24, 0x3e); /* Minor version */
+	Put16(sector + 26, 3); /* Major version */
+	Put16(sector + 28, 0xfffe); /* Byte order */
+	Put16(sector + 30, 9); /* Sector shift */
+	Put16(sector + 32, 6); /* Mini sector shift */
+	Put32(sector + 44, numFat);
+	Put32(sector + 48, dirStart);
+	Put32(sector + 56, MINI_CUTOFF);
+	Put32(sector + 60, miniFatStart);
+	Put32(sector + 64, miniFatSects);
+	Put32(sector + 68, (numDifat > 0) ? difatStart : ENDOFCHAIN);
+	Put32(sector + 72, numDifat);
+	for (i = 0; i < HEADER_DIFAT; i++)
+		Put32(sector + 76 + i * 4, (i < numFat) ? fatStart + i : FREESECT);
+	fwrite(sector, 1, SECTOR_SIZE, fp);
+
+	/* Big streams */
+	for (i = 0; i < numEntries; i++)
+	{
+		CfbEntry* entry = &cfb->entries.d[i];
+		if (dirIds[i] == NOSTREAM || entry->type != CFB_STREAM ||
+			entry->size < MINI_CUTOFF)
+			continue;
+		if (entry->srcPath != NULL)
+		{
+			if (!CopyFileData(fp, entry->srcPath, entry->size))
+			{
+				fclose(fp);
+				xfree(fat);
+				goto cleanup;
+			}
+		}
+		else
+			fwrite(entry->data, 1, (size_t)entry->size, fp);
+		WritePadding(fp, entry->size, SECTOR_SIZE);
+	}
+
+	/* Mini stream */
+	for (i = 0; i < numEntries; i++)
+	{
+		CfbEntry* entry = &cfb->entries.d[i];
+		if (dirIds[i] == NOSTREAM || entry->type != CFB_STREAM ||
+			entry->size == 0 || entry->size >= MINI_CUTOFF)
+			continue;
+		if (entry->srcPath != NULL)
+		{
+			if (!CopyFileData(fp, entry->srcPath, entry->size))
+			{
+				fclose(fp);
+				xfree(fat);
+				goto cleanup;
+			}
+		}
+		else
+			fwrite(entry->data, 1, (size_t)entry->size, fp);
+		WritePadding(fp, entry->size, MINI_SECTOR_SIZE);
+	}
+	WritePadding(fp, (uint64_t)numMini * MINI_SECTOR_SIZE, SECTOR_SIZE);
+
+	/* Directory */
+	for (i = 0; i < dirSects * (SECTOR_SIZE / 128); i++)
+	{
+		unsigned char ent[128];
+		memset(ent, 0, 128);
+		Put32(ent + 68, NOSTREAM);
+		Put32(ent + 72, NOSTREAM);
+		Put32(ent + 76, NOSTREAM);
+		if (i < numDir)
+		{
+			CfbEntry* entry;
+			unsigned index;
+			unsigned j;
+			/* Directory IDs are handed out in entry order.  */
+			for (index = 0; dirIds[index] != i; index++);
+			entry = &cfb->entries.d[index];
+			for (j = 0; j < entry->nameLen; j++)
+				Put16(ent + j * 2, entry->name[j]);
+			Put16(ent + 64, (entry->nameLen + 1) * 2);
+			ent[66] = (unsigned char)entry->type;
+			ent[67] = 1; /* Black */
+			Put32(ent + 68, left[index]);
+			Put32(ent + 72, right[index]);
+			Put32(ent + 76, child[index]);
+			memcpy(ent + 80, entry->clsid, 16);
+			Put32(ent + 96, entry->stateBits);
+			memcpy(ent + 100, entry->times, 16);
+			if (entry->type == CFB_ROOT)
+			{
+				Put32(ent + 116, miniStreamStart);
+				Put32(ent + 120, numMini * MINI_SECTOR_SIZE);
+			}
+			else if (entry->type == CFB_STREAM)
+			{
+				Put32(ent + 116, starts[index]);
+				Put32(ent + 120, (uint32_t)entry->size);
+			}
+		}
+		fwrite(ent, 1, 128, fp);
+	}
+
+	/* Mini FAT */
+	if (miniFatSects > 0)
+	{
+		uint32_t written = 0;
+		for (i = 0; i < numEntries; i++)
+		{
+			CfbEntry* entry = &cfb->entries.d[i];
+			uint32_t count, n;
+			if (dirIds[i] == NOSTREAM || entry->type != CFB_STREAM ||
+				entry->size == 0 || entry->size >= MINI_CUTOFF)
+				continue;
+			count = (uint32_t)((entry->size + MINI_SECTOR_SIZE - 1) /
+							   MINI_SECTOR_SIZE);
+			for (n = 0; n < count; n++)
+			{
+				unsigned char word[4];
+				Put32(word, (n + 1 < count) ? starts[i] + n + 1 : ENDOFCHAIN);
+				fwrite(word, 1, 4, fp);
+				written++;
+			}
+		}
+		memset(sector, 0xff, SECTOR_SIZE);
+		fwrite(sector, 1, miniFatSects * SECTOR_SIZE - written * 4, fp);
+	}
+
+	/* FAT */
+	for (i = 0; i < numFat * 128; i++)
+	{
+		unsigned char word[4];
+		Put32(word, fat[i]);
+		fwrite(word, 1, 4, fp);
+	}
+
+	/* DIFAT */
+	for (i = 0; i < numDifat; i++)
+	{
+		unsigned j;
+		memset(sector, 0xff, SECTOR_SIZE);
+		for (j = 0; j < 127; j++)
+		{
+			uint32_t fatIndex = HEADER_DIFAT + i * 127 + j;
+			if (fatIndex < numFat)
+				Put32(sector + j * 4, fatStart + fatIndex);
+		}
+		Put32(sector + 127 * 4, (i + 1 < numDifat) ? difatStart + i + 1 :
+			  ENDOFCHAIN);
+		fwrite(sector, 1, SECTOR_SIZE, fp);
+	}
+
+	xfree(fat);
+	if (ferror(fp))
+		fprintf(stderr, "ERROR: Could not write file: %s\n", path);
+	else
+		retval = 1;
+	if (fclose(fp) != 0)
+		retval = 0;
+
+cleanup:
+	xfree(dirIds);
+	xfree(starts);
+	xfree(left);
+	xfree(right);
+	xfree(child);
+	xfree(kids);
+	return retval;
+}
+
+/* Find a live entry by name within the storage `parent'.  Returns its
+   index, or (unsigned)-1 if there is no such entry.  */
+unsigned CfbFind(CfbFile* cfb, unsigned parent, const uint16_t* name,
+				 unsigned nameLen)
+{
+	CfbEntry key;
+	unsigned i;
+	key.nameLen = nameLen;
+	memcpy(key.name, name, nameLen * sizeof(uint16_t));
+	for (i = 1; i < cfb->entries.len; i++)
+	{
+		CfbEntry* entry = &cfb->entries.d[i];
+		if (entry->parent == parent && !entry->deleted &&
+			CfbNameCmp(entry, &key) == 0)
+			return i;
+	}
+	return (unsigned)-1;
+}
+
+/* Create or replace a stream.  The compound file takes ownership of
+   `data', which may be NULL if `srcPath' names the file to copy the
+   stream contents from.  Returns the index of the entry.  */
+unsigned CfbSetStream(CfbFile* cfb, unsigned parent, const uint16_t* name,
+					  unsigned nameLen, unsigned char* data, uint64_t size,
+					  const char* srcPath)
+{
+	CfbEntry* entry;
+	unsigned index;
+	index = CfbFind(cfb, parent, name, nameLen);
+	if (index == (unsigned)-1)
+	{
+		index = cfb->entries.len;
+		EA_SET_SIZE(cfb->entries, cfb->entries.len + 1);
+		entry = &cfb->entries.d[index];
+		memset(entry, 0, sizeof(CfbEntry));
+		memcpy(entry->name, name, nameLen * sizeof(uint16_t));
+		entry->nameLen = nameLen;
+		entry->type = CFB_STREAM;
+		entry->parent = parent;
+	}
+	else
+	{
+		entry = &cfb->entries.d[index];
+		xfree(entry->data);
+	}
+	entry->data = data;
+	entry->size = size;
+	entry->srcPath = srcPath;
+	return index;
+}
+
+void CfbDestroy(CfbFile* cfb)
+{
+	unsigned i;
+	for (i = 0; i < cfb->entries.len; i++)
+		xfree(cfb->entries.d[i].data);
+	EA_DESTROY(cfb->entries);
+}
+
+static uint32_t Get32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned Get16(const unsigned char* p)
+{
+	return (unsigned)p[0] | ((unsigned)p[1] << 8);
+}
+
+static void Put16(unsigned char* p, unsigned v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void Put32(unsigned char* p, uint32_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+/* Follow a sector chain through `fat' and store the sector numbers in
+   `chain'.  Returns false if the chain leaves the table, points past
+   `maxLen' sectors, or is longer than `maxLen'.  */
+static bool ReadChain(uint32_t start, const uint32_t* fat, uint32_t fatLen,
+					  uint32_t maxLen, uint32_t_array* chain)
+{
+	uint32_t sect = start;
+	EA_CLEAR(*chain);
+	while (sect != ENDOFCHAIN)
+	{
+		if (sect >= fatLen || sect >= maxLen || chain->len >= maxLen)
+			return false;
+		EA_APPEND(*chain, sect);
+		sect = fat[sect];
+	}
+	return true;
+}
+
+/* Compare directory entry names the way compound files order them:
+   shorter names first, then by upper-case code units.  */
+static int CfbNameCmp(const CfbEntry* e1, const CfbEntry* e2)
+{
+	unsigned i;
+	if (e1->nameLen != e2->nameLen)
+		return (e1->nameLen < e2->nameLen) ? -1 : 1;
+	for (i = 0; i < e1->nameLen; i++)
+	{
+		unsigned c1 = e1->name[i];
+		unsigned c2 = e2->name[i];
+		if ((c1 >= 'a' && c1 <= 'z') || (c1 >= 0xe0 && c1 <= 0xfe && c1 != 0xf7))
+			c1 -= 0x20;
+		if ((c2 >= 'a' && c2 <= 'z') || (c2 >= 0xe0 && c2 <= 0xfe && c2 != 0xf7))
+			c2 -= 0x20;
+		if (c1 != c2)
+			return (c1 < c2) ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Link the sorted entries `kids[lo..hi)' into a balanced binary tree
+   and return the directory ID of its root.  */
+static uint32_t BuildSiblingTree(unsigned* kids, unsigned lo, unsigned hi,
+								 uint32_t* left, uint32_t* right,
+								 const uint32_t* dirIds)
+{
+	unsigned mid;
+	if (lo >= hi)
+		return NOSTREAM;
+	mid = lo + (hi - lo) / 2;
+	left[kids[mid]] = BuildSiblingTree(kids, lo, mid, left, right, dirIds);
+	right[kids[mid]] = BuildSiblingTree(kids, mid + 1, hi, left, right,
+										dirIds);
+	return dirIds[kids[mid]];
+}
+
+/* Copy exactly `size' bytes from the file `srcPath' to `out'.  */
+static bool CopyFileData(FILE* out, const char* srcPath, uint64_t size)
+{
+	FILE* fp;
+	unsigned char buf[65536];
+	uint64_t left = size;
+	fp = fopen(srcPath, "rb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open file: %s\n", srcPath);
+		return false;
+	}
+	while (left > 0)
+	{
+		size_t want = (left < sizeof(buf)) ? (size_t)left : sizeof(buf);
+		if (fread(buf, 1, want, fp) != want)
+		{
+			fprintf(stderr, "ERROR: Could not read file: %s\n", srcPath);
+			fclose(fp);
+			return false;
+		}
+		fwrite(buf, 1, want, out);
+		left -= want;
+	}
+	fclose(fp);
+	return true;
+}
+
+/* Write zero bytes to pad `len' bytes of data up to a multiple of
+   `unit'.  */
+static void WritePadding(FILE* fp, uint64_t len, unsigned unit)
+{
+	static const unsigned char zeros[SECTOR_SIZE];
+	unsigned pad = (unsigned)((unit - len % unit) % unit);
+	if (pad > 0)
+		fwrite(zeros, 1, pad, fp);
+}
@@ -0,0 +1,64 @@
+/* cfb.h -- read and write OLE compound files (structured storage).
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef CFB_H
+#define CFB_H
+
+/* Note: `exparray.h' must be included before this header.  */
+
+#include <stdint.h>
+
+#define CFB_MAX_NAME 31
+
+/* Directory entry types */
+#define CFB_STORAGE 1
+#define CFB_STREAM 2
+#define CFB_ROOT 5
+
+typedef struct CfbEntry_t CfbEntry;
+
+/* One storage or stream.  The contents of a stream are either held in
+   memory in `data', or, if `srcPath' is not NULL, read from that file
+   when the compound file is written.  */
+struct CfbEntry_t
+{
+	uint16_t name[CFB_MAX_NAME+1];
+	unsigned nameLen; /* In UTF-16 code units, without the null */
+	unsigned type;
+	unsigned parent; /* Index of the containing storage */
+	unsigned char clsid[16];
+	uint32_t stateBits;
+	unsigned char times[16]; /* Creation and modification times */
+	unsigned char* data;
+	const char* srcPath;
+	uint64_t size;
+	/* Set if the entry should not be written.  */
+	int deleted;
+};
+
+EA_TYPE(CfbEntry);
+
+/* An in-memory compound file.  Entry zero is always the root
+   storage.  */
+typedef struct CfbFile_t CfbFile;
+struct CfbFile_t
+{
+	CfbEntry_array entries;
+};
+
+void CfbInit(CfbFile* cfb);
+int CfbRead(CfbFile* cfb, const char* path);
+int CfbWrite(CfbFile* cfb, const char* path);
+unsigned CfbFind(CfbFile* cfb, unsigned parent, const uint16_t* name,
+				 unsigned nameLen);
+unsigned CfbSetStream(CfbFile* cfb, unsigned parent, const uint16_t* name,
+					  unsigned nameLen, unsigned char* data, uint64_t size,
+					  const char* srcPath);
+void CfbDestroy(CfbFile* cfb);
+
+#endif /* not CFB_H */
@@ -22,6 +22,10 @@ See the file "UNLICENSE" in the top level directory for details.
 
 /* Define necessary types before including local headers.  */
 EA_TYPE(char);
+/* Most labels and item names fit into this many characters without
+   allocating memory.  */
+EA_SMALL_TYPE(char, 64);
+EA_DEFINE_SMALL_FUNCS(char);
 
 /* Local includes */
 #include "colon-parser.h"
@@ -40,13 +44,13 @@ int ParseLSRFile(FILE* fp, AddBodyClbk AddBody,
 	unsigned curLevel; /* current nesting level */
 	unsigned testLevel; /* test a new nesting level */
 	bool subLevel;
-	char_array colonLabel;
+	char_small_array colonLabel;
 
 	readChar = fgetc(fp);
 	curLevel = 0;
 	testLevel = 0;
 	subLevel = false;
-	EA_INIT(char, colonLabel, 16);
+	char_small_array_init(&colonLabel);
 
 	while (readChar != EOF)
 	{
@@ -56,11 +60,11 @@ int ParseLSRFile(FILE* fp, AddBodyClbk AddBody,
 		if (subLevel == false)
 		{
 			/* Read the label that is followed by a colon.  */
-			EA_APPEND(colonLabel, '\0');
+			char_small_array_append(&colonLabel, '\0');
 			while (readChar != EOF && (char)readChar != ':')
 			{
-				unsigned pos = colonLabel.len - 1;
-				EA_INSERT(colonLabel, pos, (char)readChar);
+				char_small_array_insert(&colonLabel, colonLabel.ea.len - 1,
+										(char)readChar);
 				readChar = fgetc(fp);
 			}
 			if (readChar == EOF)
@@ -75,7 +79,7 @@ int ParseLSRFile(FILE* fp, AddBodyClbk AddBody,
 		}
 
 		/* Data processing hook */
-		if (!AddBody(curLevel, &colonLabel))
+		if (!AddBody(curLevel, char_small_array_ea(&colonLabel)))
 			goto failure;
 
 		readChar = fgetc(fp); /* Read the newline.  */
@@ -91,7 +95,7 @@ int ParseLSRFile(FILE* fp, AddBodyClbk AddBody,
 		readChar = fgetc(fp);
 		while (readChar != EOF)
 		{
-			char_array itemName;
+			char_small_array itemName;
 			int result;
 
 			if ((char)readChar == '\n') /* double newline */
@@ -116,35 +120,35 @@ int ParseLSRFile(FILE* fp, AddBodyClbk AddBody,
 					goto failure;
 			}
 
-			EA_INIT(char, itemName, 16);
-			EA_APPEND(itemName, '\0');
+			char_small_array_init(&itemName);
+			char_small_array_append(&itemName, '\0');
 			while (readChar != EOF && (char)readChar != '\n' &&
 				(char)readChar != ':')
 			{
-				unsigned pos = itemName.len - 1;
-				EA_INSERT(itemName, pos, (char)readChar);
+				char_small_array_insert(&itemName, itemName.ea.len - 1,
+										(char)readChar);
 				readChar = fgetc(fp);
 			}
 			if (readChar == EOF)
 			{
-				xfree(itemName.d);
+				char_small_array_destroy(&itemName);
 				break;
 			}
 			if (readChar == ':')
 			{
 				/* A nested label was found.  */
 				/* Prepare for next loop.  */
-				EA_SET_SIZE(colonLabel, itemName.len);
-				strcpy(colonLabel.d, itemName.d);
+				char_small_array_set_size(&colonLabel, itemName.ea.len);
+				strcpy(colonLabel.ea.d, itemName.ea.d);
 				subLevel = true;
-				xfree(itemName.d);
+				char_small_array_destroy(&itemName);
 				break;
 			}
 
 			/* Data processing hook */
-			result = AddItem(&itemName);
+			result = AddItem(char_small_array_ea(&itemName));
 
-			xfree(itemName.d);
+			char_small_array_destroy(&itemName);
 			if (!result)
 				goto failure;
 			readChar = fgetc(fp);
@@ -152,17 +156,17 @@ int ParseLSRFile(FILE* fp, AddBodyClbk AddBody,
 
 		if (subLevel == true)
 			continue;
-		EA_SET_SIZE(colonLabel, 0);
+		char_small_array_set_size(&colonLabel, 0);
 		if (readChar == EOF)
 			break;
 		if ((char)readChar == '\n')
 			readChar = fgetc(fp);
 	}
 
-	xfree(colonLabel.d);
+	char_small_array_destroy(&colonLabel);
 	return 1;
 
 failure:
-	xfree(colonLabel.d);
+	char_small_array_destroy(&colonLabel);
 	return 0;
 }
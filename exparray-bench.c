@@ -0,0 +1,204 @@
+/* exparray-bench.c -- compare the exparray macros with the functions
+   that `EA_DEFINE_FUNCS()' generates.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* Each test runs the same loop once with the `EA_*' macros and once
+   with the `typename_array_*()' functions, and prints the time each
+   took.  The loops follow the ways `msi-tool' uses its arrays:
+   building names one character at a time as the colon parser does,
+   growing a table by whole rows, appending single values, and using
+   an array as a stack.  Build it with `make bench' and run it on an
+   otherwise idle machine; pass a number to repeat every test that
+   many times and keep the best time.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+
+typedef char* char_ptr;
+
+EA_TYPE(char);
+EA_TYPE(unsigned);
+EA_TYPE(char_ptr);
+EA_DEFINE_FUNCS(char);
+EA_DEFINE_FUNCS(unsigned);
+EA_DEFINE_FUNCS(char_ptr);
+
+#define NUM_NAMES 4000000
+#define NUM_ROWS 2000000
+#define ROW_COLS 8
+#define NUM_APPENDS 50000000
+#define NUM_PUSHES 100000000
+
+/* Keeps the compiler from dropping the loops.  */
+volatile unsigned sink;
+
+static const char* const names[4] = {
+	"libfoo-bar.so.1.2.3", "README", "some_longer_file_name_here.txt",
+	"x.h"
+};
+
+static double Now(void);
+static void BuildNames(bool useFuncs);
+static void GrowRows(bool useFuncs);
+static void AppendValues(bool useFuncs);
+static void PushPop(bool useFuncs);
+static void RunTest(const char* title, void (*test)(bool),
+					unsigned repeat);
+
+int main(int argc, char* argv[])
+{
+	unsigned repeat = 1;
+	if (argc > 1)
+		repeat = (unsigned)strtoul(argv[1], NULL, 10);
+	if (repeat == 0)
+		repeat = 1;
+	printf("%-32s %10s %10s\n", "Test", "Macros", "Functions");
+	RunTest("Build names by character", BuildNames, repeat);
+	RunTest("Grow a table by rows", GrowRows, repeat);
+	RunTest("Append values", AppendValues, repeat);
+	RunTest("Push and pop a stack", PushPop, repeat);
+	return 0;
+}
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build each name in front of its null character, the way the colon
+   parser builds labels.  */
+static void BuildNames(bool useFuncs)
+{
+	unsigned i, j;
+	for (i = 0; i < NUM_NAMES; i++)
+	{
+		const char* name = names[i&3];
+		char_array array;
+		if (useFuncs == false)
+		{
+			EA_INIT(char, array, 16);
+			EA_APPEND(array, '\0');
+			for (j = 0; name[j] != '\0'; j++)
+			{
+				unsigned pos = array.len - 1;
+				EA_INSERT(array, pos, name[j]);
+			}
+		}
+		else
+		{
+			char_array_init(&array, 16);
+			char_array_append(&array, '\0');
+			for (j = 0; name[j] != '\0'; j++)
+				char_array_insert(&array, array.len - 1, name[j]);
+		}
+		sink += array.len;
+		EA_DESTROY(array);
+	}
+}
+
+/* Grow a table by one row at a time and fill in its cells, the way
+   `msi-tool' adds table rows.  */
+static void GrowRows(bool useFuncs)
+{
+	char_ptr_array table;
+	unsigned i, j;
+	EA_INIT(char_ptr, table, 16);
+	for (i = 0; i < NUM_ROWS; i++)
+	{
+		unsigned row = table.len;
+		if (useFuncs == false)
+			EA_SET_SIZE(table, table.len + ROW_COLS);
+		else
+			char_ptr_array_set_size(&table, table.len + ROW_COLS);
+		for (j = 0; j < ROW_COLS; j++)
+			table.d[row+j] = (char*)names[j&3];
+	}
+	sink += table.len;
+	EA_DESTROY(table);
+}
+
+static void AppendValues(bool useFuncs)
+{
+	unsigned_array array;
+	unsigned i;
+	EA_INIT(unsigned, array, 16);
+	for (i = 0; i < NUM_APPENDS; i++)
+	{
+		if (useFuncs == false)
+			EA_APPEND(array, i);
+		else
+			unsigned_array_append(&array, i);
+	}
+	sink += array.d[array.len-1];
+	EA_DESTROY(array);
+}
+
+/* Push every value and pop two after every second one, so that the
+   stack stays small.  */
+static void PushPop(bool useFuncs)
+{
+	unsigned_array stack;
+	unsigned i;
+	EA_INIT(unsigned, stack, 16);
+	for (i = 0; i < NUM_PUSHES; i++)
+	{
+		if (useFuncs == false)
+		{
+			EA_APPEND(stack, i);
+			if ((i & 1) != 0)
+			{
+				EA_POP_BACK(stack);
+				EA_POP_BACK(stack);
+			}
+		}
+		else
+		{
+			unsigned_array_append(&stack, i);
+			if ((i & 1) != 0)
+			{
+				unsigned_array_pop(&stack);
+				unsigned_array_pop(&stack);
+			}
+		}
+	}
+	sink += stack.len;
+	EA_DESTROY(stack);
+}
+
+/* Run `test' with the macros and with the functions, `repeat' times
+   each, and print the best time of each.  */
+static void RunTest(const char* title, void (*test)(bool),
+					unsigned repeat)
+{
+	double best[2];
+	unsigned i, j;
+	for (j = 0; j < 2; j++)
+	{
+		best[j] = 0;
+		for (i = 0; i < repeat; i++)
+		{
+			double start = Now();
+			double elapsed;
+			test((j == 0) ? false : true);
+			elapsed = Now() - start;
+			if (i == 0 || elapsed < best[j])
+				best[j] = elapsed;
+		}
+	}
+	printf("%-32s %8.3f s %8.3f s\n", title, best[0], best[1]);
+}
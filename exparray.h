@@ -65,47 +65,96 @@ See the file "UNLICENSE" in the top level directory for details.
   allocated memory.  You can change this by defining
   `EA_LINEAR_REALLOC' or `EA_GARRAY_REALLOC'.
 
+* The exponential reallocators grow the allocation by a factor of
+  `EA_GROWTH_NUM' / `EA_GROWTH_DEN', which is 2 unless you define
+  both, for example to 3 and 2 so that huge arrays waste less space.
+  The sizes of arrays are `unsigned' unless you define `EA_SIZE_T',
+  which makes them `size_t'.  Either way, the sizes in bytes are
+  computed as `size_t', and growing an array beyond what either type
+  can hold calls `ea_overflow()', which prints an error and aborts
+  unless you define it to something else.  Every file that shares
+  arrays with another must be compiled with the same settings.
+
 * The rest of the functions are convenience functions that use the
   previously mentioned primitives.  See their individual documentation
   for more details.
 
 * There is a wrapper header available for you to use this
   implementation as a backend in place of the real GLib GArray
-  implementation.  */
+  implementation.
+
+* For arrays on a hot path, `EA_DEFINE_FUNCS(typename)' generates
+  static inline functions such as `typename_array_append()' that do
+  the same as the macros for one specific type.  They take a pointer
+  to the array, evaluate every argument once, and use the constant
+  element size of the type, so the compiler can inline them fully.
+  They can be mixed freely with the macros on the same array, but only
+  with the default exponential reallocators.
+
+* For short-lived arrays that are usually small, such as the names
+  read by a parser, `EA_SMALL_TYPE(typename, n)' defines
+  `typename_small_array', which has room for `n' elements inside the
+  structure and only allocates memory once it needs more.  Use it
+  through the functions generated by `EA_DEFINE_SMALL_FUNCS(typename)'
+  only.  Its first member is a `typename_array', so
+  `typename_small_array_ea()' can pass it to code that expects a
+  `typename_array*' and only reads from it.  */
 
 #ifndef EXPARRAY_H
 #define EXPARRAY_H
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifndef ea_malloc
 #include "xmalloc.h"
 #define ea_malloc  xmalloc
 #define ea_realloc xrealloc
-#define ea_free    free /* Don't need extra safety */
+#define ea_free    xfree
 #endif
 
 #define EA_STMT_START do
 #define EA_STMT_END while (0)
 
+#ifdef EA_SIZE_T
+typedef size_t ea_size_t;
+#else
+typedef unsigned ea_size_t;
+#endif
+#define EA_SIZE_MAX ((ea_size_t)-1)
+
+#ifndef EA_GROWTH_NUM
+#define EA_GROWTH_NUM 2
+#define EA_GROWTH_DEN 1
+#endif
+
+#ifndef ea_overflow
+#define ea_overflow()											\
+EA_STMT_START {													\
+	fputs("ERROR: Array size overflow.\n", stderr);				\
+	abort();													\
+} EA_STMT_END
+#endif
+
 #define EA_TYPE(typename)						\
 	struct typename##_array_tag					\
 	{											\
 		typename *d;							\
-		unsigned len;							\
-		unsigned tysize;						\
+		ea_size_t len;							\
+		ea_size_t tysize;						\
 		/* User-defined fields.  */				\
-		unsigned user1;							\
+		ea_size_t user1;						\
 	};											\
 	typedef struct typename##_array_tag typename##_array
 
 struct generic_array_tag
 {
 	char *d;
-	unsigned len;
-	unsigned tysize;
+	ea_size_t len;
+	ea_size_t tysize;
 	/* User-defined fields.  */
-	unsigned user1;
+	ea_size_t user1;
 };
 typedef struct generic_array_tag generic_array;
 
@@ -126,7 +175,7 @@ EA_STMT_START {													\
 	(array).len = 0;											\
 	(array).tysize = sizeof(typename);							\
 	(array).ea_len_alloc = reserve;								\
-	(array).d = (typename *)ea_malloc((array).tysize *			\
+	(array).d = (typename *)ea_malloc((size_t)(array).tysize *	\
 									  (array).ea_len_alloc);	\
 } EA_STMT_END
 
@@ -142,6 +191,57 @@ EA_STMT_START {										\
 	(array).user1 = 0;								\
 } EA_STMT_END
 
+#ifndef EA_INLINE
+#if defined(__GNUC__)
+#define EA_INLINE static __inline__
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define EA_INLINE static inline
+#else
+#define EA_INLINE static
+#endif
+#endif
+
+/* Returns the number of elements to allocate for an array that
+   needs room for `len' elements plus one, growing `alloc' by the
+   growth factor as often as needed.  Calls `ea_overflow()' if the
+   number of elements or of bytes does not fit.  */
+EA_INLINE ea_size_t ea_grow_alloc(ea_size_t alloc, ea_size_t len,
+								  size_t tysize)
+{
+	if (len == EA_SIZE_MAX)
+		ea_overflow();
+	if (alloc == 0)
+		alloc = 1;
+	while (len >= alloc)
+	{
+		ea_size_t grown;
+		if (alloc > EA_SIZE_MAX / EA_GROWTH_NUM)
+			grown = EA_SIZE_MAX;
+		else
+			grown = alloc * EA_GROWTH_NUM / EA_GROWTH_DEN;
+		if (grown <= alloc)
+			grown = alloc + 1;
+		alloc = grown;
+	}
+	if (tysize != 0 && alloc > (size_t)-1 / tysize)
+		ea_overflow();
+	return alloc;
+}
+
+/* Returns `alloc' shrunk by the growth factor as often as the result
+   still has room for more than `len' elements.  */
+EA_INLINE ea_size_t ea_shrink_alloc(ea_size_t alloc, ea_size_t len)
+{
+	while (alloc / EA_GROWTH_NUM * EA_GROWTH_DEN > len)
+	{
+		ea_size_t shrunk = alloc / EA_GROWTH_NUM * EA_GROWTH_DEN;
+		if (shrunk >= alloc)
+			break;
+		alloc = shrunk;
+	}
+	return alloc;
+}
+
 /* Reallocators:
 
    EA_GROW(array)
@@ -205,13 +305,13 @@ EA_STMT_START {														\
 EA_STMT_START {															\
 	generic_array *cpp_punk = (generic_array *)(&array);				\
 	if ((array).len % (array).ea_stride == 0)							\
-		cpp_punk->d = (char *)ea_realloc((array).d, (array).tysize *	\
+		cpp_punk->d = (char *)ea_realloc((array).d, (size_t)(array).tysize * \
 										 ((array).len + (array).ea_stride)); \
 } EA_STMT_END
 #define EA_NORMALIZE(array)												\
 EA_STMT_START {															\
 	generic_array *cpp_punk = (generic_array *)(&array);				\
-	cpp_punk->d = (char *)ea_realloc((array).d, (array).tysize *		\
+	cpp_punk->d = (char *)ea_realloc((array).d, (size_t)(array).tysize * \
 	   ((array).len + ((array).ea_stride - (array).len % (array).ea_stride))); \
 } EA_STMT_END
 /* END EA_LINEAR_REALLOC */
@@ -223,22 +323,20 @@ EA_STMT_START {									\
 	if ((array).len >= (array).ea_len_alloc)	\
 	{											\
 		generic_array *cpp_punk = (generic_array *)(&array);			\
-		(array).ea_len_alloc <<= 1;										\
-		cpp_punk->d = (char *)ea_realloc((array).d, (array).tysize *	\
+		(array).ea_len_alloc = ea_grow_alloc((array).ea_len_alloc,		\
+											 (array).len, (array).tysize); \
+		cpp_punk->d = (char *)ea_realloc((array).d, (size_t)(array).tysize * \
 										 (array).ea_len_alloc);			\
 	}																	\
 } EA_STMT_END
 #define EA_NORMALIZE(array)											\
 EA_STMT_START {														\
 	generic_array *cpp_punk = (generic_array *)(&array);			\
-	while ((array).ea_len_alloc > 0 &&								\
-		   (array).ea_len_alloc >= (array).len)						\
-		(array).ea_len_alloc >>= 1;									\
-	if ((array).ea_len_alloc == 0)									\
-		(array).ea_len_alloc = 1;									\
-	while ((array).len >= (array).ea_len_alloc)						\
-		(array).ea_len_alloc <<= 1;									\
-	cpp_punk->d = (char *)ea_realloc((array).d, (array).tysize *	\
+	(array).ea_len_alloc = ea_shrink_alloc((array).ea_len_alloc,	\
+										   (array).len);			\
+	(array).ea_len_alloc = ea_grow_alloc((array).ea_len_alloc,		\
+										 (array).len, (array).tysize); \
+	cpp_punk->d = (char *)ea_realloc((array).d, (size_t)(array).tysize * \
 									 (array).ea_len_alloc);			\
 } EA_STMT_END
 #endif /* END reallocators */
@@ -318,7 +416,7 @@ EA_STMT_START {															\
    `element'     the value of the item to append */
 #define EA_INSERT(array, pos, element)									\
 EA_STMT_START {															\
-	unsigned sos = pos; /* avoid macro evaluation problems */			\
+	ea_size_t sos = pos; /* avoid macro evaluation problems */			\
 	EA_INS(array, sos);													\
 	EA_SR(array, sos) = element;										\
 } EA_STMT_END
@@ -334,10 +432,11 @@ EA_STMT_START {															\
 EA_STMT_START {															\
 	if (data != NULL)													\
 	{																	\
-		unsigned pos = (array).len;										\
+		ea_size_t pos = (array).len;									\
 		(array).len += num_data;										\
 		EA_NORMALIZE(array);											\
-		memcpy(&EA_SR(array, pos), data, (array).tysize * num_data);	\
+		memcpy(&EA_SR(array, pos), data,								\
+			   (size_t)(array).tysize * (num_data));					\
 	}																	\
 } EA_STMT_END
 
@@ -354,12 +453,15 @@ EA_STMT_START {															\
 EA_STMT_START {															\
 	if (data != NULL)													\
 	{																	\
-		unsigned sos = pos; /* avoid macro evaluation problems */		\
+		ea_size_t sos = pos; /* avoid macro evaluation problems */		\
+		/* The elements from `sos' to the old end move back.  */		\
+		ea_size_t num_moved = (array).len - sos;						\
 		(array).len += num_data;										\
 		EA_NORMALIZE(array);											\
-		memmove(&EA_SR(array, sos+num_data), &EA_SR(array, sos),		\
-				(array).tysize * ((array).len - sos));					\
-		memcpy(&EA_SR(array, sos), data, (array).tysize * num_data);	\
+		memmove(&EA_SR(array, sos+(num_data)), &EA_SR(array, sos),		\
+				(size_t)(array).tysize * num_moved);					\
+		memcpy(&EA_SR(array, sos), data,								\
+			   (size_t)(array).tysize * (num_data));					\
 	}																	\
 } EA_STMT_END
 
@@ -511,4 +613,177 @@ EA_STMT_START {										\
    whether the length is zero.  */
 #define EA_EMPTY(array) ((array).len == 0)
 
+/*********************************************************************
+   Type-specialized functions.  */
+
+#if !defined(EA_GARRAY_REALLOC) && !EA_LINEAR_REALLOC
+/* Define static inline functions for arrays of `typename', after
+   `EA_TYPE(typename)'.  Each function does the same as the macro of
+   the similar name:
+
+   `typename_array_init(array, reserve)'        `EA_INIT()'
+   `typename_array_destroy(array)'              `EA_DESTROY()'
+   `typename_array_reserve(array, size)'        make room for `size'
+                                                elements
+   `typename_array_set_size(array, size)'       `EA_SET_SIZE()'
+   `typename_array_append(array, element)'      `EA_APPEND()'
+   `typename_array_insert(array, pos, element)' `EA_INSERT()'
+   `typename_array_remove(array, pos)'          `EA_REMOVE()'
+   `typename_array_pop(array)'                  `EA_POP_BACK()', which
+                                                also returns the
+                                                element
+
+   `array' is a pointer to the array.  Unlike `EA_SET_SIZE()',
+   `typename_array_set_size()' only reallocates when the array grows
+   beyond its allocated space, and never shrinks it.  */
+#define EA_DEFINE_FUNCS(typename)										\
+EA_INLINE void typename##_array_init(typename##_array *array,			\
+									 ea_size_t reserve)					\
+{																		\
+	array->len = 0;														\
+	array->tysize = sizeof(typename);									\
+	array->ea_len_alloc = reserve;										\
+	array->d = (typename *)ea_malloc(sizeof(typename) * (size_t)reserve); \
+}																		\
+EA_INLINE void typename##_array_destroy(typename##_array *array)		\
+{																		\
+	if (array->d != NULL)												\
+		ea_free(array->d);												\
+	array->d = NULL;													\
+	array->len = 0;														\
+	array->tysize = 0;													\
+	array->user1 = 0;													\
+}																		\
+EA_INLINE void typename##_array_reserve(typename##_array *array,		\
+										ea_size_t size)					\
+{																		\
+	/* Keep room for one element beyond the size, as `EA_GROW()'		\
+	   does.  */														\
+	if (size >= array->ea_len_alloc)									\
+	{																	\
+		array->ea_len_alloc = ea_grow_alloc(array->ea_len_alloc, size,	\
+											sizeof(typename));			\
+		array->d = (typename *)ea_realloc(array->d, sizeof(typename) *	\
+										  array->ea_len_alloc);			\
+	}																	\
+}																		\
+EA_INLINE void typename##_array_set_size(typename##_array *array,		\
+										 ea_size_t size)				\
+{																		\
+	typename##_array_reserve(array, size);								\
+	array->len = size;													\
+}																		\
+EA_INLINE void typename##_array_append(typename##_array *array,			\
+									   typename element)				\
+{																		\
+	typename##_array_reserve(array, array->len + 1);					\
+	array->d[array->len++] = element;									\
+}																		\
+EA_INLINE void typename##_array_insert(typename##_array *array,			\
+									   ea_size_t pos, typename element)	\
+{																		\
+	typename##_array_reserve(array, array->len + 1);					\
+	memmove(&array->d[pos+1], &array->d[pos],							\
+			sizeof(typename) * (array->len - pos));						\
+	array->d[pos] = element;											\
+	array->len++;														\
+}																		\
+EA_INLINE void typename##_array_remove(typename##_array *array,			\
+									   ea_size_t pos)					\
+{																		\
+	memmove(&array->d[pos], &array->d[pos+1],							\
+			sizeof(typename) * (array->len - (pos + 1)));				\
+	array->len--;														\
+}																		\
+EA_INLINE typename typename##_array_pop(typename##_array *array)		\
+{																		\
+	return array->d[--array->len];										\
+}																		\
+typedef int typename##_array_funcs_defined
+
+/* Define `typename_small_array', an array with room for `n' elements
+   inside the structure, after `EA_TYPE(typename)'.  `ea' is a real
+   `typename_array' whose `d' points to `buf' until the elements no
+   longer fit.  */
+#define EA_SMALL_TYPE(typename, n)					\
+	struct typename##_small_array_tag				\
+	{												\
+		typename##_array ea;						\
+		/* The elements while they fit */			\
+		typename buf[n];							\
+	};												\
+	typedef struct typename##_small_array_tag typename##_small_array
+
+/* Define static inline functions for `typename_small_array', after
+   `EA_SMALL_TYPE(typename, n)'.  They work like those of
+   `EA_DEFINE_FUNCS()', except that `typename_small_array_init()'
+   takes no reserve, since the array starts out in its own buffer, and
+   `typename_small_array_ea()' returns its `ea' member.  The functions
+   that move the elements out of the buffer copy them to allocated
+   memory at twice the size of the buffer.  */
+#define EA_DEFINE_SMALL_FUNCS(typename)									\
+EA_INLINE void typename##_small_array_init(typename##_small_array *array) \
+{																		\
+	array->ea.d = array->buf;											\
+	array->ea.len = 0;													\
+	array->ea.tysize = sizeof(typename);								\
+	array->ea.ea_len_alloc = sizeof(array->buf) / sizeof(typename);		\
+}																		\
+EA_INLINE void typename##_small_array_destroy(typename##_small_array *array) \
+{																		\
+	if (array->ea.d != array->buf)										\
+		ea_free(array->ea.d);											\
+	array->ea.d = array->buf;											\
+	array->ea.len = 0;													\
+	array->ea.ea_len_alloc = sizeof(array->buf) / sizeof(typename);		\
+}																		\
+EA_INLINE void typename##_small_array_reserve(typename##_small_array *array, \
+											  ea_size_t size)			\
+{																		\
+	typename##_array *ea = &array->ea;									\
+	if (size >= ea->ea_len_alloc)										\
+	{																	\
+		ea->ea_len_alloc = ea_grow_alloc(ea->ea_len_alloc, size,		\
+										 sizeof(typename));				\
+		if (ea->d == array->buf)										\
+		{																\
+			ea->d = (typename *)ea_malloc(sizeof(typename) *			\
+										  ea->ea_len_alloc);			\
+			memcpy(ea->d, array->buf, sizeof(typename) * ea->len);		\
+		}																\
+		else															\
+		{																\
+			ea->d = (typename *)ea_realloc(ea->d, sizeof(typename) *	\
+										   ea->ea_len_alloc);			\
+		}																\
+	}																	\
+}																		\
+EA_INLINE void typename##_small_array_set_size(typename##_small_array *array, \
+											   ea_size_t size)			\
+{																		\
+	typename##_small_array_reserve(array, size);						\
+	array->ea.len = size;												\
+}																		\
+EA_INLINE void typename##_small_array_append(typename##_small_array *array, \
+											 typename element)			\
+{																		\
+	typename##_small_array_reserve(array, array->ea.len + 1);			\
+	array->ea.d[array->ea.len++] = element;								\
+}																		\
+EA_INLINE void typename##_small_array_insert(typename##_small_array *array, \
+											 ea_size_t pos, typename element) \
+{																		\
+	typename##_small_array_reserve(array, array->ea.len + 1);			\
+	memmove(&array->ea.d[pos+1], &array->ea.d[pos],						\
+			sizeof(typename) * (array->ea.len - pos));					\
+	array->ea.d[pos] = element;											\
+	array->ea.len++;													\
+}																		\
+EA_INLINE typename##_array *typename##_small_array_ea(typename##_small_array *array) \
+{																		\
+	return &array->ea;													\
+}																		\
+typedef int typename##_small_array_funcs_defined
+#endif /* not EA_GARRAY_REALLOC, not EA_LINEAR_REALLOC */
+
 #endif /* not EXPARRAY_H */
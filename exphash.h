@@ -0,0 +1,389 @@
+/* exphash.h -- open-addressing hash maps and sets to go with
+   exparray.h.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* How to use exphash:
+
+* Like exparray, exphash generates code for specific types with
+  macros.  Call `EH_MAP_TYPE(name, keytype, valtype)' to define a map
+  type called `name', and then
+  `EH_DEFINE_MAP_FUNCS(name, keytype, valtype, hash, equal)' to define
+  its functions.  `hash(key)' must return an `unsigned' hash of a key,
+  and `equal(key1, key2)' must return nonzero if two keys are equal.
+  `EH_SET_TYPE(name, keytype)' and
+  `EH_DEFINE_SET_FUNCS(name, keytype, hash, equal)' do the same for a
+  set, which has no values.
+
+* The functions of a map `name' are:
+
+  `name_init(map)'               start out empty without allocating
+  `name_destroy(map)'            free the memory of the map
+  `name_find(map, key)'          returns a pointer to the value of
+                                 `key', or NULL if it is not there
+  `name_insert(map, key, value)' returns a pointer to the value of
+                                 `key', adding it with `value' first if
+                                 it is not there yet
+  `name_remove(map, key)'        returns nonzero if `key' was there
+
+  A set has `name_init()', `name_destroy()' and `name_remove()' too,
+  and `name_contains(set, key)' and `name_add(set, key)', which
+  returns nonzero if `key' was not in the set yet.  `map' and `set'
+  are pointers.  Pointers returned by the functions are only valid
+  until the next change of the map.  The keys are copied into the
+  map as they are, so a key that points to other memory, such as a
+  string, must stay valid for as long as it is in the map.
+
+* `eh_strview' is a key type for strings that are not necessarily
+  null-terminated, such as a part of a path, with the hash and equal
+  functions `eh_strview_hash()' and `eh_strview_equal()'.
+  `eh_unsigned_hash()' and `eh_unsigned_equal()' are there for
+  `unsigned' keys.
+
+* The table is split into groups of `EH_GROUP' slots, and every slot
+  has a control byte that is either `EH_EMPTY', `EH_DELETED', or seven
+  bits of the hash of its key.  A lookup goes through the groups
+  starting at the one selected by the low bits of the hash, compares
+  the control bytes of a whole group with the hash bits at once, and
+  only compares the keys of the slots that match.  It stops at the
+  first group that has an empty slot.  With SSE2, a group is compared
+  in a few instructions.  The table is kept at most 7/8 full.  Slot
+  `i' holds a key if `EH_FULL(map, i)'.
+
+* The memory is allocated with `ea_malloc' and freed with `ea_free',
+  like that of exparrays.  */
+
+#ifndef EXPHASH_H
+#define EXPHASH_H
+
+#include <string.h>
+
+#include "exparray.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define EH_SSE2 1
+#endif
+
+/* The number of slots in a group.  */
+#define EH_GROUP 16
+#define EH_EMPTY ((unsigned char)0x80)
+#define EH_DELETED ((unsigned char)0xfe)
+
+/* The number of slots of a map or set.  */
+#define EH_CAPACITY(map) ((map)->num_groups * EH_GROUP)
+#define EH_FULL(map, i) ((map)->ctrl[i] < 0x80)
+
+/* Returns a mask with a bit set for every slot of the group at `ctrl'
+   whose control byte is `tag'.  */
+EA_INLINE unsigned eh_match_tag(const unsigned char *ctrl, unsigned char tag)
+{
+#ifdef EH_SSE2
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (unsigned)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+	unsigned mask = 0;
+	unsigned i;
+	for (i = 0; i < EH_GROUP; i++)
+	{
+		if (ctrl[i] == tag)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/* Returns a mask with a bit set for every empty or deleted slot of the
+   group at `ctrl'.  */
+EA_INLINE unsigned eh_match_free(const unsigned char *ctrl)
+{
+#ifdef EH_SSE2
+	return (unsigned)_mm_movemask_epi8(
+		_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	unsigned mask = 0;
+	unsigned i;
+	for (i = 0; i < EH_GROUP; i++)
+	{
+		if (ctrl[i] & 0x80)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/* Returns the index of the lowest bit set in `mask', which must not be
+   zero.  */
+EA_INLINE unsigned eh_lowest_bit(unsigned mask)
+{
+#if defined(__GNUC__)
+	return (unsigned)__builtin_ctz(mask);
+#else
+	unsigned i = 0;
+	while ((mask & 1) == 0)
+	{
+		mask >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+/* Mix the bits of a hash, so that both its low bits, which select the
+   group, and its high bits, which go into the control byte, depend on
+   all of the key.  */
+EA_INLINE unsigned eh_mix(unsigned hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x7feb352du;
+	hash ^= hash >> 15;
+	hash *= 0x846ca68bu;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+typedef struct eh_strview_tag eh_strview;
+struct eh_strview_tag
+{
+	const char *d;
+	ea_size_t len;
+};
+
+EA_INLINE eh_strview eh_strview_make(const char *d, ea_size_t len)
+{
+	eh_strview view;
+	view.d = d;
+	view.len = len;
+	return view;
+}
+
+EA_INLINE eh_strview eh_strview_cstr(const char *str)
+{
+	return eh_strview_make(str, strlen(str));
+}
+
+EA_INLINE unsigned eh_strview_hash(eh_strview key)
+{
+	/* FNV-1a */
+	unsigned hash = 2166136261u;
+	ea_size_t i;
+	for (i = 0; i < key.len; i++)
+	{
+		hash ^= (unsigned char)key.d[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+EA_INLINE int eh_strview_equal(eh_strview key1, eh_strview key2)
+{
+	return key1.len == key2.len && memcmp(key1.d, key2.d, key1.len) == 0;
+}
+
+EA_INLINE unsigned eh_unsigned_hash(unsigned key)
+{
+	return key;
+}
+
+EA_INLINE int eh_unsigned_equal(unsigned key1, unsigned key2)
+{
+	return key1 == key2;
+}
+
+#define EH_MAP_TYPE(name, keytype, valtype)				\
+	struct name##_tag									\
+	{													\
+		unsigned char *ctrl;							\
+		keytype *keys;									\
+		valtype *vals;									\
+		/* The number of keys */						\
+		ea_size_t len;									\
+		/* The number of slots that are not empty */	\
+		ea_size_t num_used;								\
+		/* A power of two, or zero before the first	\
+		   insertion */									\
+		ea_size_t num_groups;							\
+	};													\
+	typedef struct name##_tag name
+
+/* A set is a map whose `vals' are never allocated.  */
+#define EH_SET_TYPE(name, keytype) \
+	EH_MAP_TYPE(name, keytype, char)
+
+/* Define the functions that maps and sets share.  `name_slot()'
+   returns the slot of `key' or (ea_size_t)-1, and `name_claim()'
+   returns the slot for a new key after making room for it.  */
+#define EH_DEFINE_CORE_FUNCS(name, keytype, valtype, hash, equal, has_vals) \
+EA_INLINE void name##_init(name *map)									\
+{																		\
+	map->ctrl = NULL;													\
+	map->keys = NULL;													\
+	map->vals = NULL;													\
+	map->len = 0;														\
+	map->num_used = 0;													\
+	map->num_groups = 0;												\
+}																		\
+EA_INLINE void name##_destroy(name *map)								\
+{																		\
+	if (map->num_groups > 0)											\
+	{																	\
+		ea_free(map->ctrl);												\
+		ea_free(map->keys);												\
+		if (has_vals)													\
+			ea_free(map->vals);											\
+	}																	\
+	name##_init(map);													\
+}																		\
+EA_INLINE ea_size_t name##_slot(const name *map, keytype key)			\
+{																		\
+	unsigned h;															\
+	ea_size_t group;													\
+	ea_size_t step;														\
+	unsigned char tag;													\
+	if (map->num_groups == 0)											\
+		return (ea_size_t)-1;											\
+	h = eh_mix(hash(key));												\
+	tag = (unsigned char)(h >> 25);										\
+	group = h & (map->num_groups - 1);									\
+	for (step = 1; step <= map->num_groups; step++)						\
+	{																	\
+		const unsigned char *ctrl = &map->ctrl[group*EH_GROUP];			\
+		unsigned match = eh_match_tag(ctrl, tag);						\
+		while (match != 0)												\
+		{																\
+			ea_size_t slot = group * EH_GROUP + eh_lowest_bit(match);	\
+			if (equal(map->keys[slot], key))							\
+				return slot;											\
+			match &= match - 1;											\
+		}																\
+		if (eh_match_tag(ctrl, EH_EMPTY) != 0)							\
+			break;														\
+		group = (group + step) & (map->num_groups - 1);					\
+	}																	\
+	return (ea_size_t)-1;												\
+}																		\
+EA_INLINE void name##_rehash(name *map, ea_size_t num_groups)			\
+{																		\
+	name old = *map;													\
+	ea_size_t i;														\
+	map->num_groups = num_groups;										\
+	map->ctrl = (unsigned char *)ea_malloc(num_groups * EH_GROUP);		\
+	memset(map->ctrl, EH_EMPTY, num_groups * EH_GROUP);					\
+	map->keys = (keytype *)ea_malloc(sizeof(keytype) *					\
+									 (size_t)num_groups * EH_GROUP);	\
+	if (has_vals)														\
+	{																	\
+		map->vals = (valtype *)ea_malloc(sizeof(valtype) *				\
+										 (size_t)num_groups * EH_GROUP); \
+	}																	\
+	map->num_used = map->len;											\
+	for (i = 0; i < EH_CAPACITY(&old); i++)								\
+	{																	\
+		unsigned h;														\
+		ea_size_t group;												\
+		ea_size_t step = 1;												\
+		unsigned free_mask;												\
+		ea_size_t slot;													\
+		if (!EH_FULL(&old, i))											\
+			continue;													\
+		h = eh_mix(hash(old.keys[i]));									\
+		group = h & (num_groups - 1);									\
+		while ((free_mask = eh_match_free(&map->ctrl[group*EH_GROUP])) == 0) \
+			group = (group + step++) & (num_groups - 1);				\
+		slot = group * EH_GROUP + eh_lowest_bit(free_mask);				\
+		map->ctrl[slot] = (unsigned char)(h >> 25);						\
+		map->keys[slot] = old.keys[i];									\
+		if (has_vals)													\
+			map->vals[slot] = old.vals[i];								\
+	}																	\
+	if (old.num_groups > 0)												\
+	{																	\
+		ea_free(old.ctrl);												\
+		ea_free(old.keys);												\
+		if (has_vals)													\
+			ea_free(old.vals);											\
+	}																	\
+}																		\
+EA_INLINE ea_size_t name##_claim(name *map, keytype key)				\
+{																		\
+	unsigned h;															\
+	ea_size_t group;													\
+	ea_size_t step = 1;													\
+	unsigned free_mask;													\
+	ea_size_t slot;														\
+	if ((map->num_used + 1) * 8 > EH_CAPACITY(map) * 7)					\
+	{																	\
+		/* Leave the new table at most 7/16 full, so that it lasts a	\
+		   while.  Many deleted slots just get cleaned up.  */			\
+		ea_size_t num_groups = 1;										\
+		while ((map->len + 1) * 16 > num_groups * EH_GROUP * 7)			\
+		{																\
+			if (num_groups > EA_SIZE_MAX / (2 * EH_GROUP))				\
+				ea_overflow();											\
+			num_groups <<= 1;											\
+		}																\
+		name##_rehash(map, num_groups);									\
+	}																	\
+	h = eh_mix(hash(key));												\
+	group = h & (map->num_groups - 1);									\
+	while ((free_mask = eh_match_free(&map->ctrl[group*EH_GROUP])) == 0) \
+		group = (group + step++) & (map->num_groups - 1);				\
+	slot = group * EH_GROUP + eh_lowest_bit(free_mask);					\
+	if (map->ctrl[slot] == EH_EMPTY)									\
+		map->num_used++;												\
+	map->ctrl[slot] = (unsigned char)(h >> 25);							\
+	map->keys[slot] = key;												\
+	map->len++;															\
+	return slot;														\
+}																		\
+EA_INLINE int name##_remove(name *map, keytype key)					\
+{																		\
+	ea_size_t slot = name##_slot(map, key);								\
+	if (slot == (ea_size_t)-1)											\
+		return 0;														\
+	map->ctrl[slot] = EH_DELETED;										\
+	map->len--;															\
+	return 1;															\
+}																		\
+typedef int name##_core_funcs_defined
+
+#define EH_DEFINE_MAP_FUNCS(name, keytype, valtype, hash, equal)		\
+EH_DEFINE_CORE_FUNCS(name, keytype, valtype, hash, equal, 1);			\
+EA_INLINE valtype *name##_find(const name *map, keytype key)			\
+{																		\
+	ea_size_t slot = name##_slot(map, key);								\
+	return (slot != (ea_size_t)-1) ? &map->vals[slot] : NULL;			\
+}																		\
+EA_INLINE valtype *name##_insert(name *map, keytype key, valtype value) \
+{																		\
+	ea_size_t slot = name##_slot(map, key);								\
+	if (slot == (ea_size_t)-1)											\
+	{																	\
+		slot = name##_claim(map, key);									\
+		map->vals[slot] = value;										\
+	}																	\
+	return &map->vals[slot];											\
+}																		\
+typedef int name##_map_funcs_defined
+
+#define EH_DEFINE_SET_FUNCS(name, keytype, hash, equal)					\
+EH_DEFINE_CORE_FUNCS(name, keytype, char, hash, equal, 0);				\
+EA_INLINE int name##_contains(const name *set, keytype key)			\
+{																		\
+	return name##_slot(set, key) != (ea_size_t)-1;						\
+}																		\
+EA_INLINE int name##_add(name *set, keytype key)						\
+{																		\
+	if (name##_slot(set, key) != (ea_size_t)-1)							\
+		return 0;														\
+	name##_claim(set, key);												\
+	return 1;															\
+}																		\
+typedef int name##_set_funcs_defined
+
+#endif /* not EXPHASH_H */
@@ -0,0 +1,410 @@
+/* file-hash.c -- compute MD5 hashes of many files in parallel, with a
+   persistent cache of previously computed hashes.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* Files are hashed on the shared thread pool.  Each worker keeps
+   `MD5_LANES' files open at a time, one per lane of the multi-buffer
+   MD5 kernel, and refills a lane with the next pending file as soon
+   as its current file is finished.  While all lanes are busy, whole
+   blocks are fed to `Md5x4Blocks()'; once the queue of pending files
+   runs dry, the remaining lanes are finished one at a time.
+
+   The cache file records the hash of every file that was ever hashed
+   with it, keyed by device, inode, modification time and size.  Files
+   whose key is found in the cache are never read again.  The
+   modification time includes nanoseconds, since build outputs are
+   often rewritten within the same second at the same size.  The first
+   line of the file names its format, and a file in any other format is
+   ignored, so that older caches keyed by whole seconds are never
+   matched.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "thread-pool.h"
+#include "file-hash.h"
+
+/* Amount of file data read into a lane at once.  */
+#define LANE_CHUNK (64 * 1024)
+
+/* The first line of the cache file.  */
+#define HASH_CACHE_FORMAT "msi-tool hash cache 2"
+
+typedef struct HashKey_t HashKey;
+typedef struct HashCacheEntry_t HashCacheEntry;
+typedef struct HashJob_t HashJob;
+typedef struct HashLane_t HashLane;
+
+struct HashKey_t
+{
+	unsigned long long dev;
+	unsigned long long ino;
+	long long mtime;
+	long mtimeNsec;
+	unsigned long long size;
+};
+
+struct HashCacheEntry_t
+{
+	HashKey key;
+	FileDigest digest;
+};
+
+EA_TYPE(unsigned);
+EA_TYPE(HashCacheEntry);
+
+/* State shared by all workers of one `HashFiles()' call.  */
+struct HashJob_t
+{
+	char** paths;
+	FileDigest* digests;
+	HashKey* keys;
+	bool* done;
+	HashCacheEntry_array cache;
+	unsigned_array pending;
+	unsigned nextPending;
+	/* Counted with atomic operations by the workers */
+	unsigned numFailed;
+};
+
+struct HashLane_t
+{
+	unsigned file; /* (unsigned)-1 if the lane is idle */
+	FILE* fp;
+	Md5Ctx ctx;
+	unsigned char* buf;
+	size_t pos;
+	size_t end;
+	bool eof;
+};
+
+/* Private Declarations */
+static int HashKey_cmp(const void* e1, const void* e2);
+static void LoadHashCache(const char* cacheName, HashCacheEntry_array* cache);
+static void SaveHashCache(const char* cacheName, HashJob* job,
+						  unsigned count);
+static void StatWorker(void* data, unsigned index);
+static void HashWorker(void* data, unsigned index);
+static bool FillLane(HashJob* job, HashLane* lane);
+static void FinishLane(HashJob* job, HashLane* lane);
+
+/* Compute the MD5 digest of each of the `count' files named in
+   `paths', storing them into `digests'.  If `cacheName' is not NULL,
+   it names a cache file that is consulted before hashing and
+   rewritten afterwards.  Returns nonzero on success, zero if any file
+   could not be read.  */
+int HashFiles(const char* cacheName, char** paths, unsigned count,
+			  FileDigest* digests)
+{
+	HashJob job;
+	unsigned i;
+
+	job.paths = paths;
+	job.digests = digests;
+	job.keys = (HashKey*)xmalloc(sizeof(HashKey) * count);
+	job.done = (bool*)xmalloc(sizeof(bool) * count);
+	EA_INIT(HashCacheEntry, job.cache, 16);
+	EA_INIT(unsigned, job.pending, 16);
+	job.nextPending = 0;
+	job.numFailed = 0;
+
+	if (cacheName != NULL)
+		LoadHashCache(cacheName, &job.cache);
+	ParallelFor(count, StatWorker, &job);
+	for (i = 0; i < count; i++)
+	{
+		if (job.done[i] == false)
+			EA_APPEND(job.pending, i);
+	}
+	ParallelFor(ThreadPoolSize(), HashWorker, &job);
+	if (cacheName != NULL)
+		SaveHashCache(cacheName, &job, count);
+
+	xfree(job.keys);
+	xfree(job.done);
+	EA_DESTROY(job.cache);
+	EA_DESTROY(job.pending);
+	return (job.numFailed > 0) ? 0 : 1;
+}
+
+static int HashKey_cmp(const void* e1, const void* e2)
+{
+	const HashKey* k1 = (const HashKey*)e1;
+	const HashKey* k2 = (const HashKey*)e2;
+	if (k1->dev != k2->dev)
+		return (k1->dev < k2->dev) ? -1 : 1;
+	if (k1->ino != k2->ino)
+		return (k1->ino < k2->ino) ? -1 : 1;
+	if (k1->mtime != k2->mtime)
+		return (k1->mtime < k2->mtime) ? -1 : 1;
+	if (k1->mtimeNsec != k2->mtimeNsec)
+		return (k1->mtimeNsec < k2->mtimeNsec) ? -1 : 1;
+	if (k1->size != k2->size)
+		return (k1->size < k2->size) ? -1 : 1;
+	return 0;
+}
+
+/* Read the cache file into `cache' and sort it by key.  A missing
+   cache file, or one in another format, is not an error.  */
+static void LoadHashCache(const char* cacheName, HashCacheEntry_array* cache)
+{
+	FILE* fp;
+	HashCacheEntry entry;
+	char hex[2*MD5_DIGEST_SIZE+1];
+	char format[sizeof(HASH_CACHE_FORMAT)+1];
+	fp = fopen(cacheName, "r");
+	if (fp == NULL)
+		return;
+	if (fgets(format, sizeof(format), fp) == NULL ||
+		strcmp(format, HASH_CACHE_FORMAT "\n") != 0)
+	{
+		fclose(fp);
+		return;
+	}
+	while (fscanf(fp, "%llu %llu %lld %ld %llu %32s", &entry.key.dev,
+				  &entry.key.ino, &entry.key.mtime, &entry.key.mtimeNsec,
+				  &entry.key.size, hex) == 6)
+	{
+		unsigned i;
+		if (strlen(hex) != 2 * MD5_DIGEST_SIZE)
+			continue;
+		for (i = 0; i < MD5_DIGEST_SIZE; i++)
+		{
+			unsigned byte;
+			sscanf(&hex[i*2], "%2x", &byte);
+			entry.digest[i] = (unsigned char)byte;
+		}
+		EA_APPEND_MULT(*cache, &entry, 1);
+	}
+	fclose(fp);
+	qsort(cache->d, cache->len, sizeof(HashCacheEntry), HashKey_cmp);
+}
+
+/* Rewrite the cache file with the keys and digests of all files that
+   were successfully hashed or found in the cache, followed by the
+   entries of the old cache that this call did not look up.  Other
+   calls share the same cache file, so their entries must be kept.  */
+static void SaveHashCache(const char* cacheName, HashJob* job,
+						  unsigned count)
+{
+	FILE* fp;
+	HashCacheEntry_array entries;
+	unsigned numFresh;
+	unsigned i;
+	fp = fopen(cacheName, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "WARNING: Could not write file: %s\n", cacheName);
+		return;
+	}
+	EA_INIT(HashCacheEntry, entries, 16);
+	for (i = 0; i < count; i++)
+	{
+		HashCacheEntry entry;
+		if (job->done[i] == false)
+			continue;
+		entry.key = job->keys[i];
+		memcpy(entry.digest, job->digests[i], MD5_DIGEST_SIZE);
+		EA_APPEND_MULT(entries, &entry, 1);
+	}
+	numFresh = entries.len;
+	qsort(entries.d, numFresh, sizeof(HashCacheEntry), HashKey_cmp);
+	for (i = 0; i < job->cache.len; i++)
+	{
+		if (numFresh == 0 ||
+			bsearch(&job->cache.d[i].key, entries.d, numFresh,
+					sizeof(HashCacheEntry), HashKey_cmp) == NULL)
+			EA_APPEND_MULT(entries, &job->cache.d[i], 1);
+	}
+	fputs(HASH_CACHE_FORMAT "\n", fp);
+	for (i = 0; i < entries.len; i++)
+	{
+		unsigned j;
+		fprintf(fp, "%llu %llu %lld %ld %llu ", entries.d[i].key.dev,
+				entries.d[i].key.ino, entries.d[i].key.mtime,
+				entries.d[i].key.mtimeNsec, entries.d[i].key.size);
+		for (j = 0; j < MD5_DIGEST_SIZE; j++)
+			fprintf(fp, "%02x", entries.d[i].digest[j]);
+		fputs("\n", fp);
+	}
+	fclose(fp);
+	EA_DESTROY(entries);
+}
+
+/* Fill in the cache key of a file and look it up in the cache.  */
+static void StatWorker(void* data, unsigned index)
+{
+	HashJob* job = (HashJob*)data;
+	struct stat st;
+	HashCacheEntry* hit;
+	job->done[index] = false;
+	if (stat(job->paths[index], &st) != 0)
+	{
+		memset(&job->keys[index], 0, sizeof(HashKey));
+		return;
+	}
+	job->keys[index].dev = (unsigned long long)st.st_dev;
+	job->keys[index].ino = (unsigned long long)st.st_ino;
+	job->keys[index].mtime = (long long)st.st_mtim.tv_sec;
+	job->keys[index].mtimeNsec = (long)st.st_mtim.tv_nsec;
+	job->keys[index].size = (unsigned long long)st.st_size;
+	if (job->cache.len == 0)
+		return;
+	hit = (HashCacheEntry*)bsearch(&job->keys[index], job->cache.d,
+								   job->cache.len, sizeof(HashCacheEntry),
+								   HashKey_cmp);
+	if (hit != NULL)
+	{
+		memcpy(job->digests[index], hit->digest, MD5_DIGEST_SIZE);
+		job->done[index] = true;
+	}
+}
+
+/* Hash pending files until none are left.  Every worker runs exactly
+   one instance of this function; `index' is unused.  */
+static void HashWorker(void* data, unsigned index)
+{
+	HashJob* job = (HashJob*)data;
+	HashLane lanes[MD5_LANES];
+	unsigned n;
+	(void)index;
+
+	for (n = 0; n < MD5_LANES; n++)
+	{
+		lanes[n].file = (unsigned)-1;
+		lanes[n].buf = (unsigned char*)xmalloc(LANE_CHUNK);
+	}
+
+	while (true)
+	{
+		unsigned active = 0;
+		size_t minBlocks = (size_t)-1;
+
+		/* Make sure every lane has a file and at least one block
+		   of data, unless the file is at its end.  */
+		for (n = 0; n < MD5_LANES; n++)
+		{
+			if (FillLane(job, &lanes[n]) == false)
+				continue;
+			active++;
+			if ((lanes[n].end - lanes[n].pos) / MD5_BLOCK_SIZE < minBlocks)
+				minBlocks = (lanes[n].end - lanes[n].pos) / MD5_BLOCK_SIZE;
+		}
+		if (active == 0)
+			break;
+
+		if (active == MD5_LANES)
+		{
+			/* All lanes are busy: hash in lockstep.  */
+			if (minBlocks > 0)
+			{
+				Md5Ctx* ctx[MD5_LANES];
+				const unsigned char* blocks[MD5_LANES];
+				for (n = 0; n < MD5_LANES; n++)
+				{
+					ctx[n] = &lanes[n].ctx;
+					blocks[n] = lanes[n].buf + lanes[n].pos;
+					lanes[n].pos += minBlocks * MD5_BLOCK_SIZE;
+				}
+				Md5x4Blocks(ctx, blocks, minBlocks);
+			}
+		}
+		else
+		{
+			/* The queue is drained: finish the stragglers.  */
+			for (n = 0; n < MD5_LANES; n++)
+			{
+				size_t numBlocks;
+				if (lanes[n].file == (unsigned)-1)
+					continue;
+				numBlocks = (lanes[n].end - lanes[n].pos) / MD5_BLOCK_SIZE;
+				Md5Blocks(&lanes[n].ctx, lanes[n].buf + lanes[n].pos,
+						  numBlocks);
+				lanes[n].pos += numBlocks * MD5_BLOCK_SIZE;
+			}
+		}
+
+		for (n = 0; n < MD5_LANES; n++)
+		{
+			if (lanes[n].file != (unsigned)-1 && lanes[n].eof == true &&
+				lanes[n].end - lanes[n].pos < MD5_BLOCK_SIZE)
+				FinishLane(job, &lanes[n]);
+		}
+	}
+
+	for (n = 0; n < MD5_LANES; n++)
+		xfree(lanes[n].buf);
+}
+
+/* Give an idle lane a new file and make sure a busy lane has at least
+   one whole block buffered or has reached the end of its file.
+   Returns false if the lane is idle and no files are left.  */
+static bool FillLane(HashJob* job, HashLane* lane)
+{
+	size_t rest;
+	size_t numRead;
+	while (lane->file == (unsigned)-1)
+	{
+		unsigned next = __sync_fetch_and_add(&job->nextPending, 1);
+		if (next >= job->pending.len)
+			return false;
+		lane->file = job->pending.d[next];
+		lane->fp = fopen(job->paths[lane->file], "rb");
+		if (lane->fp == NULL)
+		{
+			fprintf(stderr, "ERROR: Could not open file: %s\n",
+					job->paths[lane->file]);
+			__sync_fetch_and_add(&job->numFailed, 1);
+			lane->file = (unsigned)-1;
+			continue;
+		}
+		Md5Init(&lane->ctx);
+		lane->pos = 0;
+		lane->end = 0;
+		lane->eof = false;
+	}
+
+	rest = lane->end - lane->pos;
+	if (lane->eof == true || rest >= MD5_BLOCK_SIZE)
+		return true;
+	memmove(lane->buf, lane->buf + lane->pos, rest);
+	lane->pos = 0;
+	numRead = fread(lane->buf + rest, 1, LANE_CHUNK - rest, lane->fp);
+	lane->end = rest + numRead;
+	if (numRead < LANE_CHUNK - rest)
+	{
+		if (ferror(lane->fp))
+		{
+			fprintf(stderr, "ERROR: Could not read file: %s\n",
+					job->paths[lane->file]);
+			__sync_fetch_and_add(&job->numFailed, 1);
+		}
+		lane->eof = true;
+	}
+	return true;
+}
+
+/* Hash the tail of a lane's file, store its digest, and make the lane
+   idle.  */
+static void FinishLane(HashJob* job, HashLane* lane)
+{
+	Md5Update(&lane->ctx, lane->buf + lane->pos, lane->end - lane->pos);
+	Md5Final(&lane->ctx, job->digests[lane->file]);
+	if (!ferror(lane->fp))
+		job->done[lane->file] = true;
+	fclose(lane->fp);
+	lane->file = (unsigned)-1;
+}
@@ -0,0 +1,20 @@
+/* file-hash.h -- compute MD5 hashes of many files in parallel, with a
+   persistent cache of previously computed hashes.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef FILE_HASH_H
+#define FILE_HASH_H
+
+#include "md5.h"
+
+typedef unsigned char FileDigest[MD5_DIGEST_SIZE];
+
+int HashFiles(const char* cacheName, char** paths, unsigned count,
+			  FileDigest* digests);
+
+#endif /* not FILE_HASH_H */
@@ -0,0 +1,193 @@
+/* file-stage.c -- place copies of many files into a staging
+   directory without changing the originals.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* Each file is staged with the cheapest method that works on its
+   file system, tried in this order:
+
+   1. A reflink clone (`FICLONE'), which shares the data blocks with
+      the original until either one is changed.
+   2. A hard link to the original.
+   3. A copy made by the kernel with `copy_file_range()'.
+   4. A plain read and write copy.
+
+   The first two do not copy any file data at all.  Files are staged
+   in parallel on the shared thread pool.  */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "thread-pool.h"
+#include "file-stage.h"
+
+/* Size of the buffer used for plain copies.  */
+#define COPY_CHUNK (64 * 1024)
+
+typedef struct StageJob_t StageJob;
+
+/* State shared by all workers of one `StageFiles()' call.  */
+struct StageJob_t
+{
+	char** srcPaths;
+	char** destPaths;
+	/* The number of files that could not be staged, counted with
+	   atomic operations by the workers */
+	unsigned numFailed;
+};
+
+static bool CloneFile(int srcFd, int destFd);
+static bool CopyFileData(int srcFd, int destFd, off_t size);
+static void StageWorker(void* data, unsigned index);
+
+/* Create `destPaths[i]' as a copy of `srcPaths[i]' for every one of
+   the `count' files.  Existing destination files are replaced.
+   Returns nonzero on success, zero if any file could not be
+   staged.  */
+int StageFiles(char** srcPaths, char** destPaths, unsigned count)
+{
+	StageJob job;
+	job.srcPaths = srcPaths;
+	job.destPaths = destPaths;
+	job.numFailed = 0;
+	ParallelFor(count, StageWorker, &job);
+	return (job.numFailed > 0) ? 0 : 1;
+}
+
+/* Share the data blocks of `srcFd' with the empty file `destFd'.  */
+static bool CloneFile(int srcFd, int destFd)
+{
+#ifdef FICLONE
+	if (ioctl(destFd, FICLONE, srcFd) == 0)
+		return true;
+#endif
+	return false;
+}
+
+/* Copy `size' bytes from `srcFd' to `destFd', in the kernel if
+   possible.  */
+static bool CopyFileData(int srcFd, int destFd, off_t size)
+{
+	char* buffer;
+	off_t done = 0;
+#ifdef __linux__
+	while (done < size)
+	{
+		ssize_t result;
+		result = copy_file_range(srcFd, NULL, destFd, NULL,
+								 (size_t)(size - done), 0);
+		if (result <= 0)
+			break;
+		done += result;
+	}
+	if (done == size)
+		return true;
+	/* Not supported between these file systems; finish the copy
+	   below.  */
+	if (lseek(srcFd, done, SEEK_SET) != done ||
+		lseek(destFd, done, SEEK_SET) != done)
+		return false;
+#endif
+	buffer = (char*)xmalloc(COPY_CHUNK);
+	for (;;)
+	{
+		ssize_t numRead;
+		ssize_t numWritten = 0;
+		numRead = read(srcFd, buffer, COPY_CHUNK);
+		if (numRead == 0)
+			break;
+		if (numRead < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			xfree(buffer);
+			return false;
+		}
+		while (numWritten < numRead)
+		{
+			ssize_t result;
+			result = write(destFd, buffer + numWritten,
+						   numRead - numWritten);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				xfree(buffer);
+				return false;
+			}
+			numWritten += result;
+		}
+	}
+	xfree(buffer);
+	return true;
+}
+
+static void StageWorker(void* data, unsigned index)
+{
+	StageJob* job = (StageJob*)data;
+	const char* srcPath = job->srcPaths[index];
+	const char* destPath = job->destPaths[index];
+	struct stat st;
+	int srcFd;
+	int destFd;
+	bool staged;
+
+	unlink(destPath);
+	srcFd = open(srcPath, O_RDONLY);
+	if (srcFd < 0 || fstat(srcFd, &st) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not open file: %s\n", srcPath);
+		if (srcFd >= 0)
+			close(srcFd);
+		__sync_fetch_and_add(&job->numFailed, 1);
+		return;
+	}
+
+	destFd = open(destPath, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (destFd >= 0 && CloneFile(srcFd, destFd))
+	{
+		close(destFd);
+		close(srcFd);
+		return;
+	}
+	if (destFd >= 0)
+	{
+		close(destFd);
+		unlink(destPath);
+	}
+
+	if (link(srcPath, destPath) == 0)
+	{
+		close(srcFd);
+		return;
+	}
+
+	destFd = open(destPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	staged = (destFd >= 0 && CopyFileData(srcFd, destFd, st.st_size));
+	if (destFd >= 0 && close(destFd) != 0)
+		staged = false;
+	close(srcFd);
+	if (staged == false)
+	{
+		fprintf(stderr, "ERROR: Could not write file: %s\n", destPath);
+		__sync_fetch_and_add(&job->numFailed, 1);
+	}
+}
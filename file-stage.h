@@ -0,0 +1,15 @@
+/* file-stage.h -- place copies of many files into a staging
+   directory without changing the originals.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef FILE_STAGE_H
+#define FILE_STAGE_H
+
+int StageFiles(char** srcPaths, char** destPaths, unsigned count);
+
+#endif /* not FILE_STAGE_H */
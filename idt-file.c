@@ -0,0 +1,194 @@
+/* idt-file.c -- read and write installer tables as IDT text files.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* An IDT file holds one table as tab-separated text: three header
+   lines with the column names, the column types, and the table name
+   followed by the key columns, and then one line per row.  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "msi-db.h"
+#include "idt-file.h"
+
+typedef char* char_ptr;
+
+EA_TYPE(char_ptr);
+
+/* Write a table as an IDT file named after the table.  Returns
+   nonzero on success, zero on failure.  */
+int WriteIdtFile(MsiTable* table)
+{
+	FILE* fp;
+	const char* tableName;
+	char* filename;
+	unsigned nameLen;
+	unsigned i;
+
+	tableName = IdtTableName(table, &nameLen);
+	filename = (char*)xmalloc(nameLen + 4 + 1);
+	strncpy(filename, tableName, nameLen);
+	strcpy(filename + nameLen, ".idt");
+	fp = fopen(filename, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not write file: %s\n", filename);
+		xfree(filename);
+		return 0;
+	}
+	fputs(table->header, fp);
+	for (i = 0; i < table->numRows * table->numCols; i += table->numCols)
+	{
+		unsigned j;
+		fputs(table->cells[i], fp);
+		for (j = 1; j < table->numCols; j++)
+		{
+			fputs("\t", fp);
+			fputs(table->cells[i+j], fp);
+		}
+		fputs("\n", fp);
+	}
+	if (fclose(fp) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not write file: %s\n", filename);
+		xfree(filename);
+		return 0;
+	}
+	xfree(filename);
+	return 1;
+}
+
+/* Read the IDT file at `path' into `table'.  The header and all cells
+   point into one buffer owned by the table, which `FreeIdtTable()'
+   releases.  Rows with fewer cells than there are columns are padded
+   with nulls.  Returns nonzero on success, zero on failure.  */
+int ReadIdtFile(const char* path, MsiTable* table)
+{
+	FILE* fp;
+	char* data;
+	long size;
+	char* pos;
+	char* lineEnd;
+	char_ptr_array cells;
+	unsigned lineNum;
+	unsigned i;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open file: %s\n", path);
+		return 0;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = (char*)xmalloc(size + 1);
+	if (fread(data, 1, size, fp) != (size_t)size)
+	{
+		fprintf(stderr, "ERROR: Could not read file: %s\n", path);
+		fclose(fp);
+		xfree(data);
+		return 0;
+	}
+	fclose(fp);
+	data[size] = '\0';
+
+	/* The header ends with the third line break, which is replaced by
+	   the null character.  */
+	pos = data;
+	for (i = 0; i < 3 && pos != NULL; i++)
+	{
+		lineEnd = strchr(pos, '\n');
+		pos = (lineEnd != NULL) ? lineEnd + 1 : NULL;
+	}
+	if (pos == NULL)
+	{
+		fprintf(stderr, "ERROR: Invalid table header: %s\n", path);
+		xfree(data);
+		return 0;
+	}
+	pos[-1] = '\0';
+	if (pos - 2 >= data && pos[-2] == '\r')
+		pos[-2] = '\0';
+	table->header = data;
+	table->numCols = 1;
+	for (i = 0; data[i] != '\n' && data[i] != '\0'; i++)
+	{
+		if (data[i] == '\t')
+			table->numCols++;
+	}
+
+	EA_INIT(char_ptr, cells, 16);
+	lineNum = 4;
+	while (*pos != '\0')
+	{
+		unsigned numCells = 0;
+		char* next;
+		lineEnd = pos + strcspn(pos, "\n");
+		next = (*lineEnd != '\0') ? lineEnd + 1 : lineEnd;
+		if (lineEnd > pos && lineEnd[-1] == '\r')
+			lineEnd--;
+		*lineEnd = '\0';
+		lineEnd = next;
+		if (*pos == '\0')
+		{
+			/* Skip blank lines.  */
+			pos = lineEnd;
+			lineNum++;
+			continue;
+		}
+		EA_APPEND(cells, pos);
+		numCells++;
+		while ((pos = strchr(pos, '\t')) != NULL)
+		{
+			*pos++ = '\0';
+			EA_APPEND(cells, pos);
+			numCells++;
+		}
+		if (numCells > table->numCols)
+		{
+			fprintf(stderr, "ERROR: Too many columns in %s, line %u.\n",
+					path, lineNum);
+			xfree(cells.d);
+			xfree(data);
+			return 0;
+		}
+		for (; numCells < table->numCols; numCells++)
+			EA_APPEND(cells, "");
+		pos = lineEnd;
+		lineNum++;
+	}
+	table->cells = cells.d;
+	table->numRows = cells.len / table->numCols;
+	return 1;
+}
+
+/* Free a table read by `ReadIdtFile()'.  */
+void FreeIdtTable(MsiTable* table)
+{
+	xfree((char*)table->header);
+	xfree(table->cells);
+	table->header = NULL;
+	table->cells = NULL;
+	table->numRows = 0;
+}
+
+/* Returns the name of a table, which starts the third header line and
+   is not null-terminated.  Its length is stored in `nameLen'.  */
+const char* IdtTableName(MsiTable* table, unsigned* nameLen)
+{
+	const char* tableName;
+	tableName = strchr(strchr(table->header, '\n') + 1, '\n') + 1;
+	*nameLen = strcspn(tableName, "\t\r\n");
+	return tableName;
+}
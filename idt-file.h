@@ -0,0 +1,19 @@
+/* idt-file.h -- read and write installer tables as IDT text files.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef IDT_FILE_H
+#define IDT_FILE_H
+
+/* Note: `msi-db.h' must be included before this header.  */
+
+int WriteIdtFile(MsiTable* table);
+int ReadIdtFile(const char* path, MsiTable* table);
+void FreeIdtTable(MsiTable* table);
+const char* IdtTableName(MsiTable* table, unsigned* nameLen);
+
+#endif /* not IDT_FILE_H */
@@ -0,0 +1,251 @@
+/* md5.c -- MD5 message digest, with a multi-buffer kernel that hashes
+   four independent messages at once.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* The MD5 compression function is a long chain of dependent 32-bit
+   operations, so a single message cannot make use of SIMD registers.
+   Four unrelated messages, however, can be hashed in lockstep by
+   keeping lane `n' of every vector register for message `n'.  That is
+   what `Md5x4Blocks()' does.  With GCC-compatible compilers the lanes
+   are expressed with vector extensions, which map onto SSE2 or NEON
+   registers; other compilers fall back to hashing the lanes one after
+   another.
+
+   The round macros below are written so that they work unchanged on
+   both the scalar `uint32_t' type and the four-lane vector type.  */
+
+#include <string.h>
+
+#include "md5.h"
+
+/* Private Declarations */
+static void Md5Transform(uint32_t state[4], const unsigned char* block);
+
+#define LOAD32(p)								\
+	((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) |	\
+	 ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define STEP(f, a, b, c, d, x, t, s)			\
+	(a) += f((b), (c), (d)) + (x) + (t);		\
+	(a) = ROTL((a), (s));						\
+	(a) += (b);
+
+#define MD5_ROUNDS(a, b, c, d, X)								\
+	STEP(F, a, b, c, d, X[ 0], 0xd76aa478,  7)					\
+	STEP(F, d, a, b, c, X[ 1], 0xe8c7b756, 12)					\
+	STEP(F, c, d, a, b, X[ 2], 0x242070db, 17)					\
+	STEP(F, b, c, d, a, X[ 3], 0xc1bdceee, 22)					\
+	STEP(F, a, b, c, d, X[ 4], 0xf57c0faf,  7)					\
+	STEP(F, d, a, b, c, X[ 5], 0x4787c62a, 12)					\
+	STEP(F, c, d, a, b, X[ 6], 0xa8304613, 17)					\
+	STEP(F, b, c, d, a, X[ 7], 0xfd469501, 22)					\
+	STEP(F, a, b, c, d, X[ 8], 0x698098d8,  7)					\
+	STEP(F, d, a, b, c, X[ 9], 0x8b44f7af, 12)					\
+	STEP(F, c, d, a, b, X[10], 0xffff5bb1, 17)					\
+	STEP(F, b, c, d, a, X[11], 0x895cd7be, 22)					\
+	STEP(F, a, b, c, d, X[12], 0x6b901122,  7)					\
+	STEP(F, d, a, b, c, X[13], 0xfd987193, 12)					\
+	STEP(F, c, d, a, b, X[14], 0xa679438e, 17)					\
+	STEP(F, b, c, d, a, X[15], 0x49b40821, 22)					\
+	STEP(G, a, b, c, d, X[ 1], 0xf61e2562,  5)					\
+	STEP(G, d, a, b, c, X[ 6], 0xc040b340,  9)					\
+	STEP(G, c, d, a, b, X[11], 0x265e5a51, 14)					\
+	STEP(G, b, c, d, a, X[ 0], 0xe9b6c7aa, 20)					\
+	STEP(G, a, b, c, d, X[ 5], 0xd62f105d,  5)					\
+	STEP(G, d, a, b, c, X[10], 0x02441453,  9)					\
+	STEP(G, c, d, a, b, X[15], 0xd8a1e681, 14)					\
+	STEP(G, b, c, d, a, X[ 4], 0xe7d3fbc8, 20)					\
+	STEP(G, a, b, c, d, X[ 9], 0x21e1cde6,  5)					\
+	STEP(G, d, a, b, c, X[14], 0xc33707d6,  9)					\
+	STEP(G, c, d, a, b, X[ 3], 0xf4d50d87, 14)					\
+	STEP(G, b, c, d, a, X[ 8], 0x455a14ed, 20)					\
+	STEP(G, a, b, c, d, X[13], 0xa9e3e905,  5)					\
+	STEP(G, d, a, b, c, X[ 2], 0xfcefa3f8,  9)					\
+	STEP(G, c, d, a, b, X[ 7], 0x676f02d9, 14)					\
+	STEP(G, b, c, d, a, X[12], 0x8d2a4c8a, 20)					\
+	STEP(H, a, b, c, d, X[ 5], 0xfffa3942,  4)					\
+	STEP(H, d, a, b, c, X[ 8], 0x8771f681, 11)					\
+	STEP(H, c, d, a, b, X[11], 0x6d9d6122, 16)					\
+	STEP(H, b, c, d, a, X[14], 0xfde5380c, 23)					\
+	STEP(H, a, b, c, d, X[ 1], 0xa4beea44,  4)					\
+	STEP(H, d, a, b, c, X[ 4], 0x4bdecfa9, 11)					\
+	STEP(H, c, d, a, b, X[ 7], 0xf6bb4b60, 16)					\
+	STEP(H, b, c, d, a, X[10], 0xbebfbc70, 23)					\
+	STEP(H, a, b, c, d, X[13], 0x289b7ec6,  4)					\
+	STEP(H, d, a, b, c, X[ 0], 0xeaa127fa, 11)					\
+	STEP(H, c, d, a, b, X[ 3], 0xd4ef3085, 16)					\
+	STEP(H, b, c, d, a, X[ 6], 0x04881d05, 23)					\
+	STEP(H, a, b, c, d, X[ 9], 0xd9d4d039,  4)					\
+	STEP(H, d, a, b, c, X[12], 0xe6db99e5, 11)					\
+	STEP(H, c, d, a, b, X[15], 0x1fa27cf8, 16)					\
+	STEP(H, b, c, d, a, X[ 2], 0xc4ac5665, 23)					\
+	STEP(I, a, b, c, d, X[ 0], 0xf4292244,  6)					\
+	STEP(I, d, a, b, c, X[ 7], 0x432aff97, 10)					\
+	STEP(I, c, d, a, b, X[14], 0xab9423a7, 15)					\
+	STEP(I, b, c, d, a, X[ 5], 0xfc93a039, 21)					\
+	STEP(I, a, b, c, d, X[12], 0x655b59c3,  6)					\
+	STEP(I, d, a, b, c, X[ 3], 0x8f0ccc92, 10)					\
+	STEP(I, c, d, a, b, X[10], 0xffeff47d, 15)					\
+	STEP(I, b, c, d, a, X[ 1], 0x85845dd1, 21)					\
+	STEP(I, a, b, c, d, X[ 8], 0x6fa87e4f,  6)					\
+	STEP(I, d, a, b, c, X[15], 0xfe2ce6e0, 10)					\
+	STEP(I, c, d, a, b, X[ 6], 0xa3014314, 15)					\
+	STEP(I, b, c, d, a, X[13], 0x4e0811a1, 21)					\
+	STEP(I, a, b, c, d, X[ 4], 0xf7537e82,  6)					\
+	STEP(I, d, a, b, c, X[11], 0xbd3af235, 10)					\
+	STEP(I, c, d, a, b, X[ 2], 0x2ad7d2bb, 15)					\
+	STEP(I, b, c, d, a, X[ 9], 0xeb86d391, 21)
+
+void Md5Init(Md5Ctx* ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xefcdab89;
+	ctx->state[2] = 0x98badcfe;
+	ctx->state[3] = 0x10325476;
+	ctx->length = 0;
+	ctx->bufLen = 0;
+}
+
+void Md5Update(Md5Ctx* ctx, const void* data, size_t len)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	ctx->length += len;
+	if (ctx->bufLen > 0)
+	{
+		size_t fill = MD5_BLOCK_SIZE - ctx->bufLen;
+		if (fill > len)
+			fill = len;
+		memcpy(ctx->buffer + ctx->bufLen, bytes, fill);
+		ctx->bufLen += fill;
+		bytes += fill;
+		len -= fill;
+		if (ctx->bufLen < MD5_BLOCK_SIZE)
+			return;
+		Md5Transform(ctx->state, ctx->buffer);
+		ctx->bufLen = 0;
+	}
+	while (len >= MD5_BLOCK_SIZE)
+	{
+		Md5Transform(ctx->state, bytes);
+		bytes += MD5_BLOCK_SIZE;
+		len -= MD5_BLOCK_SIZE;
+	}
+	memcpy(ctx->buffer, bytes, len);
+	ctx->bufLen = len;
+}
+
+void Md5Final(Md5Ctx* ctx, unsigned char digest[MD5_DIGEST_SIZE])
+{
+	static const unsigned char padding[MD5_BLOCK_SIZE] = { 0x80 };
+	unsigned char lenBytes[8];
+	uint64_t bitLen = ctx->length << 3;
+	unsigned padLen;
+	unsigned i;
+
+	for (i = 0; i < 8; i++)
+		lenBytes[i] = (unsigned char)(bitLen >> (8 * i));
+	padLen = (ctx->bufLen < 56) ? (56 - ctx->bufLen) : (120 - ctx->bufLen);
+	Md5Update(ctx, padding, padLen);
+	Md5Update(ctx, lenBytes, 8);
+	for (i = 0; i < 4; i++)
+	{
+		digest[i*4]   = (unsigned char)(ctx->state[i]);
+		digest[i*4+1] = (unsigned char)(ctx->state[i] >> 8);
+		digest[i*4+2] = (unsigned char)(ctx->state[i] >> 16);
+		digest[i*4+3] = (unsigned char)(ctx->state[i] >> 24);
+	}
+}
+
+/* Hash whole blocks directly into the state of `ctx'.  The context
+   must not hold any partially buffered data.  */
+void Md5Blocks(Md5Ctx* ctx, const unsigned char* data, size_t numBlocks)
+{
+	ctx->length += (uint64_t)numBlocks * MD5_BLOCK_SIZE;
+	while (numBlocks-- > 0)
+	{
+		Md5Transform(ctx->state, data);
+		data += MD5_BLOCK_SIZE;
+	}
+}
+
+#if defined(__GNUC__)
+typedef uint32_t md5v __attribute__((vector_size(16)));
+
+/* Hash `numBlocks' whole blocks of four independent messages in
+   lockstep.  `data[n]' points to the blocks for `ctx[n]'.  None of
+   the contexts may hold partially buffered data.  */
+void Md5x4Blocks(Md5Ctx* ctx[MD5_LANES],
+				 const unsigned char* data[MD5_LANES], size_t numBlocks)
+{
+	md5v a, b, c, d;
+	size_t off;
+	unsigned n;
+
+	a = (md5v){ ctx[0]->state[0], ctx[1]->state[0],
+				ctx[2]->state[0], ctx[3]->state[0] };
+	b = (md5v){ ctx[0]->state[1], ctx[1]->state[1],
+				ctx[2]->state[1], ctx[3]->state[1] };
+	c = (md5v){ ctx[0]->state[2], ctx[1]->state[2],
+				ctx[2]->state[2], ctx[3]->state[2] };
+	d = (md5v){ ctx[0]->state[3], ctx[1]->state[3],
+				ctx[2]->state[3], ctx[3]->state[3] };
+
+	for (off = 0; off < numBlocks * MD5_BLOCK_SIZE; off += MD5_BLOCK_SIZE)
+	{
+		md5v X[16];
+		md5v aa = a, bb = b, cc = c, dd = d;
+		unsigned i;
+		for (i = 0; i < 16; i++)
+		{
+			X[i] = (md5v){ LOAD32(data[0] + off + i*4),
+						   LOAD32(data[1] + off + i*4),
+						   LOAD32(data[2] + off + i*4),
+						   LOAD32(data[3] + off + i*4) };
+		}
+		MD5_ROUNDS(a, b, c, d, X)
+		a += aa; b += bb; c += cc; d += dd;
+	}
+
+	for (n = 0; n < MD5_LANES; n++)
+	{
+		ctx[n]->state[0] = a[n];
+		ctx[n]->state[1] = b[n];
+		ctx[n]->state[2] = c[n];
+		ctx[n]->state[3] = d[n];
+		ctx[n]->length += (uint64_t)numBlocks * MD5_BLOCK_SIZE;
+	}
+}
+#else /* not __GNUC__ */
+void Md5x4Blocks(Md5Ctx* ctx[MD5_LANES],
+				 const unsigned char* data[MD5_LANES], size_t numBlocks)
+{
+	unsigned n;
+	for (n = 0; n < MD5_LANES; n++)
+		Md5Blocks(ctx[n], data[n], numBlocks);
+}
+#endif /* not __GNUC__ */
+
+static void Md5Transform(uint32_t state[4], const unsigned char* block)
+{
+	uint32_t X[16];
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	unsigned i;
+	for (i = 0; i < 16; i++)
+		X[i] = LOAD32(block + i*4);
+	MD5_ROUNDS(a, b, c, d, X)
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
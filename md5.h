@@ -0,0 +1,38 @@
+/* md5.h -- MD5 message digest, with a multi-buffer kernel that hashes
+   four independent messages at once.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef MD5_H
+#define MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5_BLOCK_SIZE 64
+#define MD5_DIGEST_SIZE 16
+/* Number of messages processed together by `Md5x4Blocks()'.  */
+#define MD5_LANES 4
+
+typedef struct Md5Ctx_t Md5Ctx;
+
+struct Md5Ctx_t
+{
+	uint32_t state[4];
+	uint64_t length; /* Total number of bytes hashed so far */
+	unsigned char buffer[MD5_BLOCK_SIZE];
+	unsigned bufLen;
+};
+
+void Md5Init(Md5Ctx* ctx);
+void Md5Update(Md5Ctx* ctx, const void* data, size_t len);
+void Md5Final(Md5Ctx* ctx, unsigned char digest[MD5_DIGEST_SIZE]);
+void Md5Blocks(Md5Ctx* ctx, const unsigned char* data, size_t numBlocks);
+void Md5x4Blocks(Md5Ctx* ctx[MD5_LANES],
+				 const unsigned char* data[MD5_LANES], size_t numBlocks);
+
+#endif /* not MD5_H */
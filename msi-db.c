@@ -0,0 +1,858 @@
+/* msi-db.c -- write tables directly into a Windows Installer database.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* An installer database is a compound file.  Every table is one
+   stream holding its rows column by column: each cell is either a
+   2 or 4 byte integer biased so that zero means null, or a reference
+   into a shared string pool kept in the `_StringPool' and
+   `_StringData' streams.  The table list lives in `_Tables' and the
+   column definitions in `_Columns', both of which are encoded the same
+   way.  Stream names are compressed by packing two characters from a
+   64 character alphabet into one UTF-16 code unit, and table streams
+   are marked with an extra leading code unit.
+
+   `MergeMsiDatabase()' decodes every table of an existing database,
+   replaces or adds the given tables the way `msidb -i' imports IDT
+   files, and then writes the whole database back out with a freshly
+   built string pool.  Streams that are not tables, such as the
+   summary information and `Binary' table contents, are kept as they
+   are.  Strings are copied byte for byte, so they must already be in
+   the code page of the database.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "cfb.h"
+#include "msi-db.h"
+
+/* Column type bits as stored in the `_Columns' table */
+#define MSITYPE_VALID       0x0100
+#define MSITYPE_LOCALIZABLE 0x0200
+#define MSITYPE_STRING      0x0800
+#define MSITYPE_NULLABLE    0x1000
+#define MSITYPE_KEY         0x2000
+#define MSITYPE_IS_BINARY(type) \
+	(((type) & ~MSITYPE_NULLABLE) == (MSITYPE_STRING | MSITYPE_VALID))
+
+#define TABLE_STREAM_MARK 0x4840
+#define MAX_STRING_LEN 0xffff
+
+typedef char* char_ptr;
+typedef struct DbColumn_t DbColumn;
+typedef struct DbTable_t DbTable;
+
+EA_TYPE(char_ptr);
+EA_TYPE(uint32_t);
+
+struct DbColumn_t
+{
+	char* name;
+	unsigned type;
+};
+
+EA_TYPE(DbColumn);
+
+/* A decoded table.  The cells are stored row by row.  Cells of string
+   columns are indices into `strings', all other cells are the raw
+   stored value.  Zero is null in both cases.  */
+struct DbTable_t
+{
+	char* name;
+	DbColumn_array cols;
+	unsigned numRows;
+	uint32_t_array cells;
+};
+
+EA_TYPE(DbTable);
+
+/* All strings seen so far, owned by this array.  Index zero is the
+   null string.  */
+static char_ptr_array strings;
+
+/* State for sorting table rows by their primary key.  */
+static DbTable* sortTable;
+
+/* Private Declarations */
+static uint32_t Get32(const unsigned char* p);
+static unsigned Get16(const unsigned char* p);
+static void PutN(unsigned char* p, uint32_t v, unsigned width);
+static uint32_t GetN(const unsigned char* p, unsigned width);
+static bool EncodeStreamName(const char* name, bool table, uint16_t* out,
+							 unsigned* outLen);
+static CfbEntry* FindTableStream(CfbFile* cfb, const char* name);
+static unsigned AddString(const char* str, size_t len);
+static unsigned ColumnWidth(unsigned type, unsigned refBytes);
+static bool IsStringColumn(unsigned type);
+static void InitTable(DbTable* table, const char* name);
+static void AddColumn(DbTable* table, const char* name, unsigned type);
+static void DestroyTable(DbTable* table);
+static bool DecodeStringPool(CfbFile* cfb, uint32_t* codepage,
+							 unsigned* refBytes);
+static bool DecodeTable(DbTable* table, const unsigned char* data,
+						uint64_t size, unsigned refBytes);
+static bool ParseIdtTable(const MsiTable* src, DbTable* table);
+static unsigned SplitFields(char* line, char_ptr_array* fields);
+static int String_qsort(const void* e1, const void* e2);
+static int DbRow_qsort(const void* e1, const void* e2);
+static unsigned char* EncodeTable(DbTable* table, unsigned refBytes,
+								  size_t* size);
+
+/* Import `tables' into the installer database `dbPath', replacing
+   tables of the same name.  Each of the `streams' is embedded under its
+   name, so that a `Media' table entry of "#name" can refer to it.
+   Returns nonzero on success, zero on failure.  */
+int MergeMsiDatabase(const char* dbPath, MsiTable* tables, unsigned numTables,
+					 MsiStream* streams, unsigned numStreams)
+{
+	CfbFile cfb;
+	DbTable_array dbTables;
+	DbTable sysTables;
+	DbTable sysColumns;
+	uint32_t codepage;
+	unsigned refBytes;
+	uint32_t* refs = NULL;
+	unsigned* order = NULL;
+	uint32_t* strMap = NULL;
+	unsigned numUnique = 0;
+	bool sysAppended = false;
+	char* tmpPath = NULL;
+	int retval = 0;
+	unsigned i, j;
+
+	if (!CfbRead(&cfb, dbPath))
+		return 0;
+	EA_INIT(char_ptr, strings, 1024);
+	EA_APPEND(strings, NULL);
+	EA_INIT(DbTable, dbTables, 64);
+	InitTable(&sysTables, "_Tables");
+	AddColumn(&sysTables, "Name", MSITYPE_KEY | MSITYPE_STRING |
+			  MSITYPE_VALID | 0x0400 | 64);
+	InitTable(&sysColumns, "_Columns");
+	AddColumn(&sysColumns, "Table", MSITYPE_KEY | MSITYPE_STRING |
+			  MSITYPE_VALID | 0x0400 | 64);
+	AddColumn(&sysColumns, "Number", MSITYPE_KEY | 0x0500 | 2);
+	AddColumn(&sysColumns, "Name", MSITYPE_STRING | MSITYPE_VALID |
+			  0x0400 | 64);
+	AddColumn(&sysColumns, "Type", 0x0500 | 2);
+
+	/* Decode the table list and the column definitions.  */
+	if (!DecodeStringPool(&cfb, &codepage, &refBytes))
+		goto corrupt;
+	{
+		CfbEntry* entry;
+		entry = FindTableStream(&cfb, "_Tables");
+		if (entry == NULL ||
+			!DecodeTable(&sysTables, entry->data, entry->size, refBytes))
+			goto corrupt;
+		entry = FindTableStream(&cfb, "_Columns");
+		if (entry == NULL ||
+			!DecodeTable(&sysColumns, entry->data, entry->size, refBytes))
+			goto corrupt;
+	}
+	for (i = 0; i < sysTables.numRows; i++)
+	{
+		if (sysTables.cells.d[i] == 0)
+			goto corrupt;
+		EA_SET_SIZE(dbTables, dbTables.len + 1);
+		InitTable(&EA_BACK(dbTables), strings.d[sysTables.cells.d[i]]);
+	}
+	for (i = 0; i < sysColumns.numRows; i++)
+	{
+		uint32_t* row = &sysColumns.cells.d[i*4];
+		unsigned number = row[1] - 0x8000;
+		DbTable* table = NULL;
+		if (row[0] == 0 || row[2] == 0 || number < 1 || number > 255)
+			goto corrupt;
+		for (j = 0; j < dbTables.len; j++)
+		{
+			if (strcmp(dbTables.d[j].name, strings.d[row[0]]) == 0)
+			{ table = &dbTables.d[j]; break; }
+		}
+		if (table == NULL)
+			goto corrupt;
+		while (table->cols.len < number)
+			AddColumn(table, NULL, 0);
+		if (table->cols.d[number-1].name != NULL)
+			goto corrupt;
+		table->cols.d[number-1].name = xmalloc(strlen(strings.d[row[2]]) + 1);
+		strcpy(table->cols.d[number-1].name, strings.d[row[2]]);
+		table->cols.d[number-1].type = (row[3] - 0x8000) & 0xffff;
+	}
+
+	/* Decode the contents of every table.  */
+	for (i = 0; i < dbTables.len; i++)
+	{
+		DbTable* table = &dbTables.d[i];
+		CfbEntry* entry;
+		for (j = 0; j < table->cols.len; j++)
+		{
+			if (table->cols.d[j].name == NULL)
+				goto corrupt;
+		}
+		entry = FindTableStream(&cfb, table->name);
+		if (entry != NULL &&
+			!DecodeTable(table, entry->data, entry->size, refBytes))
+			goto corrupt;
+	}
+
+	/* Replace or add the new tables.  */
+	for (i = 0; i < numTables; i++)
+	{
+		DbTable newTable;
+		if (!ParseIdtTable(&tables[i], &newTable))
+			goto cleanup;
+		for (j = 0; j < dbTables.len; j++)
+		{
+			if (strcmp(dbTables.d[j].name, newTable.name) == 0)
+				break;
+		}
+		if (j == dbTables.len)
+			EA_SET_SIZE(dbTables, dbTables.len + 1);
+		else
+			DestroyTable(&dbTables.d[j]);
+		dbTables.d[j] = newTable;
+	}
+
+	/* Rebuild the table list and the column definitions.  */
+	EA_CLEAR(sysTables.cells);
+	EA_CLEAR(sysColumns.cells);
+	sysTables.numRows = 0;
+	sysColumns.numRows = 0;
+	for (i = 0; i < dbTables.len; i++)
+	{
+		DbTable* table = &dbTables.d[i];
+		EA_APPEND(sysTables.cells, AddString(table->name,
+											 strlen(table->name)));
+		sysTables.numRows++;
+		for (j = 0; j < table->cols.len; j++)
+		{
+			DbColumn* col = &table->cols.d[j];
+			EA_APPEND(sysColumns.cells, AddString(table->name,
+												  strlen(table->name)));
+			EA_APPEND(sysColumns.cells, j + 1 + 0x8000);
+			EA_APPEND(sysColumns.cells, AddString(col->name,
+												  strlen(col->name)));
+			EA_APPEND(sysColumns.cells, col->type + 0x8000);
+			sysColumns.numRows++;
+		}
+	}
+	/* From here on the system tables are handled like any other.  */
+	EA_APPEND(dbTables, sysTables);
+	EA_APPEND(dbTables, sysColumns);
+	sysAppended = true;
+
+	/* Build the new string pool: count the references to every string,
+	   then sort and merge duplicates.  */
+	refs = (uint32_t*)xmalloc(sizeof(uint32_t) * strings.len);
+	memset(refs, 0, sizeof(uint32_t) * strings.len);
+	for (i = 0; i < dbTables.len; i++)
+	{
+		DbTable* table = &dbTables.d[i];
+		unsigned numCols = table->cols.len;
+		for (j = 0; j < numCols; j++)
+		{
+			unsigned row;
+			if (!IsStringColumn(table->cols.d[j].type))
+				continue;
+			for (row = 0; row < table->numRows; row++)
+				refs[table->cells.d[row*numCols+j]]++;
+		}
+	}
+	order = (unsigned*)xmalloc(sizeof(unsigned) * strings.len);
+	j = 0;
+	for (i = 1; i < strings.len; i++)
+	{
+		if (refs[i] > 0 && strings.d[i] != NULL)
+			order[j++] = i;
+	}
+	qsort(order, j, sizeof(unsigned), String_qsort);
+	strMap = (uint32_t*)xmalloc(sizeof(uint32_t) * strings.len);
+	memset(strMap, 0, sizeof(uint32_t) * strings.len);
+	{
+		unsigned numUsed = j;
+		uint32_t* poolRefs;
+		unsigned char* pool;
+		unsigned char* data;
+		size_t dataLen = 0;
+		uint16_t name[CFB_MAX_NAME+1];
+		unsigned nameLen;
+		for (i = 0; i < numUsed; i++)
+		{
+			size_t len = strlen(strings.d[order[i]]);
+			if (i == 0 || strcmp(strings.d[order[i]],
+								 strings.d[order[i-1]]) != 0)
+			{
+				if (len > MAX_STRING_LEN)
+				{
+					fprintf(stderr, "ERROR: String too long for the "
+							"database: %.40s...\n", strings.d[order[i]]);
+					goto cleanup;
+				}
+				order[numUnique++] = order[i];
+				dataLen += len;
+			}
+			strMap[order[i]] = numUnique;
+		}
+		refBytes = (numUnique > 0xffff) ? 3 : 2;
+
+		poolRefs = (uint32_t*)xmalloc(sizeof(uint32_t) * (numUnique + 1));
+		memset(poolRefs, 0, sizeof(uint32_t) * (numUnique + 1));
+		for (i = 1; i < strings.len; i++)
+			poolRefs[strMap[i]] += refs[i];
+		pool = (unsigned char*)xmalloc(4 + 4 * numUnique);
+		data = (unsigned char*)xmalloc(dataLen + 1);
+		PutN(pool, codepage | ((refBytes == 3) ? 0x80000000 : 0), 4);
+		dataLen = 0;
+		for (i = 0; i < numUnique; i++)
+		{
+			size_t len = strlen(strings.d[order[i]]);
+			PutN(pool + 4 + i * 4, (uint32_t)len, 2);
+			PutN(pool + 6 + i * 4, (poolRefs[i+1] > 0xffff) ? 0xffff :
+				 poolRefs[i+1], 2);
+			memcpy(data + dataLen, strings.d[order[i]], len);
+			dataLen += len;
+		}
+		xfree(poolRefs);
+		EncodeStreamName("_StringPool", true, name, &nameLen);
+		CfbSetStream(&cfb, 0, name, nameLen, pool, 4 + 4 * numUnique, NULL);
+		EncodeStreamName("_StringData", true, name, &nameLen);
+		CfbSetStream(&cfb, 0, name, nameLen, data, dataLen, NULL);
+	}
+
+	/* Encode every table with the new string references.  */
+	for (i = 0; i < dbTables.len; i++)
+	{
+		DbTable* table = &dbTables.d[i];
+		unsigned numCols = table->cols.len;
+		uint16_t name[CFB_MAX_NAME+1];
+		unsigned nameLen;
+		unsigned char* stream;
+		size_t size;
+		for (j = 0; j < numCols; j++)
+		{
+			unsigned row;
+			if (!IsStringColumn(table->cols.d[j].type))
+				continue;
+			for (row = 0; row < table->numRows; row++)
+			{
+				uint32_t* cell = &table->cells.d[row*numCols+j];
+				*cell = strMap[*cell];
+			}
+		}
+		if (!EncodeStreamName(table->name, true, name, &nameLen))
+		{
+			fprintf(stderr, "ERROR: Table name too long: %s\n", table->name);
+			goto cleanup;
+		}
+		if (table->numRows == 0)
+		{
+			/* Empty tables have no stream at all.  */
+			unsigned index = CfbFind(&cfb, 0, name, nameLen);
+			if (index != (unsigned)-1)
+				cfb.entries.d[index].deleted = true;
+			continue;
+		}
+		stream = EncodeTable(table, refBytes, &size);
+		CfbSetStream(&cfb, 0, name, nameLen, stream, size, NULL);
+	}
+
+	for (i = 0; i < numStreams; i++)
+	{
+		struct stat st;
+		uint16_t name[CFB_MAX_NAME+1];
+		unsigned nameLen;
+		if (stat(streams[i].path, &st) != 0)
+		{
+			fprintf(stderr, "ERROR: Could not open file: %s\n",
+					streams[i].path);
+			goto cleanup;
+		}
+		if (!EncodeStreamName(streams[i].name, false, name, &nameLen))
+		{
+			fprintf(stderr, "ERROR: Stream name too long: %s\n",
+					streams[i].name);
+			goto cleanup;
+		}
+		CfbSetStream(&cfb, 0, name, nameLen, NULL, (uint64_t)st.st_size,
+					 streams[i].path);
+	}
+
+	/* Write a new file and only then replace the old one.  */
+	tmpPath = (char*)xmalloc(strlen(dbPath) + 4 + 1);
+	sprintf(tmpPath, "%s.tmp", dbPath);
+	if (!CfbWrite(&cfb, tmpPath))
+	{
+		remove(tmpPath);
+		goto cleanup;
+	}
+	if (rename(tmpPath, dbPath) != 0)
+	{
+		fprintf(stderr, "ERROR: Could not replace file: %s\n", dbPath);
+		remove(tmpPath);
+		goto cleanup;
+	}
+	retval = 1;
+	goto cleanup;
+
+corrupt:
+	fprintf(stderr, "ERROR: Not a valid installer database: %s\n", dbPath);
+cleanup:
+	if (sysAppended == false)
+	{
+		DestroyTable(&sysTables);
+		DestroyTable(&sysColumns);
+	}
+	for (i = 0; i < dbTables.len; i++)
+		DestroyTable(&dbTables.d[i]);
+	EA_DESTROY(dbTables);
+	for (i = 0; i < strings.len; i++)
+		xfree(strings.d[i]);
+	EA_DESTROY(strings);
+	xfree(refs);
+	xfree(order);
+	xfree(strMap);
+	xfree(tmpPath);
+	CfbDestroy(&cfb);
+	return retval;
+}
+
+static uint32_t Get32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned Get16(const unsigned char* p)
+{
+	return (unsigned)p[0] | ((unsigned)p[1] << 8);
+}
+
+static void PutN(unsigned char* p, uint32_t v, unsigned width)
+{
+	unsigned i;
+	for (i = 0; i < width; i++)
+		p[i] = (unsigned char)(v >> (i * 8));
+}
+
+static uint32_t GetN(const unsigned char* p, unsigned width)
+{
+	uint32_t v = 0;
+	unsigned i;
+	for (i = 0; i < width; i++)
+		v |= (uint32_t)p[i] << (i * 8);
+	return v;
+}
+
+/* Map a character to the 64 character alphabet used in stream names,
+   or return -1 if it is not part of that alphabet.  */
+static int NameCharCode(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'A' && ch <= 'Z')
+		return ch - 'A' + 10;
+	if (ch >= 'a' && ch <= 'z')
+		return ch - 'a' + 36;
+	if (ch == '.')
+		return 62;
+	if (ch == '_')
+		return 63;
+	return -1;
+}
+
+/* Compress a stream name.  Pairs of alphabet characters share one code
+   unit starting at 0x3800, single alphabet characters are stored from
+   0x4800, and anything else is stored as is.  Returns false if the
+   result does not fit in a directory entry.  */
+static bool EncodeStreamName(const char* name, bool table, uint16_t* out,
+							 unsigned* outLen)
+{
+	unsigned len = 0;
+	if (table == true)
+		out[len++] = TABLE_STREAM_MARK;
+	while (*name != '\0')
+	{
+		int c1 = NameCharCode(name[0]);
+		int c2 = (name[1] != '\0') ? NameCharCode(name[1]) : -1;
+		if (len >= CFB_MAX_NAME)
+			return false;
+		if (c1 >= 0 && c2 >= 0)
+		{
+			out[len++] = (uint16_t)(0x3800 + c1 + (c2 << 6));
+			name += 2;
+		}
+		else if (c1 >= 0)
+		{
+			out[len++] = (uint16_t)(0x4800 + c1);
+			name++;
+		}
+		else
+		{
+			out[len++] = (unsigned char)*name;
+			name++;
+		}
+	}
+	*outLen = len;
+	return true;
+}
+
+static CfbEntry* FindTableStream(CfbFile* cfb, const char* name)
+{
+	uint16_t encName[CFB_MAX_NAME+1];
+	unsigned nameLen;
+	unsigned index;
+	if (!EncodeStreamName(name, true, encName, &nameLen))
+		return NULL;
+	index = CfbFind(cfb, 0, encName, nameLen);
+	if (index == (unsigned)-1 || cfb->entries.d[index].type != CFB_STREAM)
+		return NULL;
+	return &cfb->entries.d[index];
+}
+
+/* Append a copy of a string to `strings' and return its index.  */
+static unsigned AddString(const char* str, size_t len)
+{
+	char* copy = (char*)xmalloc(len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	EA_APPEND(strings, copy);
+	return strings.len - 1;
+}
+
+/* Returns the number of bytes of one cell of a column.  */
+static unsigned ColumnWidth(unsigned type, unsigned refBytes)
+{
+	if (MSITYPE_IS_BINARY(type))
+		return 2;
+	if (type & MSITYPE_STRING)
+		return refBytes;
+	if ((type & 0xff) <= 2)
+		return 2;
+	if ((type & 0xff) == 4)
+		return 4;
+	return 0;
+}
+
+static bool IsStringColumn(unsigned type)
+{
+	return ((type & MSITYPE_STRING) && !MSITYPE_IS_BINARY(type)) ?
+		true : false;
+}
+
+static void InitTable(DbTable* table, const char* name)
+{
+	table->name = (char*)xmalloc(strlen(name) + 1);
+	strcpy(table->name, name);
+	EA_INIT(DbColumn, table->cols, 16);
+	table->numRows = 0;
+	EA_INIT(uint32_t, table->cells, 16);
+}
+
+/* Add a column to a table.  `name' is copied unless it is NULL.  */
+static void AddColumn(DbTable* table, const char* name, unsigned type)
+{
+	DbColumn col;
+	col.name = NULL;
+	if (name != NULL)
+	{
+		col.name = (char*)xmalloc(strlen(name) + 1);
+		strcpy(col.name, name);
+	}
+	col.type = type;
+	EA_APPEND(table->cols, col);
+}
+
+static void DestroyTable(DbTable* table)
+{
+	unsigned i;
+	xfree(table->name);
+	for (i = 0; i < table->cols.len; i++)
+		xfree(table->cols.d[i].name);
+	EA_DESTROY(table->cols);
+	EA_DESTROY(table->cells);
+}
+
+/* Load the string pool into `strings' so that the string IDs of the
+   database are the indices into `strings'.  */
+static bool DecodeStringPool(CfbFile* cfb, uint32_t* codepage,
+							 unsigned* refBytes)
+{
+	CfbEntry* poolEntry = FindTableStream(cfb, "_StringPool");
+	CfbEntry* dataEntry = FindTableStream(cfb, "_StringData");
+	const unsigned char* pool;
+	uint64_t count;
+	uint64_t offset = 0;
+	uint64_t i;
+
+	if (poolEntry == NULL || dataEntry == NULL || poolEntry->size < 4)
+		return false;
+	pool = poolEntry->data;
+	*codepage = Get32(pool) & ~0x80000000;
+	*refBytes = (Get32(pool) & 0x80000000) ? 3 : 2;
+	count = poolEntry->size / 4;
+	i = 1;
+	while (i < count)
+	{
+		unsigned len = Get16(pool + i * 4);
+		unsigned refCount = Get16(pool + i * 4 + 2);
+		if (len == 0 && refCount == 0)
+		{
+			/* Unused string ID */
+			EA_APPEND(strings, NULL);
+			i++;
+			continue;
+		}
+		if (len == 0)
+		{
+			/* Strings longer than 64 KiB take up two entries, and the
+			   second holds the length.  */
+			if (i + 1 >= count)
+				return false;
+			len = Get32(pool + (i + 1) * 4);
+			i += 2;
+		}
+		else
+			i++;
+		if (offset + len > dataEntry->size)
+			return false;
+		AddString((const char*)dataEntry->data + offset, len);
+		offset += len;
+	}
+	return true;
+}
+
+/* Decode the rows of a table stream.  The columns of `table' must
+   already be defined.  */
+static bool DecodeTable(DbTable* table, const unsigned char* data,
+						uint64_t size, unsigned refBytes)
+{
+	unsigned numCols = table->cols.len;
+	unsigned rowWidth = 0;
+	const unsigned char* colData = data;
+	unsigned i;
+
+	for (i = 0; i < numCols; i++)
+	{
+		unsigned width = ColumnWidth(table->cols.d[i].type, refBytes);
+		if (width == 0)
+			return false;
+		rowWidth += width;
+	}
+	if (rowWidth == 0 || size % rowWidth != 0)
+		return false;
+	table->numRows = (unsigned)(size / rowWidth);
+	EA_SET_SIZE(table->cells, table->numRows * numCols);
+	for (i = 0; i < numCols; i++)
+	{
+		unsigned type = table->cols.d[i].type;
+		unsigned width = ColumnWidth(type, refBytes);
+		unsigned row;
+		for (row = 0; row < table->numRows; row++)
+		{
+			uint32_t v = GetN(colData + row * width, width);
+			if (IsStringColumn(type) &&
+				(v >= strings.len || strings.d[v] == NULL))
+				v = 0;
+			table->cells.d[row*numCols+i] = v;
+		}
+		colData += (size_t)width * table->numRows;
+	}
+	return true;
+}
+
+/* Convert a table in IDT form.  Column types are written as in IDT
+   files: `s', `l', `i' or `v' followed by the width, in upper case if
+   the column may be null.  */
+static bool ParseIdtTable(const MsiTable* src, DbTable* table)
+{
+	char* header;
+	char* lines[3];
+	char_ptr_array names, types, keys;
+	unsigned numKeys;
+	unsigned i, row;
+	bool retval = false;
+
+	header = (char*)xmalloc(strlen(src->header) + 1);
+	strcpy(header, src->header);
+	lines[0] = header;
+	lines[1] = strchr(lines[0], '\n');
+	lines[2] = (lines[1] != NULL) ? strchr(lines[1] + 1, '\n') : NULL;
+	if (lines[2] == NULL)
+	{
+		xfree(header);
+		fputs("ERROR: Invalid table header.\n", stderr);
+		return false;
+	}
+	*lines[1]++ = '\0';
+	*lines[2]++ = '\0';
+	lines[2][strcspn(lines[2], "\r\n")] = '\0';
+	EA_INIT(char_ptr, names, 16);
+	EA_INIT(char_ptr, types, 16);
+	EA_INIT(char_ptr, keys, 16);
+	SplitFields(lines[0], &names);
+	SplitFields(lines[1], &types);
+	numKeys = SplitFields(lines[2], &keys) - 1;
+	InitTable(table, keys.d[0]);
+	if (names.len != src->numCols || types.len != src->numCols ||
+		numKeys == 0 || numKeys > src->numCols)
+	{
+		fprintf(stderr, "ERROR: Invalid header for table: %s\n", keys.d[0]);
+		goto cleanup;
+	}
+
+	for (i = 0; i < src->numCols; i++)
+	{
+		char ch = types.d[i][0];
+		unsigned width = (unsigned)atoi(types.d[i] + 1);
+		unsigned type;
+		switch (tolower((unsigned char)ch))
+		{
+		case 's': type = 0x0d00 | width; break;
+		case 'l': type = 0x0d00 | MSITYPE_LOCALIZABLE | width; break;
+		case 'i': type = (width == 2) ? 0x0502 : (width == 4) ? 0x0104 : 0;
+			break;
+		case 'v': type = 0x0900; break;
+		default: type = 0; break;
+		}
+		if (type == 0 || width > 255)
+		{
+			fprintf(stderr, "ERROR: Invalid column type in table %s: %s\n",
+					table->name, types.d[i]);
+			goto cleanup;
+		}
+		if (isupper((unsigned char)ch))
+			type |= MSITYPE_NULLABLE;
+		/* Key columns always come first.  */
+		if (i < numKeys)
+		{
+			if (strcmp(names.d[i], keys.d[i+1]) != 0)
+			{
+				fprintf(stderr, "ERROR: Key columns of table %s must "
+						"come first.\n", table->name);
+				goto cleanup;
+			}
+			type |= MSITYPE_KEY;
+		}
+		AddColumn(table, names.d[i], type);
+	}
+
+	table->numRows = src->numRows;
+	EA_SET_SIZE(table->cells, src->numRows * src->numCols);
+	for (row = 0; row < src->numRows; row++)
+	{
+		for (i = 0; i < src->numCols; i++)
+		{
+			const char* text = src->cells[row*src->numCols+i];
+			unsigned type = table->cols.d[i].type;
+			uint32_t v = 0;
+			if (text[0] == '\0')
+				v = 0;
+			else if (MSITYPE_IS_BINARY(type))
+			{
+				fprintf(stderr, "ERROR: Binary values are not supported: "
+						"%s\n", table->name);
+				goto cleanup;
+			}
+			else if (type & MSITYPE_STRING)
+				v = AddString(text, strlen(text));
+			else if ((type & 0xff) == 2)
+				v = (uint32_t)(atol(text) + 0x8000) & 0xffff;
+			else
+				v = (uint32_t)atol(text) + 0x80000000U;
+			table->cells.d[row*src->numCols+i] = v;
+		}
+	}
+	retval = true;
+
+cleanup:
+	if (retval == false)
+		DestroyTable(table);
+	EA_DESTROY(names);
+	EA_DESTROY(types);
+	EA_DESTROY(keys);
+	xfree(header);
+	return retval;
+}
+
+/* Split a line at tabs, in place.  Returns the number of fields.  */
+static unsigned SplitFields(char* line, char_ptr_array* fields)
+{
+	EA_APPEND(*fields, line);
+	while ((line = strchr(line, '\t')) != NULL)
+	{
+		*line++ = '\0';
+		EA_APPEND(*fields, line);
+	}
+	return fields->len;
+}
+
+static int String_qsort(const void* e1, const void* e2)
+{
+	return strcmp(strings.d[*(const unsigned*)e1],
+				  strings.d[*(const unsigned*)e2]);
+}
+
+static int DbRow_qsort(const void* e1, const void* e2)
+{
+	unsigned numCols = sortTable->cols.len;
+	const uint32_t* row1 = &sortTable->cells.d[*(const unsigned*)e1 * numCols];
+	const uint32_t* row2 = &sortTable->cells.d[*(const unsigned*)e2 * numCols];
+	unsigned i;
+	for (i = 0; i < numCols && (sortTable->cols.d[i].type & MSITYPE_KEY);
+		 i++)
+	{
+		if (row1[i] != row2[i])
+			return (row1[i] < row2[i]) ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Encode the rows of a table, sorted by primary key, into a newly
+   allocated stream.  */
+static unsigned char* EncodeTable(DbTable* table, unsigned refBytes,
+								  size_t* size)
+{
+	unsigned numCols = table->cols.len;
+	unsigned numRows = table->numRows;
+	unsigned* rowOrder;
+	unsigned char* stream;
+	unsigned char* colData;
+	size_t rowWidth = 0;
+	unsigned i, row;
+
+	rowOrder = (unsigned*)xmalloc(sizeof(unsigned) * numRows);
+	for (row = 0; row < numRows; row++)
+		rowOrder[row] = row;
+	sortTable = table;
+	qsort(rowOrder, numRows, sizeof(unsigned), DbRow_qsort);
+
+	for (i = 0; i < numCols; i++)
+		rowWidth += ColumnWidth(table->cols.d[i].type, refBytes);
+	*size = rowWidth * numRows;
+	stream = (unsigned char*)xmalloc(*size + 1);
+	colData = stream;
+	for (i = 0; i < numCols; i++)
+	{
+		unsigned width = ColumnWidth(table->cols.d[i].type, refBytes);
+		for (row = 0; row < numRows; row++)
+			PutN(colData + row * width,
+				 table->cells.d[rowOrder[row]*numCols+i], width);
+		colData += (size_t)width * numRows;
+	}
+	xfree(rowOrder);
+	return stream;
+}
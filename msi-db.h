@@ -0,0 +1,38 @@
+/* msi-db.h -- write tables directly into a Windows Installer database.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef MSI_DB_H
+#define MSI_DB_H
+
+typedef struct MsiTable_t MsiTable;
+typedef struct MsiStream_t MsiStream;
+
+/* One table in the same form as an IDT file: `header' holds the three
+   tab-separated header lines (column names, column types, and the
+   table name followed by the key columns), and `cells' holds
+   `numRows' rows of `numCols' values each.  Empty values are
+   nulls.  */
+struct MsiTable_t
+{
+	const char* header;
+	unsigned numCols;
+	char** cells;
+	unsigned numRows;
+};
+
+/* A file to embed as a stream, such as a cabinet.  */
+struct MsiStream_t
+{
+	const char* name;
+	const char* path;
+};
+
+int MergeMsiDatabase(const char* dbPath, MsiTable* tables, unsigned numTables,
+					 MsiStream* streams, unsigned numStreams);
+
+#endif /* not MSI_DB_H */
@@ -62,8 +62,8 @@ See the file "UNLICENSE" in the top level directory for details.
    structure is never changed; thus, it can be safely shared.  If you
    need more information about the contents of the table structures,
    you should look at the relevent Windows Platform SDK documentation.
-   The major data structures `rootDir', `rootDirN', and `qsortFiles'
-   share all of their strings.  The only dynamic memory they own is
+   The major data structures `rootDir' and `rootDirN' share all of
+   their strings.  The only dynamic memory they own is
    the dynamic memory necessary to represent their array and tree
    structures.
 
@@ -101,16 +101,35 @@ See the file "UNLICENSE" in the top level directory for details.
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "xmalloc.h"
 #define ea_malloc xmalloc
 #define ea_realloc xrealloc
 #define ea_free xfree
 #include "exparray.h"
+#include "exphash.h"
 #include "bool.h"
+#include "thread-pool.h"
+#include "ring-queue.h"
+#include "file-hash.h"
+#include "file-stage.h"
+#include "path-glob.h"
+#include "short-name.h"
+#include "pe-version.h"
+#include "cab-writer.h"
+#include "msi-db.h"
+#include "msi-validate.h"
+#include "idt-file.h"
+#include "table-diff.h"
+#include "table-query.h"
 
 /* Define necessary types before including local headers.  */
 EA_TYPE(char);
+EA_SMALL_TYPE(char, 64);
+EA_DEFINE_SMALL_FUNCS(char);
 
 /* Local includes */
 #include "colon-parser.h"
@@ -119,12 +138,37 @@ EA_TYPE(char);
 
 typedef char* char_ptr;
 typedef struct DirTree_t DirTree;
+typedef DirTree* DirTree_ptr;
 typedef struct FileIndex_t FileIndex;
+typedef struct PackStrategy_t PackStrategy;
+typedef ShortNameSet* ShortNameSet_ptr;
+typedef struct FileMeta_t FileMeta;
+typedef FileMeta* FileMeta_ptr;
 
 EA_TYPE(char_ptr);
+EA_DEFINE_FUNCS(char_ptr);
 EA_TYPE(unsigned);
 EA_TYPE(DirTree);
+EA_TYPE(DirTree_ptr);
 EA_TYPE(FileIndex);
+EA_TYPE(ShortNameSet_ptr);
+EA_TYPE(FileMeta_ptr);
+EH_MAP_TYPE(name_map, eh_strview, unsigned);
+EH_DEFINE_MAP_FUNCS(name_map, eh_strview, unsigned,
+					eh_strview_hash, eh_strview_equal);
+
+/* A `FeatureComponents' row */
+typedef struct FeatCompKey_t FeatCompKey;
+struct FeatCompKey_t
+{
+	char* featureID;
+	char* compID;
+};
+
+unsigned FeatCompHash(FeatCompKey key);
+int FeatCompEqual(FeatCompKey key1, FeatCompKey key2);
+EH_SET_TYPE(featcomp_set, FeatCompKey);
+EH_DEFINE_SET_FUNCS(featcomp_set, FeatCompKey, FeatCompHash, FeatCompEqual);
 
 /* Structure definitions */
 
@@ -134,13 +178,40 @@ struct DirTree_t
 	unsigned tableRow;
 	char* dirKey;
 	char* component;
+	/* The row of `component' in compTable */
+	unsigned compRow;
 	unsigned compRefCount; /* currently unnecessary */
 	/* Were components created for separate groupings of files within
 	   the same directory?  */
 	bool fileComps;
 	DirTree_array children;
-	/* Indices into fileTable, currently unnecessary */
+	/* Indices into fileTable */
 	unsigned_array fileIdcs;
+	/* Indices into `children' by name and into `fileIdcs' by long
+	   file name, kept up to date as they are added */
+	name_map childNames;
+	name_map fileNames;
+	/* The component that holds the files of this directory which are
+	   listed individually for the feature with index `indivFeature'.  */
+	char* indivComp;
+	unsigned indivFeature;
+};
+
+/* What the metadata stage finds out about one file.  Only the thread
+   that takes the file from `metaQueue' writes to it until the stage is
+   finished.  */
+struct FileMeta_t
+{
+	/* Shared with `filePaths' */
+	const char* path;
+	const char* fileID;
+	/* With `-r', the path the file was moved to */
+	char* newPath;
+	unsigned size;
+	bool found;
+	bool isPe;
+	bool hasVersion;
+	PeVersion version;
 };
 
 struct FileIndex_t
@@ -149,6 +220,27 @@ struct FileIndex_t
 	unsigned tableIndex;
 };
 
+/* Component Packing Callback
+
+   Divides the files of one directory that are installed by the same
+   features into components.
+
+   Parameters:
+   unsigned* rows -- the `File' table rows of the files
+   unsigned numRows -- the number of files
+   unsigned* bins -- receives the zero-based component number of every
+                     file, where the first file of each component must
+                     come before the first file of the next one
+
+   Returns the number of components.  */
+typedef unsigned (* PackFunc)(unsigned*, unsigned, unsigned*);
+
+struct PackStrategy_t
+{
+	const char* name;
+	PackFunc pack;
+};
+
 /* Container helper functions */
 
 int FileIndex_qsort(const void* e1, const void* e2)
@@ -162,10 +254,52 @@ char_ptr_array compTable;		const unsigned compCols = 6;
 char_ptr_array fileTable;		const unsigned fileCols = 8;
 char_ptr_array featureTable;	const unsigned featureCols = 8;
 char_ptr_array featCompTable;	const unsigned featCompCols = 2;
+char_ptr_array fileHashTable;	const unsigned fileHashCols = 6;
+char_ptr_array dupFileTable;	const unsigned dupFileCols = 5;
+/* Source path name of each `File' table row, owned by this array.  */
+char_ptr_array filePaths;
+/* The last sequence number within each cabinet, one per `Media'
+   table row.  */
+unsigned_array cabLastSeq;
+/* The metadata stage.  Every file row is pushed onto `metaQueue' as
+   soon as the listings name it, and worker threads open it while the
+   rest of the input is parsed.  `metaBlocks' holds the `FileMeta' of
+   every row in blocks of `META_BLOCK', so that they never move.  */
+#define META_BLOCK 1024
+RingQueue* metaQueue = NULL;
+FileMeta_ptr_array metaBlocks;
+unsigned numMetaFiles = 0;
 
 /* Global parameter variables */
 char* idPrefix = "";
 bool renameFiles = false;
+bool hashFiles = false;
+bool writeCabinet = false;
+bool dedupFiles = false;
+char* msiDatabase = NULL;
+/* Directory to place copies of the files in for `cabarc'.  */
+char* stageDir = NULL;
+/* Directory to lay out the files in uncompressed, as in an
+   administrative image.  */
+char* layoutDir = NULL;
+/* Features nested deeper than this share the cabinet of their
+   ancestor.  Zero puts all files into one cabinet.  */
+unsigned cabDepth = 0;
+bool sortFiles = false;
+/* The component packing strategy, or NULL to keep the components
+   created while parsing.  */
+const PackStrategy* packStrategy = NULL;
+/* Size limit of the `size' packing strategy in KiB.  */
+unsigned packSizeLimit = 1024;
+bool packReport = false;
+/* Only read the parts of the listings that `features.txt' refers
+   to.  */
+bool lazyTree = false;
+bool validateTables = false;
+/* The number of threads to use, or zero for one per processor, and
+   whether to print how busy they were.  */
+unsigned numThreads = 0;
+bool poolReport = false;
 char* progDirName = "";
 char* progDirID = NULL;
 
@@ -178,7 +312,9 @@ DirTree_array rootDirN;
 /* `rootNameN' owns the names of all root directories other than the
    first.  */
 char_ptr_array rootNameN;
-FileIndex_array qsortFiles; /* currently unnecessary */
+/* Root directories by name: 0 for `rootDir' and i + 1 for
+   `rootDirN.d[i]' */
+name_map rootNames;
 
 /* Parser callback state variables */
 char_ptr_array dirStack;
@@ -186,13 +322,36 @@ char_ptr_array dirStack;
    into the `Directory' table.  The indices refer to the start of the
    row.  */
 unsigned_array dirStkAssoc;
+/* The short names used within each directory, indexed by `Directory'
+   table row and created when first needed.  */
+ShortNameSet_ptr_array dirShortNames;
 bool firstList;
 bool addedComponent;
 char* dirID;
+/* With `lazyTree', the patterns of all items in the feature file, and
+   the pattern states of the directory being read.  The directory is
+   skipped if there are no states.  */
+GlobSet* listFilter = NULL;
+unsigned* listStates = NULL;
+unsigned* listNext = NULL;
+unsigned listNumStates;
 char_ptr_array featStack;
 unsigned_array featStkAssoc;
-bool reusedComponent;
-DirTree* lastDir = NULL;
+/* Items listed for the current feature, and whether there are any
+   patterns among them.  */
+char_ptr_array featItems;
+bool featPatterns = false;
+/* The directories named by the previous item in the feature file, so
+   that the next item can start where its path differs.
+   `featCursorEnds' holds the position of the slash after each of
+   them in `featCursorPath'.  */
+char_array featCursorPath;
+DirTree_ptr_array featCursorDirs;
+unsigned_array featCursorEnds;
+/* The rows of `featCompTable' while the feature file is read */
+featcomp_set featComps;
+/* The number of rows that were left out as duplicates.  */
+unsigned featCompDups = 0;
 
 /* Parser callback functions */
 int LSRAddBody(unsigned curLevel, char_array* colonLabel);
@@ -201,25 +360,123 @@ int LSRAddItem(char_array* itemName);
 int FeatAddBody(unsigned curLevel, char_array* colonLabel);
 int FeatRemoveLevels(unsigned testLevel);
 int FeatAddItem(char_array* itemName);
+int FeatAddPath(char* path, unsigned len);
+void FeatAddFile(DirTree* dir, unsigned colStart);
+void MoveDirKeyPath(DirTree* dir, unsigned colStart);
+void FeatGlobDir(GlobSet* set, DirTree* dir, unsigned* states,
+				 unsigned numStates);
+int FeatFlushItems();
+int FilterAddBody(unsigned curLevel, char_array* colonLabel);
+int FilterRemoveLevels(unsigned testLevel);
+int FilterAddItem(char_array* itemName);
+int ReadListFilter();
 
 /* Helper functions */
 void DisplayCmdHelp();
-void GenerateTables();
+int GenerateTables();
+int BuildFileHashTable();
+void StartMetadataStage();
+void QueueFileMetadata(const char* path, const char* fileID,
+					   const char* longName);
+void StopMetadataStage();
+int FinishMetadataStage();
+void FreeFileMeta();
+int FileSeq_qsort(const void* e1, const void* e2);
+void BuildKeyIndex(FileIndex_array* index, char_ptr_array* table,
+				   unsigned numCols);
+unsigned LookupKey(FileIndex_array* index, char* key);
+unsigned* FeatureParents(FileIndex_array* featIndex);
+int DedupFiles();
+unsigned PackByDirectory(unsigned* rows, unsigned numRows, unsigned* bins);
+unsigned PackByKeyFile(unsigned* rows, unsigned numRows, unsigned* bins);
+unsigned PackBySize(unsigned* rows, unsigned numRows, unsigned* bins);
+void RepackComponents();
+void PartitionCabinets();
+int FileCompress_qsort(const void* e1, const void* e2);
+void SequenceForCompression();
+char* CabinetName(unsigned index);
+int BuildCabinet();
+int WriteCabLists(const char* dir);
+int StageCabinetFiles();
+char* LongName(char* name);
+int LayoutAdminImage();
 char* GetUuid();
-unsigned FindFile(FileIndex_array* database, char* filename,
-				  unsigned begin, unsigned end);
+unsigned NameHash(const char* name, unsigned len);
+DirTree* FindChildDir(DirTree* dir, const char* name, unsigned len);
+unsigned FindFileInDir(DirTree* dir, const char* name);
 DirTree* FindAnyDirTree(char* path);
 DirTree* FindDirTree(DirTree* rootDir, char* path);
-void AddFeatComps(char_ptr_array* featCompTable, char* featureID,
-				  DirTree* curDir);
+char* DirShortName(unsigned colStart, const char* longName);
+void AddFeatComp(char* featureID, char* compID);
+void AddFeatComps(char* featureID, DirTree* dir);
 void FreeDirTree(DirTree* dir);
 
+/* Component packing strategies */
+const PackStrategy packStrategies[] =
+{
+	{ "dir", PackByDirectory },
+	{ "key", PackByKeyFile },
+	{ "size", PackBySize }
+};
+const unsigned numPackStrategies =
+	sizeof(packStrategies) / sizeof(PackStrategy);
+
+/* Columns that refer to other tables, for `-v' */
+const MsiForeignKey foreignKeys[] =
+{
+	{ "Directory", "Directory_Parent", "Directory" },
+	{ "Component", "Directory_", "Directory" },
+	{ "Component", "KeyPath", "File" },
+	{ "File", "Component_", "Component" },
+	{ "Feature", "Feature_Parent", "Feature" },
+	{ "Feature", "Directory_", "Directory" },
+	{ "FeatureComponents", "Feature_", "Feature" },
+	{ "FeatureComponents", "Component_", "Component" },
+	{ "MsiFileHash", "File_", "File" },
+	{ "DuplicateFile", "Component_", "Component" },
+	{ "DuplicateFile", "File_", "File" },
+	{ "DuplicateFile", "DestFolder", "Directory" }
+};
+const unsigned numForeignKeys =
+	sizeof(foreignKeys) / sizeof(MsiForeignKey);
+
 int main(int argc, char* argv[])
 {
 	int retval = 0;
 	char_ptr_array lsrFiles;
 	FILE* fp;
 
+	/* Subcommands that work on the tables written by earlier runs */
+	if (argc >= 2 && strcmp(argv[1], "diff") == 0)
+	{
+		unsigned numViolations;
+		if (argc != 4)
+		{
+			fputs("Usage: msi-tool diff OLD-DIR NEW-DIR\n", stderr);
+			return 1;
+		}
+		if (!ThreadPoolInit(0))
+			return 1;
+		retval = DiffTableSets(argv[2], argv[3], &numViolations);
+		ThreadPoolDestroy();
+		return (!retval || numViolations > 0) ? 1 : 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "query") == 0)
+	{
+		unsigned numUnanswered;
+		if (argc < 3)
+		{
+			fputs("Usage: msi-tool query DIR [QUESTION ...]\n", stderr);
+			return 1;
+		}
+		if (!ThreadPoolInit(0))
+			return 1;
+		retval = QueryTables(argv[2], (const char**)&argv[3], argc - 3,
+							 &numUnanswered);
+		ThreadPoolDestroy();
+		return (!retval || numUnanswered > 0) ? 1 : 0;
+	}
+
 	/* Initialization */
 	EA_INIT(char_ptr, lsrFiles, 16);
 	EA_INIT(char_ptr, dirTable, 16);
@@ -227,17 +484,29 @@ int main(int argc, char* argv[])
 	EA_INIT(char_ptr, fileTable, 16);
 	EA_INIT(char_ptr, featureTable, 16);
 	EA_INIT(char_ptr, featCompTable, 16);
+	EA_INIT(char_ptr, fileHashTable, 16);
+	EA_INIT(char_ptr, dupFileTable, 16);
+	EA_INIT(char_ptr, filePaths, 16);
+	EA_INIT(unsigned, cabLastSeq, 16);
+	EA_INIT(FileMeta_ptr, metaBlocks, 16);
 
 	EA_INIT(char_ptr, dirStack, 16);
 	EA_INIT(unsigned, dirStkAssoc, 16);
+	EA_INIT(ShortNameSet_ptr, dirShortNames, 16);
 
 	curDir = &rootDir;
 	EA_INIT(DirTree, rootDirN, 16);
 	EA_INIT(char_ptr, rootNameN, 16);
-	EA_INIT(FileIndex, qsortFiles, 16);
+	name_map_init(&rootNames);
+	featcomp_set_init(&featComps);
 
 	EA_INIT(char_ptr, featStack, 16);
 	EA_INIT(unsigned, featStkAssoc, 16);
+	EA_INIT(char_ptr, featItems, 16);
+	EA_INIT(char, featCursorPath, 16);
+	EA_APPEND(featCursorPath, '\0');
+	EA_INIT(DirTree_ptr, featCursorDirs, 16);
+	EA_INIT(unsigned, featCursorEnds, 16);
 
 	/* Process the command line.  */
 	if (argc == 1)
@@ -260,6 +529,94 @@ int main(int argc, char* argv[])
 				case 'r':
 					renameFiles = true;
 					break;
+				case 'H':
+					hashFiles = true;
+					break;
+				case 'c':
+					writeCabinet = true;
+					break;
+				case 'D':
+					dedupFiles = true;
+					break;
+				case 'm':
+					msiDatabase = &cmdArg[2];
+					break;
+				case 'a':
+					layoutDir = &cmdArg[2];
+					if (layoutDir[0] == '\0')
+					{
+						fprintf(stderr, "Missing layout directory: %s\n",
+								cmdArg);
+						retval = 1; goto cleanup;
+					}
+					break;
+				case 't':
+					stageDir = &cmdArg[2];
+					if (stageDir[0] == '\0')
+					{
+						fprintf(stderr, "Missing staging directory: %s\n",
+								cmdArg);
+						retval = 1; goto cleanup;
+					}
+					break;
+				case 's':
+					sortFiles = true;
+					break;
+				case 'k':
+				{
+					char* name = &cmdArg[2];
+					unsigned j;
+					/* A number selects `size' with that limit.  */
+					if (isdigit((int)name[0]))
+					{
+						packSizeLimit = (unsigned)atoi(name);
+						name = "size";
+					}
+					packStrategy = NULL;
+					for (j = 0; j < numPackStrategies; j++)
+					{
+						if (strcmp(packStrategies[j].name, name) == 0)
+							packStrategy = &packStrategies[j];
+					}
+					if (packStrategy == NULL || packSizeLimit == 0)
+					{
+						fprintf(stderr, "Unknown packing strategy: %s\n",
+								cmdArg);
+						retval = 1; goto cleanup;
+					}
+					break;
+				}
+				case 'K':
+					packReport = true;
+					break;
+				case 'l':
+					lazyTree = true;
+					break;
+				case 'v':
+					validateTables = true;
+					break;
+				case 'j':
+					numThreads = (unsigned)atoi(&cmdArg[2]);
+					if (numThreads == 0)
+					{
+						fprintf(stderr, "Invalid number of threads: %s\n",
+								cmdArg);
+						retval = 1; goto cleanup;
+					}
+					break;
+				case 'J':
+					poolReport = true;
+					break;
+				case 'f':
+					cabDepth = (cmdArg[2] != '\0') ?
+						(unsigned)atoi(&cmdArg[2]) : 1;
+					if (cabDepth == 0)
+					{
+						fprintf(stderr, "Invalid feature depth: %s\n",
+								cmdArg);
+						retval = 1; goto cleanup;
+					}
+					break;
 				case 'd':
 					progDirName = &cmdArg[2];
 					break;
@@ -280,6 +637,15 @@ int main(int argc, char* argv[])
 		fputs("Missing directory listing file name(s).\n", stderr);
 	if (progDirName[0] == '\0' || lsrFiles.len == 0)
 	{ retval = 1; goto cleanup; }
+	if (layoutDir != NULL && writeCabinet == true)
+	{
+		fputs("The `-a' and `-c' options cannot be used together.\n",
+			  stderr);
+		retval = 1; goto cleanup;
+	}
+	/* An administrative image has no cabinets to split.  */
+	if (layoutDir != NULL)
+		cabDepth = 0;
 
 	{
 		char* barPos;
@@ -301,6 +667,9 @@ int main(int argc, char* argv[])
 		strcat(progDirID, "DIR");
 	}
 
+	if (!ThreadPoolInit(numThreads))
+	{ retval = 1; goto cleanup; }
+
 	/* Open the uuid file.  */
 	uuidFP = fopen("uuids.txt", "r");
 	if (uuidFP == NULL)
@@ -309,6 +678,15 @@ int main(int argc, char* argv[])
 		retval = 1; goto cleanup;
 	}
 
+	/* Read the items of the feature file up front so that the
+	   listings can skip everything else.  */
+	if (lazyTree == true && !ReadListFilter())
+	{ retval = 1; goto cleanup; }
+
+	/* Files are opened while the listings and the feature file are
+	   parsed.  */
+	StartMetadataStage();
+
 	/* Parse the first ls -R listing.  */
 	firstList = true;
 	fp = fopen(lsrFiles.d[0], "r");
@@ -354,21 +732,6 @@ int main(int argc, char* argv[])
 		{ retval = 1; goto cleanup; }
 	}
 
-	/* Quick-sort a file lookup array.  */
-	{
-		unsigned i;
-		for (i = 0; i < fileTable.len; i += fileCols)
-		{
-			char* longName;
-			longName = strchr(fileTable.d[i+2], (int)'|') + 1;
-			qsortFiles.d[i/fileCols].name = longName;
-			qsortFiles.d[i/fileCols].tableIndex = i / fileCols;
-			EA_ADD(qsortFiles);
-		}
-		qsort(qsortFiles.d, qsortFiles.len, sizeof(FileIndex),
-			  FileIndex_qsort);
-	}
-
 	/* Open the feature file.  */
 	/* The feature file contains a list of features, and with each
 	   feature there is an associated list of files and possibly
@@ -383,16 +746,50 @@ int main(int argc, char* argv[])
 	}
 	retval = ParseLSRFile(fp, FeatAddBody, FeatRemoveLevels, FeatAddItem);
 	fclose(fp);
+	if (!retval || !FeatFlushItems())
+	{ retval = 1; goto cleanup; }
+	if (featCompDups > 0)
+	{
+		printf("Removed %u duplicate FeatureComponents rows.\n",
+			   featCompDups);
+	}
+	if (!FinishMetadataStage())
+	{ retval = 1; goto cleanup; }
+
+	/* Repacking may need new component GUIDs.  */
+	if (packStrategy != NULL || packReport == true)
+		RepackComponents();
 	fclose(uuidFP); uuidFP = NULL;
-	if (!retval)
+
+	if (dedupFiles == true && !DedupFiles())
+	{ retval = 1; goto cleanup; }
+
+	PartitionCabinets();
+	if (sortFiles == true)
+		SequenceForCompression();
+	if (hashFiles == true && !BuildFileHashTable())
 	{ retval = 1; goto cleanup; }
 
-	GenerateTables();
+	if (stageDir != NULL && !StageCabinetFiles())
+	{ retval = 1; goto cleanup; }
+	if (layoutDir != NULL && !LayoutAdminImage())
+	{ retval = 1; goto cleanup; }
+	/* The cabinet has to exist before it can be embedded.  */
+	if (writeCabinet == true && !BuildCabinet())
+	{ retval = 1; goto cleanup; }
+	if (!GenerateTables())
+	{ retval = 1; goto cleanup; }
+	if (poolReport == true)
+		ThreadPoolReport();
 	retval = 0;
 
 cleanup:
 	{
 		unsigned i;
+		/* The workers may still be reading the files.  */
+		StopMetadataStage();
+		FreeFileMeta();
+		xfree(metaBlocks.d);
 		if (uuidFP != NULL)
 			fclose(uuidFP);
 		xfree(lsrFiles.d);
@@ -414,6 +811,11 @@ cleanup:
 			xfree(fileTable.d[i]);
 			xfree(fileTable.d[i+2]);
 			xfree(fileTable.d[i+3]);
+			/* Version and Language are only owned when not empty.  */
+			if (fileTable.d[i+4][0] != '\0')
+				xfree(fileTable.d[i+4]);
+			if (fileTable.d[i+5][0] != '\0')
+				xfree(fileTable.d[i+5]);
 			xfree(fileTable.d[i+7]);
 		}
 		xfree(fileTable.d);
@@ -425,12 +827,33 @@ cleanup:
 		}
 		xfree(featureTable.d);
 		xfree(featCompTable.d);
+		featcomp_set_destroy(&featComps);
+		for (i = 0; i < fileHashTable.len; i += fileHashCols)
+		{
+			unsigned j;
+			for (j = 2; j < fileHashCols; j++)
+				xfree(fileHashTable.d[i+j]);
+		}
+		xfree(fileHashTable.d);
+		for (i = 0; i < dupFileTable.len; i += dupFileCols)
+		{
+			xfree(dupFileTable.d[i]);
+			xfree(dupFileTable.d[i+3]);
+		}
+		xfree(dupFileTable.d);
+		for (i = 0; i < filePaths.len; i++)
+			xfree(filePaths.d[i]);
+		xfree(filePaths.d);
+		xfree(cabLastSeq.d);
 		for (i = 0; i < dirStack.len; i++)
 		{
 			xfree(dirStack.d[i]);
 		}
 		xfree(dirStack.d);
 		xfree(dirStkAssoc.d);
+		for (i = 0; i < dirShortNames.len; i++)
+			ShortNameSetFree(dirShortNames.d[i]);
+		xfree(dirShortNames.d);
 		FreeDirTree(&rootDir);
 		for (i = 0; i < rootDirN.len; i++)
 		{
@@ -439,11 +862,22 @@ cleanup:
 		}
 		xfree(rootDirN.d);
 		xfree(rootNameN.d);
-		xfree(qsortFiles.d);
+		name_map_destroy(&rootNames);
 		for (i = 0; i < featStack.len; i++)
 			xfree(featStack.d[i]);
 		xfree(featStack.d);
 		xfree(featStkAssoc.d);
+		for (i = 0; i < featItems.len; i++)
+			xfree(featItems.d[i]);
+		xfree(featItems.d);
+		xfree(featCursorPath.d);
+		xfree(featCursorDirs.d);
+		xfree(featCursorEnds.d);
+		if (listFilter != NULL)
+			GlobFree(listFilter);
+		xfree(listStates);
+		xfree(listNext);
+		ThreadPoolDestroy();
 	}
 
 	return retval;
@@ -453,7 +887,12 @@ void DisplayCmdHelp()
 {
 	puts(
 "Ussage:\n\
-msi-tool [-pPREFIX] [-r] -dPROGFILES-DIRNAME LSR-FILE1 LSR-FILE2 ...\n\
+msi-tool [-pPREFIX] [-r] [-tSTAGEDIR] [-H] [-D] [-c] [-f[DEPTH]] [-s]\n\
+         [-aLAYOUTDIR] [-kPACKING] [-K] [-l] [-v] [-jTHREADS] [-J]\n\
+         [-mDATABASE]\n\
+         -dPROGFILES-DIRNAME LSR-FILE1 LSR-FILE2 ...\n\
+msi-tool diff OLD-DIR NEW-DIR\n\
+msi-tool query DIR [QUESTION ...]\n\
 \n\
 msi-tool reads in directory listing files, a feature specification\n\
 file, and a UUID file and generates corresponding tables for a Windows\n\
@@ -468,136 +907,282 @@ Options:\n\
   -r             Indicates that msi-tool should rename and move files\n\
                  to prepare for creating an embedded cabinet file.\n\
                  Optional.\n\
+\n\
+  -tSTAGEDIR     Like `-r', but leave the files in place and put\n\
+                 links or copies of them into STAGEDIR instead.\n\
+                 Optional.\n\
+\n\
+  -H             Compute MD5 hashes of all unversioned files and write\n\
+                 an `MsiFileHash' table.  Hashes are cached by file\n\
+                 identity in \"hashcache.txt\".  Optional.\n\
+\n\
+  -D             Store files with identical contents only once, and\n\
+                 install the other copies through a `DuplicateFile'\n\
+                 table.  Optional.\n\
+\n\
+  -c             Compress all files into the cabinet named in the\n\
+                 `Media' table, in the current working directory.\n\
+                 Optional.\n\
+\n\
+  -f[DEPTH]      Use one cabinet per feature, where features nested\n\
+                 deeper than DEPTH share the cabinet of their parent.\n\
+                 DEPTH defaults to 1, one cabinet per top-level\n\
+                 feature.  Optional.\n\
+\n\
+  -s             Order the files within each cabinet by type, name\n\
+                 and size, with small files first, so that similar\n\
+                 files are compressed together.  Optional.\n\
+\n\
+  -aLAYOUTDIR    Do not use a cabinet.  Instead, link or copy the\n\
+                 files uncompressed into LAYOUTDIR in the directory\n\
+                 structure that Windows Installer expects next to\n\
+                 the installer database.  Cannot be combined with\n\
+                 `-c'.  Optional.\n\
+\n\
+  -kPACKING      Choose how files are grouped into components: `dir'\n\
+                 for one component per directory and feature, `key'\n\
+                 to also give every versioned file its own\n\
+                 component, `size' for groups of at most 1024 KiB,\n\
+                 or a number for groups of at most that many KiB.\n\
+                 Optional.\n\
+\n\
+  -K             Print the number of components and the size of the\n\
+                 `Component' and `FeatureComponents' tables that each\n\
+                 packing would produce.  Optional.\n\
+\n\
+  -l             Only read the files and directories of the listings\n\
+                 that \"features.txt\" refers to, and leave out the\n\
+                 rest.  Optional.\n\
+\n\
+  -v             Check the generated tables for empty or overlong\n\
+                 cells, duplicate keys, references to missing rows,\n\
+                 and gaps in the file sequence.  The tables are not\n\
+                 merged into the database given with `-m' if there\n\
+                 are errors.  Optional.\n\
+\n\
+  -jTHREADS      Use THREADS threads for reading, hashing,\n\
+                 compressing, and writing files.  Defaults to one\n\
+                 thread per processor.  Optional.\n\
+\n\
+  -J             Print how busy each thread was.  Optional.\n\
+\n\
+  -mDATABASE     Also merge the generated tables into the existing\n\
+                 installer database DATABASE, replacing tables of the\n\
+                 same name.  With `-c', the cabinet is embedded too.\n\
+                 Optional.\n\
 \n\
   -dPROGFILES-DIRNAME  The name of the application's directory that will\n\
                        be located within the Program Files folder.\n\
                        This option should take the form\n\
-                       `shrtname|long-long-name'.");
+                       `shrtname|long-long-name'.\n\
+\n\
+`msi-tool diff' compares the `File', `Component', and\n\
+`FeatureComponents' tables written to OLD-DIR and NEW-DIR by two runs.\n\
+It lists the rows that were added (+), removed (-), and changed (~),\n\
+and components that kept their GUID although their key path or files\n\
+changed (!).  The exit status is 1 if there are any such components.\n\
+\n\
+`msi-tool query' loads the tables written to DIR by a run and answers\n\
+each QUESTION, or each line of standard input if there are none:\n\
+\n\
+  file NAME      The components and features of every file named\n\
+                 NAME, which may include the path of its directory.\n\
+\n\
+  dir PATH       The components installed into the directory with\n\
+                 the key or path PATH.\n\
+\n\
+  feature NAME   The number of components, files, and bytes of the\n\
+                 feature with the key or title NAME.\n\
+\n\
+  features       The size of every feature.");
 }
 
-void GenerateTables()
+/* The number of IDT files that `WriteIdtTask()' could not write */
+static unsigned idtFailures = 0;
+
+static void WriteIdtTask(void* data)
 {
-	FILE* fp;
+	if (!WriteIdtFile((MsiTable*)data))
+		__sync_fetch_and_add(&idtFailures, 1);
+}
+
+/* Write all tables as IDT files, and also into the installer database
+   given with `-m' if any.  Returns nonzero on success, zero on
+   failure.  */
+int GenerateTables()
+{
+	MsiTable tables[8];
+	unsigned numTables = 0;
+	char_ptr_array dirRows;
+	char_ptr_array mediaRows;
+	MsiStream* cabStreams;
+	int retval = 1;
 	unsigned i;
 
-	fp = fopen("Directory.idt", "w");
-	fputs(
-		"Directory\tDirectory_Parent\tDefaultDir\n"
-		"s72\tS72\tl255\n"
-		"Directory\tDirectory\n", fp);
-	fputs("TARGETDIR\t\tSourceDir\n", fp);
-	fputs("ProgramFilesFolder\tTARGETDIR\t.\n", fp);
-	fprintf(fp, "%s\tProgramFilesFolder\t%s\n", progDirID, progDirName);
-	fprintf(fp, "%s\t%s\t.\n", dirTable.d[0], dirTable.d[1]);
-	for (i = dirCols; i < dirTable.len; i += dirCols)
+	/* The `Directory' table starts with the standard folders.  */
+	EA_INIT(char_ptr, dirRows, dirTable.len + 16);
+	EA_APPEND(dirRows, "TARGETDIR");
+	EA_APPEND(dirRows, "");
+	EA_APPEND(dirRows, "SourceDir");
+	EA_APPEND(dirRows, "ProgramFilesFolder");
+	EA_APPEND(dirRows, "TARGETDIR");
+	EA_APPEND(dirRows, ".");
+	EA_APPEND(dirRows, progDirID);
+	EA_APPEND(dirRows, "ProgramFilesFolder");
+	EA_APPEND(dirRows, progDirName);
+	EA_APPEND(dirRows, dirTable.d[0]);
+	EA_APPEND(dirRows, dirTable.d[1]);
+	EA_APPEND(dirRows, ".");
 	{
-		unsigned j;
-		fputs(dirTable.d[i], fp);
-		for (j = 1; j < dirCols; j++)
-		{
-			fputs("\t", fp);
-			fputs(dirTable.d[i+j], fp);
-		}
-		fputs("\n", fp);
+		unsigned numCells = dirTable.len - dirCols;
+		EA_APPEND_MULT(dirRows, dirTable.d + dirCols, numCells);
 	}
-	fclose(fp);
-	fp = fopen("Component.idt", "w");
-	fputs(
-		"Component\tComponentId\tDirectory_\tAttributes\tCondition\tKeyPath\n"
-		"s72\tS38\ts72\ti2\tS255\tS72\n"
-		"Component\tComponent\n", fp);
-	for (i = 0; i < compTable.len; i += compCols)
+
+	/* One `Media' row per cabinet.  The `Cabinet' column refers to an
+	   embedded stream by prefixing its name with `#', and is empty for
+	   an administrative image.  */
+	EA_INIT(char_ptr, mediaRows, cabLastSeq.len * 6);
+	cabStreams = (MsiStream*)xmalloc(sizeof(MsiStream) * cabLastSeq.len);
+	for (i = 0; i < cabLastSeq.len; i++)
 	{
-		unsigned j;
-		fputs(compTable.d[i], fp);
-		for (j = 1; j < compCols; j++)
-		{
-			fputs("\t", fp);
-			fputs(compTable.d[i+j], fp);
-		}
-		fputs("\n", fp);
+		char* diskId;
+		char* lastSequence;
+		char* cabName;
+		char* cabinet;
+		diskId = (char*)xmalloc(11 + 1);
+		sprintf(diskId, "%u", i + 1);
+		lastSequence = (char*)xmalloc(11 + 1);
+		sprintf(lastSequence, "%u", cabLastSeq.d[i]);
+		cabName = CabinetName(i);
+		cabinet = (char*)xmalloc(1 + strlen(cabName) + 1);
+		if (layoutDir != NULL)
+			cabinet[0] = '\0'; /* Files are stored uncompressed */
+		else
+			sprintf(cabinet, "#%s", cabName);
+		EA_APPEND(mediaRows, diskId);
+		EA_APPEND(mediaRows, lastSequence);
+		EA_APPEND(mediaRows, "");
+		EA_APPEND(mediaRows, cabinet);
+		EA_APPEND(mediaRows, "");
+		EA_APPEND(mediaRows, "");
+		cabStreams[i].name = cabName;
+		cabStreams[i].path = cabName;
 	}
-	fclose(fp);
-	fp = fopen("File.idt", "w");
-	fputs(
+
+	tables[numTables].header =
+		"Directory\tDirectory_Parent\tDefaultDir\n"
+		"s72\tS72\tl255\n"
+		"Directory\tDirectory\n";
+	tables[numTables].numCols = dirCols;
+	tables[numTables].cells = dirRows.d;
+	tables[numTables++].numRows = dirRows.len / dirCols;
+	tables[numTables].header =
+		"Component\tComponentId\tDirectory_\tAttributes\tCondition\tKeyPath\n"
+		"s72\tS38\ts72\ti2\tS255\tS72\n"
+		"Component\tComponent\n";
+	tables[numTables].numCols = compCols;
+	tables[numTables].cells = compTable.d;
+	tables[numTables++].numRows = compTable.len / compCols;
+	tables[numTables].header =
 		"File\tComponent_\tFileName\tFileSize\tVersion\tLanguage\t"
 		  "Attributes\tSequence\n"
 		"s72\ts72\tl255\ti4\tS72\tS20\tI2\ti2\n"
-		"File\tFile\n", fp);
-	for (i = 0; i < fileTable.len; i += fileCols)
-	{
-		unsigned j;
-		fputs(fileTable.d[i], fp);
-		for (j = 1; j < fileCols; j++)
-		{
-			fputs("\t", fp);
-			fputs(fileTable.d[i+j], fp);
-		}
-		fputs("\n", fp);
-	}
-	fclose(fp);
-	fp = fopen("Feature.idt", "w");
-	fputs(
+		"File\tFile\n";
+	tables[numTables].numCols = fileCols;
+	tables[numTables].cells = fileTable.d;
+	tables[numTables++].numRows = fileTable.len / fileCols;
+	tables[numTables].header =
 		"Feature\tFeature_Parent\tTitle\tDescription\tDisplay\tLevel\t"
 		  "Directory_\tAttributes\n"
 		"s38\tS38\tL64\tL255\tI2\ti2\tS72\ti2\n"
-		"Feature\tFeature\n", fp);
-	for (i = 0; i < featureTable.len; i += featureCols)
-	{
-		unsigned j;
-		fputs(featureTable.d[i], fp);
-		for (j = 1; j < featureCols; j++)
-		{
-			fputs("\t", fp);
-			fputs(featureTable.d[i+j], fp);
-		}
-		fputs("\n", fp);
-	}
-	fclose(fp);
-	fp = fopen("FeatureComponents.idt", "w");
-	fputs(
+		"Feature\tFeature\n";
+	tables[numTables].numCols = featureCols;
+	tables[numTables].cells = featureTable.d;
+	tables[numTables++].numRows = featureTable.len / featureCols;
+	tables[numTables].header =
 		"Feature_\tComponent_\n"
 		"s38\ts72\n"
-		"FeatureComponents\tFeature_\tComponent_\n", fp);
-	for (i = 0; i < featCompTable.len; i += featCompCols)
+		"FeatureComponents\tFeature_\tComponent_\n";
+	tables[numTables].numCols = featCompCols;
+	tables[numTables].cells = featCompTable.d;
+	tables[numTables++].numRows = featCompTable.len / featCompCols;
+	tables[numTables].header =
+		"DiskId\tLastSequence\tDiskPrompt\tCabinet\tVolumeLabel\tSource\n"
+		"i2\ti2\tL64\tS255\tS32\tS72\n"
+		"Media\tDiskId\n";
+	tables[numTables].numCols = 6;
+	tables[numTables].cells = mediaRows.d;
+	tables[numTables++].numRows = cabLastSeq.len;
+	if (hashFiles == true)
 	{
-		unsigned j;
-		fputs(featCompTable.d[i], fp);
-		for (j = 1; j < featCompCols; j++)
+		tables[numTables].header =
+			"File_\tOptions\tHashPart1\tHashPart2\tHashPart3\tHashPart4\n"
+			"s72\ti2\ti4\ti4\ti4\ti4\n"
+			"MsiFileHash\tFile_\n";
+		tables[numTables].numCols = fileHashCols;
+		tables[numTables].cells = fileHashTable.d;
+		tables[numTables++].numRows = fileHashTable.len / fileHashCols;
+	}
+	if (dedupFiles == true)
+	{
+		tables[numTables].header =
+			"FileKey\tComponent_\tFile_\tDestName\tDestFolder\n"
+			"s72\ts72\ts72\tL255\tS72\n"
+			"DuplicateFile\tFileKey\n";
+		tables[numTables].numCols = dupFileCols;
+		tables[numTables].cells = dupFileTable.d;
+		tables[numTables++].numRows = dupFileTable.len / dupFileCols;
+	}
+
+	if (validateTables == true)
+		retval = ValidateMsiTables(tables, numTables,
+								   foreignKeys, numForeignKeys);
+	/* The IDT files are written in the background while the tables
+	   are merged into the database.  The largest table is started
+	   first since it takes the longest.  */
+	{
+		unsigned largest = 0;
+		idtFailures = 0;
+		for (i = 1; i < numTables; i++)
+		{
+			if (tables[i].numRows > tables[largest].numRows)
+				largest = i;
+		}
+		for (i = 0; i < numTables; i++)
 		{
-			fputs("\t", fp);
-			fputs(featCompTable.d[i+j], fp);
+			SubmitTask(WriteIdtTask, &tables[i],
+					   (i == largest) ? TASK_HIGH : TASK_NORMAL);
 		}
-		fputs("\n", fp);
 	}
-	fclose(fp);
-	fp = fopen("Media.idt", "w");
-	fputs(
-		"DiskId\tLastSequence\tDiskPrompt\tCabinet\tVolumeLabel\tSource\n"
-		"i2\ti2\tL64\tS255\tS32\tS72\n"
-		"Media\tDiskId\n", fp);
-	fprintf(fp, "1\t%u\t\t#%sarchive.cab\t\t\n", fileTable.len / fileCols,
-		idPrefix);
-	fclose(fp);
-	if (renameFiles == true)
+	if (msiDatabase != NULL && retval)
 	{
-		char* filename = "cablist.txt";
-		char* pathname;
-		pathname = (char*)xmalloc(strlen(rootDir.name) + 1 +
-								  strlen(filename) + 1);
-		sprintf(pathname, "%s/%s", rootDir.name, filename);
-		fp = fopen(pathname, "w");
-		for (i = 0; i < fileTable.len / fileCols; i++)
-			fprintf(fp, "%sf%u\n", idPrefix, i);
-		fclose(fp);
-		xfree(pathname);
+		retval = MergeMsiDatabase(msiDatabase, tables, numTables, cabStreams,
+								  (writeCabinet == true) ? cabLastSeq.len : 0);
+	}
+	WaitForTasks();
+	if (idtFailures > 0)
+		retval = 0;
+
+	if (renameFiles == true && !WriteCabLists(rootDir.name))
+		retval = 0;
+	for (i = 0; i < mediaRows.len; i += 6)
+	{
+		xfree(mediaRows.d[i]);
+		xfree(mediaRows.d[i+1]);
+		xfree(mediaRows.d[i+3]);
 	}
+	for (i = 0; i < cabLastSeq.len; i++)
+		xfree((char*)cabStreams[i].name);
+	xfree(cabStreams);
+	xfree(mediaRows.d);
+	xfree(dirRows.d);
+	return retval;
 }
 
 int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 {
 	unsigned curPos;
-	char_array dirName;
+	char_small_array dirName;
 	unsigned pathPart;
     /* `backDirs' is true if the code had to go up in the directory
 	   hierarchy, as in `cd ..'.  "Back" is for backwards in a path
@@ -605,8 +1190,8 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 	bool backDirs;
 
 	curPos = 0;
-	EA_INIT(char, dirName, 16);
-	EA_APPEND(dirName, '\0');
+	char_small_array_init(&dirName);
+	char_small_array_append(&dirName, '\0');
 
 	pathPart = 0;
 	backDirs = false;
@@ -618,7 +1203,7 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 		{
 			/* Check with the directory stack.  */
 			if (dirStack.len > pathPart &&
-				strcmp(dirStack.d[pathPart], dirName.d) != 0)
+				strcmp(dirStack.d[pathPart], dirName.ea.d) != 0)
 			{
 				/* Pop all later directories off of the stack.  */
 				unsigned i;
@@ -636,13 +1221,13 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 			else if (dirStack.len <= pathPart)
 				backDirs = false;
 			if ((dirStack.len > pathPart &&
-				 strcmp(dirStack.d[pathPart], dirName.d) != 0) ||
+				 strcmp(dirStack.d[pathPart], dirName.ea.d) != 0) ||
 				dirStack.len <= pathPart)
 			{
 				char* newDirPart;
 				DirTree* existDir;
-				newDirPart = (char*)xmalloc(dirName.len);
-				strcpy(newDirPart, dirName.d);
+				newDirPart = (char*)xmalloc(dirName.ea.len);
+				strcpy(newDirPart, dirName.ea.d);
 				EA_APPEND(dirStack, newDirPart);
 				EA_APPEND(dirStkAssoc, dirTable.len);
 				/* If the directory already exists, add the
@@ -681,17 +1266,39 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 				}
 			}
 			/* Clear the directory name.  */
-			dirName.len = 1;
-			dirName.d[0] = '\0';
+			dirName.ea.len = 1;
+			dirName.ea.d[0] = '\0';
 			pathPart++;
 			if (colonLabel->d[curPos] == '\0')
 				break;
 		}
 		else
-			EA_INSERT(dirName, dirName.len - 1, colonLabel->d[curPos]);
+			char_small_array_insert(&dirName, dirName.ea.len - 1,
+									colonLabel->d[curPos]);
 		curPos++;
 	}
-	xfree(dirName.d);
+	char_small_array_destroy(&dirName);
+
+	/* Skip directories that no item of the feature file can refer to.
+	   Since all of their subdirectories are skipped too, the
+	   directory tree never has to descend through a skipped
+	   directory.  The root directory itself is always kept.  */
+	addedComponent = false;
+	if (listFilter != NULL)
+	{
+		unsigned i;
+		listNumStates = GlobStep(listFilter, NULL, 0, dirStack.d[0],
+								 listStates);
+		for (i = 1; i < dirStack.len && listNumStates > 0; i++)
+		{
+			unsigned* swap;
+			listNumStates = GlobStep(listFilter, listStates, listNumStates,
+									 dirStack.d[i], listNext);
+			swap = listStates; listStates = listNext; listNext = swap;
+		}
+		if (listNumStates == 0 && dirStack.len > 1)
+			return 1;
+	}
 
 	/* Build the directory and component tables.  */
 	/* Directories only count as components if there are files other
@@ -700,6 +1307,7 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 		unsigned colStart;
 		unsigned dirTableRow;
 		char* newDir;
+		char* shortName;
 		DirTree* existDir;
 		/* If this isn't the first time, never add a new
 		   directory for the root.  */
@@ -728,17 +1336,33 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 		{
 			/* Add a directory row.  */
 			colStart = dirTable.len;
-			EA_SET_SIZE(dirTable, dirTable.len + dirCols);
+			char_ptr_array_set_size(&dirTable, dirTable.len + dirCols);
 			dirID = (char*)xmalloc(strlen(idPrefix) + 1 + 11 + 1);
 			dirTableRow = dirTable.len / dirCols - 1;
-			sprintf(dirID, "%sd%u", idPrefix, dirTable.len / dirCols - 1);
+			sprintf(dirID, "%sd%u", idPrefix,
+					(unsigned)(dirTable.len / dirCols - 1));
 			dirTable.d[colStart] = dirID;
-			newDir = (char*)xmalloc(strlen(dirID) + 1 +
+			/* The first root directory is written as `.', so its short
+			   name does not matter.  */
+			if (dirStkAssoc.len > 1)
+			{
+				shortName = DirShortName(dirStkAssoc.d[dirStkAssoc.len-2],
+										 dirStack.d[dirStack.len-1]);
+				if (shortName == NULL)
+					return 0;
+			}
+			else
+			{
+				shortName = (char*)xmalloc(strlen(dirID) + 1);
+				strcpy(shortName, dirID);
+			}
+			newDir = (char*)xmalloc(strlen(shortName) + 1 +
 									strlen(dirStack.d[dirStack.len-1]) + 1);
 			newDir[0] = '\0';
-			strcat(newDir, dirID);
+			strcat(newDir, shortName);
 			strcat(newDir, "|");
 			strcat(newDir, dirStack.d[dirStack.len-1]);
+			xfree(shortName);
 			dirTable.d[colStart+2] = newDir;
 			/* Connect the parent directory.  */
 			if (dirStkAssoc.len > 1)
@@ -765,6 +1389,7 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 				/* This is the first time visiting the first root
 				   directory (curDir == &rootDir).  */
 				curDir->name = strchr(dirTable.d[colStart+2], (int)'|') + 1;
+				name_map_insert(&rootNames, eh_strview_cstr(curDir->name), 0);
 			}
 			else
 			{
@@ -776,6 +1401,8 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 				strcpy(rootName, dirStack.d[0]);
 				curDir->name = rootName;
 				EA_APPEND(rootNameN, rootName);
+				name_map_insert(&rootNames, eh_strview_cstr(rootName),
+								curRoot + 1);
 			}
 			curDir->tableRow = 0;
 			curDir->dirKey = dirTable.d[colStart];
@@ -784,6 +1411,10 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 			curDir->fileComps = false;
 			EA_INIT(DirTree, curDir->children, 16);
 			EA_INIT(unsigned, curDir->fileIdcs, 16);
+			name_map_init(&curDir->childNames);
+			name_map_init(&curDir->fileNames);
+			curDir->indivComp = NULL;
+			curDir->indivFeature = (unsigned)-1;
 		}
 		else
 		{
@@ -799,16 +1430,10 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 				/* Traverse the directory hierarchy.  */
 				for (i = 0; i < dirStack.len - 1; i++)
 				{
-					unsigned j;
-					for (j = 0; j < curDir->children.len; j++)
-					{
-						if (strcmp(dirStack.d[i],
-								   curDir->children.d[j].name) == 0)
-						{
-							curDir = &curDir->children.d[j];
-							break;
-						}
-					}
+					DirTree* child = FindChildDir(curDir, dirStack.d[i],
+												  strlen(dirStack.d[i]));
+					if (child != NULL)
+						curDir = child;
 				}
 			}
 			/* Initialize and add the directory tree item.  */
@@ -824,13 +1449,20 @@ int LSRAddBody(unsigned curLevel, char_array* colonLabel)
 											 children.len].children), 16);
 			EA_INIT(unsigned, (curDir->children.d[curDir->
 											  children.len].fileIdcs), 16);
+			name_map_init(&curDir->children.d[curDir->
+											  children.len].childNames);
+			name_map_init(&curDir->children.d[curDir->
+											  children.len].fileNames);
+			curDir->children.d[curDir->children.len].indivComp = NULL;
+			curDir->children.d[curDir->children.len].indivFeature =
+				(unsigned)-1;
+			name_map_insert(&curDir->childNames, eh_strview_cstr(longName),
+							curDir->children.len);
 			EA_ADD(curDir->children);
 			curDir = &curDir->children.d[curDir->children.len-1];
 		}
 	}
 
-	/* Set parser state variables.  */
-	addedComponent = false;
 	return 1;
 }
 
@@ -842,14 +1474,19 @@ int LSRRemoveLevels(unsigned testLevel)
 
 int LSRAddItem(char_array* itemName)
 {
+	if (listFilter != NULL &&
+		!GlobMatchFile(listFilter, listStates, listNumStates, itemName->d))
+		return 1;
+
 	if (addedComponent == false)
 	{
 		unsigned colStart;
 		char* compID;
 		colStart = compTable.len;
-		EA_SET_SIZE(compTable, compTable.len + compCols);
+		char_ptr_array_set_size(&compTable, compTable.len + compCols);
 		compID = (char*)xmalloc(strlen(idPrefix) + 1 + 11 + 1);
-		sprintf(compID, "%sc%u", idPrefix, compTable.len / compCols - 1);
+		sprintf(compID, "%sc%u", idPrefix,
+				(unsigned)(compTable.len / compCols - 1));
 		compTable.d[colStart] = compID;
 		compTable.d[colStart+1] = GetUuid();
 		compTable.d[colStart+2] = dirID;
@@ -859,79 +1496,68 @@ int LSRAddItem(char_array* itemName)
 
 		/* Connect the component to its directory.  */
 		curDir->component = compID;
+		curDir->compRow = colStart / compCols;
 	}
 
 	/* Add a file table entry.  */
 	{
 		unsigned colStart;
 		char* fileID;
+		char* shortName;
 		char* newFile;
-		char* fileSize;
 		char* seqNum;
 		colStart = fileTable.len;
-		EA_SET_SIZE(fileTable, fileTable.len + fileCols);
+		char_ptr_array_set_size(&fileTable, fileTable.len + fileCols);
 		fileID = (char*)xmalloc(strlen(idPrefix) + 1 + 11 + 1);
-		sprintf(fileID, "%sf%u", idPrefix, fileTable.len / fileCols - 1);
-		newFile = (char*)xmalloc(strlen(fileID) + 1 + itemName->len);
+		sprintf(fileID, "%sf%u", idPrefix,
+				(unsigned)(fileTable.len / fileCols - 1));
+		shortName = DirShortName(dirStkAssoc.d[dirStkAssoc.len-1],
+								 itemName->d);
+		if (shortName == NULL)
+		{
+			xfree(fileID);
+			return 0;
+		}
+		newFile = (char*)xmalloc(strlen(shortName) + 1 + itemName->len);
 		newFile[0] = '\0';
-		strcat(newFile, fileID);
+		strcat(newFile, shortName);
 		strcat(newFile, "|");
 		strcat(newFile, itemName->d);
+		xfree(shortName);
 		fileTable.d[colStart] = fileID;
 		fileTable.d[colStart+1] = compTable.d[compTable.len-6];
 		fileTable.d[colStart+2] = newFile;
-		/* Get the file size.  */
+		/* Remember the path of the file and queue it for the metadata
+		   stage, which fills in its size and version.  */
 		{
-			unsigned sizeNum;
 			char* filePath;
 			unsigned pathLen;
-			char* newPathName;
 			unsigned j;
-			FILE* sizeFP;
 			pathLen = 0;
 			for (j = 0; j < dirStack.len; j++)
 				pathLen += strlen(dirStack.d[j]) + 1;
 			filePath = (char*)xmalloc(pathLen + itemName->len);
-			newPathName = (char*)xmalloc(strlen(rootDir.name) + 1 +
-										 strlen(fileID) + 1);
 			filePath[0] = '\0';
-			newPathName[0] = '\0';
 			for (j = 0; j < dirStack.len; j++)
 			{
 				strcat(filePath, dirStack.d[j]);
 				strcat(filePath, "/");
 			}
-			strcpy(newPathName, rootDir.name);
-			strcat(newPathName, "/");
 			strcat(filePath, itemName->d);
-			strcat(newPathName, fileID);
-			sizeFP = fopen(filePath, "rb");
-			if (sizeFP == NULL)
-			{
-				fprintf(stderr, "ERROR: Could not open file: %s\n",
-						filePath);
-				xfree(filePath);
-				xfree(newPathName);
-				return 0;
-			}
-			fseek(sizeFP, 0, SEEK_END);
-			sizeNum = ftell(sizeFP);
-			fclose(sizeFP);
-			if (renameFiles == true)
-				rename(filePath, newPathName);
-			xfree(filePath);
-			xfree(newPathName);
-			fileSize = (char*)xmalloc(11 + 1);
-			sprintf(fileSize, "%u", sizeNum);
+			EA_APPEND(filePaths, filePath);
+			QueueFileMetadata(filePath, fileID, itemName->d);
 		}
-		fileTable.d[colStart+3] = fileSize;
+		fileTable.d[colStart+3] = NULL; /* FileSize */
 		fileTable.d[colStart+4] = ""; /* Version */
 		fileTable.d[colStart+5] = ""; /* Language */
 		fileTable.d[colStart+6] = "0";
 		seqNum = (char*)xmalloc(11 + 1);
-		sprintf(seqNum, "%u", fileTable.len / fileCols);
+		sprintf(seqNum, "%u", (unsigned)(fileTable.len / fileCols));
 		fileTable.d[colStart+7] = seqNum;
 		/* Add an index to the fileTable row in curDir.  */
+		name_map_insert(&curDir->fileNames,
+						eh_strview_cstr(strchr(newFile, (int)'|') + 1),
+						curDir->fileIdcs.len);
 		EA_APPEND(curDir->fileIdcs, colStart);
 		/* Update component information.  */
 		curDir->compRefCount++;
@@ -953,6 +1579,9 @@ int FeatAddBody(unsigned curLevel, char_array* colonLabel)
 	char* dispOrder;
 	char* localFeatLabel;
 
+	if (!FeatFlushItems())
+		return 0;
+
 	/* Add a feature stack entry.  */
 	featStack.d[featStack.len] = (char*)xmalloc(colonLabel->len);
 	strcpy(featStack.d[featStack.len], colonLabel->d);
@@ -962,11 +1591,13 @@ int FeatAddBody(unsigned curLevel, char_array* colonLabel)
 
 	/* Add a Feature entry.  */
 	colStart = featureTable.len;
-	EA_SET_SIZE(featureTable, featureTable.len + featureCols);
+	char_ptr_array_set_size(&featureTable, featureTable.len + featureCols);
 	featureID = (char*)xmalloc(strlen(idPrefix) + 2 + 11 + 1);
-	sprintf(featureID, "%sft%u", idPrefix, featureTable.len / featureCols - 1);
+	sprintf(featureID, "%sft%u", idPrefix,
+			(unsigned)(featureTable.len / featureCols - 1));
 	dispOrder = (char*)xmalloc(11 + 1);
-	sprintf(dispOrder, "%u", (featureTable.len / featureCols) * 2);
+	sprintf(dispOrder, "%u",
+			(unsigned)(featureTable.len / featureCols) * 2);
 	localFeatLabel = (char*)xmalloc(colonLabel->len);
 	strcpy(localFeatLabel, colonLabel->d);
 	featureTable.d[colStart] = featureID;
@@ -988,8 +1619,6 @@ int FeatAddBody(unsigned curLevel, char_array* colonLabel)
 	else
 		featureTable.d[colStart+7] = "2";
 
-	/* Set parser state variables.  */
-	reusedComponent = false;
 	return 1;
 }
 
@@ -1006,163 +1635,1837 @@ int FeatRemoveLevels(unsigned testLevel)
 	return 0;
 }
 
-int FeatAddItem(char_array* itemName)
+/* Add a file or directory named by its path to the current feature.
+   `len' is the length of the path including the null character.  */
+int FeatAddPath(char* path, unsigned len)
 {
-	unsigned i;
-	char_array pathPart;
-	bool foundDir;
-	bool skippedRoot;
-	EA_INIT(char, pathPart, 16);
-	EA_APPEND(pathPart, '\0');
-	/* Parse the path until the end file.  */
-	curDir = &rootDir;
-	skippedRoot = false;
-	for (i = 0; i < itemName->len; i++) /* Include the null character */
+	unsigned depth;
+	unsigned start; /* Start of the current path component */
+	unsigned end;
+	bool foundDir = true;
+
+	/* Skip the directories that this path shares with the previous
+	   one.  */
+	for (depth = 0; depth < featCursorDirs.len; depth++)
+	{
+		if (strncmp(path, featCursorPath.d,
+					featCursorEnds.d[depth] + 1) != 0)
+			break;
+	}
+	EA_SET_SIZE(featCursorDirs, depth);
+	EA_SET_SIZE(featCursorEnds, depth);
+	curDir = (depth > 0) ? featCursorDirs.d[depth-1] : NULL;
+	start = (depth > 0) ? featCursorEnds.d[depth-1] + 1 : 0;
+	EA_SET_SIZE(featCursorPath, len);
+	memcpy(featCursorPath.d, path, len);
+
+	/* Parse the rest of the path until the end file.  */
+	for (; ; start = end + 1)
 	{
-		if (itemName->d[i] == '/' || itemName->d[i] == '\0')
+		DirTree* nextDir = NULL;
+		end = start + strcspn(&path[start], "/");
+		if (curDir == NULL)
 		{
-			unsigned j;
-			foundDir = false;
-			if (skippedRoot == false)
-			{
-				/* Check which root we will use.  */
-				if (strcmp(rootDir.name, pathPart.d) == 0)
-					curDir = &rootDir;
-				else
-				{
-					unsigned i;
-					for (i = 0; i < rootDirN.len; i++)
-					{
-						if (strcmp(rootDirN.d[i].name, pathPart.d) == 0)
-						{
-							curDir = &rootDirN.d[i];
-							break;
-						}
-					}
-					if (i == rootDirN.len)
-					{
-						fprintf(stderr, "ERROR: Invalid root directory "
-								"in \"features.txt\": %s.\n", pathPart.d);
-						xfree(pathPart.d);
-						return 0;
-					}
-				}
-				skippedRoot = true;
-				if (itemName->d[i] != '\0')
-				{
-					pathPart.d[0] = '\0';
-					EA_SET_SIZE(pathPart, 1);
-				}
-				continue;
-			}
-			for (j = 0; j < curDir->children.len; j++)
-			{
-				if (strcmp(curDir->children.d[j].name, pathPart.d) == 0)
-				{
-					curDir = &curDir->children.d[j];
-					pathPart.d[0] = '\0';
-					EA_SET_SIZE(pathPart, 1);
-					foundDir = true;
-					break;
-				}
-			}
-			if (foundDir == false)
+			/* Check which root we will use.  */
+			unsigned* root = name_map_find(&rootNames,
+				eh_strview_make(&path[start], end - start));
+			if (root != NULL)
+				nextDir = (*root == 0) ? &rootDir : &rootDirN.d[*root-1];
+			else
 			{
-				/* This might be a file and not a directory.  */
-				break;
+				fprintf(stderr, "ERROR: Invalid root directory "
+						"in \"features.txt\": %.*s.\n",
+						(int)(end - start), &path[start]);
+				return 0;
 			}
 		}
 		else
-			EA_INSERT(pathPart, pathPart.len - 1, itemName->d[i]);
-	}
-	if (curDir == &rootDir && strcmp(itemName->d, pathPart.d) == 0 &&
-		strcmp(rootDir.name, itemName->d) != 0)
-	{
-		fprintf(stderr, "ERROR: Invalid directory specified "
-				"within \"features.txt\": %s.\n", itemName->d);
-		return 0;
+			nextDir = FindChildDir(curDir, &path[start], end - start);
+		if (nextDir == NULL)
+		{
+			/* This might be a file and not a directory.  */
+			foundDir = false;
+			break;
+		}
+		curDir = nextDir;
+		/* A trailing slash names the directory itself.  */
+		if (path[end] == '\0' || (path[end] == '/' && path[end+1] == '\0'))
+			break;
+		EA_APPEND(featCursorDirs, curDir);
+		EA_APPEND(featCursorEnds, end);
 	}
-	else if (foundDir == false && strcmp(itemName->d, pathPart.d) != 0 &&
-			 pathPart.len > 1)
+
+	if (foundDir == false)
 	{
 		/* Add an individual file.  */
-		unsigned colStart = (unsigned)-1;
-		bool addedComponent = false;
-		char* compID;
-		unsigned i;
+		unsigned colStart;
 
 		/* Find the table index of the current file.  */
-		for (i = 0; i < curDir->fileIdcs.len; i++)
-		{
-			unsigned testIndex;
-			testIndex = curDir->fileIdcs.d[i];
-			if (strcmp(strchr(fileTable.d[testIndex+2], (int)'|') + 1,
-					   pathPart.d) == 0)
-			{
-				colStart = testIndex;
-				break;
-			}
-		}
+		colStart = (path[end] == '\0') ?
+			FindFileInDir(curDir, &path[start]) : (unsigned)-1;
 		if (colStart == (unsigned)-1)
 		{
 			fprintf(stderr, "ERROR: Invalid file name specified "
-					"within \"features.txt\": %s.\n", itemName->d);
+					"within \"features.txt\": %s.\n", path);
 			return 0;
 		}
 
-		if ((reusedComponent == false || curDir != lastDir) &&
-			curDir->fileComps == true)
-		{
-			/* Create a new component.  */
-			unsigned compColStart;
-			compColStart = compTable.len;
-			EA_SET_SIZE(compTable, compTable.len + compCols);
-			compID = (char*)xmalloc(strlen(idPrefix) + 1 + 11 + 1);
-			sprintf(compID, "%sc%u", idPrefix, compTable.len / compCols - 1);
-			compTable.d[compColStart] = compID;
-			compTable.d[compColStart+1] = GetUuid();
-			compTable.d[compColStart+2] = curDir->dirKey;
-			compTable.d[compColStart+3] = "2";
-			compTable.d[compColStart+4] = ""; /* Condition */
+		FeatAddFile(curDir, colStart);
+	}
+	else
+	{
+		/* Recursively add a directory.  */
+		unsigned colStart;
+		char* featureID;
+		colStart = featureTable.len - featureCols;
+		featureID = featureTable.d[colStart];
+		AddFeatComps(featureID, curDir);
+	}
+	return 1;
+}
+
+/* Move a file that is listed individually into a component of the
+   current feature.  All files of one directory that are listed for
+   the same feature share a component.  The first files of a directory
+   that are listed individually take over the component of the
+   directory itself.  */
+void FeatAddFile(DirTree* dir, unsigned colStart)
+{
+	unsigned feature = featureTable.len / featureCols - 1;
+	char* compID;
+
+	if (dir->indivFeature != feature)
+	{
+		unsigned featColStart;
+		if (dir->fileComps == true)
+		{
+			/* Create a new component.  */
+			unsigned compColStart;
+			compColStart = compTable.len;
+			char_ptr_array_set_size(&compTable, compTable.len + compCols);
+			compID = (char*)xmalloc(strlen(idPrefix) + 1 + 11 + 1);
+			sprintf(compID, "%sc%u", idPrefix,
+					(unsigned)(compTable.len / compCols - 1));
+			compTable.d[compColStart] = compID;
+			compTable.d[compColStart+1] = GetUuid();
+			compTable.d[compColStart+2] = dir->dirKey;
+			compTable.d[compColStart+3] = "2";
+			compTable.d[compColStart+4] = ""; /* Condition */
 			compTable.d[compColStart+5] = fileTable.d[colStart];
-			addedComponent = true;
 		}
 		else
 		{
-			compID = curDir->component;
-			curDir->fileComps = true;
+			compID = dir->component;
+			dir->fileComps = true;
+		}
+		/* Associate the component with the given feature.  */
+		featColStart = featureTable.len - featureCols;
+		AddFeatComp(featureTable.d[featColStart], compID);
+		if (dir->component != compID)
+			dir->compRefCount--;
+		dir->indivFeature = feature;
+		dir->indivComp = compID;
+	}
+	/* Associate the file with the component.  */
+	if (fileTable.d[colStart+1] == dir->component &&
+		dir->indivComp != dir->component)
+		MoveDirKeyPath(dir, colStart);
+	fileTable.d[colStart+1] = dir->indivComp;
+}
+
+/* The file whose `File' table row starts at `colStart' is about to
+   leave the component of its directory.  If it is the key path of that
+   component, the next file of the directory that stays in it becomes
+   the key path instead.  Files only ever leave the directory component,
+   so all files before the key path have already left.  A component
+   that loses all its files falls back to its directory as key path.  */
+void MoveDirKeyPath(DirTree* dir, unsigned colStart)
+{
+	char** keyPath = &compTable.d[dir->compRow*compCols+5];
+	unsigned* index;
+	unsigned i;
+	if (*keyPath != fileTable.d[colStart])
+		return;
+	index = name_map_find(&dir->fileNames,
+		eh_strview_cstr(strchr(fileTable.d[colStart+2], (int)'|') + 1));
+	*keyPath = "";
+	for (i = *index + 1; i < dir->fileIdcs.len; i++)
+	{
+		unsigned next = dir->fileIdcs.d[i];
+		if (fileTable.d[next+1] == dir->component)
+		{
+			*keyPath = fileTable.d[next];
+			break;
+		}
+	}
+}
+
+int FeatAddItem(char_array* itemName)
+{
+	/* The items are added once the whole feature has been read, since
+	   an exclusion also applies to the items listed before it.  */
+	char* item;
+	item = (char*)xmalloc(itemName->len);
+	strcpy(item, itemName->d);
+	EA_APPEND(featItems, item);
+	if (item[0] == '!' || strpbrk(item, "*?[") != NULL)
+		featPatterns = true;
+	return 1;
+}
+
+/* Add the files of `dir' and its subdirectories that the patterns
+   select to the current feature.  `states' are the pattern states of
+   `dir'.  */
+void FeatGlobDir(GlobSet* set, DirTree* dir, unsigned* states,
+				 unsigned numStates)
+{
+	unsigned_array matched;
+	unsigned* next;
+	unsigned i;
+
+	EA_INIT(unsigned, matched, 16);
+	for (i = 0; i < dir->fileIdcs.len; i++)
+	{
+		unsigned colStart = dir->fileIdcs.d[i];
+		if (GlobMatchFile(set, states, numStates,
+						  strchr(fileTable.d[colStart+2], (int)'|') + 1))
+			EA_APPEND(matched, colStart);
+	}
+	if (matched.len > 0 && matched.len == dir->fileIdcs.len &&
+		dir->fileComps == false)
+	{
+		/* The whole directory component belongs to the feature.  */
+		AddFeatComp(featureTable.d[featureTable.len-featureCols],
+					dir->component);
+	}
+	else
+	{
+		/* The other files stay in the directory component, so the
+		   matched files must not take it over.  */
+		if (matched.len > 0 && matched.len < dir->fileIdcs.len)
+			dir->fileComps = true;
+		for (i = 0; i < matched.len; i++)
+			FeatAddFile(dir, matched.d[i]);
+	}
+	xfree(matched.d);
+
+	next = (unsigned*)xmalloc(sizeof(unsigned) * GlobNumStates(set));
+	for (i = 0; i < dir->children.len; i++)
+	{
+		DirTree* child = &dir->children.d[i];
+		unsigned numNext;
+		numNext = GlobStep(set, states, numStates, child->name, next);
+		if (numNext > 0)
+			FeatGlobDir(set, child, next, numNext);
+	}
+	xfree(next);
+}
+
+/* Add the items listed for the current feature.  If there are any
+   patterns or exclusions among them, all items are treated as
+   patterns and matched against the directory trees at once.
+   Returns nonzero on success, zero on failure.  */
+int FeatFlushItems()
+{
+	int retval = 1;
+	unsigned i;
+
+	if (featPatterns == false)
+	{
+		for (i = 0; i < featItems.len && retval; i++)
+			retval = FeatAddPath(featItems.d[i], strlen(featItems.d[i]) + 1);
+	}
+	else
+	{
+		GlobSet* set;
+		unsigned* states;
+		set = GlobCompile(featItems.d, featItems.len);
+		states = (unsigned*)xmalloc(sizeof(unsigned) * GlobNumStates(set));
+		for (i = 0; i <= rootDirN.len; i++)
+		{
+			DirTree* root = (i == 0) ? &rootDir : &rootDirN.d[i-1];
+			unsigned numStates;
+			numStates = GlobStep(set, NULL, 0, root->name, states);
+			if (numStates > 0)
+				FeatGlobDir(set, root, states, numStates);
+		}
+		xfree(states);
+		for (i = 0; i < featItems.len; i++)
+		{
+			char* item = featItems.d[i];
+			if (item[0] == '!' || GlobPatternMatched(set, i))
+				continue;
+			if (strpbrk(item, "*?[") != NULL)
+			{
+				fprintf(stderr, "WARNING: No files match the pattern "
+						"in \"features.txt\": %s.\n", item);
+				continue;
+			}
+			fprintf(stderr, "ERROR: Invalid file name specified "
+					"within \"features.txt\": %s.\n", item);
+			retval = 0;
+		}
+		GlobFree(set);
+	}
+
+	for (i = 0; i < featItems.len; i++)
+		xfree(featItems.d[i]);
+	EA_SET_SIZE(featItems, 0);
+	featPatterns = false;
+	return retval;
+}
+
+/* Items of the feature file collected by `ReadListFilter()'.  */
+static char_ptr_array filterItems;
+
+int FilterAddBody(unsigned curLevel, char_array* colonLabel)
+{
+	/* Features do not matter for the filter.  */
+	return 1;
+}
+
+int FilterRemoveLevels(unsigned testLevel)
+{
+	return 1;
+}
+
+int FilterAddItem(char_array* itemName)
+{
+	char* item;
+	/* An exclusion only applies within its own feature, so it cannot
+	   rule out anything for the listings.  */
+	if (itemName->d[0] == '!')
+		return 1;
+	item = (char*)xmalloc(itemName->len);
+	strcpy(item, itemName->d);
+	EA_APPEND(filterItems, item);
+	return 1;
+}
+
+/* Compile the items of all features into `listFilter', so that the
+   listings only create directories, components, and files that a
+   feature can refer to.  Returns nonzero on success, zero on
+   failure.  */
+int ReadListFilter()
+{
+	FILE* fp;
+	int retval;
+	unsigned i;
+
+	fp = fopen("features.txt", "r");
+	if (fp == NULL)
+	{
+		fputs("ERROR: Could not open file: features.txt\n", stderr);
+		return 0;
+	}
+	EA_INIT(char_ptr, filterItems, 16);
+	retval = ParseLSRFile(fp, FilterAddBody, FilterRemoveLevels,
+						  FilterAddItem);
+	fclose(fp);
+	if (retval)
+	{
+		listFilter = GlobCompile(filterItems.d, filterItems.len);
+		listStates = (unsigned*)xmalloc(sizeof(unsigned) *
+										GlobNumStates(listFilter));
+		listNext = (unsigned*)xmalloc(sizeof(unsigned) *
+									  GlobNumStates(listFilter));
+	}
+	for (i = 0; i < filterItems.len; i++)
+		xfree(filterItems.d[i]);
+	xfree(filterItems.d);
+	return retval;
+}
+
+/* Open one file for the metadata stage: get its size, read its version
+   resource if it is a PE file, and with `-r', move it to the root of
+   the first listing under the name of its key.  */
+static void ReadFileMeta(FileMeta* meta)
+{
+	FILE* fp;
+
+	fp = fopen(meta->path, "rb");
+	if (fp == NULL)
+	{
+		meta->found = false;
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	meta->size = ftell(fp);
+	fclose(fp);
+	meta->found = true;
+	if (meta->isPe == true)
+	{
+		meta->hasVersion =
+			(ReadPeVersion(meta->path, &meta->version)) ? true : false;
+	}
+
+	if (renameFiles == true)
+	{
+		meta->newPath = (char*)xmalloc(strlen(rootDir.name) + 1 +
+									   strlen(meta->fileID) + 1);
+		sprintf(meta->newPath, "%s/%s", rootDir.name, meta->fileID);
+		rename(meta->path, meta->newPath);
+	}
+}
+
+/* A worker of the metadata stage, which reads files from `metaQueue'
+   until it is closed.  */
+static void MetadataConsumer(void* data)
+{
+	void* item;
+	while (RingQueueWait(metaQueue, &item))
+		ReadFileMeta((FileMeta*)item);
+}
+
+/* Start one consumer on every thread of the pool other than this one,
+   which parses the input and produces the files.  */
+void StartMetadataStage()
+{
+	unsigned i;
+	metaQueue = RingQueueCreate(META_BLOCK);
+	for (i = 1; i < ThreadPoolSize(); i++)
+		SubmitTask(MetadataConsumer, NULL, TASK_NORMAL);
+}
+
+/* Queue the file of the `File' table row that was just added.  `path'
+   and `fileID' must stay valid until the stage is finished.  If the
+   queue is full, this thread reads files itself until there is room,
+   so parsing never runs far ahead of the disk.  */
+void QueueFileMetadata(const char* path, const char* fileID,
+					   const char* longName)
+{
+	FileMeta* meta;
+	void* item;
+	if (numMetaFiles % META_BLOCK == 0)
+	{
+		EA_APPEND(metaBlocks,
+				  (FileMeta*)xmalloc(sizeof(FileMeta) * META_BLOCK));
+	}
+	meta = &metaBlocks.d[numMetaFiles/META_BLOCK][numMetaFiles%META_BLOCK];
+	numMetaFiles++;
+	meta->path = path;
+	meta->fileID = fileID;
+	meta->newPath = NULL;
+	meta->found = false;
+	meta->isPe = (IsPeFileName(longName)) ? true : false;
+	meta->hasVersion = false;
+	while (!RingQueuePush(metaQueue, meta))
+	{
+		if (RingQueuePop(metaQueue, &item))
+			ReadFileMeta((FileMeta*)item);
+	}
+}
+
+/* Read the files that are still queued and wait for the consumers to
+   stop.  */
+void StopMetadataStage()
+{
+	void* item;
+	if (metaQueue == NULL)
+		return;
+	RingQueueClose(metaQueue);
+	while (RingQueuePop(metaQueue, &item))
+		ReadFileMeta((FileMeta*)item);
+	WaitForTasks();
+	RingQueueFree(metaQueue);
+	metaQueue = NULL;
+}
+
+/* Wait for the metadata stage and fill in the `FileSize', `Version'
+   and `Language' columns of every file in the `File' table from this
+   thread.  Returns nonzero on success, zero on failure.  */
+int FinishMetadataStage()
+{
+	int retval = 1;
+	unsigned i;
+
+	StopMetadataStage();
+	for (i = 0; i < numMetaFiles; i++)
+	{
+		FileMeta* meta = &metaBlocks.d[i/META_BLOCK][i%META_BLOCK];
+		unsigned colStart = i * fileCols;
+		char* fileSize;
+		char* version;
+		char* language;
+		PeVersion* pv = &meta->version;
+		unsigned j;
+		if (meta->found == false)
+		{
+			fprintf(stderr, "ERROR: Could not open file: %s\n",
+					filePaths.d[i]);
+			retval = 0;
+			continue;
+		}
+		fileSize = (char*)xmalloc(11 + 1);
+		sprintf(fileSize, "%u", meta->size);
+		fileTable.d[colStart+3] = fileSize;
+		if (meta->newPath != NULL)
+		{
+			xfree(filePaths.d[i]);
+			filePaths.d[i] = meta->newPath;
+			meta->newPath = NULL;
+		}
+
+		if (meta->hasVersion == false)
+			continue;
+		version = (char*)xmalloc(4 * 6 + 1);
+		sprintf(version, "%u.%u.%u.%u", pv->version[0], pv->version[1],
+				pv->version[2], pv->version[3]);
+		fileTable.d[colStart+4] = version;
+		if (pv->numLangs == 0)
+			continue;
+		language = (char*)xmalloc(PE_MAX_LANGS * 6 + 1);
+		language[0] = '\0';
+		for (j = 0; j < pv->numLangs; j++)
+		{
+			sprintf(language + strlen(language), (j == 0) ? "%u" : ",%u",
+					(unsigned)pv->langs[j]);
+		}
+		fileTable.d[colStart+5] = language;
+	}
+
+	FreeFileMeta();
+	return retval;
+}
+
+void FreeFileMeta()
+{
+	unsigned i;
+	for (i = 0; i < numMetaFiles; i++)
+		xfree(metaBlocks.d[i/META_BLOCK][i%META_BLOCK].newPath);
+	for (i = 0; i < metaBlocks.len; i++)
+		xfree(metaBlocks.d[i]);
+	EA_SET_SIZE(metaBlocks, 0);
+	numMetaFiles = 0;
+}
+
+/* Hash the contents of every unversioned file and add a row for it to
+   the `MsiFileHash' table.  Versioned files must not have a hash.
+   Returns nonzero on success, zero on failure.  */
+int BuildFileHashTable()
+{
+	unsigned numFiles;
+	char_ptr_array hashPaths;
+	unsigned_array hashRows;
+	FileDigest* digests;
+	unsigned i;
+
+	numFiles = fileTable.len / fileCols;
+	EA_INIT(char_ptr, hashPaths, 16);
+	EA_INIT(unsigned, hashRows, 16);
+	for (i = 0; i < numFiles; i++)
+	{
+		if (fileTable.d[i*fileCols+4][0] != '\0') /* Version */
+			continue;
+		EA_APPEND(hashPaths, filePaths.d[i]);
+		EA_APPEND(hashRows, i);
+	}
+
+	digests = (FileDigest*)xmalloc(sizeof(FileDigest) * hashRows.len);
+	if (!HashFiles("hashcache.txt", hashPaths.d, hashPaths.len, digests))
+	{
+		xfree(digests);
+		xfree(hashPaths.d);
+		xfree(hashRows.d);
+		return 0;
+	}
+
+	for (i = 0; i < hashRows.len; i++)
+	{
+		unsigned colStart;
+		unsigned j;
+		colStart = fileHashTable.len;
+		char_ptr_array_set_size(&fileHashTable, fileHashTable.len + fileHashCols);
+		fileHashTable.d[colStart] = fileTable.d[hashRows.d[i]*fileCols];
+		fileHashTable.d[colStart+1] = "0"; /* Options */
+		/* The digest is stored as four little-endian 32-bit words.  */
+		for (j = 0; j < 4; j++)
+		{
+			unsigned char* part = &digests[i][j*4];
+			int partNum;
+			char* hashPart;
+			partNum = (int)((unsigned)part[0] | ((unsigned)part[1] << 8) |
+							((unsigned)part[2] << 16) |
+							((unsigned)part[3] << 24));
+			hashPart = (char*)xmalloc(11 + 1);
+			sprintf(hashPart, "%d", partNum);
+			fileHashTable.d[colStart+2+j] = hashPart;
+		}
+	}
+
+	xfree(digests);
+	xfree(hashPaths.d);
+	xfree(hashRows.d);
+	return 1;
+}
+
+/* Compare two `File' table rows by their `Sequence' column.  */
+int FileSeq_qsort(const void* e1, const void* e2)
+{
+	unsigned seq1 = (unsigned)atoi(fileTable.d[*(unsigned*)e1*fileCols+7]);
+	unsigned seq2 = (unsigned)atoi(fileTable.d[*(unsigned*)e2*fileCols+7]);
+	if (seq1 != seq2)
+		return (seq1 < seq2) ? -1 : 1;
+	return 0;
+}
+
+/* Build a sorted index of the key column of a table.  */
+void BuildKeyIndex(FileIndex_array* index, char_ptr_array* table,
+				   unsigned numCols)
+{
+	unsigned i;
+	EA_INIT(FileIndex, *index, table->len / numCols + 1);
+	for (i = 0; i < table->len; i += numCols)
+	{
+		index->d[index->len].name = table->d[i];
+		index->d[index->len].tableIndex = i / numCols;
+		EA_ADD(*index);
+	}
+	qsort(index->d, index->len, sizeof(FileIndex), FileIndex_qsort);
+}
+
+/* Returns the row with the given key, or (unsigned)-1 if there is no
+   such row.  */
+unsigned LookupKey(FileIndex_array* index, char* key)
+{
+	FileIndex keyEntry;
+	FileIndex* found;
+	keyEntry.name = key;
+	found = (FileIndex*)bsearch(&keyEntry, index->d, index->len,
+								sizeof(FileIndex), FileIndex_qsort);
+	return (found != NULL) ? found->tableIndex : (unsigned)-1;
+}
+
+/* Returns the parent row of every `Feature' table row, or (unsigned)-1
+   for top-level features, in newly allocated memory.  Features are
+   always listed after their parents.  */
+unsigned* FeatureParents(FileIndex_array* featIndex)
+{
+	unsigned numFeatures = featureTable.len / featureCols;
+	unsigned* parents;
+	unsigned i;
+	parents = (unsigned*)xmalloc(sizeof(unsigned) * (numFeatures + 1));
+	for (i = 0; i < numFeatures; i++)
+	{
+		char* parent = featureTable.d[i*featureCols+1];
+		parents[i] = (parent[0] != '\0') ?
+			LookupKey(featIndex, parent) : (unsigned)-1;
+	}
+	return parents;
+}
+
+/* One file considered for deduplication.  */
+typedef struct DupCandidate_t DupCandidate;
+struct DupCandidate_t
+{
+	unsigned row;
+	bool found;
+	unsigned long long dev;
+	unsigned long long ino;
+	unsigned long long size;
+	FileDigest digest;
+};
+
+/* A component installed by a feature.  */
+typedef struct CompFeature_t CompFeature;
+struct CompFeature_t
+{
+	unsigned comp;
+	unsigned feature;
+};
+
+static void DedupStatWorker(void* data, unsigned index)
+{
+	DupCandidate* cand = &((DupCandidate*)data)[index];
+	struct stat st;
+	cand->row = index;
+	cand->found = false;
+	if (stat(filePaths.d[index], &st) != 0)
+		return;
+	cand->found = true;
+	cand->dev = (unsigned long long)st.st_dev;
+	cand->ino = (unsigned long long)st.st_ino;
+	cand->size = (unsigned long long)st.st_size;
+}
+
+/* Order candidates by size, then file identity.  */
+static int DupIdentity_qsort(const void* e1, const void* e2)
+{
+	const DupCandidate* c1 = (const DupCandidate*)e1;
+	const DupCandidate* c2 = (const DupCandidate*)e2;
+	if (c1->size != c2->size)
+		return (c1->size < c2->size) ? -1 : 1;
+	if (c1->dev != c2->dev)
+		return (c1->dev < c2->dev) ? -1 : 1;
+	if (c1->ino != c2->ino)
+		return (c1->ino < c2->ino) ? -1 : 1;
+	if (c1->row != c2->row)
+		return (c1->row < c2->row) ? -1 : 1;
+	return 0;
+}
+
+/* Order candidates by size, then contents, then `File' table row.  */
+static int DupContents_qsort(const void* e1, const void* e2)
+{
+	const DupCandidate* c1 = (const DupCandidate*)e1;
+	const DupCandidate* c2 = (const DupCandidate*)e2;
+	int result;
+	if (c1->size != c2->size)
+		return (c1->size < c2->size) ? -1 : 1;
+	result = memcmp(c1->digest, c2->digest, sizeof(FileDigest));
+	if (result != 0)
+		return result;
+	if (c1->row != c2->row)
+		return (c1->row < c2->row) ? -1 : 1;
+	return 0;
+}
+
+static int CompFeature_qsort(const void* e1, const void* e2)
+{
+	const CompFeature* p1 = (const CompFeature*)e1;
+	const CompFeature* p2 = (const CompFeature*)e2;
+	if (p1->comp != p2->comp)
+		return (p1->comp < p2->comp) ? -1 : 1;
+	if (p1->feature != p2->feature)
+		return (p1->feature < p2->feature) ? -1 : 1;
+	return 0;
+}
+
+/* Returns true if, whenever `dupComp' is installed, `origComp' is
+   installed too.  That is the case when every feature that installs
+   `dupComp' or one of its ancestors also installs `origComp'.  */
+static bool CompInstalledWith(CompFeature* pairs, unsigned numPairs,
+							  unsigned* parents, unsigned dupComp,
+							  unsigned origComp)
+{
+	unsigned i;
+	if (dupComp == origComp)
+		return true;
+	for (i = 0; i < numPairs; i++)
+	{
+		unsigned feature;
+		bool covered = false;
+		if (pairs[i].comp != dupComp)
+			continue;
+		for (feature = pairs[i].feature; feature != (unsigned)-1;
+			 feature = parents[feature])
+		{
+			CompFeature key;
+			key.comp = origComp;
+			key.feature = feature;
+			if (bsearch(&key, pairs, numPairs, sizeof(CompFeature),
+						CompFeature_qsort) != NULL)
+			{ covered = true; break; }
+		}
+		if (covered == false)
+			return false;
+	}
+	return true;
+}
+
+/* Find files with identical contents and replace all but one of them
+   by rows in the `DuplicateFile' table, so that the contents are only
+   stored once.  Hard links are recognized by their file identity, and
+   other files of the same size are compared by their MD5 hashes.  A
+   file is only replaced by a copy of another file if installing it
+   always installs the other file too.  Returns nonzero on success,
+   zero on failure.  */
+int DedupFiles()
+{
+	unsigned numFiles = fileTable.len / fileCols;
+	unsigned numComps = compTable.len / compCols;
+	DupCandidate* cands;
+	unsigned numCands = 0;
+	char_ptr_array hashPaths;
+	unsigned_array hashCands;
+	FileDigest* digests;
+	FileIndex_array featIndex;
+	FileIndex_array compIndex;
+	unsigned* parents;
+	unsigned* fileComp;
+	CompFeature* pairs;
+	unsigned numPairs = 0;
+	unsigned* original;
+	unsigned_array kept;
+	bool* needKey;
+	unsigned i, j;
+
+	if (numFiles == 0)
+		return 1;
+	cands = (DupCandidate*)xmalloc(sizeof(DupCandidate) * numFiles);
+	ParallelFor(numFiles, DedupStatWorker, cands);
+	for (i = 0; i < numFiles; i++)
+	{
+		if (cands[i].found == true && cands[i].size > 0)
+			cands[numCands++] = cands[i];
+	}
+	qsort(cands, numCands, sizeof(DupCandidate), DupIdentity_qsort);
+	for (i = 0; i < numCands; i++)
+		memset(cands[i].digest, 0, sizeof(FileDigest));
+
+	/* Files of the same size only need to be hashed if they are not
+	   all links to the same file.  Only one link of each file is
+	   hashed.  */
+	EA_INIT(char_ptr, hashPaths, 16);
+	EA_INIT(unsigned, hashCands, 16);
+	for (i = 0; i < numCands; i = j)
+	{
+		bool distinct = false;
+		for (j = i + 1; j < numCands && cands[j].size == cands[i].size; j++)
+		{
+			if (cands[j].dev != cands[i].dev ||
+				cands[j].ino != cands[i].ino)
+				distinct = true;
+		}
+		if (distinct == true)
+		{
+			unsigned k;
+			for (k = i; k < j; k++)
+			{
+				if (k == i || cands[k].dev != cands[k-1].dev ||
+					cands[k].ino != cands[k-1].ino)
+				{
+					EA_APPEND(hashPaths, filePaths.d[cands[k].row]);
+					EA_APPEND(hashCands, k);
+				}
+			}
+		}
+	}
+	digests = (FileDigest*)xmalloc(sizeof(FileDigest) *
+								   (hashPaths.len + 1));
+	if (hashPaths.len > 0 &&
+		!HashFiles("hashcache.txt", hashPaths.d, hashPaths.len, digests))
+	{
+		xfree(digests);
+		xfree(hashPaths.d);
+		xfree(hashCands.d);
+		xfree(cands);
+		return 0;
+	}
+	/* Links share the digest of the first link.  */
+	for (i = 0; i < hashCands.len; i++)
+	{
+		unsigned k = hashCands.d[i];
+		memcpy(cands[k].digest, digests[i], sizeof(FileDigest));
+		for (k++; k < numCands && cands[k].size == cands[k-1].size &&
+				 cands[k].dev == cands[k-1].dev &&
+				 cands[k].ino == cands[k-1].ino; k++)
+			memcpy(cands[k].digest, digests[i], sizeof(FileDigest));
+	}
+	xfree(digests);
+	xfree(hashPaths.d);
+	xfree(hashCands.d);
+	qsort(cands, numCands, sizeof(DupCandidate), DupContents_qsort);
+
+	/* Gather which features install which components.  */
+	BuildKeyIndex(&featIndex, &featureTable, featureCols);
+	BuildKeyIndex(&compIndex, &compTable, compCols);
+	parents = FeatureParents(&featIndex);
+	fileComp = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+	for (i = 0; i < numFiles; i++)
+		fileComp[i] = LookupKey(&compIndex, fileTable.d[i*fileCols+1]);
+	pairs = (CompFeature*)xmalloc(sizeof(CompFeature) *
+								  (featCompTable.len / featCompCols + 1));
+	for (i = 0; i < featCompTable.len; i += featCompCols)
+	{
+		unsigned feature = LookupKey(&featIndex, featCompTable.d[i]);
+		unsigned comp = LookupKey(&compIndex, featCompTable.d[i+1]);
+		if (feature == (unsigned)-1 || comp == (unsigned)-1)
+			continue;
+		pairs[numPairs].comp = comp;
+		pairs[numPairs].feature = feature;
+		numPairs++;
+	}
+	qsort(pairs, numPairs, sizeof(CompFeature), CompFeature_qsort);
+
+	/* Within each group of identical files, a file is replaced by the
+	   first file listed before it that is always installed along with
+	   it.  */
+	original = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+	for (i = 0; i < numFiles; i++)
+		original[i] = (unsigned)-1;
+	EA_INIT(unsigned, kept, 16);
+	for (i = 0; i < numCands; i = j)
+	{
+		EA_SET_SIZE(kept, 0);
+		for (j = i; j < numCands && cands[j].size == cands[i].size &&
+				 memcmp(cands[j].digest, cands[i].digest,
+						sizeof(FileDigest)) == 0; j++)
+		{
+			unsigned row = cands[j].row;
+			unsigned k;
+			for (k = 0; k < kept.len; k++)
+			{
+				if (fileComp[row] != (unsigned)-1 &&
+					fileComp[kept.d[k]] != (unsigned)-1 &&
+					CompInstalledWith(pairs, numPairs, parents,
+									  fileComp[row], fileComp[kept.d[k]]))
+				{ original[row] = kept.d[k]; break; }
+			}
+			if (original[row] == (unsigned)-1)
+				EA_APPEND(kept, row);
+		}
+	}
+	xfree(kept.d);
+
+	/* Move the replaced files to the `DuplicateFile' table.  Their
+	   file keys and names are now owned by that table.  */
+	needKey = (bool*)xmalloc(sizeof(bool) * (numComps + 1));
+	for (i = 0; i < numComps; i++)
+		needKey[i] = false;
+	for (i = 0; i < numFiles; i++)
+	{
+		unsigned colStart = i * fileCols;
+		if (original[i] == (unsigned)-1)
+			continue;
+		EA_APPEND(dupFileTable, fileTable.d[colStart]);
+		EA_APPEND(dupFileTable, fileTable.d[colStart+1]);
+		EA_APPEND(dupFileTable, fileTable.d[original[i]*fileCols]);
+		EA_APPEND(dupFileTable, fileTable.d[colStart+2]);
+		EA_APPEND(dupFileTable, "");
+		if (compTable.d[fileComp[i]*compCols+5] == fileTable.d[colStart])
+			needKey[fileComp[i]] = true;
+		xfree(fileTable.d[colStart+3]);
+		if (fileTable.d[colStart+4][0] != '\0')
+			xfree(fileTable.d[colStart+4]);
+		if (fileTable.d[colStart+5][0] != '\0')
+			xfree(fileTable.d[colStart+5]);
+		xfree(fileTable.d[colStart+7]);
+		xfree(filePaths.d[i]);
+	}
+
+	/* Remove the replaced rows and renumber the remaining files in
+	   their previous order.  */
+	{
+		unsigned* order;
+		unsigned* newRow;
+		unsigned numKept = 0;
+		order = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+		newRow = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+		for (i = 0; i < numFiles; i++)
+			order[i] = i;
+		qsort(order, numFiles, sizeof(unsigned), FileSeq_qsort);
+		for (i = 0; i < numFiles; i++)
+		{
+			if (original[i] != (unsigned)-1)
+				continue;
+			newRow[i] = numKept;
+			if (numKept != i)
+			{
+				memmove(&fileTable.d[numKept*fileCols],
+						&fileTable.d[i*fileCols],
+						sizeof(char*) * fileCols);
+				filePaths.d[numKept] = filePaths.d[i];
+			}
+			numKept++;
+		}
+		j = 0;
+		for (i = 0; i < numFiles; i++)
+		{
+			if (original[order[i]] != (unsigned)-1)
+				continue;
+			sprintf(fileTable.d[newRow[order[i]]*fileCols+7], "%u", ++j);
+		}
+		for (i = 0; i < numFiles; i++)
+		{
+			if (original[i] == (unsigned)-1 && fileComp[i] != (unsigned)-1 &&
+				needKey[fileComp[i]] == true)
+			{
+				compTable.d[fileComp[i]*compCols+5] =
+					fileTable.d[newRow[i]*fileCols];
+				needKey[fileComp[i]] = false;
+			}
+		}
+		EA_SET_SIZE(fileTable, numKept * fileCols);
+		EA_SET_SIZE(filePaths, numKept);
+		xfree(order);
+		xfree(newRow);
+	}
+	/* Components that lost all their files fall back to their
+	   directory as key path.  */
+	for (i = 0; i < numComps; i++)
+	{
+		if (needKey[i] == true)
+			compTable.d[i*compCols+5] = "";
+	}
+
+	xfree(needKey);
+	xfree(original);
+	xfree(pairs);
+	xfree(fileComp);
+	xfree(parents);
+	xfree(featIndex.d);
+	xfree(compIndex.d);
+	xfree(cands);
+	return 1;
+}
+
+/* Files of one directory whose components are installed by the same
+   set of features.  Such files may be packed into components freely.
+   The files are `packRows[start]' to `packRows[start+count-1]'.  */
+typedef struct PackGroup_t PackGroup;
+struct PackGroup_t
+{
+	DirTree* dir;
+	unsigned comp; /* The first old component of the files */
+	unsigned start;
+	unsigned count;
+};
+
+EA_TYPE(PackGroup);
+
+/* Tables used while repacking components.  */
+struct PackState
+{
+	FileIndex_array compIndex;
+	/* The features of component `i' are `pairs[featStart[i]]' to
+	   `pairs[featStart[i+1]-1]', without duplicates.  */
+	CompFeature* pairs;
+	unsigned* featStart;
+	unsigned_array rows;
+	PackGroup_array groups;
+};
+
+/* One component for all files.  */
+unsigned PackByDirectory(unsigned* rows, unsigned numRows, unsigned* bins)
+{
+	unsigned i;
+	for (i = 0; i < numRows; i++)
+		bins[i] = 0;
+	return (numRows > 0) ? 1 : 0;
+}
+
+/* One component for every versioned file, so that it is the key path
+   of its own component, and one for all the other files.  */
+unsigned PackByKeyFile(unsigned* rows, unsigned numRows, unsigned* bins)
+{
+	unsigned numBins = 0;
+	unsigned otherBin = (unsigned)-1;
+	unsigned i;
+	for (i = 0; i < numRows; i++)
+	{
+		if (fileTable.d[rows[i]*fileCols+4][0] != '\0') /* Version */
+			bins[i] = numBins++;
+		else
+		{
+			if (otherBin == (unsigned)-1)
+				otherBin = numBins++;
+			bins[i] = otherBin;
 		}
-		if (reusedComponent == false || addedComponent == true)
+	}
+	return numBins;
+}
+
+/* Consecutive files up to `packSizeLimit' KiB per component.  Larger
+   files get a component of their own.  */
+unsigned PackBySize(unsigned* rows, unsigned numRows, unsigned* bins)
+{
+	unsigned long long limit = (unsigned long long)packSizeLimit * 1024;
+	unsigned long long binSize = 0;
+	unsigned numBins = 0;
+	unsigned i;
+	for (i = 0; i < numRows; i++)
+	{
+		unsigned long long size;
+		size = strtoull(fileTable.d[rows[i]*fileCols+3], NULL, 10);
+		if (numBins == 0 || (binSize > 0 && binSize + size > limit))
 		{
-			/* Associate the component with the given feature.  */
-			unsigned colStart;
-			unsigned featColStart;
-			colStart = featCompTable.len;
-			featColStart = featureTable.len - featureCols;
-			EA_SET_SIZE(featCompTable, featCompTable.len + featCompCols);
-			featCompTable.d[colStart] = featureTable.d[featColStart];
-			featCompTable.d[colStart+1] = compID;
-			if (curDir->component != compID)
-				curDir->compRefCount--;
-			lastDir = curDir;
-			reusedComponent = true;
-		}
-		/* Associate the file with the component.  */
-		fileTable.d[colStart+1] = compID;
+			numBins++;
+			binSize = 0;
+		}
+		bins[i] = numBins - 1;
+		binSize += size;
+	}
+	return numBins;
+}
+
+/* Returns true if two components are installed by the same
+   features.  */
+static bool SameFeatures(struct PackState* ps, unsigned comp1, unsigned comp2)
+{
+	unsigned count = ps->featStart[comp1+1] - ps->featStart[comp1];
+	unsigned i;
+	if (comp1 == comp2)
+		return true;
+	if (ps->featStart[comp2+1] - ps->featStart[comp2] != count)
+		return false;
+	for (i = 0; i < count; i++)
+	{
+		if (ps->pairs[ps->featStart[comp1]+i].feature !=
+			ps->pairs[ps->featStart[comp2]+i].feature)
+			return false;
+	}
+	return true;
+}
+
+/* Sort the files of every directory in `dir' into groups.  */
+static void CollectPackGroups(struct PackState* ps, DirTree* dir)
+{
+	unsigned firstGroup = ps->groups.len;
+	unsigned i;
+	for (i = 0; i < dir->fileIdcs.len; i++)
+	{
+		unsigned row = dir->fileIdcs.d[i] / fileCols;
+		unsigned comp = LookupKey(&ps->compIndex, fileTable.d[row*fileCols+1]);
+		unsigned j;
+		for (j = firstGroup; j < ps->groups.len; j++)
+		{
+			if (SameFeatures(ps, ps->groups.d[j].comp, comp))
+				break;
+		}
+		if (j == ps->groups.len)
+		{
+			ps->groups.d[j].dir = dir;
+			ps->groups.d[j].comp = comp;
+			ps->groups.d[j].start = 0;
+			ps->groups.d[j].count = 0;
+			EA_ADD(ps->groups);
+		}
+		ps->groups.d[j].count++;
+	}
+	/* Lay out the rows of the new groups one after another.  */
+	for (i = firstGroup; i < ps->groups.len; i++)
+	{
+		ps->groups.d[i].start = ps->rows.len;
+		EA_SET_SIZE(ps->rows, ps->rows.len + ps->groups.d[i].count);
+		ps->groups.d[i].count = 0;
+	}
+	for (i = 0; i < dir->fileIdcs.len; i++)
+	{
+		unsigned row = dir->fileIdcs.d[i] / fileCols;
+		unsigned comp = LookupKey(&ps->compIndex, fileTable.d[row*fileCols+1]);
+		unsigned j;
+		for (j = firstGroup; j < ps->groups.len; j++)
+		{
+			if (SameFeatures(ps, ps->groups.d[j].comp, comp))
+				break;
+		}
+		ps->rows.d[ps->groups.d[j].start+ps->groups.d[j].count++] = row;
+	}
+	for (i = 0; i < dir->children.len; i++)
+		CollectPackGroups(ps, &dir->children.d[i]);
+}
+
+/* Print the number and total size of the `Component' and
+   `FeatureComponents' rows that a strategy would produce.  The sizes
+   are those of the rows in the IDT files.  */
+static void ReportPacking(struct PackState* ps, const char* name,
+						  PackFunc pack)
+{
+	unsigned long long compBytes = 0;
+	unsigned long long featCompBytes = 0;
+	unsigned numComps = 0;
+	unsigned numFeatComps = 0;
+	unsigned nextComp = compTable.len / compCols;
+	unsigned* bins;
+	char compID[11+1];
+	unsigned i;
+
+	bins = (unsigned*)xmalloc(sizeof(unsigned) * (ps->rows.len + 1));
+	for (i = 0; i < ps->groups.len; i++)
+	{
+		PackGroup* group = &ps->groups.d[i];
+		unsigned numBins;
+		unsigned numFeatures;
+		unsigned b;
+		numBins = pack(&ps->rows.d[group->start], group->count, bins);
+		numFeatures = ps->featStart[group->comp+1] -
+			ps->featStart[group->comp];
+		for (b = 0; b < numBins; b++)
+		{
+			unsigned keyLen;
+			unsigned j;
+			if (b == 0)
+				keyLen = strlen(compTable.d[group->comp*compCols]);
+			else
+			{
+				sprintf(compID, "c%u", nextComp++);
+				keyLen = strlen(idPrefix) + strlen(compID);
+			}
+			for (j = 0; bins[j] != b; j++)
+				;
+			compBytes += keyLen + 38 + strlen(compTable.d[group->comp*
+														 compCols+2]) +
+				1 + strlen(fileTable.d[ps->rows.d[group->start+j]*
+									   fileCols]) + 6;
+			for (j = 0; j < numFeatures; j++)
+			{
+				unsigned feature =
+					ps->pairs[ps->featStart[group->comp]+j].feature;
+				featCompBytes += strlen(featureTable.d[feature*featureCols]) +
+					keyLen + 2;
+			}
+			numFeatComps += numFeatures;
+		}
+		numComps += numBins;
+	}
+	printf("%-8s %10u %10llu %10u %10llu\n", name, numComps, compBytes,
+		   numFeatComps, featCompBytes);
+	xfree(bins);
+}
+
+/* Returns a new GUID for the component of the files in `rows' whose
+   entry in `bins' is `bin'.  It is a name-based (version 3) UUID made
+   from `baseGuid', the GUID of the component that the files were
+   listed in, and the long names of the files, so that a component gets
+   the same GUID in every build that puts exactly the same files into
+   it, and a new one as soon as its files change.  GUIDs taken from
+   "uuids.txt" in order would instead stay with a position in the
+   listing while the files at that position change.  */
+static char* BinGuid(const char* baseGuid, unsigned* rows, unsigned* bins,
+					 unsigned numRows, unsigned bin)
+{
+	Md5Ctx ctx;
+	unsigned char digest[MD5_DIGEST_SIZE];
+	char* guid;
+	unsigned i;
+	Md5Init(&ctx);
+	Md5Update(&ctx, baseGuid, strlen(baseGuid) + 1);
+	for (i = 0; i < numRows; i++)
+	{
+		const char* longName;
+		if (bins[i] != bin)
+			continue;
+		longName = strchr(fileTable.d[rows[i]*fileCols+2], (int)'|') + 1;
+		Md5Update(&ctx, longName, strlen(longName) + 1);
+	}
+	Md5Final(&ctx, digest);
+	digest[6] = (digest[6] & 0x0f) | 0x30;
+	digest[8] = (digest[8] & 0x3f) | 0x80;
+	guid = (char*)xmalloc(38 + 1);
+	sprintf(guid, "{%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-"
+			"%02X%02X%02X%02X%02X%02X}",
+			digest[0], digest[1], digest[2], digest[3], digest[4],
+			digest[5], digest[6], digest[7], digest[8], digest[9],
+			digest[10], digest[11], digest[12], digest[13], digest[14],
+			digest[15]);
+	return guid;
+}
+
+/* Rebuild the `Component' and `FeatureComponents' tables with the
+   selected packing strategy, and print a report of every strategy if
+   `-K' was given.  Components only ever hold files of one directory
+   that are installed by the same features, so files listed
+   individually in "features.txt" stay apart from the rest of their
+   directory.  */
+void RepackComponents()
+{
+	unsigned numComps = compTable.len / compCols;
+	struct PackState ps;
+	unsigned numPairs = 0;
+	unsigned i;
+
+	/* Gather the features of every component.  */
+	{
+		FileIndex_array featIndex;
+		BuildKeyIndex(&featIndex, &featureTable, featureCols);
+		BuildKeyIndex(&ps.compIndex, &compTable, compCols);
+		ps.pairs = (CompFeature*)xmalloc(sizeof(CompFeature) *
+									(featCompTable.len / featCompCols + 1));
+		for (i = 0; i < featCompTable.len; i += featCompCols)
+		{
+			unsigned feature = LookupKey(&featIndex, featCompTable.d[i]);
+			unsigned comp = LookupKey(&ps.compIndex, featCompTable.d[i+1]);
+			if (feature == (unsigned)-1 || comp == (unsigned)-1)
+				continue;
+			ps.pairs[numPairs].comp = comp;
+			ps.pairs[numPairs].feature = feature;
+			numPairs++;
+		}
+		xfree(featIndex.d);
+	}
+	qsort(ps.pairs, numPairs, sizeof(CompFeature), CompFeature_qsort);
+	ps.featStart = (unsigned*)xmalloc(sizeof(unsigned) * (numComps + 1));
+	{
+		unsigned numUnique = 0;
+		unsigned comp = 0;
+		for (i = 0; i < numPairs; i++)
+		{
+			if (numUnique > 0 &&
+				CompFeature_qsort(&ps.pairs[i], &ps.pairs[numUnique-1]) == 0)
+				continue;
+			while (comp <= ps.pairs[i].comp)
+				ps.featStart[comp++] = numUnique;
+			ps.pairs[numUnique++] = ps.pairs[i];
+		}
+		while (comp <= numComps)
+			ps.featStart[comp++] = numUnique;
+	}
+
+	EA_INIT(unsigned, ps.rows, 16);
+	EA_INIT(PackGroup, ps.groups, 16);
+	CollectPackGroups(&ps, &rootDir);
+	for (i = 0; i < rootDirN.len; i++)
+		CollectPackGroups(&ps, &rootDirN.d[i]);
+
+	if (packReport == true)
+	{
+		unsigned long long compBytes = 0;
+		unsigned long long featCompBytes = 0;
+		for (i = 0; i < compTable.len; i += compCols)
+		{
+			unsigned j;
+			for (j = 0; j < compCols; j++)
+				compBytes += strlen(compTable.d[i+j]) + 1;
+		}
+		for (i = 0; i < featCompTable.len; i += featCompCols)
+		{
+			featCompBytes += strlen(featCompTable.d[i]) +
+				strlen(featCompTable.d[i+1]) + 2;
+		}
+		printf("%-8s %10s %10s %10s %10s\n", "Packing", "Components",
+			   "Bytes", "FeatComps", "Bytes");
+		printf("%-8s %10u %10llu %10u %10llu\n", "none", numComps,
+			   compBytes, (unsigned)(featCompTable.len / featCompCols),
+			   featCompBytes);
+		for (i = 0; i < numPackStrategies; i++)
+		{
+			ReportPacking(&ps, packStrategies[i].name,
+						  packStrategies[i].pack);
+		}
+	}
+
+	if (packStrategy != NULL)
+	{
+		char_ptr_array newComps;
+		char_ptr_array newFeatComps;
+		bool* reused;
+		unsigned* oldCounts;
+		unsigned* bins;
+		unsigned nextComp = numComps;
+
+		EA_INIT(char_ptr, newComps, compTable.len + 16);
+		EA_INIT(char_ptr, newFeatComps, featCompTable.len + 16);
+		reused = (bool*)xmalloc(sizeof(bool) * (numComps + 1));
+		oldCounts = (unsigned*)xmalloc(sizeof(unsigned) * (numComps + 1));
+		for (i = 0; i < numComps; i++)
+		{
+			reused[i] = false;
+			oldCounts[i] = 0;
+		}
+		for (i = 0; i < ps.rows.len; i++)
+		{
+			unsigned comp = LookupKey(&ps.compIndex,
+									  fileTable.d[ps.rows.d[i]*fileCols+1]);
+			if (comp != (unsigned)-1)
+				oldCounts[comp]++;
+		}
+		bins = (unsigned*)xmalloc(sizeof(unsigned) * (ps.rows.len + 1));
+		for (i = 0; i < ps.groups.len; i++)
+		{
+			PackGroup* group = &ps.groups.d[i];
+			unsigned* rows = &ps.rows.d[group->start];
+			unsigned numBins;
+			unsigned b;
+			numBins = packStrategy->pack(rows, group->count, bins);
+			for (b = 0; b < numBins; b++)
+			{
+				unsigned colStart = newComps.len;
+				unsigned first;
+				unsigned oldComp;
+				unsigned binCount = 0;
+				unsigned j;
+				for (first = 0; bins[first] != b; first++)
+					;
+				/* Keep the identifier and GUID of an old component only
+				   if the new one installs exactly the same files.  */
+				oldComp = LookupKey(&ps.compIndex,
+									fileTable.d[rows[first]*fileCols+1]);
+				for (j = first; j < group->count; j++)
+				{
+					if (bins[j] != b)
+						continue;
+					binCount++;
+					if (LookupKey(&ps.compIndex,
+								  fileTable.d[rows[j]*fileCols+1]) != oldComp)
+						oldComp = (unsigned)-1;
+				}
+				if (oldComp != (unsigned)-1 &&
+					(reused[oldComp] == true || oldCounts[oldComp] != binCount))
+					oldComp = (unsigned)-1;
+				EA_SET_SIZE(newComps, newComps.len + compCols);
+				if (oldComp != (unsigned)-1)
+				{
+					reused[oldComp] = true;
+					newComps.d[colStart] = compTable.d[oldComp*compCols];
+					newComps.d[colStart+1] = compTable.d[oldComp*compCols+1];
+				}
+				else
+				{
+					char* compID;
+					compID = (char*)xmalloc(strlen(idPrefix) + 1 + 11 + 1);
+					sprintf(compID, "%sc%u", idPrefix, nextComp++);
+					newComps.d[colStart] = compID;
+					newComps.d[colStart+1] =
+						BinGuid(compTable.d[group->comp*compCols+1],
+								rows, bins, group->count, b);
+				}
+				newComps.d[colStart+2] = compTable.d[group->comp*compCols+2];
+				newComps.d[colStart+3] = "2";
+				newComps.d[colStart+4] = ""; /* Condition */
+				newComps.d[colStart+5] = fileTable.d[rows[first]*fileCols];
+				for (j = ps.featStart[group->comp];
+					 j < ps.featStart[group->comp+1]; j++)
+				{
+					EA_APPEND(newFeatComps, featureTable.d[ps.pairs[j].feature*
+														   featureCols]);
+					EA_APPEND(newFeatComps, newComps.d[colStart]);
+				}
+				if (b == 0 && (i == 0 || ps.groups.d[i-1].dir != group->dir))
+					group->dir->component = newComps.d[colStart];
+			}
+			for (b = 0; b < group->count; b++)
+				fileTable.d[rows[b]*fileCols+1] = newComps.d[
+					newComps.len - (numBins - bins[b]) * compCols];
+		}
+		/* Components left without files are dropped.  */
+		for (i = 0; i < numComps; i++)
+		{
+			if (reused[i] == false)
+			{
+				xfree(compTable.d[i*compCols]);
+				xfree(compTable.d[i*compCols+1]);
+			}
+		}
+		xfree(compTable.d);
+		compTable = newComps;
+		xfree(featCompTable.d);
+		featCompTable = newFeatComps;
+		xfree(reused);
+		xfree(oldCounts);
+		xfree(bins);
+	}
+
+	xfree(ps.groups.d);
+	xfree(ps.rows.d);
+	xfree(ps.featStart);
+	xfree(ps.pairs);
+	xfree(ps.compIndex.d);
+}
+
+/* Assign every file to the cabinet of the first feature that installs
+   it, where features nested deeper than `cabDepth' share the cabinet of
+   their ancestor at that depth.  Then renumber the files so that each
+   cabinet holds a contiguous range of sequence numbers, and record the
+   end of each range in `cabLastSeq'.  */
+void PartitionCabinets()
+{
+	unsigned numFeatures = featureTable.len / featureCols;
+	unsigned numComps = compTable.len / compCols;
+	unsigned numFiles = fileTable.len / fileCols;
+	unsigned* parents;
+	unsigned* depth;
+	unsigned* featCab;
+	unsigned* compCab;
+	unsigned* fileCab;
+	unsigned* order;
+	FileIndex_array featIndex;
+	FileIndex_array compIndex;
+	unsigned numCabs = 0;
+	unsigned i;
+
+	EA_SET_SIZE(cabLastSeq, 0);
+	if (cabDepth == 0 || numFiles == 0)
+	{
+		EA_APPEND(cabLastSeq, numFiles);
+		return;
+	}
+
+	BuildKeyIndex(&featIndex, &featureTable, featureCols);
+	BuildKeyIndex(&compIndex, &compTable, compCols);
+	parents = FeatureParents(&featIndex);
+	depth = (unsigned*)xmalloc(sizeof(unsigned) * (numFeatures + 1));
+	featCab = (unsigned*)xmalloc(sizeof(unsigned) * (numFeatures + 1));
+	for (i = 0; i < numFeatures; i++)
+	{
+		unsigned parent = parents[i];
+		depth[i] = (parent != (unsigned)-1) ? depth[parent] + 1 : 1;
+		if (parent == (unsigned)-1 || depth[i] <= cabDepth)
+			featCab[i] = numCabs++;
+		else
+			featCab[i] = featCab[parent];
+	}
+
+	/* A component goes with the first feature that installs it.  */
+	compCab = (unsigned*)xmalloc(sizeof(unsigned) * (numComps + 1));
+	for (i = 0; i < numComps; i++)
+		compCab[i] = (unsigned)-1;
+	for (i = 0; i < featCompTable.len; i += featCompCols)
+	{
+		unsigned feature = LookupKey(&featIndex, featCompTable.d[i]);
+		unsigned comp = LookupKey(&compIndex, featCompTable.d[i+1]);
+		if (feature != (unsigned)-1 && comp != (unsigned)-1 &&
+			featCab[feature] < compCab[comp])
+			compCab[comp] = featCab[feature];
+	}
+
+	/* Files of components that no feature installs go into the first
+	   cabinet, which exists even if there are no features.  */
+	if (numCabs == 0)
+		numCabs = 1;
+	fileCab = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+	for (i = 0; i < numFiles; i++)
+	{
+		unsigned comp = LookupKey(&compIndex, fileTable.d[i*fileCols+1]);
+		fileCab[i] = (comp != (unsigned)-1 && compCab[comp] !=
+					  (unsigned)-1) ? compCab[comp] : 0;
+	}
+
+	/* Renumber the files by cabinet, keeping their previous order
+	   within each cabinet.  Cabinets without files are dropped.  */
+	order = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+	for (i = 0; i < numFiles; i++)
+		order[i] = i;
+	qsort(order, numFiles, sizeof(unsigned), FileSeq_qsort);
+	{
+		unsigned cab;
+		unsigned seq = 0;
+		unsigned* seqs = (unsigned*)xmalloc(sizeof(unsigned) * numFiles);
+		/* Count the files of each cabinet, and turn the counts into
+		   the sequence number before the first file of each.  */
+		unsigned* cabNext = (unsigned*)xmalloc(sizeof(unsigned) *
+											   (numCabs + 1));
+		for (cab = 0; cab < numCabs; cab++)
+			cabNext[cab] = 0;
+		for (i = 0; i < numFiles; i++)
+			cabNext[fileCab[i]]++;
+		for (cab = 0; cab < numCabs; cab++)
+		{
+			unsigned count = cabNext[cab];
+			cabNext[cab] = seq;
+			seq += count;
+			if (count > 0)
+				EA_APPEND(cabLastSeq, seq);
+		}
+		for (i = 0; i < numFiles; i++)
+			seqs[order[i]] = ++cabNext[fileCab[order[i]]];
+		for (i = 0; i < numFiles; i++)
+			sprintf(fileTable.d[i*fileCols+7], "%u", seqs[i]);
+		xfree(cabNext);
+		xfree(seqs);
+	}
+
+	xfree(parents);
+	xfree(depth);
+	xfree(featCab);
+	xfree(featIndex.d);
+	xfree(compCab);
+	xfree(compIndex.d);
+	xfree(fileCab);
+	xfree(order);
+}
+
+/* Files smaller than one MSZIP block are kept together so that they
+   can share blocks.  */
+#define SMALL_FILE_SIZE 32768
+
+/* Compare the long names of two files without regard to case,
+   optionally only from the last dot onwards.  */
+static int FileNameCmp(unsigned row1, unsigned row2, bool extOnly)
+{
+	const char* name1 = strchr(fileTable.d[row1*fileCols+2], (int)'|') + 1;
+	const char* name2 = strchr(fileTable.d[row2*fileCols+2], (int)'|') + 1;
+	if (extOnly == true)
+	{
+		const char* dot1 = strrchr(name1, (int)'.');
+		const char* dot2 = strrchr(name2, (int)'.');
+		name1 = (dot1 != NULL) ? dot1 : "";
+		name2 = (dot2 != NULL) ? dot2 : "";
+	}
+	while (*name1 != '\0' &&
+		   tolower((unsigned char)*name1) == tolower((unsigned char)*name2))
+	{
+		name1++;
+		name2++;
 	}
+	return tolower((unsigned char)*name1) - tolower((unsigned char)*name2);
+}
+
+/* Order two `File' table rows for compression: small files first, then
+   by file type, then by name so that the same file in different
+   directories (such as translations) ends up adjacent, then by size.
+   Ties keep their previous sequence order.  */
+int FileCompress_qsort(const void* e1, const void* e2)
+{
+	unsigned row1 = *(unsigned*)e1;
+	unsigned row2 = *(unsigned*)e2;
+	unsigned long size1 = strtoul(fileTable.d[row1*fileCols+3], NULL, 10);
+	unsigned long size2 = strtoul(fileTable.d[row2*fileCols+3], NULL, 10);
+	bool small1 = (size1 < SMALL_FILE_SIZE) ? true : false;
+	bool small2 = (size2 < SMALL_FILE_SIZE) ? true : false;
+	int cmp;
+	if (small1 != small2)
+		return (small1 == true) ? -1 : 1;
+	cmp = FileNameCmp(row1, row2, true);
+	if (cmp == 0)
+		cmp = FileNameCmp(row1, row2, false);
+	if (cmp != 0)
+		return cmp;
+	if (size1 != size2)
+		return (size1 < size2) ? -1 : 1;
+	return FileSeq_qsort(e1, e2);
+}
+
+/* Reorder the files within each cabinet so that similar files are
+   compressed next to each other, and renumber their sequence numbers.
+   The cabinet boundaries in `cabLastSeq' stay the same.  */
+void SequenceForCompression()
+{
+	unsigned numFiles = fileTable.len / fileCols;
+	unsigned* order;
+	unsigned i;
+
+	order = (unsigned*)xmalloc(sizeof(unsigned) * (numFiles + 1));
+	for (i = 0; i < numFiles; i++)
+		order[i] = i;
+	qsort(order, numFiles, sizeof(unsigned), FileSeq_qsort);
+	for (i = 0; i < cabLastSeq.len; i++)
+	{
+		unsigned first = (i > 0) ? cabLastSeq.d[i-1] : 0;
+		qsort(order + first, cabLastSeq.d[i] - first, sizeof(unsigned),
+			  FileCompress_qsort);
+	}
+	for (i = 0; i < numFiles; i++)
+		sprintf(fileTable.d[order[i]*fileCols+7], "%u", i + 1);
+	xfree(order);
+}
+
+/* Returns the name of the cabinet for the given `Media' row in newly
+   allocated memory.  */
+char* CabinetName(unsigned index)
+{
+	char* cabName;
+	cabName = (char*)xmalloc(strlen(idPrefix) + 7 + 11 + 4 + 1);
+	if (cabLastSeq.len == 1)
+		sprintf(cabName, "%sarchive.cab", idPrefix);
 	else
+		sprintf(cabName, "%sarchive%u.cab", idPrefix, index + 1);
+	return cabName;
+}
+
+/* Write all files into the cabinets named in the `Media' table, in
+   order of their sequence numbers, using the file keys as the names
+   within the cabinet.  All cabinets are compressed at the same time.
+   Returns nonzero on success, zero on failure.  */
+int BuildCabinet()
+{
+	unsigned numFiles;
+	unsigned* order;
+	CabFile* cabFiles;
+	CabOutput* cabs;
+	int result;
+	unsigned i;
+
+	numFiles = fileTable.len / fileCols;
+	order = (unsigned*)xmalloc(sizeof(unsigned) * (numFiles + 1));
+	for (i = 0; i < numFiles; i++)
+		order[i] = i;
+	qsort(order, numFiles, sizeof(unsigned), FileSeq_qsort);
+	cabFiles = (CabFile*)xmalloc(sizeof(CabFile) * (numFiles + 1));
+	for (i = 0; i < numFiles; i++)
 	{
-		/* Recursively add a directory.  */
-		unsigned colStart;
-		char* featureID;
-		colStart = featureTable.len - featureCols;
-		featureID = featureTable.d[colStart];
-		AddFeatComps(&featCompTable, featureID, curDir);
+		cabFiles[i].path = filePaths.d[order[i]];
+		cabFiles[i].name = fileTable.d[order[i]*fileCols];
+	}
+	cabs = (CabOutput*)xmalloc(sizeof(CabOutput) * cabLastSeq.len);
+	for (i = 0; i < cabLastSeq.len; i++)
+	{
+		unsigned first = (i > 0) ? cabLastSeq.d[i-1] : 0;
+		cabs[i].path = CabinetName(i);
+		cabs[i].files = cabFiles + first;
+		cabs[i].count = cabLastSeq.d[i] - first;
+	}
+	result = WriteCabinets(cabs, cabLastSeq.len);
+	for (i = 0; i < cabLastSeq.len; i++)
+		xfree((char*)cabs[i].path);
+	xfree(cabs);
+	xfree(cabFiles);
+	xfree(order);
+	return result;
+}
+
+/* Write the names of the files for each cabinet in sequence order
+   into `dir': "cablist.txt" for a single cabinet, otherwise
+   "cablist1.txt", "cablist2.txt", and so on.  Returns nonzero on
+   success, zero on failure.  */
+int WriteCabLists(const char* dir)
+{
+	unsigned numFiles = fileTable.len / fileCols;
+	unsigned* order;
+	unsigned cab = 0;
+	FILE* fp = NULL;
+	unsigned i;
+	order = (unsigned*)xmalloc(sizeof(unsigned) * (numFiles + 1));
+	for (i = 0; i < numFiles; i++)
+		order[i] = i;
+	qsort(order, numFiles, sizeof(unsigned), FileSeq_qsort);
+	for (i = 0; i < numFiles; i++)
+	{
+		if (fp == NULL || i >= cabLastSeq.d[cab])
+		{
+			char* pathname;
+			if (fp != NULL)
+			{
+				fclose(fp);
+				cab++;
+			}
+			pathname = (char*)xmalloc(strlen(dir) + 1 + 7 + 11 + 4 + 1);
+			if (cabLastSeq.len == 1)
+				sprintf(pathname, "%s/cablist.txt", dir);
+			else
+				sprintf(pathname, "%s/cablist%u.txt", dir, cab + 1);
+			fp = fopen(pathname, "w");
+			if (fp == NULL)
+			{
+				fprintf(stderr, "ERROR: Could not write file: %s\n",
+						pathname);
+				xfree(pathname);
+				xfree(order);
+				return 0;
+			}
+			xfree(pathname);
+		}
+		fprintf(fp, "%s\n", fileTable.d[order[i]*fileCols]);
 	}
-	xfree(pathPart.d);
+	if (fp != NULL)
+		fclose(fp);
+	xfree(order);
 	return 1;
 }
 
+/* Place a copy of every file into `stageDir' under its file key, and
+   write the cabinet lists there, so that the cabinets can be built
+   with `cabarc' without touching the `ls -R' directories.  Returns
+   nonzero on success, zero on failure.  */
+int StageCabinetFiles()
+{
+	unsigned numFiles = fileTable.len / fileCols;
+	char** destPaths;
+	int result;
+	unsigned i;
+
+	if (mkdir(stageDir, 0777) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "ERROR: Could not create directory: %s\n",
+				stageDir);
+		return 0;
+	}
+	destPaths = (char**)xmalloc(sizeof(char*) * (numFiles + 1));
+	for (i = 0; i < numFiles; i++)
+	{
+		char* fileID = fileTable.d[i*fileCols];
+		destPaths[i] = (char*)xmalloc(strlen(stageDir) + 1 +
+									  strlen(fileID) + 1);
+		sprintf(destPaths[i], "%s/%s", stageDir, fileID);
+	}
+	result = StageFiles(filePaths.d, destPaths, numFiles);
+	for (i = 0; i < numFiles; i++)
+		xfree(destPaths[i]);
+	xfree(destPaths);
+	if (result)
+		result = WriteCabLists(stageDir);
+	return result;
+}
+
+/* Returns the long name part of a `short|long' name.  */
+char* LongName(char* name)
+{
+	char* barPos = strchr(name, (int)'|');
+	return (barPos != NULL) ? barPos + 1 : name;
+}
+
+/* Lay out the files uncompressed in `layoutDir' under the source
+   directory structure given by the `Directory' table, so that an
+   installer database placed in `layoutDir' installs straight from
+   them, and mark all files as uncompressed.  The files are linked
+   rather than copied where possible.  Returns nonzero on success, zero
+   on failure.  */
+int LayoutAdminImage()
+{
+	unsigned numDirs = dirTable.len / dirCols;
+	unsigned numFiles = fileTable.len / fileCols;
+	FileIndex_array dirIndex;
+	FileIndex_array compIndex;
+	char** dirPaths;
+	char** destPaths;
+	char* progPath;
+	int result = 1;
+	unsigned i;
+
+	/* The application folder sits directly in the root of the source,
+	   since `ProgramFilesFolder' is `.'.  */
+	progPath = (char*)xmalloc(strlen(layoutDir) + 1 +
+							  strlen(progDirName) + 1);
+	sprintf(progPath, "%s/%s", layoutDir, LongName(progDirName));
+	if ((mkdir(layoutDir, 0777) != 0 && errno != EEXIST) ||
+		(mkdir(progPath, 0777) != 0 && errno != EEXIST))
+	{
+		fprintf(stderr, "ERROR: Could not create directory: %s\n",
+				progPath);
+		xfree(progPath);
+		return 0;
+	}
+
+	/* Directories are always listed after their parents.  */
+	BuildKeyIndex(&dirIndex, &dirTable, dirCols);
+	dirPaths = (char**)xmalloc(sizeof(char*) * (numDirs + 1));
+	for (i = 0; i < numDirs; i++)
+	{
+		unsigned parent = LookupKey(&dirIndex, dirTable.d[i*dirCols+1]);
+		char* parentPath = (parent != (unsigned)-1) ?
+			dirPaths[parent] : progPath;
+		char* name = dirTable.d[i*dirCols+2];
+		/* The first root directory is written to the `Directory' table
+		   as `.', the application folder itself.  */
+		if (i == 0 || strcmp(name, ".") == 0)
+		{
+			dirPaths[i] = (char*)xmalloc(strlen(parentPath) + 1);
+			strcpy(dirPaths[i], parentPath);
+			continue;
+		}
+		name = LongName(name);
+		dirPaths[i] = (char*)xmalloc(strlen(parentPath) + 1 +
+									 strlen(name) + 1);
+		sprintf(dirPaths[i], "%s/%s", parentPath, name);
+		if (result && mkdir(dirPaths[i], 0777) != 0 && errno != EEXIST)
+		{
+			fprintf(stderr, "ERROR: Could not create directory: %s\n",
+					dirPaths[i]);
+			result = 0;
+		}
+	}
+
+	if (result)
+	{
+		BuildKeyIndex(&compIndex, &compTable, compCols);
+		destPaths = (char**)xmalloc(sizeof(char*) * (numFiles + 1));
+		for (i = 0; i < numFiles; i++)
+		{
+			unsigned comp = LookupKey(&compIndex, fileTable.d[i*fileCols+1]);
+			unsigned dir = LookupKey(&dirIndex,
+									 compTable.d[comp*compCols+2]);
+			char* name = LongName(fileTable.d[i*fileCols+2]);
+			destPaths[i] = (char*)xmalloc(strlen(dirPaths[dir]) + 1 +
+										  strlen(name) + 1);
+			sprintf(destPaths[i], "%s/%s", dirPaths[dir], name);
+			/* msidbFileAttributesNoncompressed */
+			fileTable.d[i*fileCols+6] = "8192";
+		}
+		result = StageFiles(filePaths.d, destPaths, numFiles);
+		for (i = 0; i < numFiles; i++)
+			xfree(destPaths[i]);
+		xfree(destPaths);
+		xfree(compIndex.d);
+	}
+
+	for (i = 0; i < numDirs; i++)
+		xfree(dirPaths[i]);
+	xfree(dirPaths);
+	xfree(dirIndex.d);
+	xfree(progPath);
+	return result;
+}
+
 char* GetUuid()
 {
 	char* uuid;
@@ -1174,24 +3477,55 @@ char* GetUuid()
 	return uuid;
 }
 
-/* This function takes a filename and returns the index in the file
-   table for which that file's information is located.  In this
-   function, `end' refers to the element one position beyond the end
-   of the list.  */
-/* This function is untested.  */
-unsigned FindFile(FileIndex_array* database, char* filename,
-				  unsigned begin, unsigned end)
-{
-	unsigned middle;
-	if (end - begin == 0)
-		return (unsigned)-1;
-	middle = (begin + end) / 2;
-	if (strcmp(database->d[middle*fileCols+2].name, filename) == 0)
-		return database->d[middle*fileCols+2].tableIndex;
-	else if (strcmp(database->d[middle*fileCols+2].name, filename) < 0)
-		return FindFile(database, filename, begin, middle);
-	else
-		return FindFile(database, filename, middle + 1, end);
+/* Hash `len' characters of a file or directory name.  */
+unsigned NameHash(const char* name, unsigned len)
+{
+	/* FNV-1a */
+	unsigned hash = 2166136261u;
+	unsigned i;
+	for (i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Returns the subdirectory of `dir' named by the first `len'
+   characters of `name', or NULL if there is none.  */
+DirTree* FindChildDir(DirTree* dir, const char* name, unsigned len)
+{
+	unsigned* index = name_map_find(&dir->childNames,
+									eh_strview_make(name, len));
+	return (index != NULL) ? &dir->children.d[*index] : NULL;
+}
+
+/* Returns the index of the start of the `File' table row of the file
+   in `dir' with the given long name, or (unsigned)-1 if there is
+   none.  */
+unsigned FindFileInDir(DirTree* dir, const char* name)
+{
+	unsigned* index = name_map_find(&dir->fileNames,
+									eh_strview_cstr(name));
+	return (index != NULL) ? dir->fileIdcs.d[*index] : (unsigned)-1;
+}
+
+/* Returns a new string with a short name for `longName' that is unique
+   within the directory whose `Directory' table row starts at
+   `colStart', or NULL if there is none left.  */
+char* DirShortName(unsigned colStart, const char* longName)
+{
+	unsigned row = colStart / dirCols;
+	if (row >= dirShortNames.len)
+	{
+		unsigned i = dirShortNames.len;
+		EA_SET_SIZE(dirShortNames, row + 1);
+		for (; i <= row; i++)
+			dirShortNames.d[i] = NULL;
+	}
+	if (dirShortNames.d[row] == NULL)
+		dirShortNames.d[row] = ShortNameSetCreate();
+	return MakeShortName(dirShortNames.d[row], longName);
 }
 
 /* Parse a path and search all root directory collections until there
@@ -1220,61 +3554,68 @@ DirTree* FindAnyDirTree(char* path)
    "path" must not include the root prefix.  */
 DirTree* FindDirTree(DirTree* rootDir, char* path)
 {
-	char* substr;
-	char* slashPos;
-	unsigned subLen;
-	unsigned i;
-	bool lastPart;
-	slashPos = strchr(path, (int)'/');
-	if (slashPos == NULL)
-	{
-		/* This is the last part to look for.  */
-		lastPart = true;
-		substr = path;
-	}
-	else
+	DirTree* dir = rootDir;
+	while (dir != NULL)
 	{
-		lastPart = false;
-		subLen = slashPos - path;
-		substr = (char*)xmalloc(subLen + 1);
-		strncpy(substr, path, subLen);
-		substr[subLen] = '\0';
+		unsigned len = strcspn(path, "/");
+		dir = FindChildDir(dir, path, len);
+		if (path[len] == '\0')
+			break;
+		path += len + 1;
 	}
-	for (i = 0; i < rootDir->children.len; i++)
+	return dir;
+}
+
+/* Hash and compare `FeatureComponents' rows for `featComps'.  */
+unsigned FeatCompHash(FeatCompKey key)
+{
+	return NameHash(key.featureID, strlen(key.featureID)) ^
+		(NameHash(key.compID, strlen(key.compID)) * 16777619u);
+}
+
+int FeatCompEqual(FeatCompKey key1, FeatCompKey key2)
+{
+	return strcmp(key1.featureID, key2.featureID) == 0 &&
+		strcmp(key1.compID, key2.compID) == 0;
+}
+
+/* Add a `FeatureComponents' row unless the same pair was already
+   added.  */
+void AddFeatComp(char* featureID, char* compID)
+{
+	FeatCompKey key;
+	key.featureID = featureID;
+	key.compID = compID;
+	if (!featcomp_set_add(&featComps, key))
 	{
-		if (strcmp(rootDir->children.d[i].name, substr) == 0)
-		{
-			if (lastPart == false)
-			{
-				xfree(substr);
-				return FindDirTree(&rootDir->children.d[i], slashPos + 1);
-			}
-			else
-				return &rootDir->children.d[i];
-		}
+		featCompDups++;
+		return;
 	}
-	if (lastPart == false)
-		xfree(substr);
-	return NULL;
+	EA_APPEND(featCompTable, featureID);
+	EA_APPEND(featCompTable, compID);
 }
 
-/* Recursively associate components for a feature given a DirTree
-   structure to traverse.  */
-void AddFeatComps(char_ptr_array* featCompTable, char* featureID,
-				  DirTree* curDir)
+/* Add the components of a directory and all of its subdirectories to
+   a feature.  */
+void AddFeatComps(char* featureID, DirTree* dir)
 {
-	unsigned colStart;
-	unsigned i;
+	DirTree_ptr_array stack;
 
-	if (curDir->component != NULL)
+	EA_INIT(DirTree_ptr, stack, 16);
+	EA_APPEND(stack, dir);
+	while (stack.len > 0)
 	{
-		colStart = featCompTable->len;
-		EA_SET_SIZE(*featCompTable, featCompTable->len + featCompCols);
-		featCompTable->d[colStart] = featureID;
-		featCompTable->d[colStart+1] = curDir->component;
+		DirTree* curDir = stack.d[stack.len-1];
+		unsigned i;
+		EA_POP_BACK(stack);
+		if (curDir->component != NULL)
+			AddFeatComp(featureID, curDir->component);
+		/* Push the children in reverse so that they are visited in
+		   order.  */
+		for (i = curDir->children.len; i > 0; i--)
+			EA_APPEND(stack, &curDir->children.d[i-1]);
 	}
-	for (i = 0; i < curDir->children.len; i++)
-		AddFeatComps(featCompTable, featureID, &curDir->children.d[i]);
+	xfree(stack.d);
 }
 
 void FreeDirTree(DirTree* dir)
@@ -1284,4 +3625,6 @@ void FreeDirTree(DirTree* dir)
 		FreeDirTree(&dir->children.d[i]);
 	xfree(dir->children.d);
 	xfree(dir->fileIdcs.d);
+	name_map_destroy(&dir->childNames);
+	name_map_destroy(&dir->fileNames);
 }
@@ -0,0 +1,642 @@
+/* msi-validate.c -- check generated installer tables for errors that
+   Windows Installer would reject.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* The checks are the ones that `msidb' and the ICE validators would
+   otherwise only report after the tables were imported on Windows:
+   cells that do not fit the column type written in the table header,
+   duplicate primary keys, references to rows that do not exist, and
+   gaps in the file sequence numbers.
+
+   Validation runs in two passes on the thread pool.  The first pass
+   checks the cells of every table in chunks of rows and builds a hash
+   index of the primary keys of each table.  The second pass uses
+   those indices to look up every foreign key, again in chunks, so
+   even a table with a million rows is checked in a fraction of a
+   second.  Messages are collected per chunk and printed in table
+   order once all work is done.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "thread-pool.h"
+#include "msi-db.h"
+#include "msi-validate.h"
+
+/* The number of rows checked by one work item.  */
+#define CHUNK_ROWS 65536
+/* At most this many messages are printed.  */
+#define MAX_MESSAGES 50
+
+typedef char* char_ptr;
+typedef struct ColumnInfo_t ColumnInfo;
+typedef struct TableInfo_t TableInfo;
+typedef struct Check_t Check;
+
+EA_TYPE(char);
+EA_TYPE(char_ptr);
+
+struct ColumnInfo_t
+{
+	char* name;
+	/* `s', `l', or `i' */
+	char kind;
+	bool nullable;
+	/* Maximum string length, zero for no limit, or the integer size in
+	   bytes.  */
+	unsigned width;
+};
+
+struct TableInfo_t
+{
+	MsiTable* table;
+	/* Owns the parsed header, which the names below point into.  */
+	char* header;
+	char* name;
+	ColumnInfo* cols;
+	unsigned numKeys;
+	/* Hash index of the primary keys.  Each slot holds a row index
+	   plus one, or zero if it is empty.  */
+	unsigned* keyHash;
+	unsigned keyMask;
+};
+
+enum CheckKind
+{
+	CHECK_CELLS,
+	CHECK_KEYS,
+	CHECK_REFS,
+	CHECK_SEQUENCE
+};
+
+/* One work item.  */
+struct Check_t
+{
+	enum CheckKind kind;
+	TableInfo* info;
+	unsigned firstRow;
+	unsigned numRows;
+	/* For `CHECK_REFS' and `CHECK_SEQUENCE' */
+	unsigned col;
+	TableInfo* refInfo;
+	unsigned refCol;
+	/* Messages separated by newlines, and the number of errors found,
+	   which can be more than the number of messages.  */
+	char_array msgs;
+	unsigned numMsgs;
+	unsigned numErrors;
+};
+
+static bool ParseHeader(TableInfo* info);
+static TableInfo* FindTable(TableInfo* infos, unsigned numInfos,
+							const char* name);
+static unsigned FindColumn(TableInfo* info, const char* name);
+static unsigned HashCells(char** cells, unsigned numCells);
+static void AddError(Check* check, const char* format, ...);
+static void CheckCells(Check* check);
+static void CheckKeys(Check* check);
+static void CheckRefs(Check* check);
+static void CheckSequence(Check* check);
+static void ValidateWorker(void* data, unsigned index);
+static void AddChunks(Check** checks, unsigned* numChecks,
+					  enum CheckKind kind, TableInfo* info, unsigned col,
+					  TableInfo* refInfo);
+
+/* Check all tables.  Every column listed in `foreignKeys' must refer
+   to an existing row of its referenced table.  Prints an error for
+   every problem found.  Returns nonzero if the tables are valid, zero
+   otherwise.  */
+int ValidateMsiTables(MsiTable* tables, unsigned numTables,
+					  const MsiForeignKey* foreignKeys,
+					  unsigned numForeignKeys)
+{
+	TableInfo* infos;
+	Check* checks = NULL;
+	unsigned numChecks = 0;
+	unsigned firstPass;
+	unsigned numErrors = 0;
+	unsigned numPrinted = 0;
+	bool headersValid = true;
+	unsigned i;
+
+	infos = (TableInfo*)xmalloc(sizeof(TableInfo) * (numTables + 1));
+	for (i = 0; i < numTables; i++)
+	{
+		infos[i].table = &tables[i];
+		if (!ParseHeader(&infos[i]))
+			headersValid = false;
+	}
+	if (headersValid == false)
+	{
+		for (i = 0; i < numTables; i++)
+		{
+			xfree(infos[i].header);
+			xfree(infos[i].cols);
+		}
+		xfree(infos);
+		return 0;
+	}
+
+	/* First pass: cells and primary keys.  */
+	for (i = 0; i < numTables; i++)
+	{
+		AddChunks(&checks, &numChecks, CHECK_CELLS, &infos[i], 0, NULL);
+		AddChunks(&checks, &numChecks, CHECK_KEYS, &infos[i], 0, NULL);
+	}
+	firstPass = numChecks;
+	ParallelFor(numChecks, ValidateWorker, checks);
+
+	/* Second pass: foreign keys and sequence numbers.  */
+	for (i = 0; i < numForeignKeys; i++)
+	{
+		TableInfo* info;
+		TableInfo* refInfo;
+		unsigned col;
+		info = FindTable(infos, numTables, foreignKeys[i].table);
+		refInfo = FindTable(infos, numTables, foreignKeys[i].refTable);
+		if (info == NULL || refInfo == NULL)
+			continue;
+		col = FindColumn(info, foreignKeys[i].column);
+		if (col == (unsigned)-1 || refInfo->numKeys != 1)
+			continue;
+		AddChunks(&checks, &numChecks, CHECK_REFS, info, col, refInfo);
+	}
+	{
+		TableInfo* fileInfo = FindTable(infos, numTables, "File");
+		TableInfo* mediaInfo = FindTable(infos, numTables, "Media");
+		if (fileInfo != NULL && mediaInfo != NULL &&
+			FindColumn(fileInfo, "Sequence") != (unsigned)-1 &&
+			FindColumn(mediaInfo, "LastSequence") != (unsigned)-1)
+		{
+			AddChunks(&checks, &numChecks, CHECK_SEQUENCE, fileInfo,
+					  FindColumn(fileInfo, "Sequence"), mediaInfo);
+			checks[numChecks-1].refCol =
+				FindColumn(mediaInfo, "LastSequence");
+		}
+	}
+	ParallelFor(numChecks - firstPass, ValidateWorker, checks + firstPass);
+
+	for (i = 0; i < numChecks; i++)
+	{
+		char* msg = checks[i].msgs.d;
+		numErrors += checks[i].numErrors;
+		while (numPrinted < MAX_MESSAGES && *msg != '\0')
+		{
+			char* end = strchr(msg, '\n');
+			fwrite(msg, 1, end - msg + 1, stderr);
+			msg = end + 1;
+			numPrinted++;
+		}
+		xfree(checks[i].msgs.d);
+	}
+	if (numErrors > numPrinted)
+	{
+		fprintf(stderr, "ERROR: %u more errors were found in the tables.\n",
+				numErrors - numPrinted);
+	}
+
+	for (i = 0; i < numTables; i++)
+	{
+		xfree(infos[i].header);
+		xfree(infos[i].cols);
+		xfree(infos[i].keyHash);
+	}
+	xfree(infos);
+	xfree(checks);
+	return (numErrors == 0);
+}
+
+/* Parse the column names, types, and key columns out of the header of
+   `info->table'.  Returns true on success, false on failure.  */
+static bool ParseHeader(TableInfo* info)
+{
+	MsiTable* table = info->table;
+	char* lines[3];
+	char_ptr_array names, types, keys;
+	bool retval = false;
+	unsigned i;
+
+	info->header = (char*)xmalloc(strlen(table->header) + 1);
+	strcpy(info->header, table->header);
+	info->name = "";
+	info->cols = NULL;
+	info->numKeys = 0;
+	info->keyHash = NULL;
+	info->keyMask = 0;
+	lines[0] = info->header;
+	lines[1] = strchr(lines[0], '\n');
+	lines[2] = (lines[1] != NULL) ? strchr(lines[1] + 1, '\n') : NULL;
+	if (lines[2] == NULL)
+	{
+		fputs("ERROR: Invalid table header.\n", stderr);
+		return false;
+	}
+	*lines[1]++ = '\0';
+	*lines[2]++ = '\0';
+	lines[2][strcspn(lines[2], "\r\n")] = '\0';
+
+	EA_INIT(char_ptr, names, 16);
+	EA_INIT(char_ptr, types, 16);
+	EA_INIT(char_ptr, keys, 16);
+	EA_APPEND(names, lines[0]);
+	EA_APPEND(types, lines[1]);
+	EA_APPEND(keys, lines[2]);
+	for (i = 0; i < 3; i++)
+	{
+		char_ptr_array* fields = (i == 0) ? &names :
+			(i == 1) ? &types : &keys;
+		char* pos = fields->d[0];
+		while ((pos = strchr(pos, '\t')) != NULL)
+		{
+			*pos++ = '\0';
+			EA_APPEND(*fields, pos);
+		}
+	}
+	info->name = keys.d[0];
+	info->numKeys = keys.len - 1;
+	if (names.len != table->numCols || types.len != table->numCols ||
+		info->numKeys == 0 || info->numKeys > table->numCols)
+	{
+		fprintf(stderr, "ERROR: Invalid header for table: %s\n", info->name);
+		goto cleanup;
+	}
+
+	info->cols = (ColumnInfo*)xmalloc(sizeof(ColumnInfo) * table->numCols);
+	for (i = 0; i < table->numCols; i++)
+	{
+		ColumnInfo* col = &info->cols[i];
+		col->name = names.d[i];
+		col->kind = (char)tolower((unsigned char)types.d[i][0]);
+		col->nullable = isupper((unsigned char)types.d[i][0]) ? true : false;
+		col->width = (unsigned)atoi(types.d[i] + 1);
+		if ((col->kind != 's' && col->kind != 'l' && col->kind != 'i') ||
+			(col->kind == 'i' && col->width != 2 && col->width != 4) ||
+			col->width > 255)
+		{
+			fprintf(stderr, "ERROR: Invalid column type in table %s: %s\n",
+					info->name, types.d[i]);
+			goto cleanup;
+		}
+		if (i < info->numKeys && strcmp(col->name, keys.d[i+1]) != 0)
+		{
+			fprintf(stderr, "ERROR: Key columns of table %s must "
+					"come first.\n", info->name);
+			goto cleanup;
+		}
+	}
+	retval = true;
+
+cleanup:
+	xfree(names.d);
+	xfree(types.d);
+	xfree(keys.d);
+	return retval;
+}
+
+static TableInfo* FindTable(TableInfo* infos, unsigned numInfos,
+							const char* name)
+{
+	unsigned i;
+	for (i = 0; i < numInfos; i++)
+	{
+		if (strcmp(infos[i].name, name) == 0)
+			return &infos[i];
+	}
+	return NULL;
+}
+
+/* Returns the index of the named column, or (unsigned)-1 if there is
+   none.  */
+static unsigned FindColumn(TableInfo* info, const char* name)
+{
+	unsigned i;
+	for (i = 0; i < info->table->numCols; i++)
+	{
+		if (strcmp(info->cols[i].name, name) == 0)
+			return i;
+	}
+	return (unsigned)-1;
+}
+
+static unsigned HashCells(char** cells, unsigned numCells)
+{
+	/* FNV-1a, with a null character after each cell */
+	unsigned hash = 2166136261u;
+	unsigned i;
+	for (i = 0; i < numCells; i++)
+	{
+		const unsigned char* c;
+		for (c = (const unsigned char*)cells[i]; *c != '\0'; c++)
+		{
+			hash ^= *c;
+			hash *= 16777619u;
+		}
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Count an error, and keep its message unless enough messages were
+   collected already.  */
+static void AddError(Check* check, const char* format, ...)
+{
+	va_list ap;
+	char buffer[512];
+	unsigned len;
+
+	check->numErrors++;
+	if (check->numMsgs >= MAX_MESSAGES)
+		return;
+	check->numMsgs++;
+	va_start(ap, format);
+	vsnprintf(buffer, sizeof(buffer) - 1, format, ap);
+	va_end(ap);
+	buffer[sizeof(buffer) - 2] = '\0';
+	len = strlen(buffer);
+	buffer[len++] = '\n';
+	/* Replace the null character at the end.  */
+	EA_POP_BACK(check->msgs);
+	EA_APPEND_MULT(check->msgs, buffer, len);
+	EA_APPEND(check->msgs, '\0');
+}
+
+/* Check that every cell fits the type of its column.  */
+static void CheckCells(Check* check)
+{
+	MsiTable* table = check->info->table;
+	unsigned numCols = table->numCols;
+	unsigned row;
+
+	for (row = check->firstRow; row < check->firstRow + check->numRows;
+		 row++)
+	{
+		char** cells = &table->cells[row*numCols];
+		unsigned i;
+		for (i = 0; i < numCols; i++)
+		{
+			ColumnInfo* col = &check->info->cols[i];
+			const char* text = cells[i];
+			if (text[0] == '\0')
+			{
+				if (col->nullable == false)
+				{
+					AddError(check, "ERROR: %s row `%s': %s must not "
+							 "be empty.", check->info->name, cells[0],
+							 col->name);
+				}
+			}
+			else if (col->kind == 'i')
+			{
+				const char* c = text;
+				long limit = (col->width == 2) ? 32767L : 2147483647L;
+				long value = 0;
+				bool valid = true;
+				bool tooLarge = false;
+				if (*c == '-')
+					c++;
+				if (*c == '\0')
+					valid = false;
+				for (; *c != '\0' && valid == true; c++)
+				{
+					if (!isdigit((unsigned char)*c))
+						valid = false;
+					else if (value > (limit - (*c - '0')) / 10)
+						tooLarge = true;
+					else
+						value = value * 10 + (*c - '0');
+				}
+				if (valid == false)
+				{
+					AddError(check, "ERROR: %s row `%s': %s is not an "
+							 "integer: %s", check->info->name, cells[0],
+							 col->name, text);
+				}
+				else if (tooLarge == true)
+				{
+					AddError(check, "ERROR: %s row `%s': %s does not fit "
+							 "in %u bytes: %s", check->info->name, cells[0],
+							 col->name, col->width, text);
+				}
+			}
+			else
+			{
+				size_t len = strcspn(text, "\t\r\n");
+				if (text[len] != '\0')
+				{
+					AddError(check, "ERROR: %s row `%s': %s contains a "
+							 "tab or line break.", check->info->name,
+							 cells[0], col->name);
+				}
+				else if (col->width != 0 && len > col->width)
+				{
+					AddError(check, "ERROR: %s row `%s': %s is longer "
+							 "than %u characters: %s", check->info->name,
+							 cells[0], col->name, col->width, text);
+				}
+			}
+		}
+	}
+}
+
+/* Build the primary key index of a table, reporting duplicate
+   keys.  */
+static void CheckKeys(Check* check)
+{
+	TableInfo* info = check->info;
+	MsiTable* table = info->table;
+	unsigned mask = 1;
+	unsigned row;
+
+	while (mask < table->numRows * 2)
+		mask <<= 1;
+	info->keyHash = (unsigned*)xmalloc(sizeof(unsigned) * mask);
+	memset(info->keyHash, 0, sizeof(unsigned) * mask);
+	info->keyMask = --mask;
+	for (row = 0; row < table->numRows; row++)
+	{
+		char** cells = &table->cells[row*table->numCols];
+		unsigned slot = HashCells(cells, info->numKeys) & mask;
+		bool duplicate = false;
+		while (info->keyHash[slot] != 0)
+		{
+			char** other = &table->cells[(info->keyHash[slot] - 1) *
+										 table->numCols];
+			unsigned i;
+			for (i = 0; i < info->numKeys; i++)
+			{
+				if (strcmp(cells[i], other[i]) != 0)
+					break;
+			}
+			if (i == info->numKeys)
+			{ duplicate = true; break; }
+			slot = (slot + 1) & mask;
+		}
+		if (duplicate == true)
+		{
+			if (info->numKeys == 1)
+			{
+				AddError(check, "ERROR: %s row `%s' is listed more than "
+						 "once.", info->name, cells[0]);
+			}
+			else
+			{
+				AddError(check, "ERROR: %s row `%s', `%s' is listed more "
+						 "than once.", info->name, cells[0], cells[1]);
+			}
+		}
+		else
+			info->keyHash[slot] = row + 1;
+	}
+}
+
+/* Check that every value of a foreign key column names a row of the
+   referenced table.  */
+static void CheckRefs(Check* check)
+{
+	MsiTable* table = check->info->table;
+	TableInfo* refInfo = check->refInfo;
+	MsiTable* refTable = refInfo->table;
+	unsigned row;
+
+	for (row = check->firstRow; row < check->firstRow + check->numRows;
+		 row++)
+	{
+		char** cells = &table->cells[row*table->numCols];
+		char* value = cells[check->col];
+		unsigned slot;
+		bool found = false;
+		if (value[0] == '\0')
+			continue;
+		slot = HashCells(&value, 1) & refInfo->keyMask;
+		while (refInfo->keyHash[slot] != 0)
+		{
+			if (strcmp(refTable->cells[(refInfo->keyHash[slot] - 1) *
+									   refTable->numCols], value) == 0)
+			{ found = true; break; }
+			slot = (slot + 1) & refInfo->keyMask;
+		}
+		if (found == false)
+		{
+			AddError(check, "ERROR: %s row `%s': %s `%s' is not in the %s "
+					 "table.", check->info->name, cells[0],
+					 check->info->cols[check->col].name, value,
+					 refInfo->name);
+		}
+	}
+}
+
+/* Check that the file sequence numbers run from one to the number of
+   files without gaps, and that the disks of the `Media' table cover
+   them in order.  */
+static void CheckSequence(Check* check)
+{
+	MsiTable* table = check->info->table;
+	MsiTable* media = check->refInfo->table;
+	unsigned numFiles = table->numRows;
+	bool* seen;
+	unsigned lastSeq = 0;
+	unsigned row;
+
+	seen = (bool*)xmalloc(sizeof(bool) * (numFiles + 1));
+	memset(seen, 0, sizeof(bool) * (numFiles + 1));
+	for (row = 0; row < numFiles; row++)
+	{
+		char** cells = &table->cells[row*table->numCols];
+		long seq = atol(cells[check->col]);
+		if (seq < 1 || (unsigned long)seq > numFiles)
+		{
+			AddError(check, "ERROR: File row `%s': Sequence %s is outside "
+					 "of 1 to %u.", cells[0], cells[check->col], numFiles);
+		}
+		else if (seen[seq] == true)
+		{
+			AddError(check, "ERROR: File row `%s': Sequence %s is used "
+					 "more than once.", cells[0], cells[check->col]);
+		}
+		else
+			seen[seq] = true;
+	}
+	for (row = 1; row <= numFiles; row++)
+	{
+		if (seen[row] == false)
+			AddError(check, "ERROR: No file has the sequence number %u.",
+					 row);
+	}
+	xfree(seen);
+
+	for (row = 0; row < media->numRows; row++)
+	{
+		char** cells = &media->cells[row*media->numCols];
+		unsigned seq = (unsigned)atol(cells[check->refCol]);
+		if (seq < lastSeq)
+		{
+			AddError(check, "ERROR: Media row `%s': LastSequence %u is "
+					 "below that of the previous disk.", cells[0], seq);
+		}
+		lastSeq = seq;
+	}
+	if (lastSeq < numFiles)
+	{
+		AddError(check, "ERROR: The last disk in the Media table ends at "
+				 "sequence %u, but there are %u files.", lastSeq, numFiles);
+	}
+}
+
+static void ValidateWorker(void* data, unsigned index)
+{
+	Check* check = &((Check*)data)[index];
+	switch (check->kind)
+	{
+	case CHECK_CELLS: CheckCells(check); break;
+	case CHECK_KEYS: CheckKeys(check); break;
+	case CHECK_REFS: CheckRefs(check); break;
+	case CHECK_SEQUENCE: CheckSequence(check); break;
+	}
+}
+
+/* Add the work items for one check of a table.  Row checks are split
+   into chunks, the others cover the whole table.  */
+static void AddChunks(Check** checks, unsigned* numChecks,
+					  enum CheckKind kind, TableInfo* info, unsigned col,
+					  TableInfo* refInfo)
+{
+	unsigned numRows = info->table->numRows;
+	unsigned chunkRows;
+	unsigned first = 0;
+
+	chunkRows = (kind == CHECK_CELLS || kind == CHECK_REFS) ?
+		CHUNK_ROWS : numRows;
+	do
+	{
+		Check* check;
+		*checks = (Check*)xrealloc(*checks, sizeof(Check) * (*numChecks + 1));
+		check = &(*checks)[(*numChecks)++];
+		check->kind = kind;
+		check->info = info;
+		check->firstRow = first;
+		check->numRows = (numRows - first < chunkRows) ?
+			numRows - first : chunkRows;
+		check->col = col;
+		check->refInfo = refInfo;
+		check->refCol = 0;
+		EA_INIT(char, check->msgs, 16);
+		EA_APPEND(check->msgs, '\0');
+		check->numMsgs = 0;
+		check->numErrors = 0;
+		first += check->numRows;
+	} while (first < numRows);
+}
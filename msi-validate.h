@@ -0,0 +1,30 @@
+/* msi-validate.h -- check generated installer tables for errors that
+   Windows Installer would reject.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef MSI_VALIDATE_H
+#define MSI_VALIDATE_H
+
+/* Note: `msi-db.h' must be included before this header.  */
+
+typedef struct MsiForeignKey_t MsiForeignKey;
+
+/* A column whose values must be null or name a row of `refTable' by
+   its primary key, which must be a single column.  */
+struct MsiForeignKey_t
+{
+	const char* table;
+	const char* column;
+	const char* refTable;
+};
+
+int ValidateMsiTables(MsiTable* tables, unsigned numTables,
+					  const MsiForeignKey* foreignKeys,
+					  unsigned numForeignKeys);
+
+#endif /* not MSI_VALIDATE_H */
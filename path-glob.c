@@ -0,0 +1,407 @@
+/* path-glob.c -- match path names against a set of glob patterns one
+   directory level at a time.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* All patterns of a set are compiled into one nondeterministic
+   automaton.  Every path component of every pattern is a state, and
+   each pattern has one more state for having matched a whole
+   directory, which then matches everything below it.  A caller walks
+   a directory tree from the top, keeping the set of states reached
+   for each directory: `GlobStep()' moves from a directory into one of
+   its subdirectories, and `GlobMatchFile()' tests a file in the
+   directory.  Directories that no state reaches need not be visited
+   at all.
+
+   The following syntax is supported within a path component:
+
+   *       any number of characters
+   ?       any one character
+   [...]   any one of the characters listed, where `a-z' is a range
+           and a leading `!' or `^' negates the class
+   \c      the character `c' itself
+
+   A component that consists of `**' matches any number of
+   directories, including none.  A pattern that starts with `!'
+   excludes the files it matches from those that the other patterns
+   match.  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "path-glob.h"
+
+/* Token types */
+#define GLOB_CHAR 0
+#define GLOB_ANY 1
+#define GLOB_STAR 2
+#define GLOB_CLASS 3
+
+typedef struct GlobToken_t GlobToken;
+typedef struct GlobComp_t GlobComp;
+
+struct GlobToken_t
+{
+	unsigned type;
+	unsigned char ch;
+	unsigned char charClass[32]; /* One bit per character */
+};
+
+/* One path component of a pattern, which is also a state.  */
+struct GlobComp_t
+{
+	unsigned pattern;
+	/* Set if this is the state after the last component.  */
+	bool end;
+	/* Set for `**'.  */
+	bool anyDirs;
+	/* Set if the component has no special characters, in which case
+	   `literal' holds it.  */
+	char* literal;
+	GlobToken* tokens;
+	unsigned numTokens;
+};
+
+struct GlobSet_t
+{
+	GlobComp* comps;
+	unsigned numComps;
+	unsigned numPatterns;
+	/* The first state of each pattern.  */
+	unsigned* firstComp;
+	bool* exclude;
+	bool* matched;
+	/* Marks used to avoid duplicate states within one step.  */
+	unsigned* marks;
+	unsigned curMark;
+};
+
+static void CompileComponent(GlobComp* comp, const char* text, unsigned len);
+static bool MatchTokens(const GlobToken* tokens, unsigned numTokens,
+						const char* name);
+static bool MatchComponent(const GlobComp* comp, const char* name);
+static unsigned AddState(GlobSet* set, unsigned state, unsigned* next,
+						 unsigned numNext);
+
+/* Compile `count' patterns into a set.  Returns the new set.  */
+GlobSet* GlobCompile(char** patterns, unsigned count)
+{
+	GlobSet* set;
+	unsigned maxComps = 0;
+	unsigned p;
+
+	for (p = 0; p < count; p++)
+	{
+		const char* c;
+		maxComps += 2;
+		for (c = patterns[p]; *c != '\0'; c++)
+		{
+			if (*c == '/')
+				maxComps++;
+		}
+	}
+	set = (GlobSet*)xmalloc(sizeof(GlobSet));
+	set->comps = (GlobComp*)xmalloc(sizeof(GlobComp) * (maxComps + 1));
+	set->numComps = 0;
+	set->numPatterns = count;
+	set->firstComp = (unsigned*)xmalloc(sizeof(unsigned) * (count + 1));
+	set->exclude = (bool*)xmalloc(sizeof(bool) * (count + 1));
+	set->matched = (bool*)xmalloc(sizeof(bool) * (count + 1));
+
+	for (p = 0; p < count; p++)
+	{
+		const char* text = patterns[p];
+		GlobComp* comp;
+		set->firstComp[p] = set->numComps;
+		set->exclude[p] = (text[0] == '!') ? true : false;
+		set->matched[p] = false;
+		if (text[0] == '!')
+			text++;
+		while (*text != '\0')
+		{
+			unsigned len = strcspn(text, "/");
+			if (len > 0)
+			{
+				comp = &set->comps[set->numComps++];
+				comp->pattern = p;
+				comp->end = false;
+				CompileComponent(comp, text, len);
+			}
+			text += len;
+			if (*text == '/')
+				text++;
+		}
+		comp = &set->comps[set->numComps++];
+		comp->pattern = p;
+		comp->end = true;
+		comp->anyDirs = false;
+		comp->literal = NULL;
+		comp->tokens = NULL;
+		comp->numTokens = 0;
+	}
+
+	set->marks = (unsigned*)xmalloc(sizeof(unsigned) * (set->numComps + 1));
+	memset(set->marks, 0, sizeof(unsigned) * (set->numComps + 1));
+	set->curMark = 0;
+	return set;
+}
+
+/* Returns the number of states, which is the most that any state set
+   can hold.  */
+unsigned GlobNumStates(GlobSet* set)
+{
+	return set->numComps;
+}
+
+/* Compute the states reached by entering the directory `name', given
+   the states of its parent in `states'.  Pass no states to start at
+   the top, where `name' is matched against the first component of
+   every pattern.  Returns the number of states written to `next'.  */
+unsigned GlobStep(GlobSet* set, const unsigned* states, unsigned numStates,
+				  const char* name, unsigned* next)
+{
+	unsigned numNext = 0;
+	unsigned i;
+
+	set->curMark++;
+	if (states == NULL)
+	{
+		unsigned p;
+		unsigned* start;
+		start = (unsigned*)xmalloc(sizeof(unsigned) *
+								   (set->numComps + 1));
+		numStates = 0;
+		for (p = 0; p < set->numPatterns; p++)
+			numStates = AddState(set, set->firstComp[p], start, numStates);
+		set->curMark++;
+		numNext = GlobStep(set, start, numStates, name, next);
+		xfree(start);
+		return numNext;
+	}
+
+	for (i = 0; i < numStates; i++)
+	{
+		const GlobComp* comp = &set->comps[states[i]];
+		if (comp->end == true || comp->anyDirs == true)
+			numNext = AddState(set, states[i], next, numNext);
+		else if (MatchComponent(comp, name))
+			numNext = AddState(set, states[i] + 1, next, numNext);
+	}
+	/* A pattern that names a directory matches all of it.  */
+	for (i = 0; i < numNext; i++)
+	{
+		if (set->comps[next[i]].end == true)
+			set->matched[set->comps[next[i]].pattern] = true;
+	}
+	return numNext;
+}
+
+/* Returns nonzero if the file `name' within the directory with the
+   given states is matched by a pattern and not excluded.  */
+int GlobMatchFile(GlobSet* set, const unsigned* states, unsigned numStates,
+				  const char* name)
+{
+	bool included = false;
+	unsigned i;
+	for (i = 0; i < numStates; i++)
+	{
+		const GlobComp* comp = &set->comps[states[i]];
+		bool match;
+		if (comp->end == true)
+			match = true;
+		else if (set->comps[states[i]+1].end == false)
+			match = false;
+		else
+			match = (comp->anyDirs == true || MatchComponent(comp, name)) ?
+				true : false;
+		if (match == false)
+			continue;
+		if (set->exclude[comp->pattern] == true)
+			return 0;
+		set->matched[comp->pattern] = true;
+		included = true;
+	}
+	return (included == true) ? 1 : 0;
+}
+
+/* Returns nonzero if the pattern with the given index has matched any
+   file or directory so far.  */
+int GlobPatternMatched(GlobSet* set, unsigned pattern)
+{
+	return (set->matched[pattern] == true) ? 1 : 0;
+}
+
+void GlobFree(GlobSet* set)
+{
+	unsigned i;
+	for (i = 0; i < set->numComps; i++)
+	{
+		xfree(set->comps[i].literal);
+		xfree(set->comps[i].tokens);
+	}
+	xfree(set->comps);
+	xfree(set->firstComp);
+	xfree(set->exclude);
+	xfree(set->matched);
+	xfree(set->marks);
+	xfree(set);
+}
+
+static void CompileComponent(GlobComp* comp, const char* text, unsigned len)
+{
+	unsigned i;
+	comp->anyDirs = (len == 2 && text[0] == '*' && text[1] == '*') ?
+		true : false;
+	comp->literal = NULL;
+	comp->tokens = NULL;
+	comp->numTokens = 0;
+	if (comp->anyDirs == true)
+		return;
+	for (i = 0; i < len; i++)
+	{
+		if (strchr("*?[\\", text[i]) != NULL)
+			break;
+	}
+	if (i == len)
+	{
+		comp->literal = (char*)xmalloc(len + 1);
+		memcpy(comp->literal, text, len);
+		comp->literal[len] = '\0';
+		return;
+	}
+
+	comp->tokens = (GlobToken*)xmalloc(sizeof(GlobToken) * len);
+	for (i = 0; i < len; i++)
+	{
+		GlobToken* token = &comp->tokens[comp->numTokens++];
+		switch (text[i])
+		{
+		case '*':
+			token->type = GLOB_STAR;
+			/* Consecutive stars are the same as one.  */
+			while (i + 1 < len && text[i+1] == '*')
+				i++;
+			break;
+		case '?':
+			token->type = GLOB_ANY;
+			break;
+		case '[':
+		{
+			unsigned j = i + 1;
+			bool negate = false;
+			unsigned k;
+			if (j < len && (text[j] == '!' || text[j] == '^'))
+			{ negate = true; j++; }
+			token->type = GLOB_CLASS;
+			memset(token->charClass, 0, sizeof(token->charClass));
+			/* A `]' right at the start is part of the class.  */
+			do
+			{
+				unsigned char first = (unsigned char)text[j];
+				unsigned char last = first;
+				if (j + 2 < len && text[j+1] == '-' && text[j+2] != ']')
+				{
+					last = (unsigned char)text[j+2];
+					j += 2;
+				}
+				for (k = first; k <= last; k++)
+					token->charClass[k/8] |= 1 << (k % 8);
+				j++;
+			} while (j < len && text[j] != ']');
+			if (j >= len)
+			{
+				/* No closing bracket, so take `[' literally.  */
+				token->type = GLOB_CHAR;
+				token->ch = '[';
+				break;
+			}
+			if (negate == true)
+			{
+				for (k = 0; k < sizeof(token->charClass); k++)
+					token->charClass[k] = ~token->charClass[k];
+			}
+			i = j;
+			break;
+		}
+		case '\\':
+			if (i + 1 < len)
+				i++;
+			/* Fall through */
+		default:
+			token->type = GLOB_CHAR;
+			token->ch = (unsigned char)text[i];
+			break;
+		}
+	}
+}
+
+static bool MatchTokens(const GlobToken* tokens, unsigned numTokens,
+						const char* name)
+{
+	unsigned t = 0;
+	const char* s = name;
+	/* Where to resume after the last star if the rest fails.  */
+	unsigned starToken = (unsigned)-1;
+	const char* starName = NULL;
+
+	while (*s != '\0')
+	{
+		if (t < numTokens)
+		{
+			const GlobToken* token = &tokens[t];
+			unsigned char c = (unsigned char)*s;
+			if (token->type == GLOB_STAR)
+			{
+				starToken = t++;
+				starName = s;
+				continue;
+			}
+			if (token->type == GLOB_ANY ||
+				(token->type == GLOB_CHAR && token->ch == c) ||
+				(token->type == GLOB_CLASS &&
+				 (token->charClass[c/8] & (1 << (c % 8))) != 0))
+			{
+				t++;
+				s++;
+				continue;
+			}
+		}
+		if (starToken == (unsigned)-1)
+			return false;
+		/* Let the last star match one more character.  */
+		t = starToken + 1;
+		s = ++starName;
+	}
+	while (t < numTokens && tokens[t].type == GLOB_STAR)
+		t++;
+	return (t == numTokens) ? true : false;
+}
+
+static bool MatchComponent(const GlobComp* comp, const char* name)
+{
+	if (comp->literal != NULL)
+		return (strcmp(comp->literal, name) == 0) ? true : false;
+	return MatchTokens(comp->tokens, comp->numTokens, name);
+}
+
+/* Add a state and, if it is `**', the state after it, since `**' may
+   match no directories at all.  Returns the new number of states.  */
+static unsigned AddState(GlobSet* set, unsigned state, unsigned* next,
+						 unsigned numNext)
+{
+	while (set->marks[state] != set->curMark)
+	{
+		set->marks[state] = set->curMark;
+		next[numNext++] = state;
+		if (set->comps[state].anyDirs == false)
+			break;
+		state++;
+	}
+	return numNext;
+}
@@ -0,0 +1,24 @@
+/* path-glob.h -- match path names against a set of glob patterns one
+   directory level at a time.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef PATH_GLOB_H
+#define PATH_GLOB_H
+
+typedef struct GlobSet_t GlobSet;
+
+GlobSet* GlobCompile(char** patterns, unsigned count);
+unsigned GlobNumStates(GlobSet* set);
+unsigned GlobStep(GlobSet* set, const unsigned* states, unsigned numStates,
+				  const char* name, unsigned* next);
+int GlobMatchFile(GlobSet* set, const unsigned* states, unsigned numStates,
+				  const char* name);
+int GlobPatternMatched(GlobSet* set, unsigned pattern);
+void GlobFree(GlobSet* set);
+
+#endif /* not PATH_GLOB_H */
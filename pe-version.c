@@ -0,0 +1,340 @@
+/* pe-version.c -- read the version resource of a Windows PE
+   executable.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* The file is mapped into memory rather than read, and only the
+   headers, the section table, the resource directory and the version
+   resource itself are ever touched, so only those pages are actually
+   read from disk.  Every offset taken from the file is checked
+   against the size of the mapping before it is used.
+
+   The walk goes: DOS header -> PE header -> resource data directory
+   -> RT_VERSION type entry -> first name entry -> first language entry
+   -> VS_VERSIONINFO block -> VS_FIXEDFILEINFO.  The languages are
+   taken from the `Translation' value under `VarFileInfo', or from the
+   language of the resource entry if there is no such value.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "bool.h"
+#include "pe-version.h"
+
+#define RT_VERSION 16
+#define VS_FFI_SIGNATURE 0xfeef04bd
+
+typedef struct PeImage_t PeImage;
+
+struct PeImage_t
+{
+	const unsigned char* base;
+	size_t size;
+	const unsigned char* sections;
+	unsigned numSections;
+};
+
+/* Private Declarations */
+static unsigned Get16(const unsigned char* p);
+static unsigned Get32(const unsigned char* p);
+static bool InBounds(const PeImage* img, size_t offset, size_t len);
+static size_t RvaToOffset(const PeImage* img, unsigned rva);
+static size_t FindResEntry(const PeImage* img, size_t resBase,
+						   size_t dirOffset, int id, unsigned* entryId);
+static bool KeyEquals(const unsigned char* key, size_t maxLen,
+					  const char* ascii);
+static bool ParseVersionInfo(const unsigned char* block, size_t len,
+							 PeVersion* info);
+
+/* Returns nonzero if `name' has one of the file extensions that
+   normally carry a version resource.  */
+int IsPeFileName(const char* name)
+{
+	static const char* const exts[] = { ".exe", ".dll", ".ocx", ".sys" };
+	size_t nameLen = strlen(name);
+	unsigned i;
+	if (nameLen < 4)
+		return 0;
+	for (i = 0; i < sizeof(exts) / sizeof(exts[0]); i++)
+	{
+		unsigned j;
+		for (j = 0; j < 4; j++)
+		{
+			if (tolower((unsigned char)name[nameLen-4+j]) != exts[i][j])
+				break;
+		}
+		if (j == 4)
+			return 1;
+	}
+	return 0;
+}
+
+/* Read the file version and languages from the version resource of
+   the PE file `path'.  Returns nonzero if a version was found, zero
+   if the file could not be read, is not a PE file, or has no version
+   resource.  */
+int ReadPeVersion(const char* path, PeVersion* info)
+{
+	int fd;
+	struct stat st;
+	void* map;
+	PeImage img;
+	size_t peOff, optOff, resDirOff, resBase;
+	size_t typeDir, nameDir, dataEntry, dataOff;
+	unsigned optSize, magic, numDirs, resRva, langId;
+	bool found = false;
+
+	info->numLangs = 0;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) != 0 || st.st_size < 64)
+	{
+		close(fd);
+		return 0;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+	img.base = (const unsigned char*)map;
+	img.size = (size_t)st.st_size;
+
+	/* DOS and PE headers */
+	if (img.base[0] != 'M' || img.base[1] != 'Z')
+		goto done;
+	peOff = Get32(img.base + 0x3c);
+	if (!InBounds(&img, peOff, 24) ||
+		memcmp(img.base + peOff, "PE\0\0", 4) != 0)
+		goto done;
+	img.numSections = Get16(img.base + peOff + 6);
+	optSize = Get16(img.base + peOff + 20);
+	optOff = peOff + 24;
+	if (!InBounds(&img, optOff, optSize) || optSize < 2)
+		goto done;
+	img.sections = img.base + optOff + optSize;
+	if (!InBounds(&img, optOff + optSize, (size_t)img.numSections * 40))
+		goto done;
+
+	/* Locate the resource data directory.  */
+	magic = Get16(img.base + optOff);
+	if (magic == 0x10b) /* PE32 */
+		resDirOff = optOff + 96;
+	else if (magic == 0x20b) /* PE32+ */
+		resDirOff = optOff + 112;
+	else
+		goto done;
+	if (resDirOff + 24 > optOff + optSize)
+		goto done;
+	numDirs = Get32(img.base + resDirOff - 4);
+	if (numDirs < 3)
+		goto done;
+	resDirOff += 2 * 8; /* Skip the export and import directories.  */
+	resRva = Get32(img.base + resDirOff);
+	if (resRva == 0)
+		goto done;
+	resBase = RvaToOffset(&img, resRva);
+	if (resBase == (size_t)-1)
+		goto done;
+
+	/* Walk the three levels of the resource tree.  */
+	typeDir = FindResEntry(&img, resBase, 0, RT_VERSION, NULL);
+	if (typeDir == (size_t)-1 || !(typeDir & 0x80000000))
+		goto done;
+	nameDir = FindResEntry(&img, resBase, typeDir & 0x7fffffff, -1, NULL);
+	if (nameDir == (size_t)-1 || !(nameDir & 0x80000000))
+		goto done;
+	dataEntry = FindResEntry(&img, resBase, nameDir & 0x7fffffff, -1,
+							 &langId);
+	if (dataEntry == (size_t)-1 || (dataEntry & 0x80000000))
+		goto done;
+	if (!InBounds(&img, resBase + dataEntry, 16))
+		goto done;
+	dataOff = RvaToOffset(&img, Get32(img.base + resBase + dataEntry));
+	if (dataOff == (size_t)-1 ||
+		!InBounds(&img, dataOff, Get32(img.base + resBase + dataEntry + 4)))
+		goto done;
+
+	found = ParseVersionInfo(img.base + dataOff,
+							 Get32(img.base + resBase + dataEntry + 4), info);
+	if (found == true && info->numLangs == 0 && langId != 0)
+	{
+		info->langs[0] = (unsigned short)langId;
+		info->numLangs = 1;
+	}
+
+done:
+	munmap(map, img.size);
+	return (found == true) ? 1 : 0;
+}
+
+static unsigned Get16(const unsigned char* p)
+{
+	return (unsigned)p[0] | ((unsigned)p[1] << 8);
+}
+
+static unsigned Get32(const unsigned char* p)
+{
+	return (unsigned)p[0] | ((unsigned)p[1] << 8) |
+		((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static bool InBounds(const PeImage* img, size_t offset, size_t len)
+{
+	return (offset <= img->size && len <= img->size - offset) ? true : false;
+}
+
+/* Convert a relative virtual address to a file offset using the
+   section table.  Returns (size_t)-1 if no section contains it.  */
+static size_t RvaToOffset(const PeImage* img, unsigned rva)
+{
+	unsigned i;
+	for (i = 0; i < img->numSections; i++)
+	{
+		const unsigned char* sect = img->sections + i * 40;
+		unsigned virtSize = Get32(sect + 8);
+		unsigned virtAddr = Get32(sect + 12);
+		unsigned rawSize = Get32(sect + 16);
+		unsigned rawPtr = Get32(sect + 20);
+		if (virtSize < rawSize)
+			virtSize = rawSize;
+		if (rva >= virtAddr && rva - virtAddr < virtSize)
+		{
+			if (rva - virtAddr >= rawSize)
+				return (size_t)-1;
+			return (size_t)rawPtr + (rva - virtAddr);
+		}
+	}
+	return (size_t)-1;
+}
+
+/* Search a resource directory for an entry with the given numeric ID,
+   or take the first entry if `id' is negative.  `dirOffset' is
+   relative to the start of the resource section.  Returns the raw
+   `OffsetToData' field of the entry, with the high bit set for
+   subdirectories, or (size_t)-1 if there is no such entry.  */
+static size_t FindResEntry(const PeImage* img, size_t resBase,
+						   size_t dirOffset, int id, unsigned* entryId)
+{
+	size_t dir = resBase + dirOffset;
+	unsigned numEntries;
+	unsigned i;
+	if (!InBounds(img, dir, 16))
+		return (size_t)-1;
+	numEntries = Get16(img->base + dir + 12) + Get16(img->base + dir + 14);
+	if (!InBounds(img, dir + 16, (size_t)numEntries * 8))
+		return (size_t)-1;
+	for (i = 0; i < numEntries; i++)
+	{
+		const unsigned char* entry = img->base + dir + 16 + i * 8;
+		unsigned name = Get32(entry);
+		if (id >= 0 && ((name & 0x80000000) || name != (unsigned)id))
+			continue;
+		if (entryId != NULL)
+			*entryId = (name & 0x80000000) ? 0 : name;
+		return (size_t)Get32(entry + 4);
+	}
+	return (size_t)-1;
+}
+
+/* Compare a null-terminated UTF-16LE key with an ASCII string.  */
+static bool KeyEquals(const unsigned char* key, size_t maxLen,
+					  const char* ascii)
+{
+	size_t i;
+	for (i = 0; (i + 1) * 2 <= maxLen; i++)
+	{
+		unsigned ch = Get16(key + i * 2);
+		if (ch != (unsigned char)ascii[i])
+			return false;
+		if (ch == 0)
+			return true;
+	}
+	return false;
+}
+
+/* Parse a VS_VERSIONINFO block.  Each block starts with its length,
+   value length and type, followed by a UTF-16 key, the value and the
+   child blocks, each aligned to four bytes from the start of the
+   resource.  */
+#define BLOCK_ALIGN(x) (((x) + 3) & ~(size_t)3)
+static bool ParseVersionInfo(const unsigned char* block, size_t len,
+							 PeVersion* info)
+{
+	size_t blockLen, valueOff, childOff;
+	const unsigned char* ffi;
+
+	if (len < 6 + 32 + 52)
+		return false;
+	blockLen = Get16(block);
+	if (blockLen > len)
+		blockLen = len;
+	if (blockLen < 6 + 32 + 52)
+		return false;
+	if (!KeyEquals(block + 6, blockLen - 6, "VS_VERSION_INFO"))
+		return false;
+	valueOff = BLOCK_ALIGN(6 + 16 * 2);
+	if (Get16(block + 2) < 52 || valueOff + 52 > blockLen)
+		return false;
+	ffi = block + valueOff;
+	if (Get32(ffi) != VS_FFI_SIGNATURE)
+		return false;
+	info->version[0] = (unsigned short)(Get32(ffi + 8) >> 16);
+	info->version[1] = (unsigned short)(Get32(ffi + 8) & 0xffff);
+	info->version[2] = (unsigned short)(Get32(ffi + 12) >> 16);
+	info->version[3] = (unsigned short)(Get32(ffi + 12) & 0xffff);
+
+	/* Look for VarFileInfo\Translation among the children.  */
+	childOff = BLOCK_ALIGN(valueOff + Get16(block + 2));
+	while (childOff + 6 <= blockLen)
+	{
+		size_t childLen = Get16(block + childOff);
+		if (childLen < 6 || childOff + childLen > blockLen)
+			break;
+		if (KeyEquals(block + childOff + 6, childLen - 6, "VarFileInfo"))
+		{
+			size_t varOff = BLOCK_ALIGN(childOff + 6 + 12 * 2);
+			while (varOff + 6 <= childOff + childLen)
+			{
+				size_t varLen = Get16(block + varOff);
+				size_t valueLen = Get16(block + varOff + 2);
+				if (varLen < 6 || varOff + varLen > childOff + childLen)
+					break;
+				if (KeyEquals(block + varOff + 6, varLen - 6, "Translation"))
+				{
+					size_t transOff = BLOCK_ALIGN(varOff + 6 + 12 * 2);
+					size_t i;
+					for (i = 0; i + 4 <= valueLen &&
+							 transOff + i + 4 <= varOff + varLen &&
+							 info->numLangs < PE_MAX_LANGS; i += 4)
+					{
+						unsigned short lang;
+						unsigned j;
+						lang = (unsigned short)Get16(block + transOff + i);
+						/* Skip duplicates of the same language.  */
+						for (j = 0; j < info->numLangs; j++)
+						{
+							if (info->langs[j] == lang)
+								break;
+						}
+						if (j == info->numLangs)
+							info->langs[info->numLangs++] = lang;
+					}
+				}
+				varOff = BLOCK_ALIGN(varOff + varLen);
+			}
+		}
+		childOff = BLOCK_ALIGN(childOff + childLen);
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+/* pe-version.h -- read the version resource of a Windows PE
+   executable.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef PE_VERSION_H
+#define PE_VERSION_H
+
+/* Maximum number of languages recorded from a version resource.  */
+#define PE_MAX_LANGS 8
+
+typedef struct PeVersion_t PeVersion;
+
+struct PeVersion_t
+{
+	/* File version, most significant part first.  */
+	unsigned short version[4];
+	unsigned numLangs;
+	unsigned short langs[PE_MAX_LANGS];
+};
+
+int IsPeFileName(const char* name);
+int ReadPeVersion(const char* path, PeVersion* info);
+
+#endif /* not PE_VERSION_H */
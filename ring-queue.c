@@ -0,0 +1,214 @@
+/* ring-queue.c -- a bounded lock-free queue for handing work from one
+   stage of a pipeline to the next.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* The queue is a ring buffer of cells, each with a sequence number
+   that says whose turn it is to use the cell.  A cell at position
+   `pos' is free for the producer when its sequence number is `pos',
+   and holds an item for a consumer when it is `pos + 1'.  Producers
+   and consumers claim positions by advancing `tail' and `head' with a
+   compare-and-swap, so any number of either can use the queue without
+   a lock.
+
+   The queue never grows: `RingQueuePush()' fails when it is full, and
+   the producer decides what to do instead, which is how a fast stage
+   is held back by a slow one.  Only a consumer that finds the queue
+   empty takes a lock, to sleep until there is more work or the queue
+   is closed.  */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "ring-queue.h"
+
+typedef struct QueueCell_t QueueCell;
+
+struct QueueCell_t
+{
+	unsigned seq;
+	void* item;
+};
+
+struct RingQueue_t
+{
+	QueueCell* cells;
+	unsigned mask;
+	/* The next positions to push to and pop from.  Both only ever
+	   grow.  */
+	unsigned tail;
+	unsigned head;
+	bool closed;
+	/* The number of consumers waiting for `itemCond'.  Changed with
+	   atomic operations, as `numQueued' is in `thread-pool.c'.  */
+	unsigned numSleeping;
+	pthread_mutex_t lock;
+	pthread_cond_t itemCond;
+};
+
+/* Spin this many times on an empty queue before sleeping.  */
+#define RQ_SPINS 64
+
+static void WakeConsumers(RingQueue* queue);
+
+/* Create a queue that holds at most `capacity' items, rounded up to a
+   power of two.  */
+RingQueue* RingQueueCreate(unsigned capacity)
+{
+	RingQueue* queue;
+	unsigned i;
+	queue = (RingQueue*)xmalloc(sizeof(RingQueue));
+	queue->mask = 1;
+	while (queue->mask + 1 < capacity)
+		queue->mask = queue->mask * 2 + 1;
+	queue->cells = (QueueCell*)xmalloc(sizeof(QueueCell) *
+									   (queue->mask + 1));
+	for (i = 0; i <= queue->mask; i++)
+		queue->cells[i].seq = i;
+	queue->tail = 0;
+	queue->head = 0;
+	queue->closed = false;
+	queue->numSleeping = 0;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->itemCond, NULL);
+	return queue;
+}
+
+/* Add `item' to the end of the queue.  Returns false without waiting
+   if the queue is full.  */
+bool RingQueuePush(RingQueue* queue, void* item)
+{
+	QueueCell* cell;
+	unsigned pos = *(volatile unsigned*)&queue->tail;
+	while (true)
+	{
+		int diff;
+		cell = &queue->cells[pos&queue->mask];
+		diff = (int)(*(volatile unsigned*)&cell->seq - pos);
+		__sync_synchronize();
+		if (diff == 0)
+		{
+			unsigned oldPos =
+				__sync_val_compare_and_swap(&queue->tail, pos, pos + 1);
+			if (oldPos == pos)
+				break;
+			pos = oldPos;
+		}
+		else if (diff < 0)
+			return false;
+		else
+			pos = *(volatile unsigned*)&queue->tail;
+	}
+	cell->item = item;
+	__sync_synchronize();
+	cell->seq = pos + 1;
+	/* Publishing the item above is a full barrier, so a consumer that
+	   is about to sleep either sees the item or is counted here.  */
+	__sync_synchronize();
+	if (__sync_fetch_and_add(&queue->numSleeping, 0) > 0)
+		WakeConsumers(queue);
+	return true;
+}
+
+/* Take the item at the front of the queue.  Returns false without
+   waiting if the queue is empty.  */
+bool RingQueuePop(RingQueue* queue, void** item)
+{
+	QueueCell* cell;
+	unsigned pos = *(volatile unsigned*)&queue->head;
+	while (true)
+	{
+		int diff;
+		cell = &queue->cells[pos&queue->mask];
+		diff = (int)(*(volatile unsigned*)&cell->seq - (pos + 1));
+		__sync_synchronize();
+		if (diff == 0)
+		{
+			unsigned oldPos =
+				__sync_val_compare_and_swap(&queue->head, pos, pos + 1);
+			if (oldPos == pos)
+				break;
+			pos = oldPos;
+		}
+		else if (diff < 0)
+			return false;
+		else
+			pos = *(volatile unsigned*)&queue->head;
+	}
+	*item = cell->item;
+	__sync_synchronize();
+	cell->seq = pos + queue->mask + 1;
+	return true;
+}
+
+/* Take the item at the front of the queue, waiting for one if the
+   queue is empty.  Returns false once the queue is closed and
+   empty.  */
+bool RingQueueWait(RingQueue* queue, void** item)
+{
+	unsigned spins = 0;
+	bool found;
+	while (true)
+	{
+		if (RingQueuePop(queue, item))
+			return true;
+		if (*(volatile bool*)&queue->closed == true)
+		{
+			/* Items pushed before closing are still there.  */
+			__sync_synchronize();
+			return RingQueuePop(queue, item);
+		}
+		if (spins++ < RQ_SPINS)
+		{
+			sched_yield();
+			continue;
+		}
+		/* Count this consumer as sleeping before the last look at the
+		   queue, so that a producer either pushed before that look or
+		   sees the count and signals.  */
+		pthread_mutex_lock(&queue->lock);
+		__sync_fetch_and_add(&queue->numSleeping, 1);
+		found = RingQueuePop(queue, item);
+		if (found == false && queue->closed == false)
+			pthread_cond_wait(&queue->itemCond, &queue->lock);
+		__sync_fetch_and_sub(&queue->numSleeping, 1);
+		pthread_mutex_unlock(&queue->lock);
+		if (found == true)
+			return true;
+		spins = 0;
+	}
+}
+
+/* Mark the end of the items.  Consumers finish the items that are
+   left and then stop waiting.  */
+void RingQueueClose(RingQueue* queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = true;
+	pthread_cond_broadcast(&queue->itemCond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void RingQueueFree(RingQueue* queue)
+{
+	if (queue == NULL)
+		return;
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->itemCond);
+	xfree(queue->cells);
+	xfree(queue);
+}
+
+static void WakeConsumers(RingQueue* queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	pthread_cond_signal(&queue->itemCond);
+	pthread_mutex_unlock(&queue->lock);
+}
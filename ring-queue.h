@@ -0,0 +1,24 @@
+/* ring-queue.h -- a bounded lock-free queue for handing work from one
+   stage of a pipeline to the next.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include "bool.h"
+
+typedef struct RingQueue_t RingQueue;
+
+RingQueue* RingQueueCreate(unsigned capacity);
+bool RingQueuePush(RingQueue* queue, void* item);
+bool RingQueuePop(RingQueue* queue, void** item);
+bool RingQueueWait(RingQueue* queue, void** item);
+void RingQueueClose(RingQueue* queue);
+void RingQueueFree(RingQueue* queue);
+
+#endif /* not RING_QUEUE_H */
@@ -0,0 +1,294 @@
+/* short-name.c -- generate unique 8.3 short names within a directory.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* A long name that is already a valid short name is used unchanged.
+   Any other name is translated much like Windows does it: characters
+   that cannot appear in a short name are replaced or dropped, the base
+   name is cut to six characters and the extension to three, and `~N'
+   is appended.  The cut base name and the extension form the stem of
+   the name, and the last N given to each stem in the directory is
+   remembered.  N starts one past that number, or at one for a new
+   stem, and counts up past any short names that are already taken.
+   So the numbers of a stem are given out in order rather than by
+   searching for the lowest free one each time, which keeps a
+   directory with N entries that share one stem at O(N) rather than
+   O(N^2).  Translating a name takes one pass through a table that
+   maps every byte to its short name character, and checking whether a
+   short name is free is a hash lookup.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "short-name.h"
+
+/* Every name takes this many bytes, enough for `NAME~N.EXT' and the
+   null character.  */
+#define SN_SIZE 13
+
+typedef struct NameTable_t NameTable;
+
+/* A hash table of names, each with a value.  Each slot of `hash'
+   holds a name index plus one, or zero if it is empty.  The table is
+   kept at most half full, and `names' and `values' have room for as
+   many entries as that allows.  */
+struct NameTable_t
+{
+	char* names;
+	unsigned* values;
+	unsigned numNames;
+	unsigned* hash;
+	unsigned mask;
+};
+
+struct ShortNameSet_t
+{
+	/* The short names used in the directory, in uppercase */
+	NameTable used;
+	/* The last number given to each stem, the cut base name followed
+	   by the extension */
+	NameTable stems;
+};
+
+/* The short name character for every byte, or zero if the byte is
+   dropped.  A byte is valid in a short name as it is if it maps to its
+   own uppercase form.  */
+static char shortChars[256];
+static bool shortCharsInit = false;
+
+static void InitShortChars(void);
+static unsigned ShortNameHash(const char* name);
+static void NameTableInit(NameTable* table);
+static unsigned NameTableFind(NameTable* table, const char* name);
+static unsigned NameTableAdd(NameTable* table, const char* name,
+							 unsigned value);
+static void NameTableFree(NameTable* table);
+
+ShortNameSet* ShortNameSetCreate(void)
+{
+	ShortNameSet* set;
+	if (shortCharsInit == false)
+		InitShortChars();
+	set = (ShortNameSet*)xmalloc(sizeof(ShortNameSet));
+	NameTableInit(&set->used);
+	NameTableInit(&set->stems);
+	return set;
+}
+
+/* Returns a new string with a short name for `longName' that is not
+   yet used in `set', and marks it as used.  Returns NULL if there is
+   no free short name left.  */
+char* MakeShortName(ShortNameSet* set, const char* longName)
+{
+	char base[8+1], ext[3+1];
+	char name[SN_SIZE];
+	unsigned baseLen = 0, extLen = 0;
+	bool valid = true;
+	const char* lastDot;
+	const char* pos;
+	char* shortName;
+	unsigned stem;
+	unsigned num;
+
+	/* Leading dots do not start an extension.  */
+	for (pos = longName; *pos == '.'; pos++);
+	lastDot = strrchr(pos, '.');
+
+	for (pos = longName; *pos != '\0'; pos++)
+	{
+		unsigned char ch = (unsigned char)*pos;
+		char shortCh = shortChars[ch];
+		if (pos == lastDot)
+			continue;
+		if (shortCh != (char)toupper(ch))
+			valid = false;
+		if (shortCh == '\0')
+			continue;
+		if (lastDot == NULL || pos < lastDot)
+		{
+			if (baseLen < 8)
+				base[baseLen] = shortCh;
+			baseLen++;
+		}
+		else
+		{
+			if (extLen < 3)
+				ext[extLen] = shortCh;
+			extLen++;
+		}
+	}
+	if (baseLen == 0 || baseLen > 8 || extLen > 3 ||
+		(lastDot != NULL && extLen == 0))
+		valid = false;
+	if (baseLen > 8)
+		baseLen = 8;
+	if (extLen > 3)
+		extLen = 3;
+	base[baseLen] = '\0';
+	ext[extLen] = '\0';
+
+	if (valid == true)
+	{
+		sprintf(name, (extLen > 0) ? "%s.%s" : "%s%s", base, ext);
+		if (NameTableFind(&set->used, name) == (unsigned)-1)
+		{
+			NameTableAdd(&set->used, name, 0);
+			shortName = (char*)xmalloc(strlen(longName) + 1);
+			strcpy(shortName, longName);
+			return shortName;
+		}
+	}
+
+	if (baseLen == 0)
+	{
+		strcpy(base, "_");
+		baseLen = 1;
+	}
+	if (baseLen > 6)
+		base[6] = '\0';
+	sprintf(name, "%s.%s", base, ext);
+	stem = NameTableFind(&set->stems, name);
+	if (stem == (unsigned)-1)
+		stem = NameTableAdd(&set->stems, name, 0);
+	num = set->stems.values[stem];
+	do
+	{
+		char suffix[1+6+1];
+		unsigned keep;
+		num++;
+		if (num > 999999)
+		{
+			fprintf(stderr, "ERROR: No short name left for %s\n", longName);
+			return NULL;
+		}
+		sprintf(suffix, "~%u", num);
+		keep = 8 - strlen(suffix);
+		if (keep > strlen(base))
+			keep = strlen(base);
+		memcpy(name, base, keep);
+		sprintf(name + keep, (extLen > 0) ? "%s.%s" : "%s%s", suffix, ext);
+	} while (NameTableFind(&set->used, name) != (unsigned)-1);
+	NameTableAdd(&set->used, name, 0);
+	set->stems.values[stem] = num;
+
+	shortName = (char*)xmalloc(strlen(name) + 1);
+	strcpy(shortName, name);
+	return shortName;
+}
+
+void ShortNameSetFree(ShortNameSet* set)
+{
+	if (set == NULL)
+		return;
+	NameTableFree(&set->used);
+	NameTableFree(&set->stems);
+	xfree(set);
+}
+
+static void InitShortChars(void)
+{
+	static const char* const specials = "$%'-_@~`!(){}^#&";
+	unsigned i;
+	for (i = 0; i < 256; i++)
+	{
+		if (isalnum(i) && i < 128)
+			shortChars[i] = (char)toupper(i);
+		else if (i != '\0' && strchr(specials, i) != NULL)
+			shortChars[i] = (char)i;
+		else if (i == ' ' || i == '.')
+			shortChars[i] = '\0';
+		else
+			shortChars[i] = '_';
+	}
+	shortCharsInit = true;
+}
+
+static unsigned ShortNameHash(const char* name)
+{
+	unsigned hash = 2166136261u;
+	while (*name != '\0')
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void NameTableInit(NameTable* table)
+{
+	table->mask = 15;
+	table->numNames = 0;
+	table->hash = (unsigned*)xmalloc(sizeof(unsigned) * (table->mask + 1));
+	memset(table->hash, 0, sizeof(unsigned) * (table->mask + 1));
+	table->names = (char*)xmalloc(SN_SIZE * (table->mask + 1) / 2);
+	table->values = (unsigned*)xmalloc(sizeof(unsigned) *
+									   (table->mask + 1) / 2);
+}
+
+/* Returns the index of `name' in `table', or (unsigned)-1 if it is not
+   there.  */
+static unsigned NameTableFind(NameTable* table, const char* name)
+{
+	unsigned slot = ShortNameHash(name) & table->mask;
+	while (table->hash[slot] != 0)
+	{
+		unsigned index = table->hash[slot] - 1;
+		if (strcmp(&table->names[index*SN_SIZE], name) == 0)
+			return index;
+		slot = (slot + 1) & table->mask;
+	}
+	return (unsigned)-1;
+}
+
+/* Add `name', which must not be in `table' yet, and returns its
+   index.  */
+static unsigned NameTableAdd(NameTable* table, const char* name,
+							 unsigned value)
+{
+	unsigned index = table->numNames;
+	unsigned slot;
+
+	if ((table->numNames + 1) * 2 > table->mask + 1)
+	{
+		unsigned i;
+		table->mask = table->mask * 2 + 1;
+		table->names = (char*)xrealloc(table->names,
+									   SN_SIZE * (table->mask + 1) / 2);
+		table->values = (unsigned*)
+			xrealloc(table->values, sizeof(unsigned) * (table->mask + 1) / 2);
+		xfree(table->hash);
+		table->hash = (unsigned*)xmalloc(sizeof(unsigned) *
+										 (table->mask + 1));
+		memset(table->hash, 0, sizeof(unsigned) * (table->mask + 1));
+		for (i = 0; i < table->numNames; i++)
+		{
+			slot = ShortNameHash(&table->names[i*SN_SIZE]) & table->mask;
+			while (table->hash[slot] != 0)
+				slot = (slot + 1) & table->mask;
+			table->hash[slot] = i + 1;
+		}
+	}
+
+	strcpy(&table->names[index*SN_SIZE], name);
+	table->values[index] = value;
+	slot = ShortNameHash(name) & table->mask;
+	while (table->hash[slot] != 0)
+		slot = (slot + 1) & table->mask;
+	table->hash[slot] = index + 1;
+	table->numNames++;
+	return index;
+}
+
+static void NameTableFree(NameTable* table)
+{
+	xfree(table->names);
+	xfree(table->values);
+	xfree(table->hash);
+}
@@ -0,0 +1,18 @@
+/* short-name.h -- generate unique 8.3 short names within a directory.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef SHORT_NAME_H
+#define SHORT_NAME_H
+
+typedef struct ShortNameSet_t ShortNameSet;
+
+ShortNameSet* ShortNameSetCreate(void);
+char* MakeShortName(ShortNameSet* set, const char* longName);
+void ShortNameSetFree(ShortNameSet* set);
+
+#endif /* not SHORT_NAME_H */
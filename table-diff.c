@@ -0,0 +1,428 @@
+/* table-diff.c -- report the changes between the tables of two runs.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* Both table sets are sorted by primary key when they are loaded, so
+   every table is compared with a single merge join.  Component rules
+   are checked the same way after sorting the components of both runs
+   by GUID: a component that keeps its GUID must keep its key path and
+   exactly the same files, otherwise Windows Installer can leave files
+   behind or fail to install them during a minor upgrade or patch.
+   Files are compared by their installed paths rather than their keys,
+   since the keys are numbered in listing order.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "msi-db.h"
+#include "table-set.h"
+#include "table-diff.h"
+
+typedef struct CompPath_t CompPath;
+
+/* A component GUID together with the installed path of one of its
+   files or its key path.  The path is kept as the directory path and
+   the file name so that no string needs to be built for every file;
+   `name' is NULL for a key path that is not a file.  */
+struct CompPath_t
+{
+	const char* guid;
+	const char* dir;
+	const char* name;
+};
+
+static void PrintKey(const char* mark, const char* tableName, MsiTable* table,
+					 unsigned row, unsigned numKeys);
+static void DiffTable(TableSet* oldSet, TableSet* newSet, unsigned t);
+static void SetFilePath(CompPath* path, TableSet* set, unsigned comp,
+						unsigned fileRow);
+static void PrintPath(CompPath* path);
+static CompPath* ComponentKeyPaths(TableSet* set, unsigned* numPaths);
+static CompPath* ComponentFiles(TableSet* set, unsigned* numPaths);
+static int CompPath_qsort(const void* e1, const void* e2);
+static bool HasGuid(CompPath* paths, unsigned numPaths, const char* guid);
+static unsigned CheckComponentRules(TableSet* oldSet, TableSet* newSet);
+
+/* Print the rows of the `File', `Component', and `FeatureComponents'
+   tables in `newDir' that were added, removed, or changed since the
+   tables in `oldDir', followed by any component rule violations and a
+   summary.  The number of violations is stored in `numViolations'.
+   Returns nonzero on success, zero on failure.  */
+int DiffTableSets(const char* oldDir, const char* newDir,
+				  unsigned* numViolations)
+{
+	static const unsigned diffTables[3] =
+		{ TS_FILE, TS_COMPONENT, TS_FEATURECOMPONENTS };
+	TableSet sets[2];
+	TableSet* oldSet = &sets[0];
+	TableSet* newSet = &sets[1];
+	const char* dirs[2];
+	unsigned i;
+
+	dirs[0] = oldDir;
+	dirs[1] = newDir;
+	if (!LoadTableSets(sets, dirs, 2))
+		return 0;
+	for (i = 0; i < 3; i++)
+	{
+		unsigned t = diffTables[i];
+		if (strcmp(oldSet->tables[t].header, newSet->tables[t].header) != 0)
+		{
+			fprintf(stderr, "ERROR: The columns of the %s tables differ.\n",
+					tableSetNames[t]);
+			FreeTableSet(oldSet);
+			FreeTableSet(newSet);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < 3; i++)
+		DiffTable(oldSet, newSet, diffTables[i]);
+	*numViolations = CheckComponentRules(oldSet, newSet);
+	printf("Component rule violations: %u\n", *numViolations);
+
+	FreeTableSet(oldSet);
+	FreeTableSet(newSet);
+	return 1;
+}
+
+/* Print `mark', the table name, and the key of a row.  */
+static void PrintKey(const char* mark, const char* tableName, MsiTable* table,
+					 unsigned row, unsigned numKeys)
+{
+	unsigned i;
+	printf("%s %s %s", mark, tableName, table->cells[row*table->numCols]);
+	for (i = 1; i < numKeys; i++)
+		printf(", %s", table->cells[row*table->numCols+i]);
+}
+
+/* Merge join one table of both sets and print the differences.  */
+static void DiffTable(TableSet* oldSet, TableSet* newSet, unsigned t)
+{
+	MsiTable* oldTable = &oldSet->tables[t];
+	MsiTable* newTable = &newSet->tables[t];
+	unsigned* oldRows = oldSet->sorted[t];
+	unsigned* newRows = newSet->sorted[t];
+	unsigned numKeys = oldSet->numKeys[t];
+	unsigned numCols = oldTable->numCols;
+	const char* name = tableSetNames[t];
+	unsigned added = 0, removed = 0, changed = 0;
+	char** colNames;
+	char* names;
+	unsigned i = 0, j = 0;
+
+	/* Split the column names out of a copy of the first header
+	   line.  */
+	names = (char*)xmalloc(strcspn(oldTable->header, "\n") + 1);
+	memcpy(names, oldTable->header, strcspn(oldTable->header, "\n"));
+	names[strcspn(oldTable->header, "\n")] = '\0';
+	colNames = (char**)xmalloc(sizeof(char*) * numCols);
+	colNames[0] = names;
+	for (i = 1; i < numCols; i++)
+	{
+		char* tab = strchr(colNames[i-1], '\t');
+		*tab = '\0';
+		colNames[i] = tab + 1;
+	}
+
+	i = 0;
+	while (i < oldTable->numRows || j < newTable->numRows)
+	{
+		int cmp;
+		if (i >= oldTable->numRows)
+			cmp = 1;
+		else if (j >= newTable->numRows)
+			cmp = -1;
+		else
+			cmp = CompareRowKeys(oldTable, oldRows[i], newTable, newRows[j],
+								 numKeys);
+		if (cmp < 0)
+		{
+			PrintKey("-", name, oldTable, oldRows[i++], numKeys);
+			putchar('\n');
+			removed++;
+		}
+		else if (cmp > 0)
+		{
+			PrintKey("+", name, newTable, newRows[j++], numKeys);
+			putchar('\n');
+			added++;
+		}
+		else
+		{
+			char** oldCells = &oldTable->cells[oldRows[i]*numCols];
+			char** newCells = &newTable->cells[newRows[j]*numCols];
+			bool first = true;
+			unsigned c;
+			for (c = numKeys; c < numCols; c++)
+			{
+				if (strcmp(oldCells[c], newCells[c]) == 0)
+					continue;
+				if (first == true)
+				{
+					PrintKey("~", name, newTable, newRows[j], numKeys);
+					fputs(":", stdout);
+					first = false;
+					changed++;
+				}
+				else
+					putchar(',');
+				printf(" %s `%s' -> `%s'", colNames[c], oldCells[c],
+					   newCells[c]);
+			}
+			if (first == false)
+				putchar('\n');
+			i++; j++;
+		}
+	}
+	printf("%s: %u added, %u removed, %u changed\n", name, added, removed,
+		   changed);
+	xfree(colNames);
+	xfree(names);
+}
+
+/* Store the installed path of a file of the component in row `comp'
+   in `path'.  */
+static void SetFilePath(CompPath* path, TableSet* set, unsigned comp,
+						unsigned fileRow)
+{
+	MsiTable* files = &set->tables[TS_FILE];
+	MsiTable* comps = &set->tables[TS_COMPONENT];
+	const char* dirPath = NULL;
+
+	if (comp != (unsigned)-1)
+		dirPath = TableDirPath(set, comps->cells[comp*comps->numCols+2]);
+	path->dir = (dirPath != NULL) ? dirPath : "?";
+	path->name = LongFileName(files->cells[fileRow*files->numCols+2]);
+}
+
+/* Print a path stored by `SetFilePath()' or a key path.  */
+static void PrintPath(CompPath* path)
+{
+	if (path->name == NULL)
+		fputs(path->dir, stdout);
+	else
+		printf("%s/%s", path->dir, path->name);
+}
+
+/* Returns the key path of every component that has a GUID, sorted by
+   GUID.  */
+static CompPath* ComponentKeyPaths(TableSet* set, unsigned* numPaths)
+{
+	MsiTable* comps = &set->tables[TS_COMPONENT];
+	CompPath* paths;
+	unsigned i;
+
+	paths = (CompPath*)xmalloc(sizeof(CompPath) * (comps->numRows + 1));
+	*numPaths = 0;
+	for (i = 0; i < comps->numRows; i++)
+	{
+		char** cells = &comps->cells[i*comps->numCols];
+		unsigned file;
+		if (cells[1][0] == '\0')
+			continue;
+		paths[*numPaths].guid = cells[1];
+		file = FindTableRow(set, TS_FILE, cells[5]);
+		if (file != (unsigned)-1)
+			SetFilePath(&paths[*numPaths], set, i, file);
+		else
+		{
+			/* The key path is the directory or a registry value.  */
+			paths[*numPaths].dir = cells[5];
+			paths[*numPaths].name = NULL;
+		}
+		(*numPaths)++;
+	}
+	qsort(paths, *numPaths, sizeof(CompPath), CompPath_qsort);
+	return paths;
+}
+
+/* Returns the installed path of every file of a component that has a
+   GUID, sorted by GUID and path.  The copies in the `DuplicateFile'
+   table count as files of their component, since the component
+   installs them just the same.  */
+static CompPath* ComponentFiles(TableSet* set, unsigned* numPaths)
+{
+	MsiTable* files = &set->tables[TS_FILE];
+	MsiTable* comps = &set->tables[TS_COMPONENT];
+	MsiTable* dups = &set->tables[TS_DUPLICATEFILE];
+	CompPath* paths;
+	const char* lastKey = NULL;
+	unsigned comp = (unsigned)-1;
+	unsigned i;
+
+	paths = (CompPath*)xmalloc(sizeof(CompPath) *
+							   (files->numRows + dups->numRows + 1));
+	*numPaths = 0;
+	for (i = 0; i < files->numRows; i++)
+	{
+		const char* compKey = files->cells[i*files->numCols+1];
+		/* Files of one component are usually listed together, so only
+		   look up the component when it changes.  */
+		if (lastKey == NULL || strcmp(compKey, lastKey) != 0)
+		{
+			comp = FindTableRow(set, TS_COMPONENT, compKey);
+			lastKey = compKey;
+		}
+		if (comp == (unsigned)-1 ||
+			comps->cells[comp*comps->numCols+1][0] == '\0')
+			continue;
+		paths[*numPaths].guid = comps->cells[comp*comps->numCols+1];
+		SetFilePath(&paths[*numPaths], set, comp, i);
+		(*numPaths)++;
+	}
+	for (i = 0; i < dups->numRows; i++)
+	{
+		char** cells = &dups->cells[i*dups->numCols];
+		const char* dirPath = NULL;
+		comp = FindTableRow(set, TS_COMPONENT, cells[1]);
+		if (comp == (unsigned)-1 ||
+			comps->cells[comp*comps->numCols+1][0] == '\0')
+			continue;
+		paths[*numPaths].guid = comps->cells[comp*comps->numCols+1];
+		/* Without a destination folder or name, the copy goes into the
+		   directory of its component under the name of the
+		   original.  */
+		if (cells[4][0] != '\0')
+			dirPath = TableDirPath(set, cells[4]);
+		else
+			dirPath = TableDirPath(set, comps->cells[comp*comps->numCols+2]);
+		paths[*numPaths].dir = (dirPath != NULL) ? dirPath : "?";
+		if (cells[3][0] != '\0')
+			paths[*numPaths].name = LongFileName(cells[3]);
+		else
+		{
+			unsigned file = FindTableRow(set, TS_FILE, cells[2]);
+			paths[*numPaths].name = (file != (unsigned)-1) ?
+				LongFileName(files->cells[file*files->numCols+2]) : "?";
+		}
+		(*numPaths)++;
+	}
+	qsort(paths, *numPaths, sizeof(CompPath), CompPath_qsort);
+	return paths;
+}
+
+static int CompPath_qsort(const void* e1, const void* e2)
+{
+	const CompPath* p1 = (const CompPath*)e1;
+	const CompPath* p2 = (const CompPath*)e2;
+	int result = strcmp(p1->guid, p2->guid);
+	if (result != 0)
+		return result;
+	result = strcmp(p1->dir, p2->dir);
+	if (result != 0)
+		return result;
+	if (p1->name == NULL || p2->name == NULL)
+		return (p1->name != NULL) - (p2->name != NULL);
+	return strcmp(p1->name, p2->name);
+}
+
+/* Binary search for a GUID in sorted paths.  */
+static bool HasGuid(CompPath* paths, unsigned numPaths, const char* guid)
+{
+	unsigned low = 0, high = numPaths;
+	while (low < high)
+	{
+		unsigned mid = low + (high - low) / 2;
+		int result = strcmp(paths[mid].guid, guid);
+		if (result == 0)
+			return true;
+		if (result < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return false;
+}
+
+/* Print every component whose GUID stayed the same although its key
+   path or its files changed.  Returns the number of violations.  */
+static unsigned CheckComponentRules(TableSet* oldSet, TableSet* newSet)
+{
+	CompPath* oldPaths;
+	CompPath* newPaths;
+	unsigned numOld, numNew;
+	CompPath* oldKeys;
+	CompPath* newKeys;
+	unsigned numOldKeys, numNewKeys;
+	unsigned numViolations = 0;
+	unsigned i = 0, j = 0;
+
+	oldKeys = ComponentKeyPaths(oldSet, &numOldKeys);
+	newKeys = ComponentKeyPaths(newSet, &numNewKeys);
+	while (i < numOldKeys && j < numNewKeys)
+	{
+		int cmp = strcmp(oldKeys[i].guid, newKeys[j].guid);
+		if (cmp < 0)
+			i++;
+		else if (cmp > 0)
+			j++;
+		else
+		{
+			if (CompPath_qsort(&oldKeys[i], &newKeys[j]) != 0)
+			{
+				printf("! Component %s: key path changed from `",
+					   newKeys[j].guid);
+				PrintPath(&oldKeys[i]);
+				fputs("' to `", stdout);
+				PrintPath(&newKeys[j]);
+				fputs("' without a new GUID\n", stdout);
+				numViolations++;
+			}
+			i++; j++;
+		}
+	}
+
+	/* Files can only be added to or removed from a component together
+	   with a new GUID.  */
+	oldPaths = ComponentFiles(oldSet, &numOld);
+	newPaths = ComponentFiles(newSet, &numNew);
+	i = 0; j = 0;
+	while (i < numOld || j < numNew)
+	{
+		int cmp;
+		if (i >= numOld)
+			cmp = 1;
+		else if (j >= numNew)
+			cmp = -1;
+		else
+			cmp = CompPath_qsort(&oldPaths[i], &newPaths[j]);
+		if (cmp < 0)
+		{
+			if (HasGuid(newKeys, numNewKeys, oldPaths[i].guid))
+			{
+				printf("! Component %s: file `", oldPaths[i].guid);
+				PrintPath(&oldPaths[i]);
+				fputs("' removed without a new GUID\n", stdout);
+				numViolations++;
+			}
+			i++;
+		}
+		else if (cmp > 0)
+		{
+			if (HasGuid(oldKeys, numOldKeys, newPaths[j].guid))
+			{
+				printf("! Component %s: file `", newPaths[j].guid);
+				PrintPath(&newPaths[j]);
+				fputs("' added without a new GUID\n", stdout);
+				numViolations++;
+			}
+			j++;
+		}
+		else
+		{ i++; j++; }
+	}
+
+	xfree(oldKeys);
+	xfree(newKeys);
+	xfree(oldPaths);
+	xfree(newPaths);
+	return numViolations;
+}
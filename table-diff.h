@@ -0,0 +1,15 @@
+/* table-diff.h -- report the changes between the tables of two runs.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef TABLE_DIFF_H
+#define TABLE_DIFF_H
+
+int DiffTableSets(const char* oldDir, const char* newDir,
+				  unsigned* numViolations);
+
+#endif /* not TABLE_DIFF_H */
@@ -0,0 +1,610 @@
+/* table-query.c -- answer questions about the tables of a run.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* The tables are loaded once and indexed by every name that a
+   question can start from, so that each question is answered with a
+   few binary searches.  The sizes of components and features are
+   summed up front, since they would otherwise require a pass over the
+   whole `File' table for every question.  Names and paths are matched
+   without regard to case, as Windows does.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#define ea_malloc xmalloc
+#define ea_realloc xrealloc
+#define ea_free xfree
+#include "exparray.h"
+#include "msi-db.h"
+#include "table-set.h"
+#include "table-query.h"
+
+EA_TYPE(char);
+
+typedef struct NameRow_t NameRow;
+
+/* A name that refers to a table row.  */
+struct NameRow_t
+{
+	const char* name;
+	unsigned row;
+};
+
+typedef struct FeatCompRow_t FeatCompRow;
+
+/* A component that a feature installs, on its own or through one of
+   its subfeatures.  */
+struct FeatCompRow_t
+{
+	unsigned feat;
+	unsigned comp;
+};
+
+EA_TYPE(FeatCompRow);
+
+typedef struct QueryIndex_t QueryIndex;
+
+struct QueryIndex_t
+{
+	TableSet set;
+	/* `File' rows by long file name */
+	NameRow* fileNames;
+	/* `Directory' rows by path, and by path below the root */
+	NameRow* dirPaths;
+	NameRow* subPaths;
+	unsigned numSubPaths;
+	/* `Component' rows by directory key */
+	NameRow* compDirs;
+	/* `FeatureComponents' rows by component key */
+	NameRow* compFeatures;
+	/* The `Component' row of each `File' row */
+	unsigned* fileComps;
+	/* The number of files and bytes of each component */
+	unsigned* compFiles;
+	unsigned long long* compBytes;
+	/* The number of components, files, and bytes of each feature,
+	   and of each feature together with its subfeatures */
+	unsigned* featComps;
+	unsigned* featFiles;
+	unsigned long long* featBytes;
+	unsigned* totalFiles;
+	unsigned long long* totalBytes;
+};
+
+static int NameCmp(const char* name1, const char* name2);
+static int NameRow_qsort(const void* e1, const void* e2);
+static int FeatCompRow_qsort(const void* e1, const void* e2);
+static const char* SkipRoot(const char* path);
+static NameRow* IndexColumn(MsiTable* table, unsigned column);
+static unsigned FirstName(NameRow* names, unsigned numNames,
+						  const char* name);
+static void BuildQueryIndex(QueryIndex* qi);
+static void FreeQueryIndex(QueryIndex* qi);
+static bool AnswerQuestion(QueryIndex* qi, const char* question);
+static void PrintFeatures(QueryIndex* qi, unsigned comp);
+static bool QueryFile(QueryIndex* qi, const char* path);
+static void PrintDirComponents(QueryIndex* qi, unsigned row);
+static bool QueryDir(QueryIndex* qi, const char* path);
+static bool QueryFeature(QueryIndex* qi, const char* feature);
+static void QueryFeatures(QueryIndex* qi);
+
+/* Load the tables in `dir' and answer every question in `questions',
+   or every line of standard input if there are none.  The number of
+   questions that had no answer is stored in `numUnanswered'.  Returns
+   nonzero on success, zero if the tables could not be loaded.  */
+int QueryTables(const char* dir, const char** questions,
+				unsigned numQuestions, unsigned* numUnanswered)
+{
+	QueryIndex qi;
+	unsigned i;
+
+	if (!LoadTableSets(&qi.set, &dir, 1))
+		return 0;
+	BuildQueryIndex(&qi);
+
+	*numUnanswered = 0;
+	for (i = 0; i < numQuestions; i++)
+	{
+		if (!AnswerQuestion(&qi, questions[i]))
+			(*numUnanswered)++;
+	}
+	if (numQuestions == 0)
+	{
+		char_array line;
+		int readChar;
+		EA_INIT(char, line, 256);
+		do
+		{
+			readChar = fgetc(stdin);
+			if (readChar != EOF && readChar != '\n')
+			{
+				EA_APPEND(line, (char)readChar);
+				continue;
+			}
+			EA_APPEND(line, '\0');
+			if (line.d[0] != '\0' && !AnswerQuestion(&qi, line.d))
+				(*numUnanswered)++;
+			/* Answers must not wait for the next question.  */
+			fflush(stdout);
+			line.len = 0;
+		} while (readChar != EOF);
+		EA_DESTROY(line);
+	}
+
+	FreeQueryIndex(&qi);
+	return 1;
+}
+
+/* Compare two names without regard to case.  */
+static int NameCmp(const char* name1, const char* name2)
+{
+	while (*name1 != '\0' &&
+		   tolower((unsigned char)*name1) == tolower((unsigned char)*name2))
+	{
+		name1++;
+		name2++;
+	}
+	return tolower((unsigned char)*name1) - tolower((unsigned char)*name2);
+}
+
+static int NameRow_qsort(const void* e1, const void* e2)
+{
+	const NameRow* n1 = (const NameRow*)e1;
+	const NameRow* n2 = (const NameRow*)e2;
+	int result = NameCmp(n1->name, n2->name);
+	if (result != 0)
+		return result;
+	/* Keep rows with the same name in table order.  */
+	return (n1->row > n2->row) - (n1->row < n2->row);
+}
+
+static int FeatCompRow_qsort(const void* e1, const void* e2)
+{
+	const FeatCompRow* r1 = (const FeatCompRow*)e1;
+	const FeatCompRow* r2 = (const FeatCompRow*)e2;
+	if (r1->feat != r2->feat)
+		return (r1->feat > r2->feat) - (r1->feat < r2->feat);
+	return (r1->comp > r2->comp) - (r1->comp < r2->comp);
+}
+
+/* Returns `path' without its first name, which is the name of the root
+   directory, or NULL if `path' has only one name.  */
+static const char* SkipRoot(const char* path)
+{
+	const char* slash = strchr(path, '/');
+	if (slash == NULL)
+		return NULL;
+	return slash + 1;
+}
+
+/* Returns the rows of `table' sorted by the value of `column'.  */
+static NameRow* IndexColumn(MsiTable* table, unsigned column)
+{
+	NameRow* names;
+	unsigned i;
+	names = (NameRow*)xmalloc(sizeof(NameRow) * (table->numRows + 1));
+	for (i = 0; i < table->numRows; i++)
+	{
+		names[i].name = table->cells[i*table->numCols+column];
+		names[i].row = i;
+	}
+	qsort(names, table->numRows, sizeof(NameRow), NameRow_qsort);
+	return names;
+}
+
+/* Returns the index of the first element of `names' that is equal to
+   `name', or of the element where it would be inserted.  */
+static unsigned FirstName(NameRow* names, unsigned numNames,
+						  const char* name)
+{
+	unsigned low = 0, high = numNames;
+	while (low < high)
+	{
+		unsigned mid = low + (high - low) / 2;
+		if (NameCmp(names[mid].name, name) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static void BuildQueryIndex(QueryIndex* qi)
+{
+	TableSet* set = &qi->set;
+	MsiTable* dirs = &set->tables[TS_DIRECTORY];
+	MsiTable* comps = &set->tables[TS_COMPONENT];
+	MsiTable* files = &set->tables[TS_FILE];
+	MsiTable* feats = &set->tables[TS_FEATURE];
+	MsiTable* featComps = &set->tables[TS_FEATURECOMPONENTS];
+	FeatCompRow_array rollup;
+	const char* lastKey = NULL;
+	unsigned comp = (unsigned)-1;
+	unsigned i;
+
+	qi->fileNames = (NameRow*)xmalloc(sizeof(NameRow) * (files->numRows + 1));
+	for (i = 0; i < files->numRows; i++)
+	{
+		qi->fileNames[i].name =
+			LongFileName(files->cells[i*files->numCols+2]);
+		qi->fileNames[i].row = i;
+	}
+	qsort(qi->fileNames, files->numRows, sizeof(NameRow), NameRow_qsort);
+
+	/* Looking up any directory builds the paths of all of them.  */
+	TableDirPath(set, "");
+	qi->dirPaths = (NameRow*)xmalloc(sizeof(NameRow) * (dirs->numRows + 1));
+	for (i = 0; i < dirs->numRows; i++)
+	{
+		qi->dirPaths[i].name = set->dirPaths[i];
+		qi->dirPaths[i].row = i;
+	}
+	qsort(qi->dirPaths, dirs->numRows, sizeof(NameRow), NameRow_qsort);
+	/* The root is named after the `DefaultDir' of `TARGETDIR', which
+	   is usually `SourceDir', so also allow paths to leave it out.  */
+	qi->subPaths = (NameRow*)xmalloc(sizeof(NameRow) * (dirs->numRows + 1));
+	qi->numSubPaths = 0;
+	for (i = 0; i < dirs->numRows; i++)
+	{
+		const char* subPath = SkipRoot(set->dirPaths[i]);
+		if (subPath == NULL)
+			continue;
+		qi->subPaths[qi->numSubPaths].name = subPath;
+		qi->subPaths[qi->numSubPaths].row = i;
+		qi->numSubPaths++;
+	}
+	qsort(qi->subPaths, qi->numSubPaths, sizeof(NameRow), NameRow_qsort);
+
+	qi->compDirs = IndexColumn(comps, 2);
+	qi->compFeatures = IndexColumn(featComps, 1);
+
+	/* Sum up the files of each component.  */
+	qi->fileComps = (unsigned*)xmalloc(sizeof(unsigned) *
+									   (files->numRows + 1));
+	qi->compFiles = (unsigned*)xmalloc(sizeof(unsigned) *
+									   (comps->numRows + 1));
+	qi->compBytes = (unsigned long long*)
+		xmalloc(sizeof(unsigned long long) * (comps->numRows + 1));
+	for (i = 0; i < comps->numRows; i++)
+	{
+		qi->compFiles[i] = 0;
+		qi->compBytes[i] = 0;
+	}
+	for (i = 0; i < files->numRows; i++)
+	{
+		char** cells = &files->cells[i*files->numCols];
+		/* Files of one component are usually listed together, so only
+		   look up the component when it changes.  */
+		if (lastKey == NULL || strcmp(cells[1], lastKey) != 0)
+		{
+			comp = FindTableRow(set, TS_COMPONENT, cells[1]);
+			lastKey = cells[1];
+		}
+		qi->fileComps[i] = comp;
+		if (comp == (unsigned)-1)
+			continue;
+		qi->compFiles[comp]++;
+		qi->compBytes[comp] += strtoul(cells[3], NULL, 10);
+	}
+
+	/* Sum up the components of each feature.  A component can belong
+	   to a feature and to one of its subfeatures as well, so collect
+	   the components of every feature together with its subfeatures,
+	   and count each one only once.  */
+	qi->featComps = (unsigned*)xmalloc(sizeof(unsigned) *
+									   (feats->numRows + 1));
+	qi->featFiles = (unsigned*)xmalloc(sizeof(unsigned) *
+									   (feats->numRows + 1));
+	qi->featBytes = (unsigned long long*)
+		xmalloc(sizeof(unsigned long long) * (feats->numRows + 1));
+	qi->totalFiles = (unsigned*)xmalloc(sizeof(unsigned) *
+										(feats->numRows + 1));
+	qi->totalBytes = (unsigned long long*)
+		xmalloc(sizeof(unsigned long long) * (feats->numRows + 1));
+	for (i = 0; i < feats->numRows; i++)
+	{
+		qi->featComps[i] = 0;
+		qi->featFiles[i] = 0;
+		qi->featBytes[i] = 0;
+		qi->totalFiles[i] = 0;
+		qi->totalBytes[i] = 0;
+	}
+	EA_INIT(FeatCompRow, rollup, 16);
+	for (i = 0; i < featComps->numRows; i++)
+	{
+		char** cells = &featComps->cells[i*featComps->numCols];
+		unsigned feat = FindTableRow(set, TS_FEATURE, cells[0]);
+		unsigned depth;
+		FeatCompRow fcRow;
+		comp = FindTableRow(set, TS_COMPONENT, cells[1]);
+		if (feat == (unsigned)-1 || comp == (unsigned)-1)
+			continue;
+		qi->featComps[feat]++;
+		qi->featFiles[feat] += qi->compFiles[comp];
+		qi->featBytes[feat] += qi->compBytes[comp];
+		fcRow.feat = feat;
+		fcRow.comp = comp;
+		EA_APPEND(rollup, fcRow);
+		/* Stop after as many steps as there are features in case the
+		   parents form a cycle.  */
+		for (depth = 0; depth < feats->numRows; depth++)
+		{
+			const char* parent =
+				feats->cells[fcRow.feat*feats->numCols+1];
+			if (parent[0] == '\0')
+				break;
+			fcRow.feat = FindTableRow(set, TS_FEATURE, parent);
+			if (fcRow.feat == (unsigned)-1 || fcRow.feat == feat)
+				break;
+			EA_APPEND(rollup, fcRow);
+		}
+	}
+	qsort(rollup.d, rollup.len, sizeof(FeatCompRow), FeatCompRow_qsort);
+	for (i = 0; i < rollup.len; i++)
+	{
+		FeatCompRow* fcRow = &rollup.d[i];
+		if (i > 0 && fcRow->feat == fcRow[-1].feat &&
+			fcRow->comp == fcRow[-1].comp)
+			continue;
+		qi->totalFiles[fcRow->feat] += qi->compFiles[fcRow->comp];
+		qi->totalBytes[fcRow->feat] += qi->compBytes[fcRow->comp];
+	}
+	EA_DESTROY(rollup);
+}
+
+static void FreeQueryIndex(QueryIndex* qi)
+{
+	xfree(qi->fileNames);
+	xfree(qi->dirPaths);
+	xfree(qi->subPaths);
+	xfree(qi->compDirs);
+	xfree(qi->compFeatures);
+	xfree(qi->fileComps);
+	xfree(qi->compFiles);
+	xfree(qi->compBytes);
+	xfree(qi->featComps);
+	xfree(qi->featFiles);
+	xfree(qi->featBytes);
+	xfree(qi->totalFiles);
+	xfree(qi->totalBytes);
+	FreeTableSet(&qi->set);
+}
+
+/* Answer one question, which is a keyword followed by its argument.
+   Returns true if there was an answer.  */
+static bool AnswerQuestion(QueryIndex* qi, const char* question)
+{
+	char* word;
+	char* arg;
+	unsigned len;
+	bool answered = true;
+
+	/* Split the question into the keyword and the argument, without
+	   the spaces around them.  */
+	while (isspace((unsigned char)*question))
+		question++;
+	word = (char*)xmalloc(strlen(question) + 1);
+	strcpy(word, question);
+	len = strlen(word);
+	while (len > 0 && isspace((unsigned char)word[len-1]))
+		word[--len] = '\0';
+	arg = word + strcspn(word, " \t");
+	if (*arg != '\0')
+	{
+		*arg++ = '\0';
+		while (isspace((unsigned char)*arg))
+			arg++;
+	}
+
+	if (strcmp(word, "file") == 0 && *arg != '\0')
+		answered = QueryFile(qi, arg);
+	else if (strcmp(word, "dir") == 0 && *arg != '\0')
+		answered = QueryDir(qi, arg);
+	else if (strcmp(word, "feature") == 0 && *arg != '\0')
+		answered = QueryFeature(qi, arg);
+	else if (strcmp(word, "features") == 0 && *arg == '\0')
+		QueryFeatures(qi);
+	else
+	{
+		printf("Unknown question: %s\n", question);
+		answered = false;
+	}
+	xfree(word);
+	return answered;
+}
+
+/* Print the features that install the component in row `comp'.  */
+static void PrintFeatures(QueryIndex* qi, unsigned comp)
+{
+	MsiTable* comps = &qi->set.tables[TS_COMPONENT];
+	MsiTable* feats = &qi->set.tables[TS_FEATURE];
+	MsiTable* featComps = &qi->set.tables[TS_FEATURECOMPONENTS];
+	const char* compKey = comps->cells[comp*comps->numCols];
+	unsigned i;
+
+	for (i = FirstName(qi->compFeatures, featComps->numRows, compKey);
+		 i < featComps->numRows &&
+			 NameCmp(qi->compFeatures[i].name, compKey) == 0; i++)
+	{
+		const char* featKey =
+			featComps->cells[qi->compFeatures[i].row*featComps->numCols];
+		unsigned feat = FindTableRow(&qi->set, TS_FEATURE, featKey);
+		if (feat != (unsigned)-1)
+			printf("  Feature %s (%s)\n", featKey,
+				   feats->cells[feat*feats->numCols+2]);
+		else
+			printf("  Feature %s (missing)\n", featKey);
+	}
+}
+
+/* Print every file named `path', which may include the path of its
+   directory, with its component and features.  */
+static bool QueryFile(QueryIndex* qi, const char* path)
+{
+	MsiTable* files = &qi->set.tables[TS_FILE];
+	MsiTable* comps = &qi->set.tables[TS_COMPONENT];
+	const char* name = strrchr(path, '/');
+	char* dirPath = NULL;
+	bool found = false;
+	unsigned i;
+
+	if (name != NULL)
+	{
+		dirPath = (char*)xmalloc(name - path + 1);
+		memcpy(dirPath, path, name - path);
+		dirPath[name-path] = '\0';
+		name++;
+	}
+	else
+		name = path;
+
+	for (i = FirstName(qi->fileNames, files->numRows, name);
+		 i < files->numRows && NameCmp(qi->fileNames[i].name, name) == 0;
+		 i++)
+	{
+		unsigned row = qi->fileNames[i].row;
+		char** cells = &files->cells[row*files->numCols];
+		unsigned comp = qi->fileComps[row];
+		const char* fileDir = NULL;
+		if (comp != (unsigned)-1)
+			fileDir = TableDirPath(&qi->set,
+								   comps->cells[comp*comps->numCols+2]);
+		if (fileDir == NULL)
+			fileDir = "?";
+		if (dirPath != NULL && NameCmp(fileDir, dirPath) != 0 &&
+			(SkipRoot(fileDir) == NULL ||
+			 NameCmp(SkipRoot(fileDir), dirPath) != 0))
+			continue;
+		found = true;
+		printf("File %s: %s/%s, %s bytes\n", cells[0], fileDir,
+			   qi->fileNames[i].name, cells[3]);
+		if (comp == (unsigned)-1)
+		{
+			printf("  Component %s (missing)\n", cells[1]);
+			continue;
+		}
+		printf("  Component %s %s\n", cells[1],
+			   comps->cells[comp*comps->numCols+1]);
+		PrintFeatures(qi, comp);
+	}
+	if (found == false)
+		printf("No file named `%s'\n", path);
+	xfree(dirPath);
+	return found;
+}
+
+/* Print the directory in row `row' and the components installed into
+   it.  */
+static void PrintDirComponents(QueryIndex* qi, unsigned row)
+{
+	MsiTable* dirs = &qi->set.tables[TS_DIRECTORY];
+	MsiTable* comps = &qi->set.tables[TS_COMPONENT];
+	const char* dirKey = dirs->cells[row*dirs->numCols];
+	unsigned i;
+
+	printf("Directory %s: %s\n", dirKey, qi->set.dirPaths[row]);
+	for (i = FirstName(qi->compDirs, comps->numRows, dirKey);
+		 i < comps->numRows && NameCmp(qi->compDirs[i].name, dirKey) == 0;
+		 i++)
+	{
+		unsigned comp = qi->compDirs[i].row;
+		printf("  Component %s %s: %u files, %llu bytes\n",
+			   comps->cells[comp*comps->numCols],
+			   comps->cells[comp*comps->numCols+1],
+			   qi->compFiles[comp], qi->compBytes[comp]);
+	}
+}
+
+/* Print the components installed into the directory with the key or
+   path `path'.  Several directory keys can share one path.  */
+static bool QueryDir(QueryIndex* qi, const char* path)
+{
+	MsiTable* dirs = &qi->set.tables[TS_DIRECTORY];
+	unsigned row;
+	unsigned i;
+
+	row = FindTableRow(&qi->set, TS_DIRECTORY, path);
+	if (row != (unsigned)-1)
+	{
+		PrintDirComponents(qi, row);
+		return true;
+	}
+	i = FirstName(qi->dirPaths, dirs->numRows, path);
+	if (i < dirs->numRows && NameCmp(qi->dirPaths[i].name, path) == 0)
+	{
+		for (; i < dirs->numRows &&
+				 NameCmp(qi->dirPaths[i].name, path) == 0; i++)
+			PrintDirComponents(qi, qi->dirPaths[i].row);
+		return true;
+	}
+	i = FirstName(qi->subPaths, qi->numSubPaths, path);
+	if (i < qi->numSubPaths && NameCmp(qi->subPaths[i].name, path) == 0)
+	{
+		for (; i < qi->numSubPaths &&
+				 NameCmp(qi->subPaths[i].name, path) == 0; i++)
+			PrintDirComponents(qi, qi->subPaths[i].row);
+		return true;
+	}
+	printf("No directory `%s'\n", path);
+	return false;
+}
+
+/* Print the size of the feature with the key or title `feature'.  */
+static bool QueryFeature(QueryIndex* qi, const char* feature)
+{
+	MsiTable* feats = &qi->set.tables[TS_FEATURE];
+	unsigned feat;
+	char** cells;
+
+	feat = FindTableRow(&qi->set, TS_FEATURE, feature);
+	if (feat == (unsigned)-1)
+	{
+		/* There are few features, so titles are simply scanned.  */
+		for (feat = 0; feat < feats->numRows; feat++)
+		{
+			if (NameCmp(feats->cells[feat*feats->numCols+2], feature) == 0)
+				break;
+		}
+		if (feat == feats->numRows)
+		{
+			printf("No feature `%s'\n", feature);
+			return false;
+		}
+	}
+
+	cells = &feats->cells[feat*feats->numCols];
+	printf("Feature %s (%s)\n", cells[0], cells[2]);
+	if (cells[1][0] != '\0')
+		printf("  Parent: %s\n", cells[1]);
+	printf("  Components: %u\n", qi->featComps[feat]);
+	printf("  Files: %u, %llu bytes\n", qi->featFiles[feat],
+		   qi->featBytes[feat]);
+	printf("  With subfeatures: %u files, %llu bytes\n",
+		   qi->totalFiles[feat], qi->totalBytes[feat]);
+	return true;
+}
+
+/* Print the size of every feature.  */
+static void QueryFeatures(QueryIndex* qi)
+{
+	MsiTable* feats = &qi->set.tables[TS_FEATURE];
+	unsigned i;
+	printf("%-20s %10s %10s %14s %10s %14s\n", "Feature", "Components",
+		   "Files", "Bytes", "All files", "All bytes");
+	for (i = 0; i < feats->numRows; i++)
+	{
+		printf("%-20s %10u %10u %14llu %10u %14llu\n",
+			   feats->cells[i*feats->numCols], qi->featComps[i],
+			   qi->featFiles[i], qi->featBytes[i], qi->totalFiles[i],
+			   qi->totalBytes[i]);
+	}
+}
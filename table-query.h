@@ -0,0 +1,15 @@
+/* table-query.h -- answer questions about the tables of a run.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef TABLE_QUERY_H
+#define TABLE_QUERY_H
+
+int QueryTables(const char* dir, const char** questions,
+				unsigned numQuestions, unsigned* numUnanswered);
+
+#endif /* not TABLE_QUERY_H */
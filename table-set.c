@@ -0,0 +1,341 @@
+/* table-set.c -- load the tables written by an earlier run and look
+   up rows by their primary keys.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "thread-pool.h"
+#include "msi-db.h"
+#include "idt-file.h"
+#include "table-set.h"
+
+const char* const tableSetNames[NUM_TS_TABLES] =
+{
+	"Directory", "Component", "File", "Feature", "FeatureComponents",
+	"DuplicateFile"
+};
+
+/* The columns that the code relies on, as in the installer database
+   schema.  */
+static const unsigned minCols[NUM_TS_TABLES] = { 3, 6, 8, 8, 2, 5 };
+
+/* Data shared with `LoadTableWorker()'.  */
+struct LoadData
+{
+	TableSet* sets;
+	const char** dirs;
+	bool* loaded;
+};
+
+typedef struct SortKey_t SortKey;
+
+/* A row to sort, with the first two key columns at hand so that
+   sorting does not need to look at the table.  `key2' is empty for
+   tables with a single key column.  */
+struct SortKey_t
+{
+	const char* key1;
+	const char* key2;
+	unsigned row;
+};
+
+static void LoadTableWorker(void* data, unsigned index);
+static int SortKey_qsort(const void* e1, const void* e2);
+static char* DirName(const char* defaultDir);
+
+/* Load the tables named in `tableSetNames' from the IDT files in each
+   of `dirs' into the corresponding element of `sets', and sort each
+   table by primary key.  All tables are loaded in parallel.  Returns
+   nonzero on success, zero on failure.  */
+int LoadTableSets(TableSet* sets, const char** dirs, unsigned numSets)
+{
+	struct LoadData data;
+	bool* loaded;
+	unsigned s, t;
+	int retval = 1;
+
+	for (s = 0; s < numSets; s++)
+	{
+		for (t = 0; t < NUM_TS_TABLES; t++)
+		{
+			sets[s].tables[t].header = NULL;
+			sets[s].tables[t].cells = NULL;
+			sets[s].sorted[t] = NULL;
+		}
+		sets[s].dirPaths = NULL;
+	}
+	loaded = (bool*)xmalloc(sizeof(bool) * numSets * NUM_TS_TABLES);
+	data.sets = sets;
+	data.dirs = dirs;
+	data.loaded = loaded;
+	ParallelFor(numSets * NUM_TS_TABLES, LoadTableWorker, &data);
+	for (s = 0; s < numSets * NUM_TS_TABLES; s++)
+	{
+		if (loaded[s] == false)
+			retval = 0;
+	}
+	xfree(loaded);
+	if (!retval)
+	{
+		for (s = 0; s < numSets; s++)
+			FreeTableSet(&sets[s]);
+	}
+	return retval;
+}
+
+/* Load one table of one set.  */
+static void LoadTableWorker(void* data, unsigned index)
+{
+	struct LoadData* ld = (struct LoadData*)data;
+	TableSet* set = &ld->sets[index/NUM_TS_TABLES];
+	unsigned t = index % NUM_TS_TABLES;
+	MsiTable* table = &set->tables[t];
+	const char* dir = ld->dirs[index/NUM_TS_TABLES];
+	const char* keyLine;
+	SortKey* keys;
+	char* path;
+	unsigned i;
+
+	ld->loaded[index] = false;
+	path = (char*)xmalloc(strlen(dir) + 1 + strlen(tableSetNames[t]) +
+						  4 + 1);
+	sprintf(path, "%s/%s.idt", dir, tableSetNames[t]);
+	if (t == TS_DUPLICATEFILE)
+	{
+		/* Only runs with `-D' write a `DuplicateFile' table, so a
+		   missing one is empty.  */
+		FILE* fp = fopen(path, "rb");
+		if (fp == NULL)
+		{
+			table->header = NULL;
+			table->numCols = minCols[t];
+			table->cells = NULL;
+			table->numRows = 0;
+			set->numKeys[t] = 1;
+			set->sorted[t] = (unsigned*)xmalloc(sizeof(unsigned));
+			xfree(path);
+			ld->loaded[index] = true;
+			return;
+		}
+		fclose(fp);
+	}
+	if (!ReadIdtFile(path, table))
+	{
+		table->header = NULL;
+		xfree(path);
+		return;
+	}
+	if (table->numCols < minCols[t])
+	{
+		fprintf(stderr, "ERROR: Too few columns in %s\n", path);
+		xfree(path);
+		return;
+	}
+	xfree(path);
+
+	/* The key columns follow the table name on the third line.  */
+	keyLine = IdtTableName(table, &i);
+	set->numKeys[t] = 0;
+	for (; keyLine[i] == '\t'; i += 1 + strcspn(&keyLine[i+1], "\t\r\n"))
+		set->numKeys[t]++;
+	if (set->numKeys[t] == 0)
+		set->numKeys[t] = 1;
+
+	keys = (SortKey*)xmalloc(sizeof(SortKey) * (table->numRows + 1));
+	for (i = 0; i < table->numRows; i++)
+	{
+		keys[i].key1 = table->cells[i*table->numCols];
+		keys[i].key2 = (set->numKeys[t] > 1) ?
+			table->cells[i*table->numCols+1] : "";
+		keys[i].row = i;
+	}
+	qsort(keys, table->numRows, sizeof(SortKey), SortKey_qsort);
+	set->sorted[t] = (unsigned*)xmalloc(sizeof(unsigned) *
+										(table->numRows + 1));
+	for (i = 0; i < table->numRows; i++)
+		set->sorted[t][i] = keys[i].row;
+	xfree(keys);
+	ld->loaded[index] = true;
+}
+
+void FreeTableSet(TableSet* set)
+{
+	unsigned t;
+	if (set->dirPaths != NULL)
+	{
+		unsigned i;
+		for (i = 0; i < set->tables[TS_DIRECTORY].numRows; i++)
+			xfree(set->dirPaths[i]);
+		xfree(set->dirPaths);
+		set->dirPaths = NULL;
+	}
+	for (t = 0; t < NUM_TS_TABLES; t++)
+	{
+		if (set->tables[t].header != NULL)
+			FreeIdtTable(&set->tables[t]);
+		xfree(set->sorted[t]);
+		set->sorted[t] = NULL;
+	}
+}
+
+/* Compare the first `numKeys' cells of two rows.  */
+int CompareRowKeys(MsiTable* table1, unsigned row1, MsiTable* table2,
+				   unsigned row2, unsigned numKeys)
+{
+	char** cells1 = &table1->cells[row1*table1->numCols];
+	char** cells2 = &table2->cells[row2*table2->numCols];
+	unsigned i;
+	for (i = 0; i < numKeys; i++)
+	{
+		int result = strcmp(cells1[i], cells2[i]);
+		if (result != 0)
+			return result;
+	}
+	return 0;
+}
+
+static int SortKey_qsort(const void* e1, const void* e2)
+{
+	const SortKey* k1 = (const SortKey*)e1;
+	const SortKey* k2 = (const SortKey*)e2;
+	int result = strcmp(k1->key1, k2->key1);
+	if (result != 0)
+		return result;
+	return strcmp(k1->key2, k2->key2);
+}
+
+/* Returns the row of `table' whose first key column is `key', or
+   (unsigned)-1 if there is none.  */
+unsigned FindTableRow(TableSet* set, unsigned table, const char* key)
+{
+	MsiTable* t = &set->tables[table];
+	unsigned* sorted = set->sorted[table];
+	unsigned low = 0, high = t->numRows;
+	while (low < high)
+	{
+		unsigned mid = low + (high - low) / 2;
+		int result = strcmp(t->cells[sorted[mid]*t->numCols], key);
+		if (result == 0)
+			return sorted[mid];
+		if (result < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return (unsigned)-1;
+}
+
+/* Returns the long target name of a `DefaultDir' value as a new
+   string, which is empty for `.'.  */
+static char* DirName(const char* defaultDir)
+{
+	unsigned len = strcspn(defaultDir, ":");
+	const char* bar = memchr(defaultDir, '|', len);
+	char* name;
+	if (bar != NULL)
+	{
+		len -= bar + 1 - defaultDir;
+		defaultDir = bar + 1;
+	}
+	if (len == 1 && defaultDir[0] == '.')
+		len = 0;
+	name = (char*)xmalloc(len + 1);
+	memcpy(name, defaultDir, len);
+	name[len] = '\0';
+	return name;
+}
+
+/* Returns the path of the directory `dirKey' from the root of the
+   `Directory' table, with the names separated by slashes, or NULL if
+   there is no such directory.  */
+const char* TableDirPath(TableSet* set, const char* dirKey)
+{
+	MsiTable* dirs = &set->tables[TS_DIRECTORY];
+	unsigned row;
+
+	if (set->dirPaths == NULL)
+	{
+		unsigned* stack;
+		bool* visiting;
+		unsigned i;
+		set->dirPaths = (char**)xmalloc(sizeof(char*) * (dirs->numRows + 1));
+		stack = (unsigned*)xmalloc(sizeof(unsigned) * (dirs->numRows + 1));
+		visiting = (bool*)xmalloc(sizeof(bool) * (dirs->numRows + 1));
+		for (i = 0; i < dirs->numRows; i++)
+		{
+			set->dirPaths[i] = NULL;
+			visiting[i] = false;
+		}
+		/* Resolve the parents first with an explicit stack.  A parent
+		   that is missing, the row itself, or part of a cycle ends the
+		   path.  */
+		for (i = 0; i < dirs->numRows; i++)
+		{
+			unsigned depth = 0;
+			if (set->dirPaths[i] != NULL)
+				continue;
+			stack[depth++] = i;
+			visiting[i] = true;
+			while (depth > 0)
+			{
+				unsigned cur = stack[depth-1];
+				char** cells = &dirs->cells[cur*dirs->numCols];
+				unsigned parent = (unsigned)-1;
+				char* name;
+				if (cells[1][0] != '\0')
+					parent = FindTableRow(set, TS_DIRECTORY, cells[1]);
+				if (parent != (unsigned)-1 && set->dirPaths[parent] == NULL &&
+					visiting[parent] == false)
+				{
+					stack[depth++] = parent;
+					visiting[parent] = true;
+					continue;
+				}
+				name = DirName(cells[2]);
+				if (parent == (unsigned)-1 || set->dirPaths[parent] == NULL ||
+					set->dirPaths[parent][0] == '\0')
+					set->dirPaths[cur] = name;
+				else if (name[0] == '\0')
+				{
+					xfree(name);
+					name = set->dirPaths[parent];
+					set->dirPaths[cur] = (char*)xmalloc(strlen(name) + 1);
+					strcpy(set->dirPaths[cur], name);
+				}
+				else
+				{
+					char* parentPath = set->dirPaths[parent];
+					set->dirPaths[cur] = (char*)xmalloc(strlen(parentPath) +
+														1 + strlen(name) + 1);
+					sprintf(set->dirPaths[cur], "%s/%s", parentPath, name);
+					xfree(name);
+				}
+				visiting[cur] = false;
+				depth--;
+			}
+		}
+		xfree(stack);
+		xfree(visiting);
+	}
+
+	row = FindTableRow(set, TS_DIRECTORY, dirKey);
+	if (row == (unsigned)-1)
+		return NULL;
+	return set->dirPaths[row];
+}
+
+/* Returns the long name within a `FileName' value.  */
+const char* LongFileName(const char* name)
+{
+	const char* bar = strchr(name, '|');
+	return (bar != NULL) ? bar + 1 : name;
+}
@@ -0,0 +1,51 @@
+/* table-set.h -- load the tables written by an earlier run and look
+   up rows by their primary keys.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef TABLE_SET_H
+#define TABLE_SET_H
+
+/* Note: `msi-db.h' must be included before this header.  */
+
+/* Indices into `TableSet.tables' */
+enum
+{
+	TS_DIRECTORY,
+	TS_COMPONENT,
+	TS_FILE,
+	TS_FEATURE,
+	TS_FEATURECOMPONENTS,
+	TS_DUPLICATEFILE,
+	NUM_TS_TABLES
+};
+
+typedef struct TableSet_t TableSet;
+
+struct TableSet_t
+{
+	MsiTable tables[NUM_TS_TABLES];
+	/* The number of key columns of each table */
+	unsigned numKeys[NUM_TS_TABLES];
+	/* Row indices of each table, sorted by primary key.  Only the
+	   first two key columns are used for sorting.  */
+	unsigned* sorted[NUM_TS_TABLES];
+	/* The path of every `Directory' row, built when first needed.  */
+	char** dirPaths;
+};
+
+extern const char* const tableSetNames[NUM_TS_TABLES];
+
+int LoadTableSets(TableSet* sets, const char** dirs, unsigned numSets);
+void FreeTableSet(TableSet* set);
+int CompareRowKeys(MsiTable* table1, unsigned row1, MsiTable* table2,
+				   unsigned row2, unsigned numKeys);
+unsigned FindTableRow(TableSet* set, unsigned table, const char* key);
+const char* TableDirPath(TableSet* set, const char* dirKey);
+const char* LongFileName(const char* name);
+
+#endif /* not TABLE_SET_H */
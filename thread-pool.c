@@ -0,0 +1,483 @@
+/* thread-pool.c -- a small pool of worker threads for running
+   independent pieces of work in parallel.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+/* The pool is created once by `ThreadPoolInit()' and then reused by
+   every parallel stage of the program, so that no stage has to create
+   threads of its own.  Work is scheduled by work stealing: every
+   thread, including the one that called `ThreadPoolInit()', owns one
+   deque of tasks per priority.  A thread pushes new tasks onto the
+   bottom of its own deques and takes its next task from there too, so
+   it keeps working on what it just produced.  A thread whose deques
+   are empty steals from the top of another thread's deque, where the
+   oldest tasks are.
+
+   `ParallelFor()' starts with a single task for the whole range.  A
+   thread that runs a range task keeps splitting off the upper half as
+   a new task until the range is small, so idle threads steal large
+   halves and the range spreads out over the pool without any shared
+   counter.  A thread that waits for its tasks to finish runs other
+   tasks in the meantime, which also lets tasks start parallel work of
+   their own.
+
+   Each thread records how long it spent running tasks, so that
+   `ThreadPoolReport()' can show how busy the pool actually was.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "bool.h"
+#include "xmalloc.h"
+#include "thread-pool.h"
+
+typedef struct Task_t Task;
+typedef struct TaskDeque_t TaskDeque;
+typedef struct PoolThread_t PoolThread;
+
+/* Either a single call to `func', or calls to `loopFunc' for every
+   index in [begin, end).  `pending' is decremented when the task is
+   done.  */
+struct Task_t
+{
+	TaskFunc func;
+	ParallelFunc loopFunc;
+	void* data;
+	unsigned begin;
+	unsigned end;
+	unsigned grain;
+	unsigned priority;
+	unsigned* pending;
+};
+
+/* A ring buffer of tasks.  `top' and `bottom' only ever grow, and the
+   tasks are at the indices in [top, bottom) modulo the capacity, which
+   is a power of two.  */
+struct TaskDeque_t
+{
+	pthread_mutex_t lock;
+	Task* tasks;
+	unsigned mask;
+	unsigned top;
+	unsigned bottom;
+};
+
+struct PoolThread_t
+{
+	TaskDeque deques[NUM_TASK_PRIORITIES];
+	pthread_t thread;
+	/* The thread to try first when stealing */
+	unsigned nextVictim;
+	/* The number of tasks being run, which is more than one while a
+	   task waits for other tasks */
+	unsigned depth;
+	/* Statistics */
+	unsigned numTasks;
+	unsigned numStolen;
+	double busyTime;
+};
+
+/* Private Declarations */
+static void* WorkerMain(void* arg);
+static double Now();
+static PoolThread* CurrentThread();
+static void InitDeque(TaskDeque* deque);
+static void PushTask(PoolThread* self, Task* task);
+static bool PopTask(TaskDeque* deque, Task* task);
+static bool StealTask(TaskDeque* deque, Task* task);
+static bool FindTask(PoolThread* self, Task* task);
+static void RunTask(PoolThread* self, Task* task);
+static void WaitForPending(PoolThread* self, unsigned* pending);
+
+static PoolThread* threads = NULL;
+static unsigned numThreads = 0;
+static unsigned numAllocated = 0;
+static pthread_key_t threadKey;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when tasks are queued while threads sleep, and when a
+   group of tasks is done.  */
+static pthread_cond_t poolCond = PTHREAD_COND_INITIALIZER;
+static bool shutdownPool = false;
+/* The number of tasks in all deques, and of threads that wait for
+   `poolCond'.  Both are changed with atomic operations, which are
+   also full memory barriers: a thread that queues a task increments
+   `numQueued' before it reads `numSleeping', and a thread that goes
+   to sleep increments `numSleeping' before it reads `numQueued', so
+   at least one of them sees the other.  */
+static unsigned numQueued = 0;
+static unsigned numSleeping = 0;
+/* The number of unfinished tasks submitted with `SubmitTask()' */
+static unsigned submitPending = 0;
+static double startTime;
+
+/* Start the worker threads.  If `numThreads' is zero, one thread is
+   used for every online processor.  The calling thread counts as one
+   of the threads.  Returns nonzero on success, zero on failure.  */
+int ThreadPoolInit(unsigned newNumThreads)
+{
+	unsigned i, p;
+	if (newNumThreads == 0)
+	{
+		long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+		newNumThreads = (numCpus > 0) ? (unsigned)numCpus : 1;
+	}
+	threads = (PoolThread*)xmalloc(sizeof(PoolThread) * newNumThreads);
+	numAllocated = newNumThreads;
+	for (i = 0; i < newNumThreads; i++)
+	{
+		for (p = 0; p < NUM_TASK_PRIORITIES; p++)
+			InitDeque(&threads[i].deques[p]);
+		threads[i].nextVictim = i + 1;
+		threads[i].depth = 0;
+		threads[i].numTasks = 0;
+		threads[i].numStolen = 0;
+		threads[i].busyTime = 0;
+	}
+	pthread_key_create(&threadKey, NULL);
+	pthread_setspecific(threadKey, &threads[0]);
+	startTime = Now();
+
+	numThreads = 1;
+	for (i = 1; i < newNumThreads; i++)
+	{
+		if (pthread_create(&threads[i].thread, NULL, WorkerMain,
+						   &threads[i]) != 0)
+		{
+			fputs("ERROR: Could not create worker thread.\n", stderr);
+			ThreadPoolDestroy();
+			return 0;
+		}
+		numThreads++;
+	}
+	return 1;
+}
+
+/* Returns the total number of threads that run parallel work,
+   including the calling thread.  */
+unsigned ThreadPoolSize()
+{
+	return (numThreads > 0) ? numThreads : 1;
+}
+
+/* Call `func(data, i)' for every `i' in [0, count) and wait until all
+   calls have returned.  */
+void ParallelFor(unsigned count, ParallelFunc func, void* data)
+{
+	unsigned pending = 1;
+	Task task;
+	if (count == 0)
+		return;
+	if (threads == NULL || numThreads == 1 || count == 1)
+	{
+		unsigned i;
+		for (i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
+
+	/* Split the range into a few pieces per thread, so that threads
+	   that finish early can steal from the others.  */
+	task.func = NULL;
+	task.loopFunc = func;
+	task.data = data;
+	task.begin = 0;
+	task.end = count;
+	task.grain = count / (numThreads * 8);
+	if (task.grain == 0)
+		task.grain = 1;
+	task.priority = TASK_NORMAL;
+	task.pending = &pending;
+	RunTask(CurrentThread(), &task);
+	WaitForPending(CurrentThread(), &pending);
+}
+
+/* Queue a call to `func(data)' to run on any thread of the pool.
+   `WaitForTasks()' waits until all submitted tasks are done.  */
+void SubmitTask(TaskFunc func, void* data, unsigned priority)
+{
+	Task task;
+	if (threads == NULL)
+	{
+		func(data);
+		return;
+	}
+	task.func = func;
+	task.loopFunc = NULL;
+	task.data = data;
+	task.priority = priority;
+	task.pending = &submitPending;
+	__sync_fetch_and_add(&submitPending, 1);
+	PushTask(CurrentThread(), &task);
+}
+
+/* Run tasks until all tasks submitted with `SubmitTask()' are
+   done.  */
+void WaitForTasks()
+{
+	if (threads == NULL)
+		return;
+	WaitForPending(CurrentThread(), &submitPending);
+}
+
+/* Print how many tasks each thread ran, and how much of the time since
+   `ThreadPoolInit()' it spent running them.  Thread 0 is the calling
+   thread, which also does all the work that is not run in
+   parallel.  */
+void ThreadPoolReport()
+{
+	double elapsed = Now() - startTime;
+	double totalBusy = 0;
+	unsigned i;
+	if (threads == NULL)
+		return;
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	printf("%-7s %10s %10s %10s %6s\n", "Thread", "Tasks", "Stolen",
+		   "Busy (s)", "Busy");
+	for (i = 0; i < numThreads; i++)
+	{
+		printf("%-7u %10u %10u %10.3f %5.1f%%\n", i, threads[i].numTasks,
+			   threads[i].numStolen, threads[i].busyTime,
+			   100 * threads[i].busyTime / elapsed);
+		totalBusy += threads[i].busyTime;
+	}
+	printf("%u threads were busy %.1f%% of %.3f s.\n", numThreads,
+		   100 * totalBusy / (elapsed * numThreads), elapsed);
+}
+
+/* Stop and join all worker threads.  */
+void ThreadPoolDestroy()
+{
+	unsigned i, p;
+	if (threads == NULL)
+		return;
+	pthread_mutex_lock(&poolLock);
+	shutdownPool = true;
+	pthread_cond_broadcast(&poolCond);
+	pthread_mutex_unlock(&poolLock);
+	for (i = 1; i < numThreads; i++)
+		pthread_join(threads[i].thread, NULL);
+	for (i = 0; i < numAllocated; i++)
+	{
+		for (p = 0; p < NUM_TASK_PRIORITIES; p++)
+		{
+			pthread_mutex_destroy(&threads[i].deques[p].lock);
+			xfree(threads[i].deques[p].tasks);
+		}
+	}
+	pthread_key_delete(threadKey);
+	EFREE(threads);
+	numThreads = 0;
+	numAllocated = 0;
+	shutdownPool = false;
+}
+
+static void* WorkerMain(void* arg)
+{
+	PoolThread* self = (PoolThread*)arg;
+	Task task;
+	pthread_setspecific(threadKey, self);
+	while (true)
+	{
+		if (FindTask(self, &task))
+		{
+			RunTask(self, &task);
+			continue;
+		}
+		pthread_mutex_lock(&poolLock);
+		__sync_fetch_and_add(&numSleeping, 1);
+		while (shutdownPool == false &&
+			   __sync_fetch_and_add(&numQueued, 0) == 0)
+			pthread_cond_wait(&poolCond, &poolLock);
+		__sync_fetch_and_sub(&numSleeping, 1);
+		if (shutdownPool == true)
+		{
+			pthread_mutex_unlock(&poolLock);
+			break;
+		}
+		pthread_mutex_unlock(&poolLock);
+	}
+	return NULL;
+}
+
+/* Returns the time in seconds from an arbitrary starting point.  */
+static double Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static PoolThread* CurrentThread()
+{
+	PoolThread* self = (PoolThread*)pthread_getspecific(threadKey);
+	return (self != NULL) ? self : &threads[0];
+}
+
+static void InitDeque(TaskDeque* deque)
+{
+	pthread_mutex_init(&deque->lock, NULL);
+	deque->mask = 63;
+	deque->tasks = (Task*)xmalloc(sizeof(Task) * (deque->mask + 1));
+	deque->top = 0;
+	deque->bottom = 0;
+}
+
+/* Push a task onto the bottom of the deque of its priority, and wake
+   up sleeping threads to steal it.  */
+static void PushTask(PoolThread* self, Task* task)
+{
+	TaskDeque* deque = &self->deques[task->priority];
+	/* Count the task first so that no thread can go to sleep while
+	   it is queued.  */
+	__sync_fetch_and_add(&numQueued, 1);
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom - deque->top > deque->mask)
+	{
+		unsigned newMask = deque->mask * 2 + 1;
+		Task* tasks = (Task*)xmalloc(sizeof(Task) * (newMask + 1));
+		unsigned i;
+		for (i = deque->top; i != deque->bottom; i++)
+			tasks[i&newMask] = deque->tasks[i&deque->mask];
+		xfree(deque->tasks);
+		deque->tasks = tasks;
+		deque->mask = newMask;
+	}
+	deque->tasks[deque->bottom&deque->mask] = *task;
+	deque->bottom++;
+	pthread_mutex_unlock(&deque->lock);
+	if (__sync_fetch_and_add(&numSleeping, 0) > 0)
+	{
+		pthread_mutex_lock(&poolLock);
+		pthread_cond_broadcast(&poolCond);
+		pthread_mutex_unlock(&poolLock);
+	}
+}
+
+/* Take the newest task of a thread's own deque.  */
+static bool PopTask(TaskDeque* deque, Task* task)
+{
+	bool found = false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom != deque->top)
+	{
+		deque->bottom--;
+		*task = deque->tasks[deque->bottom&deque->mask];
+		found = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/* Take the oldest task of another thread's deque.  */
+static bool StealTask(TaskDeque* deque, Task* task)
+{
+	bool found = false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom != deque->top)
+	{
+		*task = deque->tasks[deque->top&deque->mask];
+		deque->top++;
+		found = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/* Find the next task to run, trying the thread's own deque before
+   stealing, and all tasks of a higher priority before those of a
+   lower one.  Returns true if a task was found.  */
+static bool FindTask(PoolThread* self, Task* task)
+{
+	unsigned p;
+	if (__sync_fetch_and_add(&numQueued, 0) == 0)
+		return false;
+	for (p = NUM_TASK_PRIORITIES; p-- > 0; )
+	{
+		unsigned i;
+		if (PopTask(&self->deques[p], task))
+		{
+			__sync_fetch_and_sub(&numQueued, 1);
+			return true;
+		}
+		for (i = 0; i < numThreads; i++)
+		{
+			PoolThread* victim;
+			self->nextVictim %= numThreads;
+			victim = &threads[self->nextVictim];
+			if (victim != self && StealTask(&victim->deques[p], task))
+			{
+				__sync_fetch_and_sub(&numQueued, 1);
+				self->numStolen++;
+				return true;
+			}
+			self->nextVictim++;
+		}
+	}
+	return false;
+}
+
+static void RunTask(PoolThread* self, Task* task)
+{
+	double start = 0;
+	/* Tasks run while another task waits are already part of its busy
+	   time.  */
+	if (self->depth++ == 0)
+		start = Now();
+	if (task->func != NULL)
+		task->func(task->data);
+	else
+	{
+		unsigned i;
+		/* Leave the upper half of the range to other threads until
+		   only a small piece is left.  */
+		while (task->end - task->begin > task->grain)
+		{
+			Task half = *task;
+			half.begin = task->begin + (task->end - task->begin) / 2;
+			task->end = half.begin;
+			__sync_fetch_and_add(task->pending, 1);
+			PushTask(self, &half);
+		}
+		for (i = task->begin; i < task->end; i++)
+			task->loopFunc(task->data, i);
+	}
+	if (--self->depth == 0)
+		self->busyTime += Now() - start;
+	self->numTasks++;
+
+	if (__sync_sub_and_fetch(task->pending, 1) == 0)
+	{
+		pthread_mutex_lock(&poolLock);
+		pthread_cond_broadcast(&poolCond);
+		pthread_mutex_unlock(&poolLock);
+	}
+}
+
+/* Run tasks until `*pending' drops to zero.  */
+static void WaitForPending(PoolThread* self, unsigned* pending)
+{
+	Task task;
+	while (__sync_fetch_and_add(pending, 0) != 0)
+	{
+		if (FindTask(self, &task))
+		{
+			RunTask(self, &task);
+			continue;
+		}
+		pthread_mutex_lock(&poolLock);
+		__sync_fetch_and_add(&numSleeping, 1);
+		while (__sync_fetch_and_add(pending, 0) != 0 &&
+			   __sync_fetch_and_add(&numQueued, 0) == 0)
+			pthread_cond_wait(&poolCond, &poolLock);
+		__sync_fetch_and_sub(&numSleeping, 1);
+		pthread_mutex_unlock(&poolLock);
+	}
+}
@@ -0,0 +1,47 @@
+/* thread-pool.h -- a small pool of worker threads for running
+   independent pieces of work in parallel.
+
+Public Domain 2013, 2020 Andrew Makousky
+
+See the file "UNLICENSE" in the top level directory for details.
+
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/* Parallel Loop Body Callback
+
+   This callback is called by `ParallelFor()' once for every index in
+   the requested range.  Calls may happen concurrently from different
+   worker threads and in any order.
+
+   Parameters:
+   void* data -- the user data pointer passed to `ParallelFor()'
+   unsigned index -- the zero-based index of the work item */
+typedef void (* ParallelFunc)(void*, unsigned);
+
+/* Task Callback
+
+   This callback is called once for every task submitted with
+   `SubmitTask()', from any thread of the pool.
+
+   Parameters:
+   void* data -- the user data pointer passed to `SubmitTask()' */
+typedef void (* TaskFunc)(void*);
+
+/* Task priorities.  Every thread runs all tasks of a higher priority
+   that it can find before any task of a lower priority.  */
+#define TASK_NORMAL 0
+#define TASK_HIGH 1
+#define NUM_TASK_PRIORITIES 2
+
+int ThreadPoolInit(unsigned numThreads);
+unsigned ThreadPoolSize();
+void ParallelFor(unsigned count, ParallelFunc func, void* data);
+void SubmitTask(TaskFunc func, void* data, unsigned priority);
+void WaitForTasks();
+void ThreadPoolReport();
+void ThreadPoolDestroy();
+
+#endif /* not THREAD_POOL_H */
@@ -15,14 +15,79 @@ See the file "UNLICENSE" in the top level directory for details.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "xmalloc.h"
 
+#undef xmalloc
+#undef xrealloc
+
+/* While profiling, every block starts with a header that holds its
+   size, so that `xfree()' and `xrealloc()' know how many bytes stop
+   being live.  The union keeps the memory after it aligned.  */
+typedef union AllocHeader_t AllocHeader;
+union AllocHeader_t
+{
+	size_t size;
+	void *p;
+	double d;
+	long double ld;
+};
+
+/* Call sites are counted in a fixed table, so that profiling never
+   allocates.  Sites that do not fit are counted under NULL.  */
+#define NUM_SITES 4096
+#define NUM_SIZE_CLASSES (sizeof(size_t) * 8 + 1)
+#define REPORT_SITES 40
+
+typedef struct AllocSite_t AllocSite;
+struct AllocSite_t
+{
+	const void *site;
+	unsigned long calls;
+	size_t bytes;
+};
+
 /* Private Declarations */
 static void xalloc_die();
+static void init_profile();
+static void profile_alloc(const void *site, size_t old_size, size_t num);
+static void report_profile();
+static int compare_sites(const void *a, const void *b);
+
+/* -1 until the first call decides, then 0 or 1.  */
+static int profiling = -1;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static AllocSite sites[NUM_SITES];
+static unsigned num_sites = 0;
+static unsigned long num_mallocs = 0;
+static unsigned long num_reallocs = 0;
+static unsigned long num_frees = 0;
+static size_t total_bytes = 0;
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+/* Requests of 0 or 1 bytes are in class 0, and requests of at least
+   2^(i-1) but less than 2^i bytes are in class i.  */
+static unsigned long size_classes[NUM_SIZE_CLASSES];
+
+/* The site of a call to the plain functions */
+#if defined(XMALLOC_PROFILE)
+#define CALLER() "(unknown)"
+#elif defined(__GNUC__)
+#define CALLER() __builtin_return_address(0)
+#else
+#define CALLER() NULL
+#endif
 
 void *xmalloc(size_t num)
 {
 	void *mem;
+	if (profiling != 0)
+	{
+		init_profile();
+		if (profiling == 1)
+			return xmalloc_at(num, (const char *)CALLER());
+	}
 	mem = malloc(num ? num : 1);
 	if (mem == NULL)
 		xalloc_die();
@@ -31,6 +96,12 @@ void *xmalloc(size_t num)
 
 void *xrealloc(void *mem, size_t num)
 {
+	if (profiling != 0)
+	{
+		init_profile();
+		if (profiling == 1)
+			return xrealloc_at(mem, num, (const char *)CALLER());
+	}
 	if (mem == NULL)
 		mem = malloc(num ? num : 1);
 	else
@@ -42,12 +113,215 @@ void *xrealloc(void *mem, size_t num)
 
 void xfree(void *mem)
 {
+	if (profiling != 0)
+	{
+		init_profile();
+		if (profiling == 1 && mem != NULL)
+		{
+			AllocHeader *header = (AllocHeader *)mem - 1;
+			pthread_mutex_lock(&prof_lock);
+			num_frees++;
+			live_bytes -= header->size;
+			pthread_mutex_unlock(&prof_lock);
+			free(header);
+			return;
+		}
+	}
 	if (mem != NULL)
 		free(mem);
 }
 
+/* The profiling versions of `xmalloc()' and `xrealloc()', which count
+   the call under `site'.  They are only called directly with
+   `-DXMALLOC_PROFILE', and then always profile.  */
+void *xmalloc_at(size_t num, const char *site)
+{
+	AllocHeader *header;
+	if (profiling != 1)
+	{
+		init_profile();
+		if (profiling == 0)
+			return xmalloc(num);
+	}
+	if (num > (size_t)-1 - sizeof(AllocHeader))
+		xalloc_die();
+	header = (AllocHeader *)malloc(sizeof(AllocHeader) + num);
+	if (header == NULL)
+		xalloc_die();
+	header->size = num;
+	pthread_mutex_lock(&prof_lock);
+	num_mallocs++;
+	profile_alloc(site, 0, num);
+	pthread_mutex_unlock(&prof_lock);
+	return header + 1;
+}
+
+void *xrealloc_at(void *mem, size_t num, const char *site)
+{
+	AllocHeader *header;
+	size_t old_size = 0;
+	if (profiling != 1)
+	{
+		init_profile();
+		if (profiling == 0)
+			return xrealloc(mem, num);
+	}
+	if (num > (size_t)-1 - sizeof(AllocHeader))
+		xalloc_die();
+	if (mem == NULL)
+		header = (AllocHeader *)malloc(sizeof(AllocHeader) + num);
+	else
+	{
+		header = (AllocHeader *)mem - 1;
+		old_size = header->size;
+		header = (AllocHeader *)realloc(header, sizeof(AllocHeader) + num);
+	}
+	if (header == NULL)
+		xalloc_die();
+	header->size = num;
+	pthread_mutex_lock(&prof_lock);
+	num_reallocs++;
+	profile_alloc(site, old_size, num);
+	pthread_mutex_unlock(&prof_lock);
+	return header + 1;
+}
+
 static void xalloc_die()
 {
 	fprintf(stderr, "Memory exhausted.\n");
 	abort();
 }
+
+/* Decide whether to profile on the first call.  */
+static void init_profile()
+{
+	if (profiling != -1)
+		return;
+#ifdef XMALLOC_PROFILE
+	profiling = 1;
+#else
+	{
+		const char *env = getenv("XMALLOC_PROFILE");
+		profiling = (env != NULL && env[0] != '\0' &&
+					 strcmp(env, "0") != 0);
+	}
+#endif
+	if (profiling == 1)
+		atexit(report_profile);
+}
+
+/* Count an allocation of `num' bytes at `site' that replaces one of
+   `old_size' bytes.  `prof_lock' must be held.  */
+static void profile_alloc(const void *site, size_t old_size, size_t num)
+{
+	unsigned slot;
+	unsigned size_class = 0;
+	size_t size;
+
+	slot = (unsigned)(((size_t)site >> 2) * 2654435761u) % NUM_SITES;
+	while (sites[slot].site != site && sites[slot].calls != 0)
+		slot = (slot + 1) % NUM_SITES;
+	if (sites[slot].calls == 0)
+	{
+		/* Keep one slot free for the NULL site.  */
+		if (num_sites >= NUM_SITES - 1 && site != NULL)
+		{
+			profile_alloc(NULL, old_size, num);
+			return;
+		}
+		sites[slot].site = site;
+		num_sites++;
+	}
+	sites[slot].calls++;
+	sites[slot].bytes += num;
+
+	total_bytes += num;
+	live_bytes += num - old_size;
+	if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	for (size = num; size > 1; size >>= 1)
+		size_class++;
+	if (num > 1)
+		size_class++;
+	size_classes[size_class]++;
+}
+
+static void report_profile()
+{
+	AllocSite *sorted;
+	unsigned num_sorted = 0;
+	unsigned i;
+	size_t low, high;
+
+	fprintf(stderr, "Allocation profile:\n"
+			"  %lu mallocs, %lu reallocs, %lu frees\n"
+			"  %lu bytes allocated, %lu live at exit, "
+			"%lu at peak\n",
+			num_mallocs, num_reallocs, num_frees,
+			(unsigned long)total_bytes, (unsigned long)live_bytes,
+			(unsigned long)peak_bytes);
+
+	/* Copy with plain `malloc()', since the table must not change
+	   while it is being reported.  */
+	sorted = (AllocSite *)malloc(sizeof(AllocSite) * NUM_SITES);
+	if (sorted != NULL)
+	{
+		for (i = 0; i < NUM_SITES; i++)
+		{
+			if (sites[i].calls != 0)
+				sorted[num_sorted++] = sites[i];
+		}
+		qsort(sorted, num_sorted, sizeof(AllocSite), compare_sites);
+		fprintf(stderr, "  Call sites by bytes:\n");
+		for (i = 0; i < num_sorted && i < REPORT_SITES; i++)
+		{
+			fprintf(stderr, "  %10lu calls %14lu bytes  ",
+					sorted[i].calls, (unsigned long)sorted[i].bytes);
+			if (sorted[i].site == NULL)
+				fprintf(stderr, "(other)\n");
+#ifdef XMALLOC_PROFILE
+			else
+				fprintf(stderr, "%s\n", (const char *)sorted[i].site);
+#else
+			else
+			{
+				fprintf(stderr, "xmalloc%+ld\n", (long)((const char *)
+						sorted[i].site - (const char *)xmalloc));
+			}
+#endif
+		}
+		if (num_sorted > REPORT_SITES)
+		{
+			fprintf(stderr, "  (%u more call sites)\n",
+					num_sorted - REPORT_SITES);
+		}
+		free(sorted);
+	}
+
+	fprintf(stderr, "  Sizes:\n");
+	for (i = 0; i < NUM_SIZE_CLASSES; i++)
+	{
+		if (size_classes[i] == 0)
+			continue;
+		if (i == 0)
+			low = 0;
+		else
+			low = (size_t)1 << (i - 1);
+		if (i < NUM_SIZE_CLASSES - 1)
+			high = ((size_t)1 << i) - 1;
+		else
+			high = (size_t)-1;
+		fprintf(stderr, "  %10lu - %10lu bytes: %lu\n", (unsigned long)low,
+				(unsigned long)high, size_classes[i]);
+	}
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+	const AllocSite *site_a = (const AllocSite *)a;
+	const AllocSite *site_b = (const AllocSite *)b;
+	if (site_a->bytes != site_b->bytes)
+		return (site_a->bytes < site_b->bytes) ? 1 : -1;
+	return (site_a->calls < site_b->calls) ? 1 :
+		(site_a->calls > site_b->calls) ? -1 : 0;
+}
@@ -8,6 +8,22 @@ See the file "UNLICENSE" in the top level directory for details.
 
 */
 
+/* Allocation profile:
+
+   When the environment variable `XMALLOC_PROFILE' is set to anything
+   but "" or "0", the functions below count the calls and bytes of
+   each call site, the live and peak live bytes, and the sizes asked
+   for, and print a report to standard error at exit.  A call site is
+   then the address that the function returns to, given as an offset
+   from `xmalloc()', which `nm' and `addr2line' can turn into a line
+   of source.  Compile with `-DXMALLOC_PROFILE'
+   to always profile and to name the call sites by file and line
+   instead.  Without either, the only cost is one test of a flag per
+   call.
+
+   All memory from these functions must be freed with `xfree()', and
+   the first call must come before any other thread is started.  */
+
 #ifndef XMALLOC_H
 #define XMALLOC_H
 
@@ -16,6 +32,16 @@ See the file "UNLICENSE" in the top level directory for details.
 void *xmalloc(size_t num);
 void *xrealloc(void *mem, size_t num);
 void xfree(void *mem);
+void *xmalloc_at(size_t num, const char *site);
+void *xrealloc_at(void *mem, size_t num, const char *site);
+
+#ifdef XMALLOC_PROFILE
+#define XMALLOC_STR2(x) #x
+#define XMALLOC_STR(x) XMALLOC_STR2(x)
+#define XMALLOC_SITE __FILE__ ":" XMALLOC_STR(__LINE__)
+#define xmalloc(num) xmalloc_at((num), XMALLOC_SITE)
+#define xrealloc(mem, num) xrealloc_at((mem), (num), XMALLOC_SITE)
+#endif
 
 /* Easy Free: free memory and nullify pointer.  */
 #define EFREE(mem)			\